@@ -89,6 +89,18 @@ char *cactusDisk_getString(CactusDisk *cactusDisk, Name name, int64_t start, int
     return string;
 }
 
+const char *cactusDisk_getStringPointer(CactusDisk *cactusDisk, Name name) {
+#if defined(_OPENMP)
+    omp_set_lock(&(cactusDisk->writelock));
+#endif
+    char *string = stHash_search(cactusDisk->allStrings, (void *)name); // Cheeky 64bit int to pointer conversion
+#if defined(_OPENMP)
+    omp_unset_lock(&(cactusDisk->writelock));
+#endif
+    assert(string != NULL);
+    return string;
+}
+
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
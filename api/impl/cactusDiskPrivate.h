@@ -72,6 +72,11 @@ Name cactusDisk_addString(CactusDisk *cactusDisk, const char *string);
 char *cactusDisk_getString(CactusDisk *cactusDisk, Name name,
         int64_t start, int64_t length, int64_t strand, int64_t totalSequenceLength);
 
+/*
+ * Gets the string stored by the cactus disk, without copying it. The string must not be modified.
+ */
+const char *cactusDisk_getStringPointer(CactusDisk *cactusDisk, Name name);
+
 /*
  * Set the event tree for this disk. (Hopefully this only happens once.)
  */
@@ -6,6 +6,11 @@
 
 #include "cactusGlobalsPrivate.h"
 
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
@@ -92,3 +97,115 @@ void sequence_setHeader(Sequence *sequence,
 	free(sequence->header);
 	sequence->header = newHeader;
 }
+
+/*
+ * The sequences are written as FASTA in pieces of a whole number of lines, which are formatted in parallel,
+ * a batch at a time, into buffers that are then written out in order.
+ */
+#define FASTA_PIECE_LINES 16384
+#define FASTA_PIECES_PER_THREAD 4
+
+typedef struct _fastaPiece {
+    int64_t sequenceIndex;
+    int64_t start; // Of the piece in the sequence's string
+    int64_t length;
+} FastaPiece;
+
+static int64_t formatFastaPiece(char *buffer, const char *string, int64_t length, int64_t lineWidth) {
+    char *p = buffer;
+    for (int64_t i = 0; i < length; i += lineWidth) {
+        int64_t j = length - i < lineWidth ? length - i : lineWidth;
+        memcpy(p, string + i, j);
+        p += j;
+        *p++ = '\n';
+    }
+    return p - buffer;
+}
+
+static void writeFasta(const void *buffer, int64_t length, FILE *fileHandle) {
+    if (fwrite(buffer, 1, length, fileHandle) != length) {
+        st_errAbort("Failed to write FASTA output\n");
+    }
+}
+
+void sequence_writeFasta(stList *sequences, stList *headers, int64_t lineWidth, FILE *fileHandle,
+                         FILE *indexFileHandle) {
+    assert(stList_length(sequences) == stList_length(headers));
+    assert(lineWidth > 0);
+    int64_t pieceLength = lineWidth * FASTA_PIECE_LINES;
+
+    // Split the sequences into pieces, giving each sequence at least one so that its header gets written
+    const char **strings = st_malloc(sizeof(char *) * stList_length(sequences));
+    int64_t pieceNumber = 0;
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        Sequence *sequence = stList_get(sequences, i);
+        strings[i] = cactusDisk_getStringPointer(sequence->cactusDisk, sequence->stringName);
+        pieceNumber += sequence->length == 0 ? 1 : (sequence->length + pieceLength - 1) / pieceLength;
+    }
+    FastaPiece *pieces = st_malloc(sizeof(FastaPiece) * (pieceNumber > 0 ? pieceNumber : 1));
+    int64_t j = 0;
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        int64_t length = ((Sequence *)stList_get(sequences, i))->length;
+        int64_t start = 0;
+        do {
+            pieces[j].sequenceIndex = i;
+            pieces[j].start = start;
+            pieces[j++].length = length - start < pieceLength ? length - start : pieceLength;
+            start += pieceLength;
+        } while (start < length);
+    }
+    assert(j == pieceNumber);
+
+    int64_t batchSize = FASTA_PIECES_PER_THREAD;
+#if defined(_OPENMP)
+    batchSize *= omp_get_max_threads();
+#endif
+    batchSize = batchSize < pieceNumber ? batchSize : pieceNumber;
+    char **buffers = st_malloc(sizeof(char *) * (batchSize > 0 ? batchSize : 1));
+    int64_t *bufferLengths = st_malloc(sizeof(int64_t) * (batchSize > 0 ? batchSize : 1));
+    for (int64_t i = 0; i < batchSize; i++) {
+        buffers[i] = st_malloc(pieceLength + FASTA_PIECE_LINES); // The bases and a newline per line
+    }
+
+    int64_t offset = 0; // The number of bytes written, for the index
+    for (int64_t batchStart = 0; batchStart < pieceNumber; batchStart += batchSize) {
+        int64_t batchEnd = batchStart + batchSize < pieceNumber ? batchStart + batchSize : pieceNumber;
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int64_t i = batchStart; i < batchEnd; i++) {
+            FastaPiece *piece = &pieces[i];
+            bufferLengths[i - batchStart] = formatFastaPiece(buffers[i - batchStart],
+                                                             strings[piece->sequenceIndex] + piece->start,
+                                                             piece->length, lineWidth);
+        }
+        for (int64_t i = batchStart; i < batchEnd; i++) {
+            FastaPiece *piece = &pieces[i];
+            if (piece->start == 0) {
+                const char *header = stList_get(headers, piece->sequenceIndex);
+                int64_t headerLength = strlen(header);
+                writeFasta(">", 1, fileHandle);
+                writeFasta(header, headerLength, fileHandle);
+                writeFasta("\n", 1, fileHandle);
+                offset += headerLength + 2;
+                if (indexFileHandle != NULL) {
+                    // As samtools faidx, the sequence is named by the first word of its header
+                    fprintf(indexFileHandle, "%.*s\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n",
+                            (int)strcspn(header, " \t"), header,
+                            ((Sequence *)stList_get(sequences, piece->sequenceIndex))->length, offset, lineWidth,
+                            lineWidth + 1);
+                }
+            }
+            writeFasta(buffers[i - batchStart], bufferLengths[i - batchStart], fileHandle);
+            offset += bufferLengths[i - batchStart];
+        }
+    }
+
+    for (int64_t i = 0; i < batchSize; i++) {
+        free(buffers[i]);
+    }
+    free(buffers);
+    free(bufferLengths);
+    free(pieces);
+    free(strings);
+}
@@ -71,4 +71,12 @@ bool sequence_isTrivialSequence(Sequence *sequence);
  */
 void sequence_setHeader(Sequence *sequence, char *newHeader);
 
+/*
+ * Writes the sequences, in order, as FASTA with lines of lineWidth bases, each headed by the corresponding string
+ * in headers. The sequences are formatted in parallel straight from the cactus disk, without being copied.
+ * If indexFileHandle is not NULL a samtools faidx (.fai) index of the output is written to it.
+ */
+void sequence_writeFasta(stList *sequences, stList *headers, int64_t lineWidth, FILE *fileHandle,
+                         FILE *indexFileHandle);
+
 #endif
@@ -85,6 +85,39 @@ void testSequence_isTrivialSequence(CuTest* testCase) {
     cactusSequenceTestTeardown(testCase);
 }
 
+static char *readFile(FILE *fileHandle) {
+    rewind(fileHandle);
+    char *string = st_calloc(1000, sizeof(char));
+    size_t length = fread(string, 1, 999, fileHandle);
+    string[length] = '\0';
+    return string;
+}
+
+void testSequence_writeFasta(CuTest* testCase) {
+    cactusSequenceTestSetup(testCase);
+    Sequence *sequence2 = sequence_construct(1, 4, "GATT", "two", event, cactusDisk);
+    stList *sequences = stList_construct();
+    stList_append(sequences, sequence);
+    stList_append(sequences, sequence2);
+    stList *headers = stList_construct();
+    stList_append(headers, "one description");
+    stList_append(headers, "two");
+    FILE *fileHandle = tmpfile();
+    FILE *indexFileHandle = tmpfile();
+    sequence_writeFasta(sequences, headers, 4, fileHandle, indexFileHandle);
+    char *fasta = readFile(fileHandle);
+    char *index = readFile(indexFileHandle);
+    CuAssertStrEquals(testCase, ">one description\nACTG\nGCAC\nTG\n>two\nGATT\n", fasta);
+    CuAssertStrEquals(testCase, "one\t10\t17\t4\t5\ntwo\t4\t35\t4\t5\n", index);
+    free(fasta);
+    free(index);
+    fclose(fileHandle);
+    fclose(indexFileHandle);
+    stList_destruct(sequences);
+    stList_destruct(headers);
+    cactusSequenceTestTeardown(testCase);
+}
+
 CuSuite* cactusSequenceTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testSequence_getName);
@@ -94,5 +127,6 @@ CuSuite* cactusSequenceTestSuite(void) {
     SUITE_ADD_TEST(suite, testSequence_getString);
     SUITE_ADD_TEST(suite, testSequence_isTrivialSequence);
     SUITE_ADD_TEST(suite, testSequence_getHeader);
+    SUITE_ADD_TEST(suite, testSequence_writeFasta);
     return suite;
 }
@@ -0,0 +1,328 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks bar on synthetic flowers, or on flowers dumped from a cactus_consolidated run
+ * (see CACTUS_BAR_FLOWER_DUMP_DIR in bar.c), reporting the time spent in each phase.
+ */
+
+#include <getopt.h>
+#include <ctype.h>
+#include "sonLib.h"
+#include "cactus.h"
+#include "poaBarAligner.h"
+#include "flowerDump.h"
+
+void usage() {
+    fprintf(stderr, "cactus_barBenchmark, version 0.1\n");
+    fprintf(stderr, "-l --logLevel : Set the log level\n");
+    fprintf(stderr, "-p --params : [Required] The cactus config file\n");
+    fprintf(stderr, "-f --flowers : Replay the flowers dumped in this file instead of making synthetic flowers\n");
+    fprintf(stderr, "-d --dump : Write the synthetic flowers to this file before aligning them\n");
+    fprintf(stderr, "-n --replicates : (int > 0) The number of synthetic flowers to align [default: 1]\n");
+    fprintf(stderr, "-g --genomes : (int > 0) The number of genomes in a synthetic flower [default: 10]\n");
+    fprintf(stderr, "-a --adjacencies : (int > 0) The number of adjacencies per genome in a synthetic flower [default: 1]\n");
+    fprintf(stderr, "-e --ends : (int > 0) The number of ends in a synthetic flower [default: 2]\n");
+    fprintf(stderr, "-L --adjacencyLength : (int >= 0) The length of the ancestral adjacencies [default: 1000]\n");
+    fprintf(stderr, "-D --divergence : (float) The substitution rate of each genome from the ancestor [default: 0.05]\n");
+    fprintf(stderr, "-i --indelRate : (float) The indel rate of each genome from the ancestor [default: 0.01]\n");
+    fprintf(stderr, "-r --repeatFraction : (float) The fraction of the ancestor that is a soft masked repeat [default: 0.0]\n");
+    fprintf(stderr, "-s --seed : (int) The random seed [default: 0]\n");
+    fprintf(stderr, "-h --help : Print this help message\n");
+}
+
+typedef struct _SyntheticFlowerParams {
+    int64_t genomes;
+    int64_t adjacencies;
+    int64_t ends;
+    int64_t adjacencyLength;
+    double divergence;
+    double indelRate;
+    double repeatFraction;
+} SyntheticFlowerParams;
+
+#define REPEAT_UNIT_LENGTH 100
+
+static char randomBase(void) {
+    return "ACGT"[st_randomInt(0, 4)];
+}
+
+static char *makeAncestralAdjacency(SyntheticFlowerParams *sp, const char *repeatUnit) {
+    /*
+     * A random string, in which each chunk of REPEAT_UNIT_LENGTH bases is, with probability repeatFraction,
+     * a copy of the (lower case) repeat unit.
+     */
+    char *string = st_malloc(sp->adjacencyLength + 1);
+    for (int64_t i = 0; i < sp->adjacencyLength; i += REPEAT_UNIT_LENGTH) {
+        bool repeat = st_random() < sp->repeatFraction;
+        for (int64_t j = i; j < sp->adjacencyLength && j < i + REPEAT_UNIT_LENGTH; j++) {
+            string[j] = repeat ? repeatUnit[j - i] : randomBase();
+        }
+    }
+    string[sp->adjacencyLength] = '\0';
+    return string;
+}
+
+static void evolveAdjacency(SyntheticFlowerParams *sp, const char *ancestor, stList *strings) {
+    /*
+     * Appends a copy of the ancestor to the strings, with substitutions and short indels.
+     */
+    int64_t length = strlen(ancestor);
+    char *string = st_malloc(3 * length + 1);
+    int64_t k = 0;
+    for (int64_t i = 0; i < length; i++) {
+        double r = st_random();
+        if (r < sp->indelRate) {
+            int64_t indelLength = st_randomInt(1, 4);
+            if (st_random() < 0.5) { // Deletion
+                i += indelLength - 1;
+                continue;
+            }
+            for (int64_t j = 0; j < indelLength; j++) { // Insertion
+                string[k++] = randomBase();
+            }
+            string[k++] = ancestor[i];
+        } else if (r < sp->indelRate + sp->divergence) { // Substitution, preserving the soft masking
+            char c = randomBase();
+            string[k++] = islower(ancestor[i]) ? tolower(c) : c;
+        } else {
+            string[k++] = ancestor[i];
+        }
+    }
+    string[k] = '\0';
+    stList_append(strings, string);
+}
+
+static Flower *makeSyntheticFlower(CactusDisk *cactusDisk, SyntheticFlowerParams *sp) {
+    /*
+     * Makes a flower in which each genome has a single sequence threading the ends: the ith adjacency
+     * of each genome connects end i % ends to end (i+1) % ends, and consecutive adjacencies are separated by a
+     * one base block.
+     */
+    Flower *flower = flower_construct(cactusDisk);
+    EventTree *eventTree = cactusDisk_getEventTree(cactusDisk);
+    if (eventTree == NULL) {
+        eventTree = eventTree_construct2(cactusDisk);
+    }
+
+    End **ends = st_malloc(sizeof(End *) * sp->ends);
+    for (int64_t i = 0; i < sp->ends; i++) {
+        ends[i] = end_construct2(0, 1, flower);
+    }
+
+    char repeatUnit[REPEAT_UNIT_LENGTH];
+    for (int64_t i = 0; i < REPEAT_UNIT_LENGTH; i++) {
+        repeatUnit[i] = tolower(randomBase());
+    }
+    char **ancestors = st_malloc(sizeof(char *) * sp->adjacencies);
+    for (int64_t i = 0; i < sp->adjacencies; i++) {
+        ancestors[i] = makeAncestralAdjacency(sp, repeatUnit);
+    }
+
+    for (int64_t i = 0; i < sp->genomes; i++) {
+        char *eventHeader = stString_print("genome%" PRIi64 "", i);
+        Event *event = event_construct3(eventHeader, 0.1, eventTree_getRootEvent(eventTree), eventTree);
+
+        // Evolve the adjacencies, separated by one base blocks
+        stList *strings = stList_construct3(0, free);
+        for (int64_t j = 0; j < sp->adjacencies; j++) {
+            if (j > 0) {
+                stList_append(strings, stString_print("%c", randomBase()));
+            }
+            evolveAdjacency(sp, ancestors[j], strings);
+        }
+        char *string = stString_join2("", strings);
+        char *header = stString_print("%s.chr1", eventHeader);
+        Sequence *sequence = sequence_construct(1, strlen(string), string, header, event, cactusDisk);
+        flower_addSequence(flower, sequence);
+
+        // Make the caps, each adjacency going from the 3' side of one end to the 5' side of the next
+        int64_t coordinate = 0;
+        for (int64_t j = 0; j < sp->adjacencies; j++) {
+            int64_t adjacencyLength = strlen(stList_get(strings, 2 * j)); // Adjacencies alternate with the blocks
+            Cap *cap = cap_construct2(ends[j % sp->ends], coordinate, 1, sequence);
+            coordinate += adjacencyLength + 1;
+            Cap *cap2 = cap_construct2(end_getReverse(ends[(j + 1) % sp->ends]), coordinate, 1, sequence);
+            cap_makeAdjacent(cap, cap2);
+        }
+        assert(coordinate == strlen(string) + 1);
+
+        stList_destruct(strings);
+        free(string);
+        free(header);
+        free(eventHeader);
+    }
+
+    for (int64_t i = 0; i < sp->adjacencies; i++) {
+        free(ancestors[i]);
+    }
+    free(ancestors);
+    free(ends);
+
+    return flower;
+}
+
+static void printTimings(const char *name, double cost, int64_t capNumber, double time, BarTimings *t) {
+    fprintf(stdout, "%s\t%.0f\t%" PRIi64 "\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\n", name, cost, capNumber, time,
+            t->sequenceExtraction, t->alignment, t->trimming, t->blockCreation, t->annealing, t->melting,
+            t->cactusConstruction);
+}
+
+static void benchmarkFlower(Flower *flower, const char *name, BarParams *barParams, BarTimings *totalTimings,
+                            double *totalTime) {
+    double cost = estimateFlowerBarCost(flower, barParams->maximumLength);
+    int64_t capNumber = flower_getCapNumber(flower);
+    BarTimings timings = { 0 };
+    double startTime = barTimings_getTime();
+    barFlower(flower, barParams, NULL, NULL, &timings);
+    double time = barTimings_getTime() - startTime;
+    printTimings(name, cost, capNumber, time, &timings);
+    barTimings_add(totalTimings, &timings);
+    *totalTime += time;
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+    char *paramsFile = NULL;
+    char *flowersFile = NULL;
+    char *dumpFile = NULL;
+    int64_t replicates = 1;
+    int64_t seed = 0;
+    SyntheticFlowerParams sp = { .genomes = 10, .adjacencies = 1, .ends = 2, .adjacencyLength = 1000,
+                                 .divergence = 0.05, .indelRate = 0.01, .repeatFraction = 0.0 };
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
+                { "params", required_argument, 0, 'p' },
+                { "flowers", required_argument, 0, 'f' },
+                { "dump", required_argument, 0, 'd' },
+                { "replicates", required_argument, 0, 'n' },
+                { "genomes", required_argument, 0, 'g' },
+                { "adjacencies", required_argument, 0, 'a' },
+                { "ends", required_argument, 0, 'e' },
+                { "adjacencyLength", required_argument, 0, 'L' },
+                { "divergence", required_argument, 0, 'D' },
+                { "indelRate", required_argument, 0, 'i' },
+                { "repeatFraction", required_argument, 0, 'r' },
+                { "seed", required_argument, 0, 's' },
+                { "help", no_argument, 0, 'h' },
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int64_t key = getopt_long(argc, argv, "l:p:f:d:n:g:a:e:L:D:i:r:s:h", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        int i = 1;
+        switch (key) {
+            case 'l':
+                logLevelString = optarg;
+                break;
+            case 'p':
+                paramsFile = optarg;
+                break;
+            case 'f':
+                flowersFile = optarg;
+                break;
+            case 'd':
+                dumpFile = optarg;
+                break;
+            case 'n':
+                i = sscanf(optarg, "%" PRIi64 "", &replicates);
+                break;
+            case 'g':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.genomes);
+                break;
+            case 'a':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.adjacencies);
+                break;
+            case 'e':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.ends);
+                break;
+            case 'L':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.adjacencyLength);
+                break;
+            case 'D':
+                i = sscanf(optarg, "%lf", &sp.divergence);
+                break;
+            case 'i':
+                i = sscanf(optarg, "%lf", &sp.indelRate);
+                break;
+            case 'r':
+                i = sscanf(optarg, "%lf", &sp.repeatFraction);
+                break;
+            case 's':
+                i = sscanf(optarg, "%" PRIi64 "", &seed);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+        if (i != 1) {
+            st_errAbort("Could not parse the argument of option -%c: '%s'\n", (char)key, optarg);
+        }
+    }
+
+    st_setLogLevelFromString(logLevelString);
+
+    if (paramsFile == NULL) {
+        st_errAbort("The cactus config file must be given\n");
+    }
+    if (replicates < 1 || sp.genomes < 1 || sp.adjacencies < 1 || sp.ends < 1 || sp.adjacencyLength < 0) {
+        st_errAbort("The synthetic flower options must be positive\n");
+    }
+    st_randomSeed(seed);
+
+    CactusParams *params = cactusParams_load(paramsFile);
+    BarParams *barParams = barParams_construct(params);
+
+    fprintf(stdout, "flower\tpredicted_cost\tcaps\ttotal_time\tsequence_extraction\talignment\ttrimming\t"
+            "block_creation\tannealing\tmelting\tcactus_construction\n");
+    BarTimings totalTimings = { 0 };
+    double totalTime = 0.0;
+    if (flowersFile != NULL) {
+        FILE *fileHandle = fopen(flowersFile, "r");
+        if (fileHandle == NULL) {
+            st_errAbort("Could not open the flowers file: %s\n", flowersFile);
+        }
+        Flower *flower;
+        int64_t i = 0;
+        CactusDisk *cactusDisk = cactusDisk_construct();
+        while ((flower = loadFlowerFromDisk(cactusDisk, fileHandle)) != NULL) {
+            char *name = stString_print("flower%" PRIi64 "", i++);
+            benchmarkFlower(flower, name, barParams, &totalTimings, &totalTime);
+            free(name);
+        }
+        cactusDisk_destruct(cactusDisk);
+        fclose(fileHandle);
+    } else {
+        FILE *dumpFileHandle = dumpFile != NULL ? fopen(dumpFile, "w") : NULL;
+        for (int64_t i = 0; i < replicates; i++) {
+            CactusDisk *cactusDisk = cactusDisk_construct();
+            Flower *flower = makeSyntheticFlower(cactusDisk, &sp);
+            if (dumpFileHandle != NULL) {
+                writeFlowerToDisk(flower, dumpFileHandle);
+            }
+            char *name = stString_print("synthetic%" PRIi64 "", i);
+            benchmarkFlower(flower, name, barParams, &totalTimings, &totalTime);
+            free(name);
+            cactusDisk_destruct(cactusDisk);
+        }
+        if (dumpFileHandle != NULL) {
+            fclose(dumpFileHandle);
+        }
+    }
+    printTimings("total", 0.0, 0, totalTime, &totalTimings);
+
+    barParams_destruct(barParams);
+    cactusParams_destruct(params);
+
+    return 0;
+}
@@ -12,6 +12,7 @@
  */
 
 #include "adjacencySequences.h"
+#include <ctype.h>
 
 /*
  * Gets the raw sequence.
@@ -39,19 +40,27 @@ static char *getAdjacencySequenceP(Cap *cap, int64_t maxLength) {
     }
 }
 
-AdjacencySequence *adjacencySequence_construct(Cap *cap, int64_t maxLength) {
-    AdjacencySequence *subSequence = (AdjacencySequence *) st_malloc(
-            sizeof(AdjacencySequence));
-    subSequence->string = getAdjacencySequenceP(cap, maxLength);
+void adjacencySequence_fillOutCoordinates(Cap *cap, int64_t maxLength, AdjacencySequence *subSequence) {
     Cap *adjacentCap = cap_getAdjacency(cap);
     assert(adjacentCap != NULL);
     assert(!cap_getSide(cap));
     assert(cap_getSequence(cap) != NULL);
+    int64_t length = llabs(cap_getCoordinate(adjacentCap) - cap_getCoordinate(cap)) - 1;
+    assert(length >= 0);
+    subSequence->string = NULL;
     subSequence->subsequenceIdentifier = cap_getName(cap_getStrand(cap) ? cap : adjacentCap);
     subSequence->strand = cap_getStrand(cap);
     subSequence->start = cap_getCoordinate(cap) + (cap_getStrand(cap) ? 1 : -1);
-    subSequence->length = strlen(subSequence->string);
+    subSequence->length = length > maxLength ? maxLength : length;
     subSequence->hasStubEnd = end_isFree(cap_getEnd(adjacentCap)) && end_isStubEnd(cap_getEnd(adjacentCap));
+}
+
+AdjacencySequence *adjacencySequence_construct(Cap *cap, int64_t maxLength) {
+    AdjacencySequence *subSequence = (AdjacencySequence *) st_malloc(
+            sizeof(AdjacencySequence));
+    adjacencySequence_fillOutCoordinates(cap, maxLength, subSequence);
+    subSequence->string = getAdjacencySequenceP(cap, maxLength);
+    assert(subSequence->length == strlen(subSequence->string));
     return subSequence;
 }
 
@@ -60,3 +69,158 @@ void adjacencySequence_destruct(AdjacencySequence *subSequence) {
     free(subSequence);
 }
 
+
+/*
+ * Adjacency cache
+ */
+
+struct _AdjacencyCache {
+    int64_t maxLength;
+    int64_t maskFilter;
+    stHash *adjacencies; // Positive strand cap on the 5' side of the adjacency to its CachedAdjacency
+};
+
+/*
+ * The ends of an adjacency string, read on the positive strand.
+ */
+typedef struct _CachedAdjacency {
+    int64_t length; // Length of the complete adjacency string
+    int64_t endLength; // Length of prefix and suffix, min(length, maxLength)
+    char *prefix; // The first endLength bases
+    char *suffix; // The last endLength bases, points into prefix if the adjacency is short enough to be stored whole
+    bool suffixIsSeparate; // If suffix was allocated separately from prefix, rather than pointing into it
+    // For the first run of more than maskFilter masked bases found scanning forward (from the start of the prefix)
+    // and backward (from the end of the suffix), the offset at which the run starts and the offset at which
+    // it exceeds the mask filter, both measured in the direction of the scan. The latter is INT64_MAX if there is no such run.
+    int64_t forwardRunStart, forwardRunExceeded;
+    int64_t backwardRunStart, backwardRunExceeded;
+} CachedAdjacency;
+
+static void cachedAdjacency_destruct(CachedAdjacency *cachedAdjacency) {
+    if (cachedAdjacency->suffixIsSeparate) {
+        free(cachedAdjacency->suffix);
+    }
+    free(cachedAdjacency->prefix);
+    free(cachedAdjacency);
+}
+
+static inline bool isMasked(char base) {
+    return islower(base) || base == 'N';
+}
+
+/*
+ * Finds the first run of more than maskFilter masked bases in the first length bases of the string, scanning
+ * forward or, if reversed, backward from the end of the string.
+ */
+static void findMaskedRun(const char *string, int64_t stringLength, int64_t length, bool reversed, int64_t maskFilter,
+        int64_t *runStart, int64_t *runExceeded) {
+    *runStart = length;
+    *runExceeded = INT64_MAX;
+    if (maskFilter < 0) {
+        return;
+    }
+    int64_t start = -1;
+    for (int64_t i = 0; i < length; i++) {
+        if (isMasked(reversed ? string[stringLength - 1 - i] : string[i])) {
+            if (start == -1) {
+                start = i;
+            }
+            if (i + 1 - start > maskFilter) {
+                *runStart = start;
+                *runExceeded = i;
+                return;
+            }
+        } else {
+            start = -1;
+        }
+    }
+}
+
+AdjacencyCache *adjacencyCache_construct(int64_t maxLength, int64_t maskFilter) {
+    assert(maxLength >= 0);
+    AdjacencyCache *adjacencyCache = st_malloc(sizeof(AdjacencyCache));
+    adjacencyCache->maxLength = maxLength;
+    adjacencyCache->maskFilter = maskFilter;
+    adjacencyCache->adjacencies = stHash_construct2(NULL, (void (*)(void *))cachedAdjacency_destruct);
+    return adjacencyCache;
+}
+
+void adjacencyCache_destruct(AdjacencyCache *adjacencyCache) {
+    stHash_destruct(adjacencyCache->adjacencies);
+    free(adjacencyCache);
+}
+
+static CachedAdjacency *adjacencyCache_get(AdjacencyCache *adjacencyCache, Cap *cap) {
+    assert(!cap_getSide(cap));
+    Cap *leftCap = cap_getStrand(cap) ? cap : cap_getReverse(cap_getAdjacency(cap));
+    assert(cap_getStrand(leftCap) && !cap_getSide(leftCap));
+    CachedAdjacency *cachedAdjacency = stHash_search(adjacencyCache->adjacencies, leftCap);
+    if (cachedAdjacency != NULL) {
+        return cachedAdjacency;
+    }
+    Sequence *sequence = cap_getSequence(leftCap);
+    assert(sequence != NULL);
+    Cap *rightCap = cap_getAdjacency(leftCap);
+    assert(rightCap != NULL);
+    int64_t start = cap_getCoordinate(leftCap) + 1;
+    cachedAdjacency = st_malloc(sizeof(CachedAdjacency));
+    cachedAdjacency->length = cap_getCoordinate(rightCap) - start;
+    assert(cachedAdjacency->length >= 0);
+    cachedAdjacency->endLength = cachedAdjacency->length > adjacencyCache->maxLength ? adjacencyCache->maxLength
+                                                                                      : cachedAdjacency->length;
+    if (cachedAdjacency->length <= 2 * cachedAdjacency->endLength) { // Extract the whole string once
+        cachedAdjacency->prefix = sequence_getString(sequence, start, cachedAdjacency->length, 1);
+        cachedAdjacency->suffix = cachedAdjacency->prefix + cachedAdjacency->length - cachedAdjacency->endLength;
+        cachedAdjacency->suffixIsSeparate = 0;
+    } else { // Only extract the two ends
+        cachedAdjacency->prefix = sequence_getString(sequence, start, cachedAdjacency->endLength, 1);
+        cachedAdjacency->suffix = sequence_getString(sequence, start + cachedAdjacency->length - cachedAdjacency->endLength,
+                                                     cachedAdjacency->endLength, 1);
+        cachedAdjacency->suffixIsSeparate = 1;
+    }
+    findMaskedRun(cachedAdjacency->prefix, cachedAdjacency->endLength, cachedAdjacency->endLength, 0,
+                  adjacencyCache->maskFilter, &cachedAdjacency->forwardRunStart, &cachedAdjacency->forwardRunExceeded);
+    findMaskedRun(cachedAdjacency->suffix, cachedAdjacency->endLength, cachedAdjacency->endLength, 1,
+                  adjacencyCache->maskFilter, &cachedAdjacency->backwardRunStart, &cachedAdjacency->backwardRunExceeded);
+    stHash_insert(adjacencyCache->adjacencies, leftCap, cachedAdjacency);
+    return cachedAdjacency;
+}
+
+/*
+ * Length of the prefix of at most length bases that precedes the first masked run exceeding the filter.
+ */
+static inline int64_t unmaskedLength(int64_t length, int64_t runStart, int64_t runExceeded) {
+    return runExceeded < length ? runStart : length;
+}
+
+char *adjacencyCache_getString(AdjacencyCache *adjacencyCache, Cap *cap, int64_t *length, int64_t *overlap) {
+    CachedAdjacency *cachedAdjacency = adjacencyCache_get(adjacencyCache, cap);
+    int64_t lengthBackward;
+    char *string;
+    if (cap_getStrand(cap)) {
+        *length = unmaskedLength(cachedAdjacency->endLength, cachedAdjacency->forwardRunStart, cachedAdjacency->forwardRunExceeded);
+        lengthBackward = unmaskedLength(*length, cachedAdjacency->backwardRunStart, cachedAdjacency->backwardRunExceeded);
+        string = stString_getSubString(cachedAdjacency->prefix, 0, *length);
+    } else { // The reverse complement, so the scans swap roles
+        *length = unmaskedLength(cachedAdjacency->endLength, cachedAdjacency->backwardRunStart, cachedAdjacency->backwardRunExceeded);
+        lengthBackward = unmaskedLength(*length, cachedAdjacency->forwardRunStart, cachedAdjacency->forwardRunExceeded);
+        string = st_malloc(sizeof(char) * (*length + 1));
+        const char *suffix = cachedAdjacency->suffix + cachedAdjacency->endLength;
+        for (int64_t i = 0; i < *length; i++) {
+            string[i] = stString_reverseComplementChar(suffix[-1 - i]);
+        }
+        string[*length] = '\0';
+    }
+    // Calculate the overlap with the reverse complement
+    *overlap = *length + lengthBackward > cachedAdjacency->length ? *length + lengthBackward - cachedAdjacency->length : 0;
+    return string;
+}
+
+AdjacencySequence *adjacencySequence_construct2(Cap *cap, AdjacencyCache *adjacencyCache) {
+    AdjacencySequence *subSequence = st_malloc(sizeof(AdjacencySequence));
+    adjacencySequence_fillOutCoordinates(cap, adjacencyCache->maxLength, subSequence);
+    int64_t length, overlap;
+    subSequence->string = adjacencyCache_getString(adjacencyCache, cap, &length, &overlap);
+    subSequence->length = length; // Can be shorter than the unfiltered length if masked bases are filtered
+    return subSequence;
+}
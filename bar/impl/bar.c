@@ -4,6 +4,7 @@
 #include "poaBarAligner.h"
 #include "flowerAligner.h"
 #include "rescue.h"
+#include "flowerDump.h"
 #include "commonC.h"
 #include "stCaf.h"
 #include "stPinchGraphs.h"
@@ -11,6 +12,7 @@
 #include "stateMachine.h"
 #include "pairwiseAligner.h"
 #include "../../caf/inc/stCaf.h"
+#include <math.h>
 
 // OpenMP
 #if defined(_OPENMP)
@@ -34,134 +36,337 @@ PairwiseAlignmentParameters *pairwiseAlignmentParameters_constructFromCactusPara
     return p;
 }
 
-stPinch *getNextAlignedPairAlignment(stSortedSetIterator *it, stPinch *pinchToFillOut) {
-    AlignedPair *alignedPair = stSortedSet_getNext(it);
-    if (alignedPair == NULL) {
-        return NULL;
-    }
-    stPinch_fillOut(pinchToFillOut, alignedPair->subsequenceIdentifier, alignedPair->reverse->subsequenceIdentifier, alignedPair->position,
-                    alignedPair->reverse->position, 1, alignedPair->strand == alignedPair->reverse->strand);
-    return pinchToFillOut;
-}
-
 bool blockFilterFn(stPinchBlock *pinchBlock, void *extraArg) {
     FilterArgs *f = extraArg;
     return !stCaf_containsRequiredSpecies(pinchBlock, f->flower, f->minimumIngroupDegree, f->minimumOutgroupDegree, f->minimumDegree, f->minimumNumberOfSpecies);
 }
 
-void bar(stList *flowers, CactusParams *params, CactusDisk *cactusDisk, stList *listOfEndAlignmentFiles) {
-    //////////////////////////////////////////////
-    //Parse the many, many necessary parameters from the params file
-    //////////////////////////////////////////////
+/*
+ * Cost model constants. The cost of a flower is measured in (banding limited) bases of adjacency sequence,
+ * with a fixed overhead per adjacency for the pinching and cactus construction.
+ */
+#define BAR_COST_PER_ADJACENCY 64.0
+
+/*
+ * Ends with at least this many bases of adjacency sequence in a large flower are aligned as separate tasks.
+ */
+#define BAR_LARGE_END_SIZE 10000
+
+BarParams *barParams_construct(CactusParams *params) {
+    BarParams *p = st_calloc(1, sizeof(BarParams));
 
-    int64_t maximumLength = cactusParams_get_int(params, 2, "bar", "bandingLimit");
-    int64_t usePoa = cactusParams_get_int(params, 2, "bar", "partialOrderAlignment");
+    p->maximumLength = cactusParams_get_int(params, 2, "bar", "bandingLimit");
+    p->usePoa = cactusParams_get_int(params, 2, "bar", "partialOrderAlignment");
 
-    // Pecan prams
-    int64_t spanningTrees = cactusParams_get_int(params, 3, "bar", "pecan", "spanningTrees");
-    bool useProgressiveMerging = cactusParams_get_int(params, 3, "bar", "pecan", "useProgressiveMerging");
-    float matchGamma = cactusParams_get_float(params, 3, "bar", "pecan", "matchGamma");
-    PairwiseAlignmentParameters *pairwiseAlignmentParameters = pairwiseAlignmentParameters_constructFromCactusParams(params);
-    StateMachine *sM = stateMachine5_construct(fiveState);
-    bool pruneOutStubAlignments = cactusParams_get_int(params, 3, "bar", "pecan", "pruneOutStubAlignments");
+    // Pecan params
+    p->spanningTrees = cactusParams_get_int(params, 3, "bar", "pecan", "spanningTrees");
+    p->useProgressiveMerging = cactusParams_get_int(params, 3, "bar", "pecan", "useProgressiveMerging");
+    p->matchGamma = cactusParams_get_float(params, 3, "bar", "pecan", "matchGamma");
+    p->pruneOutStubAlignments = cactusParams_get_int(params, 3, "bar", "pecan", "pruneOutStubAlignments");
+    p->pairwiseAlignmentParameters = pairwiseAlignmentParameters_constructFromCactusParams(params);
+    p->sM = stateMachine5_construct(fiveState);
 
     // Poa params
     // toggle from pecan to abpoa for multiple alignment, by setting to non-zero
     // Note that poa uses about N^2 memory, so maximum value is generally in 10s of kb
-    int64_t poaWindow = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentWindow");
-    int64_t maskFilter = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentMaskFilter");
-    abpoa_para_t *poaParameters = usePoa ? abpoaParamaters_constructFromCactusParams(params) : NULL;
+    p->poaWindow = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentWindow");
+    p->maskFilter = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentMaskFilter");
+    p->poaParameters = p->usePoa ? abpoaParamaters_constructFromCactusParams(params) : NULL;
 
-    //////////////////////////////////////////////
-    //Run the bar algorithm
-    //////////////////////////////////////////////
+    // Block filtering params
+    p->minimumIngroupDegree = cactusParams_get_int(params, 2, "bar", "minimumIngroupDegree");
+    p->minimumOutgroupDegree = cactusParams_get_int(params, 2, "bar", "minimumOutgroupDegree");
+    p->minimumDegree = cactusParams_get_int(params, 2, "bar", "minimumBlockDegree");
+    p->minimumNumberOfSpecies = cactusParams_get_int(params, 2, "bar", "minimumNumberOfSpecies");
 
-    if (listOfEndAlignmentFiles != NULL && stList_length(flowers) != 1) {
-        st_errAbort("We have precomputed alignments but %" PRIi64 " flowers to align.\n", stList_length(flowers));
+    return p;
+}
+
+void barParams_destruct(BarParams *p) {
+    pairwiseAlignmentBandingParameters_destruct(p->pairwiseAlignmentParameters);
+    stateMachine_destruct(p->sM);
+    if (p->poaParameters) {
+        abpoa_free_para(p->poaParameters);
     }
+    free(p);
+}
 
-#if defined(_OPENMP)
-#pragma omp parallel for schedule(dynamic, 1)
-#endif
-    for (int64_t j = 0; j<stList_length(flowers); j++) {
-        Flower *flower = stList_get(flowers, j);
-
-        // These are all variables used by the filter fns
-        FilterArgs *fa = st_calloc(1, sizeof(FilterArgs));
-        fa->minimumIngroupDegree = cactusParams_get_int(params, 2, "bar", "minimumIngroupDegree");
-        fa->minimumOutgroupDegree = cactusParams_get_int(params, 2, "bar", "minimumOutgroupDegree");
-        fa->minimumDegree = cactusParams_get_int(params, 2, "bar", "minimumBlockDegree");
-        fa->minimumNumberOfSpecies = cactusParams_get_int(params, 2, "bar", "minimumNumberOfSpecies");
-        fa->flower = flower;
-
-        void *alignments;
-        if (usePoa) {
-            /*
-             * This makes a consistent set of alignments using abPoa.
-             *
-             * It does not use any precomputed alignments, if they are provided they will be ignored
-             */
-            alignments = make_flower_alignment_poa(flower, maximumLength, poaWindow, maskFilter, poaParameters);
-            st_logDebug("Created the poa alignments: %" PRIi64 " poa alignment blocks for flower\n", stList_length(alignments));
-        } else {
-            alignments = makeFlowerAlignment3(sM, flower, listOfEndAlignmentFiles, spanningTrees, maximumLength,
-                                              useProgressiveMerging, matchGamma, pairwiseAlignmentParameters,
-                                              pruneOutStubAlignments);
-            st_logDebug("Created the alignment: %" PRIi64 " pairs for flower\n", stSortedSet_size(alignments));
+double estimateFlowerBarCost(Flower *flower, int64_t maximumLength) {
+    /*
+     * Every adjacency is aligned from both of its ends, so the length is summed over the caps. Each base is
+     * aligned against roughly log(degree) others in the progressive / poa alignment of its end.
+     */
+    int64_t totalAdjacencyLength = 0;
+    Flower_CapIterator *capIt = flower_getCapIterator(flower);
+    Cap *cap;
+    while ((cap = flower_getNextCap(capIt)) != NULL) {
+        Cap *adjacentCap = cap_getAdjacency(cap);
+        if (adjacentCap != NULL) {
+            int64_t adjacencyLength = llabs(cap_getCoordinate(adjacentCap) - cap_getCoordinate(cap)) - 1;
+            totalAdjacencyLength += adjacencyLength < maximumLength ? adjacencyLength : maximumLength;
         }
+    }
+    flower_destructCapIterator(capIt);
 
-        stPinchIterator *pinchIterator = NULL;
-        if(usePoa) {
-            pinchIterator = stPinchIterator_constructFromAlignedBlocks(alignments);
+    int64_t maxEndDegree = 0;
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        if (end_getInstanceNumber(end) > maxEndDegree) {
+            maxEndDegree = end_getInstanceNumber(end);
         }
-        else {
-            pinchIterator = stPinchIterator_constructFromAlignedPairs(alignments, getNextAlignedPairAlignment);
-        }
-        /*
-         * Run the cactus caf functions to build cactus.
-         */
-
-        stPinchThreadSet *threadSet = stCaf_setup(flower);
+    }
+    flower_destructEndIterator(endIt);
 
-        stCaf_anneal(threadSet, pinchIterator, NULL, flower);
+    int64_t adjacencyNumber = flower_getCapNumber(flower) / 2;
+    return BAR_COST_PER_ADJACENCY * adjacencyNumber + totalAdjacencyLength * log2(1.0 + maxEndDegree);
+}
 
-        if (fa->minimumDegree < 2) {
-            stCaf_makeDegreeOneBlocks(threadSet);
-        }
+typedef struct _FlowerTask {
+    Flower *flower;
+    double predictedCost;
+    double time; // Wall time spent on the flower, including its separately aligned ends
+    BarTimings timings;
+    stHash *endAlignments; // Ends of the flower aligned as separate tasks, or NULL
+} FlowerTask;
 
-        if (fa->minimumIngroupDegree > 0 || fa->minimumOutgroupDegree > 0 || fa->minimumDegree > 1) {
-            stCaf_melt(flower, threadSet, blockFilterFn, fa, 0, 0, 0, INT64_MAX);
-        }
+typedef struct _EndTask {
+    FlowerTask *flowerTask;
+    End *end;
+    EndAlignment *endAlignment;
+    double time;
+} EndTask;
 
-        stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX); //Flower now destroyed.
+static int flowerTask_cmpFn(const void *a, const void *b) {
+    // Sort in descending order of predicted cost, breaking ties by name so the order is deterministic
+    const FlowerTask *t1 = a, *t2 = b;
+    if (t1->predictedCost != t2->predictedCost) {
+        return t1->predictedCost < t2->predictedCost ? 1 : -1;
+    }
+    Name n1 = flower_getName(t1->flower), n2 = flower_getName(t2->flower);
+    return n1 < n2 ? -1 : (n1 > n2 ? 1 : 0);
+}
 
-        stPinchThreadSet_destruct(threadSet);
-        st_logDebug("Ran the cactus core script.\n");
+void barFlower(Flower *flower, BarParams *p, stHash *endAlignments, stList *listOfEndAlignmentFiles,
+               BarTimings *timings) {
+    // These are all variables used by the filter fns
+    FilterArgs fa = { .flower = flower, .minimumIngroupDegree = p->minimumIngroupDegree,
+                      .minimumOutgroupDegree = p->minimumOutgroupDegree, .minimumDegree = p->minimumDegree,
+                      .minimumNumberOfSpecies = p->minimumNumberOfSpecies };
 
+    void *alignments;
+    if (p->usePoa) {
         /*
-         * Cleanup
+         * This makes a consistent set of alignments using abPoa.
+         *
+         * It does not use any precomputed alignments, if they are provided they will be ignored
          */
-        //Clean up the sorted set after cleaning up the iterator
-        stPinchIterator_destruct(pinchIterator);
-        if(usePoa) {
-            stList_destruct(alignments);
+        alignments = make_flower_alignment_poa(flower, p->maximumLength, p->poaWindow, p->maskFilter, p->poaParameters,
+                                               timings);
+        st_logDebug("Created the poa alignments: %" PRIi64 " poa alignment blocks for flower\n", stList_length(alignments));
+    } else {
+        double startTime = barTimings_getTime();
+        if (endAlignments != NULL) {
+            alignments = makeFlowerAlignment4(p->sM, flower, endAlignments, p->spanningTrees, p->maximumLength,
+                                              p->useProgressiveMerging, p->matchGamma, p->pairwiseAlignmentParameters,
+                                              p->pruneOutStubAlignments);
+        } else {
+            alignments = makeFlowerAlignment3(p->sM, flower, listOfEndAlignmentFiles, p->spanningTrees, p->maximumLength,
+                                              p->useProgressiveMerging, p->matchGamma, p->pairwiseAlignmentParameters,
+                                              p->pruneOutStubAlignments);
         }
-        else {
-            stSortedSet_destruct(alignments);
+        if (timings != NULL) {
+            timings->alignment += barTimings_getTime() - startTime;
         }
-        free(fa);
+        st_logDebug("Created the alignment: %" PRIi64 " pairs for flower\n", endAlignment_size(alignments));
+    }
+
+    stPinchIterator *pinchIterator = NULL;
+    if(p->usePoa) {
+        pinchIterator = stPinchIterator_constructFromAlignedBlocks(alignments);
+    }
+    else {
+        pinchIterator = stPinchIterator_constructFromEndAlignment(alignments);
+    }
+    /*
+     * Run the cactus caf functions to build cactus.
+     */
+
+    double startTime = barTimings_getTime();
+    stPinchThreadSet *threadSet = stCaf_setup(flower);
+    double annealStartTime = barTimings_getTime();
+
+    stCaf_anneal(threadSet, pinchIterator, NULL, flower);
+    double meltStartTime = barTimings_getTime();
+
+    if (fa.minimumDegree < 2) {
+        stCaf_makeDegreeOneBlocks(threadSet);
+    }
+
+    if (fa.minimumIngroupDegree > 0 || fa.minimumOutgroupDegree > 0 || fa.minimumDegree > 1) {
+        stCaf_melt(flower, threadSet, blockFilterFn, &fa, 0, 0, 0, INT64_MAX);
+    }
+    double finishStartTime = barTimings_getTime();
+
+    stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX); //Flower now destroyed.
+
+    stPinchThreadSet_destruct(threadSet);
+    st_logDebug("Ran the cactus core script.\n");
+    if (timings != NULL) {
+        timings->cactusConstruction += (annealStartTime - startTime) + (barTimings_getTime() - finishStartTime);
+        timings->annealing += meltStartTime - annealStartTime;
+        timings->melting += finishStartTime - meltStartTime;
+    }
+
+    /*
+     * Cleanup
+     */
+    //Clean up the alignment after cleaning up the iterator
+    stPinchIterator_destruct(pinchIterator);
+    if(p->usePoa) {
+        stList_destruct(alignments);
+    }
+    else {
+        endAlignment_destruct(alignments);
+    }
+
+    st_logDebug("Finished filling in the alignments for the flower\n");
+}
 
-        st_logDebug("Finished filling in the alignments for the flower\n");
+static void logPredictedVersusActualTimes(FlowerTask *tasks, int64_t taskNumber) {
+    /*
+     * Reports how well the cost model predicted the time taken for each flower, for tuning the model.
+     */
+    double totalCost = 0.0, totalTime = 0.0;
+    BarTimings totalTimings = { 0 };
+    for (int64_t j = 0; j < taskNumber; j++) {
+        totalCost += tasks[j].predictedCost;
+        totalTime += tasks[j].time;
+        barTimings_add(&totalTimings, &tasks[j].timings);
     }
+    double secondsPerUnitCost = totalCost > 0.0 ? totalTime / totalCost : 0.0;
+    // Pearson correlation of predicted cost and actual time
+    double meanCost = taskNumber > 0 ? totalCost / taskNumber : 0.0, meanTime = taskNumber > 0 ? totalTime / taskNumber : 0.0;
+    double covariance = 0.0, costVariance = 0.0, timeVariance = 0.0;
+    for (int64_t j = 0; j < taskNumber; j++) {
+        FlowerTask *task = &tasks[j];
+        st_logDebug("Bar flower %" PRIi64 " predicted cost: %f predicted time: %f actual time: %f seconds\n",
+                    flower_getName(task->flower), task->predictedCost, task->predictedCost * secondsPerUnitCost, task->time);
+        covariance += (task->predictedCost - meanCost) * (task->time - meanTime);
+        costVariance += (task->predictedCost - meanCost) * (task->predictedCost - meanCost);
+        timeVariance += (task->time - meanTime) * (task->time - meanTime);
+    }
+    double correlation = costVariance > 0.0 && timeVariance > 0.0 ? covariance / sqrt(costVariance * timeVariance) : 0.0;
+    st_logInfo("Bar aligned %" PRIi64 " flowers in %f seconds of thread time, %g seconds per unit of predicted cost, "
+               "correlation of predicted cost and time: %f\n", taskNumber, totalTime, secondsPerUnitCost, correlation);
+    st_logInfo("Bar phase times (seconds): sequence extraction: %f, alignment: %f, trimming: %f, block creation: %f, "
+               "annealing: %f, melting: %f, cactus construction: %f\n", totalTimings.sequenceExtraction,
+               totalTimings.alignment, totalTimings.trimming, totalTimings.blockCreation, totalTimings.annealing,
+               totalTimings.melting, totalTimings.cactusConstruction);
+}
 
+void bar(stList *flowers, CactusParams *params, CactusDisk *cactusDisk, stList *listOfEndAlignmentFiles) {
     //////////////////////////////////////////////
-    //Clean up
+    //Parse the many, many necessary parameters from the params file
     //////////////////////////////////////////////
 
-    pairwiseAlignmentBandingParameters_destruct(pairwiseAlignmentParameters);
-    stateMachine_destruct(sM);
+    BarParams *p = barParams_construct(params);
+
+    //////////////////////////////////////////////
+    //Run the bar algorithm
+    //////////////////////////////////////////////
+
+    if (listOfEndAlignmentFiles != NULL && stList_length(flowers) != 1) {
+        st_errAbort("We have precomputed alignments but %" PRIi64 " flowers to align.\n", stList_length(flowers));
+    }
+
+    // Order the flowers by descending predicted cost, so the longest running flowers start first
+    int64_t taskNumber = stList_length(flowers);
+    FlowerTask *tasks = st_calloc(taskNumber, sizeof(FlowerTask));
+    double totalCost = 0.0;
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 64) reduction(+:totalCost)
+#endif
+    for (int64_t j = 0; j < taskNumber; j++) {
+        tasks[j].flower = stList_get(flowers, j);
+        tasks[j].predictedCost = estimateFlowerBarCost(tasks[j].flower, p->maximumLength);
+        totalCost += tasks[j].predictedCost;
+    }
+    qsort(tasks, taskNumber, sizeof(FlowerTask), flowerTask_cmpFn);
+
+    // A flower predicted to take more than a thread's fair share of the work would leave the other threads
+    // idle at the end, so its large end alignments are split out as separate tasks and computed first.
+    // Poa aligns the ends of a flower jointly, so only the pecan alignments can be split.
+    int64_t threadNumber = 1;
+#if defined(_OPENMP)
+    threadNumber = omp_get_max_threads();
+#endif
+    stList *endTasks = stList_construct3(0, free);
+    if (!p->usePoa && listOfEndAlignmentFiles == NULL && threadNumber > 1) {
+        for (int64_t j = 0; j < taskNumber && tasks[j].predictedCost > totalCost / threadNumber; j++) {
+            stSortedSet *largeEnds = getEndsToAlignSeparately(tasks[j].flower, p->maximumLength, BAR_LARGE_END_SIZE);
+            stSortedSetIterator *endIt = stSortedSet_getIterator(largeEnds);
+            End *end;
+            while ((end = stSortedSet_getNext(endIt)) != NULL) {
+                EndTask *endTask = st_calloc(1, sizeof(EndTask));
+                endTask->flowerTask = &tasks[j];
+                endTask->end = end;
+                stList_append(endTasks, endTask);
+            }
+            stSortedSet_destructIterator(endIt);
+            stSortedSet_destruct(largeEnds);
+        }
+        st_logInfo("Aligning %" PRIi64 " ends of large flowers as separate tasks\n", stList_length(endTasks));
+    }
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int64_t j = 0; j < stList_length(endTasks); j++) {
+        EndTask *endTask = stList_get(endTasks, j);
+        double startTime = barTimings_getTime();
+        endTask->endAlignment = makeEndAlignment(p->sM, endTask->end, p->spanningTrees, p->maximumLength,
+                                                 p->useProgressiveMerging, p->matchGamma,
+                                                 p->pairwiseAlignmentParameters, NULL);
+        endTask->time = barTimings_getTime() - startTime;
+    }
 
-    if (poaParameters) {
-        abpoa_free_para(poaParameters);
+    for (int64_t j = 0; j < stList_length(endTasks); j++) {
+        EndTask *endTask = stList_get(endTasks, j);
+        FlowerTask *task = endTask->flowerTask;
+        if (task->endAlignments == NULL) {
+            task->endAlignments = stHash_construct2(NULL, (void(*)(void *)) endAlignment_destruct);
+        }
+        stHash_insert(task->endAlignments, endTask->end, endTask->endAlignment);
+        task->time += endTask->time;
+        task->timings.alignment += endTask->time;
     }
+    stList_destruct(endTasks);
+
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int64_t j = 0; j < taskNumber; j++) {
+        double startTime = barTimings_getTime();
+#ifdef CACTUS_BAR_FLOWER_DUMP_DIR
+        // FOR DEBUGGING ONLY: dump the flower so it can be replayed by cactus_barBenchmark
+        char flowerDumpPath[1024];
+        sprintf(flowerDumpPath, "%s/flower_%" PRIi64 ".txt", CACTUS_BAR_FLOWER_DUMP_DIR, flower_getName(tasks[j].flower));
+        FILE *flowerDumpFile = fopen(flowerDumpPath, "w");
+        writeFlowerToDisk(tasks[j].flower, flowerDumpFile);
+        fclose(flowerDumpFile);
+#endif
+        barFlower(tasks[j].flower, p, tasks[j].endAlignments, listOfEndAlignmentFiles, &tasks[j].timings);
+        tasks[j].endAlignments = NULL; // Consumed by barFlower
+        tasks[j].time += barTimings_getTime() - startTime;
+    }
+
+    logPredictedVersusActualTimes(tasks, taskNumber);
+
+    //////////////////////////////////////////////
+    //Clean up
+    //////////////////////////////////////////////
+
+    free(tasks);
+    barParams_destruct(p);
 }
@@ -9,52 +9,247 @@
 #include "adjacencySequences.h"
 #include "pairwiseAligner.h"
 
-AlignedPair *alignedPair_construct(int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
-        int64_t subsequenceIdentifier2, int64_t position2, bool strand2, int64_t score, int64_t rScore) {
-    AlignedPair *alignedPair = st_malloc(sizeof(AlignedPair));
-    alignedPair->subsequenceIdentifier = subsequenceIdentifier1;
-    alignedPair->position = position1;
-    alignedPair->strand = strand1;
+EndAlignment *endAlignment_construct(int64_t initialPairNumber) {
+    EndAlignment *endAlignment = st_calloc(1, sizeof(EndAlignment));
+    endAlignment->maxLength = initialPairNumber > 0 ? 2 * initialPairNumber : 2;
+    endAlignment->subsequenceIdentifiers = st_malloc(endAlignment->maxLength * sizeof(int64_t));
+    endAlignment->positions = st_malloc(endAlignment->maxLength * sizeof(int64_t));
+    endAlignment->scores = st_malloc(endAlignment->maxLength * sizeof(int64_t));
+    endAlignment->reverse = st_malloc(endAlignment->maxLength * sizeof(int64_t));
+    endAlignment->strands = st_malloc(endAlignment->maxLength * sizeof(bool));
+    endAlignment->deleted = st_malloc(endAlignment->maxLength * sizeof(bool));
+    return endAlignment;
+}
 
-    alignedPair->reverse = st_malloc(sizeof(AlignedPair));
-    alignedPair->reverse->reverse = alignedPair;
+void endAlignment_destruct(EndAlignment *endAlignment) {
+    free(endAlignment->subsequenceIdentifiers);
+    free(endAlignment->positions);
+    free(endAlignment->scores);
+    free(endAlignment->reverse);
+    free(endAlignment->strands);
+    free(endAlignment->deleted);
+    free(endAlignment);
+}
 
-    alignedPair->reverse->subsequenceIdentifier = subsequenceIdentifier2;
-    alignedPair->reverse->position = position2;
-    alignedPair->reverse->strand = strand2;
+static void endAlignment_setEntry(EndAlignment *endAlignment, int64_t i, int64_t subsequenceIdentifier,
+        int64_t position, bool strand, int64_t score, int64_t reverse) {
+    endAlignment->subsequenceIdentifiers[i] = subsequenceIdentifier;
+    endAlignment->positions[i] = position;
+    endAlignment->strands[i] = strand;
+    endAlignment->scores[i] = score;
+    endAlignment->reverse[i] = reverse;
+    endAlignment->deleted[i] = 0;
+}
 
-    alignedPair->score = score;
-    alignedPair->reverse->score = rScore;
+void endAlignment_add(EndAlignment *endAlignment, int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+        int64_t subsequenceIdentifier2, int64_t position2, bool strand2, int64_t score1, int64_t score2) {
+    if (endAlignment->length + 2 > endAlignment->maxLength) {
+        endAlignment->maxLength *= 2;
+        endAlignment->subsequenceIdentifiers = st_realloc(endAlignment->subsequenceIdentifiers, endAlignment->maxLength * sizeof(int64_t));
+        endAlignment->positions = st_realloc(endAlignment->positions, endAlignment->maxLength * sizeof(int64_t));
+        endAlignment->scores = st_realloc(endAlignment->scores, endAlignment->maxLength * sizeof(int64_t));
+        endAlignment->reverse = st_realloc(endAlignment->reverse, endAlignment->maxLength * sizeof(int64_t));
+        endAlignment->strands = st_realloc(endAlignment->strands, endAlignment->maxLength * sizeof(bool));
+        endAlignment->deleted = st_realloc(endAlignment->deleted, endAlignment->maxLength * sizeof(bool));
+    }
+    int64_t i = endAlignment->length;
+    endAlignment_setEntry(endAlignment, i, subsequenceIdentifier1, position1, strand1, score1, i + 1);
+    endAlignment_setEntry(endAlignment, i + 1, subsequenceIdentifier2, position2, strand2, score2, i);
+    endAlignment->length += 2;
+}
 
-    return alignedPair;
+static inline int cmpKey(int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+        int64_t subsequenceIdentifier2, int64_t position2, bool strand2) {
+    int i = cactusMisc_nameCompare(subsequenceIdentifier1, subsequenceIdentifier2);
+    if (i == 0) {
+        i = position1 > position2 ? 1 : (position1 < position2 ? -1 : 0);
+        if (i == 0) {
+            i = strand1 == strand2 ? 0 : (strand1 ? 1 : -1);
+        }
+    }
+    return i;
 }
 
-void alignedPair_destruct(AlignedPair *alignedPair) {
-    free(alignedPair); //We assume the reverse will be free independently.
+int endAlignment_cmp(EndAlignment *endAlignment, int64_t i, int64_t j) {
+    int k = cmpKey(endAlignment->subsequenceIdentifiers[i], endAlignment->positions[i], endAlignment->strands[i],
+                   endAlignment->subsequenceIdentifiers[j], endAlignment->positions[j], endAlignment->strands[j]);
+    if (k == 0) {
+        int64_t rI = endAlignment->reverse[i], rJ = endAlignment->reverse[j];
+        k = cmpKey(endAlignment->subsequenceIdentifiers[rI], endAlignment->positions[rI], endAlignment->strands[rI],
+                   endAlignment->subsequenceIdentifiers[rJ], endAlignment->positions[rJ], endAlignment->strands[rJ]);
+    }
+    return k;
 }
 
-static int alignedPair_cmpFnP(const AlignedPair *alignedPair1, const AlignedPair *alignedPair2) {
-    int i = cactusMisc_nameCompare(alignedPair1->subsequenceIdentifier, alignedPair2->subsequenceIdentifier);
-    if(i == 0) {
-        i = alignedPair1->position > alignedPair2->position ? 1 : (alignedPair1->position < alignedPair2->position ? -1 : 0);
-        if(i == 0) {
-            i = alignedPair1->strand == alignedPair2->strand ? 0 : (alignedPair1->strand ? 1 : -1);
-        }
+/*
+ * A temporary, self contained copy of an entry, used for sorting.
+ */
+typedef struct _AlignedPairEntry {
+    int64_t subsequenceIdentifier, position, score;
+    int64_t otherSubsequenceIdentifier, otherPosition;
+    int64_t index; // Index of the entry before sorting, then the index of its reverse after sorting.
+    bool strand, otherStrand;
+} AlignedPairEntry;
+
+static int alignedPairEntry_cmpFn(const void *a, const void *b) {
+    const AlignedPairEntry *e1 = a, *e2 = b;
+    int i = cmpKey(e1->subsequenceIdentifier, e1->position, e1->strand,
+                   e2->subsequenceIdentifier, e2->position, e2->strand);
+    if (i == 0) {
+        i = cmpKey(e1->otherSubsequenceIdentifier, e1->otherPosition, e1->otherStrand,
+                   e2->otherSubsequenceIdentifier, e2->otherPosition, e2->otherStrand);
     }
     return i;
 }
 
-int alignedPair_cmpFn(const AlignedPair *alignedPair1, const AlignedPair *alignedPair2) {
-    int i = alignedPair_cmpFnP(alignedPair1, alignedPair2);
-    if(i == 0) {
-        i = alignedPair_cmpFnP(alignedPair1->reverse, alignedPair2->reverse);
+void endAlignment_sort(EndAlignment *endAlignment) {
+    int64_t length = endAlignment->length - endAlignment->deletedNumber;
+    AlignedPairEntry *entries = st_malloc((length > 0 ? length : 1) * sizeof(AlignedPairEntry));
+    int64_t *newIndices = st_malloc((endAlignment->length > 0 ? endAlignment->length : 1) * sizeof(int64_t));
+    int64_t j = 0;
+    for (int64_t i = 0; i < endAlignment->length; i++) {
+        if (!endAlignment->deleted[i]) {
+            AlignedPairEntry *e = &entries[j++];
+            int64_t r = endAlignment->reverse[i];
+            assert(!endAlignment->deleted[r]);
+            e->subsequenceIdentifier = endAlignment->subsequenceIdentifiers[i];
+            e->position = endAlignment->positions[i];
+            e->strand = endAlignment->strands[i];
+            e->score = endAlignment->scores[i];
+            e->otherSubsequenceIdentifier = endAlignment->subsequenceIdentifiers[r];
+            e->otherPosition = endAlignment->positions[r];
+            e->otherStrand = endAlignment->strands[r];
+            e->index = i;
+        }
+    }
+    assert(j == length);
+    qsort(entries, length, sizeof(AlignedPairEntry), alignedPairEntry_cmpFn);
+    for (j = 0; j < length; j++) {
+        newIndices[entries[j].index] = j;
+    }
+    for (j = 0; j < length; j++) { // Must be done before the reverse array is overwritten.
+        entries[j].index = newIndices[endAlignment->reverse[entries[j].index]];
+    }
+    for (j = 0; j < length; j++) {
+        AlignedPairEntry *e = &entries[j];
+        endAlignment_setEntry(endAlignment, j, e->subsequenceIdentifier, e->position, e->strand, e->score, e->index);
+    }
+    endAlignment->length = length;
+    endAlignment->deletedNumber = 0;
+    free(entries);
+    free(newIndices);
+}
+
+int64_t endAlignment_size(EndAlignment *endAlignment) {
+    return (endAlignment->length - endAlignment->deletedNumber) / 2;
+}
+
+void endAlignment_remove(EndAlignment *endAlignment, int64_t i) {
+    assert(!endAlignment->deleted[i]);
+    int64_t j = endAlignment->reverse[i];
+    assert(!endAlignment->deleted[j]);
+    endAlignment->deleted[i] = 1;
+    endAlignment->deleted[j] = 1;
+    endAlignment->deletedNumber += 2;
+}
+
+int64_t endAlignment_lowerBound(EndAlignment *endAlignment, int64_t subsequenceIdentifier, int64_t position, bool strand) {
+    int64_t min = 0, max = endAlignment->length;
+    while (min < max) {
+        int64_t mid = min + (max - min) / 2;
+        if (cmpKey(endAlignment->subsequenceIdentifiers[mid], endAlignment->positions[mid], endAlignment->strands[mid],
+                   subsequenceIdentifier, position, strand) < 0) {
+            min = mid + 1;
+        } else {
+            max = mid;
+        }
+    }
+    return min;
+}
+
+static int64_t endAlignment_nextLiveEntry(EndAlignment *endAlignment, int64_t i) {
+    while (i < endAlignment->length && endAlignment->deleted[i]) {
+        i++;
     }
     return i;
 }
 
-stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+bool endAlignment_equals(EndAlignment *endAlignment1, EndAlignment *endAlignment2) {
+    if (endAlignment_size(endAlignment1) != endAlignment_size(endAlignment2)) {
+        return 0;
+    }
+    int64_t i = endAlignment_nextLiveEntry(endAlignment1, 0);
+    int64_t j = endAlignment_nextLiveEntry(endAlignment2, 0);
+    while (i < endAlignment1->length) {
+        assert(j < endAlignment2->length);
+        int64_t rI = endAlignment1->reverse[i], rJ = endAlignment2->reverse[j];
+        if (cmpKey(endAlignment1->subsequenceIdentifiers[i], endAlignment1->positions[i], endAlignment1->strands[i],
+                   endAlignment2->subsequenceIdentifiers[j], endAlignment2->positions[j], endAlignment2->strands[j]) != 0 ||
+            cmpKey(endAlignment1->subsequenceIdentifiers[rI], endAlignment1->positions[rI], endAlignment1->strands[rI],
+                   endAlignment2->subsequenceIdentifiers[rJ], endAlignment2->positions[rJ], endAlignment2->strands[rJ]) != 0 ||
+            endAlignment1->scores[i] != endAlignment2->scores[j] || endAlignment1->scores[rI] != endAlignment2->scores[rJ]) {
+            return 0;
+        }
+        i = endAlignment_nextLiveEntry(endAlignment1, i + 1);
+        j = endAlignment_nextLiveEntry(endAlignment2, j + 1);
+    }
+    return 1;
+}
+
+void endAlignment_appendAll(EndAlignment *target, EndAlignment *source) {
+    for (int64_t i = 0; i < source->length; i++) {
+        int64_t j = source->reverse[i];
+        if (!source->deleted[i] && i < j) {
+            endAlignment_add(target, source->subsequenceIdentifiers[i], source->positions[i], source->strands[i],
+                    source->subsequenceIdentifiers[j], source->positions[j], source->strands[j],
+                    source->scores[i], source->scores[j]);
+        }
+    }
+}
+
+/*
+ * Pinch iterator over an end alignment.
+ */
+
+typedef struct _EndAlignmentIterator {
+    EndAlignment *endAlignment;
+    int64_t index;
+} EndAlignmentIterator;
+
+static stPinch *endAlignmentIterator_getNext(EndAlignmentIterator *it, stPinch *pinchToFillOut) {
+    EndAlignment *endAlignment = it->endAlignment;
+    while (it->index < endAlignment->length) {
+        int64_t i = it->index++;
+        int64_t j = endAlignment->reverse[i];
+        if (!endAlignment->deleted[i] && i < j) { //Each pair is pinched once, from its first entry
+            stPinch_fillOut(pinchToFillOut, endAlignment->subsequenceIdentifiers[i], endAlignment->subsequenceIdentifiers[j],
+                    endAlignment->positions[i], endAlignment->positions[j], 1,
+                    endAlignment->strands[i] == endAlignment->strands[j]);
+            return pinchToFillOut;
+        }
+    }
+    return NULL;
+}
+
+static EndAlignmentIterator *endAlignmentIterator_reset(EndAlignmentIterator *it) {
+    it->index = 0;
+    return it;
+}
+
+stPinchIterator *stPinchIterator_constructFromEndAlignment(EndAlignment *endAlignment) {
+    EndAlignmentIterator *it = st_calloc(1, sizeof(EndAlignmentIterator));
+    it->endAlignment = endAlignment;
+    stPinchIterator *pinchIterator = st_calloc(1, sizeof(stPinchIterator));
+    pinchIterator->alignmentArg = it;
+    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) endAlignmentIterator_getNext;
+    pinchIterator->destructAlignmentArg = free;
+    pinchIterator->startAlignmentStack = (void *(*)(void *)) endAlignmentIterator_reset;
+    return pinchIterator;
+}
+
+EndAlignment *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
         bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, AdjacencyCache *adjacencyCache) {
     //Make an alignment of the sequences in the ends
 
     //Get the adjacency sequences to be aligned.
@@ -67,7 +262,8 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
         if(cap_getSide(cap)) {
             cap = cap_getReverse(cap);
         }
-        AdjacencySequence *adjacencySequence = adjacencySequence_construct(cap, maxSequenceLength);
+        AdjacencySequence *adjacencySequence = adjacencyCache != NULL ? adjacencySequence_construct2(cap, adjacencyCache)
+                                                                      : adjacencySequence_construct(cap, maxSequenceLength);
         stList_append(sequences, adjacencySequence);
         assert(cap_getAdjacency(cap) != NULL);
         End *otherEnd = end_getPositiveOrientation(cap_getEnd(cap_getAdjacency(cap)));
@@ -141,9 +337,7 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
     }
 
     //Convert the alignment pairs to an alignment of the caps..
-    stSortedSet *sortedAlignment =
-                stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
-                (void (*)(void *))alignedPair_destruct);
+    EndAlignment *endAlignment = endAlignment_construct(stList_length(mA->alignedPairs));
     while(stList_length(mA->alignedPairs) > 0) {
         stIntTuple *alignedPair = stList_pop(mA->alignedPairs);
         assert(stIntTuple_length(alignedPair) == 5);
@@ -165,16 +359,17 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
         double *scoreAdjustments = seqFrag1->rightEndId == seqFrag2->rightEndId ? scoreAdjustmentsCommonEnds : scoreAdjustmentsNonCommonEnds;
         assert(scoreAdjustments[seqIndex1] != INT64_MIN);
         assert(scoreAdjustments[seqIndex2] != INT64_MIN);
-        AlignedPair *alignedPair2 = alignedPair_construct(
+        endAlignment_add(endAlignment,
                 i->subsequenceIdentifier, i->start + (i->strand ? offset1 : -offset1), i->strand,
                 j->subsequenceIdentifier, j->start + (j->strand ? offset2 : -offset2), j->strand,
                 score*scoreAdjustments[seqIndex1], score*scoreAdjustments[seqIndex2]); //Do the reweighting here.
-        assert(stSortedSet_search(sortedAlignment, alignedPair2) == NULL);
-        assert(stSortedSet_search(sortedAlignment, alignedPair2->reverse) == NULL);
-        stSortedSet_insert(sortedAlignment, alignedPair2);
-        stSortedSet_insert(sortedAlignment, alignedPair2->reverse);
         stIntTuple_destruct(alignedPair);
     }
+    endAlignment_sort(endAlignment);
+    //Check the pairs are unique
+    for(int64_t k=1; k<endAlignment->length; k++) {
+        assert(endAlignment_cmp(endAlignment, k-1, k) < 0);
+    }
     //Cleanup
     stList_destruct(seqFrags);
     stList_destruct(sequences);
@@ -185,25 +380,23 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
     multipleAlignment_destruct(mA);
     stHash_destruct(endInstanceNumbers);
 
-    return sortedAlignment;
+    return endAlignment;
 }
 
-void writeEndAlignmentToDisk(End *end, stSortedSet *endAlignment, FILE *fileHandle) {
-    fprintf(fileHandle, "%" PRIi64 " %" PRIi64 "\n", end_getName(end), stSortedSet_size(endAlignment));
-    stSortedSetIterator *it = stSortedSet_getIterator(endAlignment);
-    AlignedPair *aP;
-    while((aP = stSortedSet_getNext(it)) != NULL) {
-        fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %i %" PRIi64 " ", aP->subsequenceIdentifier, aP->position, aP->strand, aP->score);
-        aP = aP->reverse;
-        fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %i %" PRIi64 "\n", aP->subsequenceIdentifier, aP->position, aP->strand, aP->score);
+void writeEndAlignmentToDisk(End *end, EndAlignment *endAlignment, FILE *fileHandle) {
+    fprintf(fileHandle, "%" PRIi64 " %" PRIi64 "\n", end_getName(end), endAlignment_size(endAlignment));
+    for(int64_t i=0; i<endAlignment->length; i++) {
+        int64_t j = endAlignment->reverse[i];
+        if(!endAlignment->deleted[i] && i < j) { //Write each aligned pair once
+            fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %i %" PRIi64 " ", endAlignment->subsequenceIdentifiers[i],
+                    endAlignment->positions[i], endAlignment->strands[i], endAlignment->scores[i]);
+            fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %i %" PRIi64 "\n", endAlignment->subsequenceIdentifiers[j],
+                    endAlignment->positions[j], endAlignment->strands[j], endAlignment->scores[j]);
+        }
     }
-    stSortedSet_destructIterator(it);
 }
 
-stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end) {
-    stSortedSet *endAlignment =
-                stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
-                (void (*)(void *))alignedPair_destruct);
+EndAlignment *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end) {
     char *line = stFile_getLineFromFile(fileHandle);
     if(line == NULL) {
         *end = NULL;
@@ -218,8 +411,9 @@ stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **en
     free(line);
     *end = flower_getEnd(flower, flowerName);
     if(*end == NULL) {
-        st_errAbort("We encountered an end name that is not in the database: '%s'\n", line);
+        st_errAbort("We encountered an end name that is not in the database: '%" PRIi64 "'\n", flowerName);
     }
+    EndAlignment *endAlignment = endAlignment_construct(lineNumber);
     for(int64_t i=0; i<lineNumber; i++) {
         line = stFile_getLineFromFile(fileHandle);
         if(line == NULL) {
@@ -232,9 +426,9 @@ stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **en
         if(i != 8) {
             st_errAbort("We encountered a mis-specified name in loading an end alignment from the disk: '%s'\n", line);
         }
-        stSortedSet_insert(endAlignment, alignedPair_construct(sI1, p1, st1, sI2, p2, st2, score1, score2));
+        endAlignment_add(endAlignment, sI1, p1, st1, sI2, p2, st2, score1, score2);
         free(line);
     }
+    endAlignment_sort(endAlignment);
     return endAlignment;
 }
-
@@ -5,93 +5,87 @@
  */
 
 #include "endAligner.h"
+#include "flowerAligner.h"
 #include "cactus.h"
 #include "sonLib.h"
 #include "adjacencySequences.h"
 #include "pairwiseAligner.h"
 
-stList *getInducedAlignment(stSortedSet *endAlignment, AdjacencySequence *adjacencySequence) {
+InducedAlignment *getInducedAlignment(EndAlignment *endAlignment, AdjacencySequence *adjacencySequence) {
     /*
      * Gets an ordered list of pairs from the end alignment for the given adjacency sequence.
      */
-    stList *inducedAlignment = stList_construct();
+    InducedAlignment *inducedAlignment = st_malloc(sizeof(InducedAlignment));
+    inducedAlignment->endAlignment = endAlignment;
+    inducedAlignment->length = 0;
+    //Get the range of entries covering the positions of the adjacency sequence.
+    int64_t firstPosition = adjacencySequence->strand ? adjacencySequence->start
+            : adjacencySequence->start - adjacencySequence->length + 1;
+    int64_t first = endAlignment_lowerBound(endAlignment, adjacencySequence->subsequenceIdentifier, firstPosition, 0);
+    int64_t last = endAlignment_lowerBound(endAlignment, adjacencySequence->subsequenceIdentifier,
+            firstPosition + adjacencySequence->length, 0);
+    inducedAlignment->entries = st_malloc((last > first ? last - first : 1) * sizeof(int64_t));
     if (adjacencySequence->strand) {
-        AlignedPair *alignedPair = alignedPair_construct(adjacencySequence->subsequenceIdentifier,
-                adjacencySequence->start - 1, adjacencySequence->strand, 0, 0, 0, 0, 0);
-        AlignedPair *alignedPair2 = stSortedSet_searchGreaterThan(endAlignment, alignedPair);
-        if (alignedPair2 != NULL) {
-            stSortedSetIterator *it = stSortedSet_getIteratorFrom(endAlignment, alignedPair2);
-            while ((alignedPair2 = stSortedSet_getNext(it)) != NULL) {
-                if (alignedPair2->subsequenceIdentifier == adjacencySequence->subsequenceIdentifier) {
-                    if (alignedPair2->position >= adjacencySequence->start + adjacencySequence->length) {
-                        break;
-                    }
-                    assert(alignedPair2->position >= adjacencySequence->start);
-                    if (alignedPair2->strand == adjacencySequence->strand) {
-                        stList_append(inducedAlignment, alignedPair2);
-                    }
-                } else {
-                    break;
-                }
+        for (int64_t i = first; i < last; i++) {
+            if (endAlignment->strands[i] == adjacencySequence->strand && !endAlignment->deleted[i]) {
+                inducedAlignment->entries[inducedAlignment->length++] = i;
             }
-            stSortedSet_destructIterator(it);
         }
-        alignedPair_destruct(alignedPair->reverse);
-        alignedPair_destruct(alignedPair);
     } else {
-        AlignedPair *alignedPair = alignedPair_construct(adjacencySequence->subsequenceIdentifier,
-                adjacencySequence->start + 1, adjacencySequence->strand, 0, 0, 0, 0, 0);
-        AlignedPair *alignedPair2 = stSortedSet_searchLessThan(endAlignment, alignedPair);
-        if (alignedPair2 != NULL) {
-            stSortedSetIterator *it = stSortedSet_getIteratorFrom(endAlignment, alignedPair2);
-            stSortedSet_getNext(it);
-            stSortedSet_getNext(it); //shift it up..
-            while ((alignedPair2 = stSortedSet_getPrevious(it)) != NULL) {
-                if (alignedPair2->subsequenceIdentifier == adjacencySequence->subsequenceIdentifier) {
-                    if (alignedPair2->position <= adjacencySequence->start - adjacencySequence->length) {
-                        break;
-                    }
-                    assert(alignedPair2->position <= adjacencySequence->start);
-                    if (alignedPair2->strand == adjacencySequence->strand) {
-                        stList_append(inducedAlignment, alignedPair2);
-                    }
-                } else {
-                    break;
-                }
+        for (int64_t i = last - 1; i >= first; i--) {
+            if (endAlignment->strands[i] == adjacencySequence->strand && !endAlignment->deleted[i]) {
+                inducedAlignment->entries[inducedAlignment->length++] = i;
             }
-            stSortedSet_destructIterator(it);
         }
-        alignedPair_destruct(alignedPair->reverse);
-        alignedPair_destruct(alignedPair);
     }
     /*
      * Check the induced alignment
      */
-    for (int64_t i = 0; i < stList_length(inducedAlignment); i++) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment, i);
-        (void) alignedPair;
-        assert(alignedPair->subsequenceIdentifier == adjacencySequence->subsequenceIdentifier);
-        assert(alignedPair->strand == adjacencySequence->strand);
+    for (int64_t i = 0; i < inducedAlignment->length; i++) {
+        int64_t j = inducedAlignment->entries[i];
+        (void) j;
+        assert(endAlignment->subsequenceIdentifiers[j] == adjacencySequence->subsequenceIdentifier);
+        assert(endAlignment->strands[j] == adjacencySequence->strand);
         if (adjacencySequence->strand) {
-            assert(alignedPair->position >= adjacencySequence->start);
-            assert(alignedPair->position < adjacencySequence->start + adjacencySequence->length);
+            assert(endAlignment->positions[j] >= adjacencySequence->start);
+            assert(endAlignment->positions[j] < adjacencySequence->start + adjacencySequence->length);
         } else {
-            assert(alignedPair->position <= adjacencySequence->start);
-            assert(alignedPair->position > adjacencySequence->start - adjacencySequence->length);
+            assert(endAlignment->positions[j] <= adjacencySequence->start);
+            assert(endAlignment->positions[j] > adjacencySequence->start - adjacencySequence->length);
         }
     }
     return inducedAlignment;
 }
 
+void inducedAlignment_destruct(InducedAlignment *inducedAlignment) {
+    free(inducedAlignment->entries);
+    free(inducedAlignment);
+}
+
+static void inducedAlignment_reverse(InducedAlignment *inducedAlignment) {
+    for (int64_t i = 0, j = inducedAlignment->length - 1; i < j; i++, j--) {
+        int64_t k = inducedAlignment->entries[i];
+        inducedAlignment->entries[i] = inducedAlignment->entries[j];
+        inducedAlignment->entries[j] = k;
+    }
+}
+
+static inline int64_t inducedAlignment_getScore(InducedAlignment *inducedAlignment, int64_t i) {
+    return inducedAlignment->endAlignment->scores[inducedAlignment->entries[i]];
+}
+
+static inline int64_t inducedAlignment_getPosition(InducedAlignment *inducedAlignment, int64_t i) {
+    return inducedAlignment->endAlignment->positions[inducedAlignment->entries[i]];
+}
+
 /*
  * Runs along and cumulate the score of the pairs, traversing forward through the induced alignment.
  */
-static int64_t *cumulateScoreForward(stList *inducedAlignment1) {
-    int64_t *iA = st_malloc(sizeof(int64_t) * stList_length(inducedAlignment1));
+static int64_t *cumulateScoreForward(InducedAlignment *inducedAlignment1) {
+    int64_t *iA = st_malloc(sizeof(int64_t) * (inducedAlignment1->length > 0 ? inducedAlignment1->length : 1));
     int64_t totalScore = 0;
-    for (int64_t i = 0; i < stList_length(inducedAlignment1); i++) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment1, i);
-        totalScore += alignedPair->score;
+    for (int64_t i = 0; i < inducedAlignment1->length; i++) {
+        totalScore += inducedAlignment_getScore(inducedAlignment1, i);
         iA[i] = totalScore;
     }
     return iA;
@@ -100,12 +94,11 @@ static int64_t *cumulateScoreForward(stList *inducedAlignment1) {
 /*
  * Runs along and cumulate the score of the pairs, traversing backward through the induced alignment.
  */
-static int64_t *cumulateScoreBackward(stList *inducedAlignment1) {
-    int64_t *iA = st_malloc(sizeof(int64_t) * stList_length(inducedAlignment1));
+static int64_t *cumulateScoreBackward(InducedAlignment *inducedAlignment1) {
+    int64_t *iA = st_malloc(sizeof(int64_t) * (inducedAlignment1->length > 0 ? inducedAlignment1->length : 1));
     int64_t totalScore = 0;
-    for (int64_t i = stList_length(inducedAlignment1) - 1; i >= 0; i--) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment1, i);
-        totalScore += alignedPair->score;
+    for (int64_t i = inducedAlignment1->length - 1; i >= 0; i--) {
+        totalScore += inducedAlignment_getScore(inducedAlignment1, i);
         iA[i] = totalScore;
     }
     return iA;
@@ -114,15 +107,15 @@ static int64_t *cumulateScoreBackward(stList *inducedAlignment1) {
 /*
  * Chooses a point along the adjacency sequence at which to filter the two alignments,
  */
-static int64_t getCutOff(stList *inducedAlignment1, stList *inducedAlignment2, int64_t *cutOff1, int64_t *cutOff2) {
+static int64_t getCutOff(InducedAlignment *inducedAlignment1, InducedAlignment *inducedAlignment2, int64_t *cutOff1, int64_t *cutOff2) {
     int64_t *cScore1 = cumulateScoreForward(inducedAlignment1);
     int64_t *cScore2 = cumulateScoreBackward(inducedAlignment2);
 
     //Check the score arrays for sanity..
-    for (int64_t i = 1; i < stList_length(inducedAlignment1); i++) {
+    for (int64_t i = 1; i < inducedAlignment1->length; i++) {
         assert(cScore1[i - 1] < cScore1[i]);
     }
-    for (int64_t i = 1; i < stList_length(inducedAlignment2); i++) {
+    for (int64_t i = 1; i < inducedAlignment2->length; i++) {
         assert(cScore2[i - 1] > cScore2[i]);
     }
 
@@ -130,23 +123,23 @@ static int64_t getCutOff(stList *inducedAlignment1, stList *inducedAlignment2, i
     *cutOff1 = 0;
     *cutOff2 = 0;
     int64_t maxScore = -1;
-    if (stList_length(inducedAlignment2) > 0) {
+    if (inducedAlignment2->length > 0) {
         maxScore = cScore2[0];
     }
     int64_t j = 0;
     int64_t pPos1 = INT64_MIN, pPos2 = INT64_MIN;
-    for (int64_t i = 0; i < stList_length(inducedAlignment1); i++) {
-        AlignedPair *alignedPair1 = stList_get(inducedAlignment1, i);
-        assert(alignedPair1->strand);
-        assert(pPos1 <= alignedPair1->position);
-        pPos1 = alignedPair1->position;
-        if (j < stList_length(inducedAlignment2)) {
+    for (int64_t i = 0; i < inducedAlignment1->length; i++) {
+        int64_t position1 = inducedAlignment_getPosition(inducedAlignment1, i);
+        assert(inducedAlignment1->endAlignment->strands[inducedAlignment1->entries[i]]);
+        assert(pPos1 <= position1);
+        pPos1 = position1;
+        if (j < inducedAlignment2->length) {
             do {
-                AlignedPair *alignedPair2 = stList_get(inducedAlignment2, j);
-                assert(!alignedPair2->strand);
-                assert(pPos2 <= alignedPair2->position);
-                pPos2 = alignedPair2->position;
-                if (alignedPair1->position < alignedPair2->position) {
+                int64_t position2 = inducedAlignment_getPosition(inducedAlignment2, j);
+                assert(!inducedAlignment2->endAlignment->strands[inducedAlignment2->entries[j]]);
+                assert(pPos2 <= position2);
+                pPos2 = position2;
+                if (position1 < position2) {
                     if (cScore1[i] + cScore2[j] >= maxScore) {
                         maxScore = cScore1[i] + cScore2[j];
                         *cutOff1 = i + 1;
@@ -156,13 +149,13 @@ static int64_t getCutOff(stList *inducedAlignment1, stList *inducedAlignment2, i
                 } else {
                     j++;
                 }
-            } while (j < stList_length(inducedAlignment2));
+            } while (j < inducedAlignment2->length);
         } else {
             if (cScore1[i] >= maxScore) {
-                *cutOff1 = stList_length(inducedAlignment1);
+                *cutOff1 = inducedAlignment1->length;
                 *cutOff2 = j;
-                assert(cScore1[stList_length(inducedAlignment1) - 1] >= maxScore);
-                maxScore = cScore1[stList_length(inducedAlignment1) - 1];
+                assert(cScore1[inducedAlignment1->length - 1] >= maxScore);
+                maxScore = cScore1[inducedAlignment1->length - 1];
                 break;
             }
         }
@@ -190,44 +183,33 @@ void updateDeletedPairs(int64_t subsequenceIdentifier, stHash *deletedAlignedPai
     (*j)++;
 }
 
-static void pruneAlignmentsP(stList *inducedAlignment, stSortedSet *endAlignment, int64_t start, int64_t end,
-        stSortedSet *pairsToDelete, stHash *deletedAlignedPairCounts) {
+static void pruneAlignmentsP(InducedAlignment *inducedAlignment, int64_t start, int64_t end,
+        stHash *deletedAlignedPairCounts) {
+    EndAlignment *endAlignment = inducedAlignment->endAlignment;
     for (int64_t i = start; i < end; i++) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment, i);
-        if (stSortedSet_search(endAlignment, alignedPair) != NULL) { //can be missing if we are pruning the reverse strand alignment at the same time
-            assert(stSortedSet_search(endAlignment, alignedPair->reverse) != NULL);
-            updateDeletedPairs(alignedPair->subsequenceIdentifier, deletedAlignedPairCounts);
-            updateDeletedPairs(alignedPair->reverse->subsequenceIdentifier, deletedAlignedPairCounts);
-            stSortedSet_remove(endAlignment, alignedPair);
-            stSortedSet_remove(endAlignment, alignedPair->reverse);
-            if (stSortedSet_search(pairsToDelete, alignedPair) == NULL) { // &&
-                assert(stSortedSet_search(pairsToDelete, alignedPair->reverse) == NULL);
-                stSortedSet_insert(pairsToDelete, alignedPair);
-                stSortedSet_insert(pairsToDelete, alignedPair->reverse);
-            } else {
-                assert(stSortedSet_search(pairsToDelete, alignedPair->reverse) != NULL);
-            }
+        int64_t j = inducedAlignment->entries[i];
+        if (!endAlignment->deleted[j]) { //can be already deleted if we are pruning the reverse strand alignment at the same time
+            updateDeletedPairs(endAlignment->subsequenceIdentifiers[j], deletedAlignedPairCounts);
+            updateDeletedPairs(endAlignment->subsequenceIdentifiers[endAlignment->reverse[j]], deletedAlignedPairCounts);
+            endAlignment_remove(endAlignment, j);
         }
     }
 }
 
-static void pruneAlignments(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, stSortedSet *endAlignment1,
-        stSortedSet *endAlignment2, void *deletedAlignedPairCounts) {
+static void pruneAlignments(Cap *cap, InducedAlignment *inducedAlignment1, InducedAlignment *inducedAlignment2,
+        void *deletedAlignedPairCounts) {
     /*
      * Chooses a point along the adjacency sequence at which to filter the two alignments,
      * then filters the aligned pairs by this point.
      */
     int64_t cutOff1 = 0, cutOff2 = 0;
     getCutOff(inducedAlignment1, inducedAlignment2, &cutOff1, &cutOff2);
-    stSortedSet *pairsToDelete = stSortedSet_construct2((void(*)(void *)) alignedPair_destruct);
     //Now do the actual filtering of the alignments.
-    pruneAlignmentsP(inducedAlignment1, endAlignment1, cutOff1, stList_length(inducedAlignment1), pairsToDelete, deletedAlignedPairCounts);
-    pruneAlignmentsP(inducedAlignment2, endAlignment2, 0, cutOff2, pairsToDelete, deletedAlignedPairCounts);
-    stSortedSet_destruct(pairsToDelete);
+    pruneAlignmentsP(inducedAlignment1, cutOff1, inducedAlignment1->length, deletedAlignedPairCounts);
+    pruneAlignmentsP(inducedAlignment2, 0, cutOff2, deletedAlignedPairCounts);
 }
 
-void getScore(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, stSortedSet *endAlignment1,
-        stSortedSet *endAlignment2, void *capScoresFnHash) {
+void getScore(Cap *cap, InducedAlignment *inducedAlignment1, InducedAlignment *inducedAlignment2, void *capScoresFnHash) {
 
     int64_t i, j;
     int64_t *maxScore = st_malloc(sizeof(int64_t));
@@ -245,59 +227,61 @@ static int sortCapsFn(const void *cap1, const void *cap2, void *capScoresFnHash)
     return (i > 0) ? 1 : ((i < 0) ? -1 : 0); 
 }
 
-bool isAlignedToStubSequence(AlignedPair *alignedPair, Flower *flower) {
-	Cap *cap = flower_getCap(flower, alignedPair->reverse->subsequenceIdentifier);
+bool isAlignedToStubSequence(Name subsequenceIdentifier, Flower *flower) {
+    /*
+     * Returns non-zero iff the subsequence is on an adjacency incident with a free stub end.
+     */
+	Cap *cap = flower_getCap(flower, subsequenceIdentifier);
     assert(cap != NULL);
     End *end1 = cap_getEnd(cap), *end2 = cap_getEnd(cap_getAdjacency(cap));
     assert(end1 != NULL && end2 != NULL);
     return (end_isStubEnd(end1) && end_isFree(end1)) || (end_isStubEnd(end2) && end_isFree(end2));
 } 
 
-static int64_t findFirstNonStubAlignment(Flower *flower, stList *inducedAlignment, bool reverse) {
-    AlignedPair *pAlignedPair = NULL;
+static int64_t findFirstNonStubAlignment(Flower *flower, InducedAlignment *inducedAlignment, bool reverse) {
+    EndAlignment *endAlignment = inducedAlignment->endAlignment;
+    int64_t pEntry = -1;
     int64_t j = -1;
-    for (int64_t i = reverse ? stList_length(inducedAlignment) - 1 : 0; i < stList_length(inducedAlignment) && i >= 0; i
+    for (int64_t i = reverse ? inducedAlignment->length - 1 : 0; i < inducedAlignment->length && i >= 0; i
             += reverse ? -1 : 1) {
-        AlignedPair *alignedPair = stList_get(inducedAlignment, i);
-        assert(isAlignedToStubSequence(alignedPair->reverse, flower));
-        assert(pAlignedPair == NULL || pAlignedPair->subsequenceIdentifier == alignedPair->subsequenceIdentifier);
-        if (pAlignedPair == NULL || pAlignedPair->position != alignedPair->position) {
-            pAlignedPair = alignedPair;
+        int64_t entry = inducedAlignment->entries[i];
+        assert(isAlignedToStubSequence(endAlignment->subsequenceIdentifiers[entry], flower));
+        assert(pEntry == -1 || endAlignment->subsequenceIdentifiers[pEntry] == endAlignment->subsequenceIdentifiers[entry]);
+        if (pEntry == -1 || endAlignment->positions[pEntry] != endAlignment->positions[entry]) {
+            pEntry = entry;
             j = i;
         }
-        if(!isAlignedToStubSequence(alignedPair, flower)) {
+        if(!isAlignedToStubSequence(endAlignment->subsequenceIdentifiers[endAlignment->reverse[entry]], flower)) {
             assert(j != -1);
             return j;
         }
     }
-    return (reverse ? -1 : stList_length(inducedAlignment));
+    return (reverse ? -1 : inducedAlignment->length);
 }
 
-static void pruneStubAlignments(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2,
-        stSortedSet *endAlignment1, stSortedSet *endAlignment2, void *deletedAlignedPairCounts) {
+static void pruneStubAlignments(Cap *cap, InducedAlignment *inducedAlignment1, InducedAlignment *inducedAlignment2,
+        void *deletedAlignedPairCounts) {
     assert(cap != NULL);
     End *end = cap_getEnd(cap);
     assert(cap_getAdjacency(cap) != NULL);
     End *adjacentEnd = cap_getEnd(cap_getAdjacency(cap));
     assert(end != NULL);
     assert(adjacentEnd != NULL);
-    int64_t cutOff1 = stList_length(inducedAlignment1) - 1;
+    int64_t cutOff1 = inducedAlignment1->length - 1;
     int64_t cutOff2 = 0;
     if (end_isStubEnd(adjacentEnd) && end_isFree(adjacentEnd)) {
         cutOff1 = findFirstNonStubAlignment(end_getFlower(end), inducedAlignment1, 1);
-        assert(stList_length(inducedAlignment2) == 0);
-        cutOff2 = stList_length(inducedAlignment2);
+        assert(inducedAlignment2->length == 0);
+        cutOff2 = inducedAlignment2->length;
     }
     if (end_isStubEnd(end) && end_isFree(end)) {
-        assert(stList_length(inducedAlignment1) == 0);
+        assert(inducedAlignment1->length == 0);
         cutOff1 = -1;
         cutOff2 = findFirstNonStubAlignment(end_getFlower(end), inducedAlignment2, 0);
     }
-    stSortedSet *pairsToDelete = stSortedSet_construct2((void(*)(void *)) alignedPair_destruct);
     //Now do the actual filtering of the alignments.
-    pruneAlignmentsP(inducedAlignment1, endAlignment1, cutOff1 + 1, stList_length(inducedAlignment1), pairsToDelete, deletedAlignedPairCounts);
-    pruneAlignmentsP(inducedAlignment2, endAlignment2, 0, cutOff2, pairsToDelete, deletedAlignedPairCounts);
-    stSortedSet_destruct(pairsToDelete);
+    pruneAlignmentsP(inducedAlignment1, cutOff1 + 1, inducedAlignment1->length, deletedAlignedPairCounts);
+    pruneAlignmentsP(inducedAlignment2, 0, cutOff2, deletedAlignedPairCounts);
 }
 
 /*
@@ -305,8 +289,8 @@ static void pruneStubAlignments(Cap *cap, stList *inducedAlignment1, stList *ind
  */
 
 static int makeFlowerAlignmentP(Cap *cap, stHash *endAlignments,
-        void(*fn)(Cap *, stList *, stList *, stSortedSet *, stSortedSet *, void *), void *extraArg) {
-    stSortedSet *endAlignment1 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(cap)));
+        void(*fn)(Cap *, InducedAlignment *, InducedAlignment *, void *), void *extraArg) {
+    EndAlignment *endAlignment1 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(cap)));
     assert(endAlignment1 != NULL);
 
     Cap *adjacentCap = cap_getAdjacency(cap);
@@ -314,31 +298,31 @@ static int makeFlowerAlignmentP(Cap *cap, stHash *endAlignments,
     assert(cap_getSide(adjacentCap));
     assert(cap_getStrand(adjacentCap));
     adjacentCap = cap_getReverse(adjacentCap);
-    stSortedSet *endAlignment2 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(adjacentCap)));
+    EndAlignment *endAlignment2 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(adjacentCap)));
     assert(endAlignment2 != NULL);
 
-    AdjacencySequence *adjacencySequence1 = adjacencySequence_construct(cap, INT64_MAX);
-    AdjacencySequence *adjacencySequence2 = adjacencySequence_construct(adjacentCap, INT64_MAX);
-    assert(adjacencySequence1->length == adjacencySequence2->length);
-    assert(adjacencySequence1->subsequenceIdentifier == adjacencySequence2->subsequenceIdentifier);
-    assert(adjacencySequence1->strand == !adjacencySequence2->strand);
-    assert(adjacencySequence2->start == adjacencySequence1->start + adjacencySequence1->length - 1);
+    //Only the coordinates of the adjacency are needed, so avoid extracting its string
+    AdjacencySequence adjacencySequence1, adjacencySequence2;
+    adjacencySequence_fillOutCoordinates(cap, INT64_MAX, &adjacencySequence1);
+    adjacencySequence_fillOutCoordinates(adjacentCap, INT64_MAX, &adjacencySequence2);
+    assert(adjacencySequence1.length == adjacencySequence2.length);
+    assert(adjacencySequence1.subsequenceIdentifier == adjacencySequence2.subsequenceIdentifier);
+    assert(adjacencySequence1.strand == !adjacencySequence2.strand);
+    assert(adjacencySequence2.start == adjacencySequence1.start + adjacencySequence1.length - 1);
 
-    stList *inducedAlignment1 = getInducedAlignment(endAlignment1, adjacencySequence1);
-    stList *inducedAlignment2 = getInducedAlignment(endAlignment2, adjacencySequence2);
-    stList_reverse(inducedAlignment2);
+    InducedAlignment *inducedAlignment1 = getInducedAlignment(endAlignment1, &adjacencySequence1);
+    InducedAlignment *inducedAlignment2 = getInducedAlignment(endAlignment2, &adjacencySequence2);
+    inducedAlignment_reverse(inducedAlignment2);
 
-    fn(cap, inducedAlignment1, inducedAlignment2, endAlignment1, endAlignment2, extraArg);
+    fn(cap, inducedAlignment1, inducedAlignment2, extraArg);
 
     //Cleanup.
-    adjacencySequence_destruct(adjacencySequence1);
-    adjacencySequence_destruct(adjacencySequence2);
-    stList_destruct(inducedAlignment1);
-    stList_destruct(inducedAlignment2);
+    inducedAlignment_destruct(inducedAlignment1);
+    inducedAlignment_destruct(inducedAlignment2);
     return 1;
 }
 
-static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments, bool pruneOutStubAlignments) {
+static EndAlignment *makeFlowerAlignment2(Flower *flower, stHash *endAlignments, bool pruneOutStubAlignments) {
     /*
      * Makes the alignments of the ends, in "endAlignments", consistent with one another using the bar algorithm.
      */
@@ -413,28 +397,22 @@ static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments,
     }
     stList_destruct(freeStubCaps);
 
-    //Now convert to set of final aligned pairs to return.
-    stSortedSet *sortedAlignment = stSortedSet_construct3((int(*)(const void *, const void *)) alignedPair_cmpFn,
-            (void(*)(void *)) alignedPair_destruct);
+    //Now merge the surviving pairs into the final aligned pairs to return.
+    int64_t totalPairs = 0;
     stList *endAlignmentsList = stHash_getValues(endAlignments);
-    while (stList_length(endAlignmentsList) > 0) {
-        stSortedSet *endAlignment = stList_pop(endAlignmentsList);
-        while (stSortedSet_size(endAlignment) > 0) {
-            AlignedPair *alignedPair = stSortedSet_getFirst(endAlignment);
-            stSortedSet_remove(endAlignment, alignedPair);
-            assert(stSortedSet_search(endAlignment, alignedPair->reverse) != NULL);
-            stSortedSet_remove(endAlignment, alignedPair->reverse);
-            assert(stSortedSet_search(sortedAlignment, alignedPair) == NULL);
-            assert(stSortedSet_search(sortedAlignment, alignedPair->reverse) == NULL);
-            stSortedSet_insert(sortedAlignment, alignedPair);
-            stSortedSet_insert(sortedAlignment, alignedPair->reverse);
-        }
+    for (int64_t i = 0; i < stList_length(endAlignmentsList); i++) {
+        totalPairs += endAlignment_size(stList_get(endAlignmentsList, i));
+    }
+    EndAlignment *flowerAlignment = endAlignment_construct(totalPairs);
+    for (int64_t i = 0; i < stList_length(endAlignmentsList); i++) {
+        endAlignment_appendAll(flowerAlignment, stList_get(endAlignmentsList, i));
     }
+    endAlignment_sort(flowerAlignment);
     stList_destruct(endAlignmentsList);
     stHash_destruct(endAlignments);
     stHash_destruct(deletedAlignedPairCounts);
 
-    return sortedAlignment;
+    return flowerAlignment;
 }
 
 /*
@@ -533,6 +511,8 @@ static void computeMissingEndAlignments(StateMachine *sM, Flower *flower, stHash
      */
     //Make the end alignments, representing each as an adjacency alignment.
     stSortedSet *endsToAlign = getEndsToAlign(flower, maxSequenceLength);
+    //Each adjacency is aligned from both of its ends, so share its string between the two end alignments
+    AdjacencyCache *adjacencyCache = adjacencyCache_construct(maxSequenceLength, -1);
     End *end;
     Flower_EndIterator *endIterator = flower_getEndIterator(flower);
     while ((end = flower_getNextEnd(endIterator)) != NULL) {
@@ -543,20 +523,21 @@ static void computeMissingEndAlignments(StateMachine *sM, Flower *flower, stHash
                         end,
                         makeEndAlignment(sM, end, spanningTrees, maxSequenceLength,
                                 useProgressiveMerging, gapGamma,
-                                pairwiseAlignmentBandingParameters));
+                                pairwiseAlignmentBandingParameters, adjacencyCache));
             } else {
-                stHash_insert(endAlignments, end, stSortedSet_construct());
+                stHash_insert(endAlignments, end, endAlignment_construct(0));
             }
         }
     }
     flower_destructEndIterator(endIterator);
     stSortedSet_destruct(endsToAlign);
+    adjacencyCache_destruct(adjacencyCache);
 }
 
-stSortedSet *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees, int64_t maxSequenceLength,
+EndAlignment *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees, int64_t maxSequenceLength,
         bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments, int64_t poaWindow) {
-    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) stSortedSet_destruct);
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments) {
+    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) endAlignment_destruct);
     computeMissingEndAlignments(sM, flower, endAlignments, spanningTrees, maxSequenceLength,
             useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters);
     return makeFlowerAlignment2(flower, endAlignments, pruneOutStubAlignments);
@@ -569,7 +550,7 @@ static void loadEndAlignments(Flower *flower, stHash *endAlignments, stList *lis
     for (int64_t i = 0; i < stList_length(listOfEndAlignments); i++) {
         End *end;
         FILE *fileHandle = fopen(stList_get(listOfEndAlignments, i), "r");
-        stSortedSet *alignment;
+        EndAlignment *alignment;
         while((alignment = loadEndAlignmentFromDisk(flower, fileHandle, &end)) != NULL) {
             assert(stHash_search(endAlignments, end) == NULL);
             stHash_insert(endAlignments, end, alignment);
@@ -578,13 +559,20 @@ static void loadEndAlignments(Flower *flower, stHash *endAlignments, stList *lis
     }
 }
 
-stSortedSet *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
+EndAlignment *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
         PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments) {
-    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) stSortedSet_destruct);
+    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) endAlignment_destruct);
     if(listOfEndAlignmentFiles != NULL) {
         loadEndAlignments(flower, endAlignments, listOfEndAlignmentFiles);
     }
+    return makeFlowerAlignment4(sM, flower, endAlignments, spanningTrees, maxSequenceLength,
+            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters, pruneOutStubAlignments);
+}
+
+EndAlignment *makeFlowerAlignment4(StateMachine *sM, Flower *flower, stHash *endAlignments, int64_t spanningTrees,
+        int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments) {
     computeMissingEndAlignments(sM, flower, endAlignments, spanningTrees, maxSequenceLength,
             useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters);
     return makeFlowerAlignment2(flower, endAlignments, pruneOutStubAlignments);
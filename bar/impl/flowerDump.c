@@ -0,0 +1,246 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "flowerDump.h"
+
+static int capCoordinateCmpFn(const void *a, const void *b) {
+    int64_t i = cap_getCoordinate((Cap *)a), j = cap_getCoordinate((Cap *)b);
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static bool capsAreAdjacent(Cap *cap, Cap *cap2) {
+    return cap_getAdjacency(cap) != NULL &&
+           cap_getPositiveOrientation(cap_getAdjacency(cap)) == cap_getPositiveOrientation(cap2);
+}
+
+static void appendSequence(stList *strings, Sequence *sequence, int64_t start, int64_t length) {
+    if (length > 0) {
+        stList_append(strings, sequence_getString(sequence, start, length, 1));
+    }
+}
+
+static char *compactSequence(Sequence *sequence, stList *caps, stHash *compactCoordinates) {
+    /*
+     * Gets the bases of the sequence that are either in a cap or in an adjacency between two caps
+     * of the flower, filling in the coordinates of the caps in the returned string. The caps must
+     * be sorted by coordinate.
+     */
+    int64_t start = sequence_getStart(sequence), end = start + sequence_getLength(sequence);
+    stList *strings = stList_construct3(0, free);
+    int64_t compactCoordinate = 0;
+    int64_t pCoordinateStart = -1; // Index of the first cap at the previous coordinate
+    for (int64_t i = 0; i < stList_length(caps); i++) {
+        Cap *cap = stList_get(caps, i);
+        int64_t coordinate = cap_getCoordinate(cap);
+        bool inSequence = coordinate >= start && coordinate < end;
+        if (i == 0) {
+            compactCoordinate = inSequence ? 1 : 0;
+        } else {
+            int64_t pCoordinate = cap_getCoordinate(stList_get(caps, i - 1));
+            if (coordinate != pCoordinate) {
+                // Keep the bases between the coordinates if they are an adjacency of the flower,
+                // else remove them, as they belong to other flowers
+                bool adjacent = 0;
+                for (int64_t j = pCoordinateStart; j < i && !adjacent; j++) {
+                    for (int64_t k = i; k < stList_length(caps) && cap_getCoordinate(stList_get(caps, k)) == coordinate; k++) {
+                        adjacent = adjacent || capsAreAdjacent(stList_get(caps, j), stList_get(caps, k));
+                    }
+                }
+                if (adjacent) {
+                    appendSequence(strings, sequence, pCoordinate + 1, coordinate - pCoordinate - 1);
+                    compactCoordinate += coordinate - pCoordinate;
+                } else {
+                    compactCoordinate++;
+                }
+            }
+        }
+        if (i == 0 || coordinate != cap_getCoordinate(stList_get(caps, i - 1))) {
+            pCoordinateStart = i;
+            if (inSequence) {
+                appendSequence(strings, sequence, coordinate, 1);
+            }
+        }
+        stHash_insert(compactCoordinates, cap, stIntTuple_construct1(compactCoordinate));
+    }
+    char *string = stString_join2("", strings);
+    stList_destruct(strings);
+    return string;
+}
+
+void writeFlowerToDisk(Flower *flower, FILE *fileHandle) {
+    // Group the caps by sequence, in coordinate order
+    stHash *sequencesToCaps = stHash_construct2(NULL, (void (*)(void *))stList_destruct);
+    stHash *sequenceIndices = stHash_construct2(NULL, (void (*)(void *))stIntTuple_destruct);
+    stList *sequences = stList_construct();
+    stList *caps = stList_construct();
+    stHash *capIndices = stHash_construct2(NULL, (void (*)(void *))stIntTuple_destruct);
+    Flower_CapIterator *capIt = flower_getCapIterator(flower);
+    Cap *cap;
+    while ((cap = flower_getNextCap(capIt)) != NULL) {
+        stHash_insert(capIndices, cap_getPositiveOrientation(cap), stIntTuple_construct1(stList_length(caps)));
+        stList_append(caps, cap);
+        stList *sequenceCaps = stHash_search(sequencesToCaps, cap_getSequence(cap));
+        if (sequenceCaps == NULL) {
+            sequenceCaps = stList_construct();
+            stHash_insert(sequencesToCaps, cap_getSequence(cap), sequenceCaps);
+            stHash_insert(sequenceIndices, cap_getSequence(cap), stIntTuple_construct1(stList_length(sequences)));
+            stList_append(sequences, cap_getSequence(cap));
+        }
+        stList_append(sequenceCaps, cap);
+    }
+    flower_destructCapIterator(capIt);
+
+    // Ends
+    stList *ends = stList_construct();
+    stHash *endIndices = stHash_construct2(NULL, (void (*)(void *))stIntTuple_destruct);
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        stHash_insert(endIndices, end, stIntTuple_construct1(stList_length(ends)));
+        stList_append(ends, end);
+    }
+    flower_destructEndIterator(endIt);
+
+    fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "\n", flower_getName(flower),
+            stList_length(sequences), stList_length(ends), stList_length(caps));
+
+    // Sequences, each followed by its event header, outgroup status, header and compacted string
+    stHash *compactCoordinates = stHash_construct2(NULL, (void (*)(void *))stIntTuple_destruct);
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        Sequence *sequence = stList_get(sequences, i);
+        stList *sequenceCaps = stHash_search(sequencesToCaps, sequence);
+        stList_sort(sequenceCaps, capCoordinateCmpFn);
+        char *string = compactSequence(sequence, sequenceCaps, compactCoordinates);
+        Event *event = sequence_getEvent(sequence);
+        fprintf(fileHandle, "%i %s\n%s\n%s\n", event_isOutgroup(event), event_getHeader(event),
+                sequence_getHeader(sequence), string);
+        free(string);
+    }
+
+    for (int64_t i = 0; i < stList_length(ends); i++) {
+        end = stList_get(ends, i);
+        fprintf(fileHandle, "%i %i\n", end_getSide(end), end_isAttached(end));
+    }
+
+    // Caps, as: end index, end orientation, coordinate, strand, sequence index, adjacency index,
+    // adjacency orientation
+    for (int64_t i = 0; i < stList_length(caps); i++) {
+        cap = stList_get(caps, i);
+        end = cap_getEnd(cap);
+        int64_t sequenceIndex = stIntTuple_get(stHash_search(sequenceIndices, cap_getSequence(cap)), 0);
+        Cap *adjacentCap = cap_getAdjacency(cap);
+        int64_t adjacentCapIndex = -1;
+        bool adjacentCapOrientation = 1;
+        if (adjacentCap != NULL) {
+            adjacentCapIndex = stIntTuple_get(stHash_search(capIndices, cap_getPositiveOrientation(adjacentCap)), 0);
+            adjacentCapOrientation = adjacentCap == stList_get(caps, adjacentCapIndex);
+        }
+        fprintf(fileHandle, "%" PRIi64 " %i %" PRIi64 " %i %" PRIi64 " %" PRIi64 " %i\n",
+                stIntTuple_get(stHash_search(endIndices, end_getPositiveOrientation(end)), 0), end_getOrientation(end),
+                stIntTuple_get(stHash_search(compactCoordinates, cap), 0), cap_getStrand(cap), sequenceIndex,
+                adjacentCapIndex, adjacentCapOrientation);
+    }
+
+    stHash_destruct(compactCoordinates);
+    stHash_destruct(sequencesToCaps);
+    stHash_destruct(sequenceIndices);
+    stHash_destruct(capIndices);
+    stHash_destruct(endIndices);
+    stList_destruct(sequences);
+    stList_destruct(caps);
+    stList_destruct(ends);
+}
+
+static char *getLine(FILE *fileHandle) {
+    char *line = stFile_getLineFromFile(fileHandle);
+    if (line == NULL) {
+        st_errAbort("Got a null line when parsing a flower\n");
+    }
+    return line;
+}
+
+Flower *loadFlowerFromDisk(CactusDisk *cactusDisk, FILE *fileHandle) {
+    char *line = stFile_getLineFromFile(fileHandle);
+    if (line == NULL) {
+        return NULL;
+    }
+    Name flowerName;
+    int64_t sequenceNumber, endNumber, capNumber;
+    if (sscanf(line, "%" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "", &flowerName, &sequenceNumber, &endNumber,
+               &capNumber) != 4 || sequenceNumber < 0 || endNumber < 0 || capNumber < 0) {
+        st_errAbort("We encountered a mis-specified first line of a flower: '%s'\n", line);
+    }
+    free(line);
+    Flower *flower = flower_construct(cactusDisk);
+
+    EventTree *eventTree = cactusDisk_getEventTree(cactusDisk);
+    if (eventTree == NULL) {
+        eventTree = eventTree_construct2(cactusDisk);
+    }
+    Sequence **sequences = st_malloc(sizeof(Sequence *) * sequenceNumber);
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        line = getLine(fileHandle);
+        int outgroup, offset;
+        if (sscanf(line, "%i %n", &outgroup, &offset) != 1) {
+            st_errAbort("We encountered a mis-specified event line of a flower: '%s'\n", line);
+        }
+        Event *event = eventTree_getEventByHeader(eventTree, line + offset);
+        if (event == NULL) {
+            event = event_construct3(line + offset, 0.1, eventTree_getRootEvent(eventTree), eventTree);
+            event_setOutgroupStatus(event, outgroup);
+        }
+        free(line);
+        char *header = getLine(fileHandle);
+        char *string = getLine(fileHandle);
+        sequences[i] = sequence_construct(1, strlen(string), string, header, event, cactusDisk);
+        flower_addSequence(flower, sequences[i]);
+        free(header);
+        free(string);
+    }
+
+    End **ends = st_malloc(sizeof(End *) * endNumber);
+    for (int64_t i = 0; i < endNumber; i++) {
+        line = getLine(fileHandle);
+        int side, isAttached;
+        if (sscanf(line, "%i %i", &side, &isAttached) != 2) {
+            st_errAbort("We encountered a mis-specified end line of a flower: '%s'\n", line);
+        }
+        ends[i] = end_construct2(side, isAttached, flower);
+        free(line);
+    }
+
+    Cap **caps = st_malloc(sizeof(Cap *) * capNumber);
+    int64_t *adjacentCapIndices = st_malloc(sizeof(int64_t) * capNumber);
+    int *adjacentCapOrientations = st_malloc(sizeof(int) * capNumber);
+    for (int64_t i = 0; i < capNumber; i++) {
+        line = getLine(fileHandle);
+        int64_t endIndex, coordinate, sequenceIndex;
+        int endOrientation, strand;
+        if (sscanf(line, "%" PRIi64 " %i %" PRIi64 " %i %" PRIi64 " %" PRIi64 " %i", &endIndex, &endOrientation,
+                   &coordinate, &strand, &sequenceIndex, &adjacentCapIndices[i], &adjacentCapOrientations[i]) != 7 ||
+            endIndex < 0 || endIndex >= endNumber || sequenceIndex < 0 || sequenceIndex >= sequenceNumber ||
+            adjacentCapIndices[i] >= capNumber) {
+            st_errAbort("We encountered a mis-specified cap line of a flower: '%s'\n", line);
+        }
+        End *end = endOrientation ? ends[endIndex] : end_getReverse(ends[endIndex]);
+        caps[i] = cap_construct2(end, coordinate, strand, sequences[sequenceIndex]);
+        free(line);
+    }
+    for (int64_t i = 0; i < capNumber; i++) {
+        int64_t j = adjacentCapIndices[i];
+        if (j > i) { // Make each adjacency once
+            cap_makeAdjacent(caps[i], adjacentCapOrientations[i] ? caps[j] : cap_getReverse(caps[j]));
+        }
+    }
+
+    free(sequences);
+    free(ends);
+    free(caps);
+    free(adjacentCapIndices);
+    free(adjacentCapOrientations);
+
+    return flower;
+}
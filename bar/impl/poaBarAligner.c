@@ -10,6 +10,7 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <time.h>
 
 // FOR DEBUGGING ONLY: Specify directory where abpoa inputs get dumped
 //#define CACTUS_ABPOA_MSA_DUMP_DIR "/home/hickey/dev/cactus/dump"
@@ -21,6 +22,27 @@
 //#include <omp.h>
 //#endif
 
+double barTimings_getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1.0e-9;
+}
+
+void barTimings_add(BarTimings *timings1, BarTimings *timings2) {
+    timings1->sequenceExtraction += timings2->sequenceExtraction;
+    timings1->alignment += timings2->alignment;
+    timings1->trimming += timings2->trimming;
+    timings1->blockCreation += timings2->blockCreation;
+    timings1->annealing += timings2->annealing;
+    timings1->melting += timings2->melting;
+    timings1->cactusConstruction += timings2->cactusConstruction;
+}
+
+double barTimings_total(BarTimings *timings) {
+    return timings->sequenceExtraction + timings->alignment + timings->trimming + timings->blockCreation +
+           timings->annealing + timings->melting + timings->cactusConstruction;
+}
+
 abpoa_para_t *abpoaParamaters_constructFromCactusParams(CactusParams *params) {
     abpoa_para_t *abpt = abpoa_init_para();
 
@@ -436,7 +458,7 @@ static void msa_fix_trimmed(Msa* msa) {
 }
 
 Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
-                                      abpoa_para_t *poa_parameters) {
+                                      abpoa_para_t *poa_parameters, BarTimings *timings) {
 
     assert(seq_no > 0);
         
@@ -520,6 +542,7 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         }
 
         // init abpoa
+        double alignment_start_time = timings != NULL ? barTimings_getTime() : 0.0;
         abpoa_t *ab = abpoa_init();
         abpoa_para_t *abpt = copy_abpoa_params(poa_parameters);
         abpoa_post_set_para(abpt);
@@ -571,6 +594,9 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         // free abpoa
         abpoa_free(ab);
         abpoa_free_para(abpt);
+        if (timings != NULL) {
+            timings->alignment += barTimings_getTime() - alignment_start_time;
+        }
 
         // mask out empty sequences that were phonied in as Ns above
         for (int64_t i = 0; i < msa->seq_no && emptyCount > 0; ++i) {
@@ -606,6 +632,7 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         //       in addition to flipping the prev_msa back and forth
         //       (not sure if this is at all noticeable on top of abpoa running time though)
         if (prev_msa) {
+            double trimming_start_time = timings != NULL ? barTimings_getTime() : 0.0;
             // trim() presently assumes we're looking at reverse-complement sequence:
             flip_msa_seq(msa);
             float* prev_column_scores = make_column_scores(prev_msa);
@@ -626,6 +653,9 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
 
             free(prev_column_scores);
             free(column_scores);
+            if (timings != NULL) {
+                timings->trimming += barTimings_getTime() - trimming_start_time;
+            }
         }
 
         // add the msa to our list
@@ -690,7 +720,7 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
 
 Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_lengths, char ***end_strings,
         int **end_string_lengths, int64_t **right_end_indexes, int64_t **right_end_row_indexes, int64_t **overlaps,
-        int64_t window_size, abpoa_para_t *poa_parameters) {
+        int64_t window_size, abpoa_para_t *poa_parameters, BarTimings *timings) {
     // Calculate the initial, potentially inconsistent msas and column scores for each msa
     float *column_scores[end_no];
     Msa **msas = st_malloc(sizeof(Msa *) * end_no);
@@ -699,11 +729,12 @@ Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_leng
 //#endif
     for(int64_t i=0; i<end_no; i++) {
         msas[i] = msa_make_partial_order_alignment(end_strings[i], end_string_lengths[i], end_lengths[i], window_size,
-                                                   poa_parameters);
+                                                   poa_parameters, timings);
         column_scores[i] = make_column_scores(msas[i]);
     }
 
     // Make the msas consistent with one another
+    double trimming_start_time = timings != NULL ? barTimings_getTime() : 0.0;
     for(int64_t i=0; i<end_no; i++) { // For each end
         Msa *msa = msas[i];
         for(int64_t j=0; j<msa->seq_no; j++) { //  For each string incident to the ith end
@@ -722,6 +753,9 @@ Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_leng
     for(int64_t i=0; i<end_no; i++) {
         free(column_scores[i]);
     }
+    if (timings != NULL) {
+        timings->trimming += barTimings_getTime() - trimming_start_time;
+    }
 
     return msas;
 }
@@ -760,79 +794,6 @@ char *get_adjacency_string(Cap *cap, int *length, bool return_string) {
     }
 }
 
-/**
- * Used to find where a run of masked (hard or soft) of at least mask_filter bases starts
- * @param seq : The string
- * @param seq_length : The length of the string
- * @param length : The maximum length we want to search in
- * @param reversed : If true, scan from the end of the string
- * @param mask_filter : Cut a string as soon as we hit more than this many hard or softmasked bases (cut is before first masked base)
- * @return length of the filtered string
- */
-static int get_unmasked_length(char* seq, int64_t seq_length, int64_t length, bool reversed, int64_t mask_filter) {
-    if (mask_filter >= 0) {
-        int64_t run_start = -1;
-        for (int64_t i = 0; i < length; ++i) {
-            char base = reversed ? seq[seq_length - 1 - i] : seq[i];
-            if (islower(base) || base == 'N') {
-                if (run_start == -1) {
-                    // start masked run
-                    run_start = i;
-                }
-                if (i + 1 - run_start > mask_filter) {
-                    // our run exceeds the mask_filter, cap before the first masked base
-                    return (int)run_start;
-                }
-            } else {
-                run_start = -1;
-            }
-        }
-    }
-    return (int)length;
-}
-
-/**
- * Used to get a prefix of a given adjacency sequence.
- * @param seq_length
- * @param length
- * @param overlap
- * @param max_seq_length
- * @return
- */
-char *get_adjacency_string_and_overlap(Cap *cap, int *length, int64_t *overlap, int64_t max_seq_length, int64_t mask_filter) {
-    // Get the complete adjacency string
-    int seq_length;
-    char *adjacency_string = get_adjacency_string(cap, &seq_length, 1);
-    assert(seq_length >= 0);
-
-    // Calculate the length of the prefix up to max_seq_length
-    *length = seq_length > max_seq_length ? max_seq_length : seq_length;
-    assert(*length >= 0);
-    int length_backward = *length;
-
-    if (mask_filter >= 0) {
-        // apply the mask filter on the forward strand
-        *length = get_unmasked_length(adjacency_string, seq_length, *length, false, mask_filter);
-        length_backward = get_unmasked_length(adjacency_string, seq_length, *length, true, mask_filter);
-    }
-
-    // Cleanup the string
-    adjacency_string[*length] = '\0'; // Terminate the string at the given length
-    char *c = stString_copy(adjacency_string);
-    free(adjacency_string);
-    adjacency_string = c;
-
-    // Calculate the overlap with the reverse complement
-    if (*length + length_backward > seq_length) { // There is overlap
-        *overlap = *length + length_backward - seq_length;
-        assert(*overlap >= 0);
-    } else { // There is no overlap
-        *overlap = 0;
-    }
-
-    return adjacency_string;
-}
-
 /**
  * Gets the length and sequences present in the next maximal gapless alignment block.
  * @param msa The msa to scan
@@ -977,7 +938,7 @@ void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignm
 }
 
 void get_end_sequences(End *end, char **end_strings, int *end_string_lengths, int64_t *overlaps,
-                       Cap **indices_to_caps, int64_t max_seq_length, int64_t mask_filter) {
+                       Cap **indices_to_caps, AdjacencyCache *adjacency_cache) {
     // Make inputs
     Cap *cap;
     End_InstanceIterator *capIterator = end_getInstanceIterator(end);
@@ -987,9 +948,11 @@ void get_end_sequences(End *end, char **end_strings, int *end_string_lengths, in
         if (cap_getSide(cap)) {
             cap = cap_getReverse(cap);
         }
-        // Get the prefix of the adjacency string and its length and overlap with its reverse complement
-        end_strings[j] = get_adjacency_string_and_overlap(cap, &(end_string_lengths[j]),
-                                                          &(overlaps[j]), max_seq_length, mask_filter);
+        // Get the prefix of the adjacency string and its length and overlap with its reverse complement,
+        // each adjacency is only extracted once, by whichever of its ends is visited first
+        int64_t length;
+        end_strings[j] = adjacencyCache_getString(adjacency_cache, cap, &length, &(overlaps[j]));
+        end_string_lengths[j] = (int)length;
 
         // Populate the caps to end/row indices, and vice versa, data structures
         indices_to_caps[j] = cap;
@@ -1018,7 +981,8 @@ int64_t getMaxSequenceLength(End *end) {
 }
 
 stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_t window_size, int64_t mask_filter,
-                                  abpoa_para_t * poa_parameters) {
+                                  abpoa_para_t * poa_parameters, BarTimings *timings) {
+    double start_time = timings != NULL ? barTimings_getTime() : 0.0;
     End *dominantEnd = getDominantEnd(flower);
     int64_t seq_no = dominantEnd != NULL ? end_getInstanceNumber(dominantEnd) : -1;
     if(dominantEnd != NULL && getMaxSequenceLength(dominantEnd) < max_seq_length) {
@@ -1033,15 +997,25 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
         int64_t overlaps[seq_no];
         Cap *indices_to_caps[seq_no];
 
-        get_end_sequences(dominantEnd, end_strings, end_string_lengths, overlaps, indices_to_caps, max_seq_length, mask_filter);
-        Msa *msa = msa_make_partial_order_alignment(end_strings, end_string_lengths, seq_no, window_size, poa_parameters);
+        AdjacencyCache *adjacency_cache = adjacencyCache_construct(max_seq_length, mask_filter);
+        get_end_sequences(dominantEnd, end_strings, end_string_lengths, overlaps, indices_to_caps, adjacency_cache);
+        adjacencyCache_destruct(adjacency_cache);
+        if (timings != NULL) {
+            timings->sequenceExtraction += barTimings_getTime() - start_time;
+        }
+        Msa *msa = msa_make_partial_order_alignment(end_strings, end_string_lengths, seq_no, window_size, poa_parameters,
+                                                    timings);
 
         //Now convert to set of alignment blocks
+        start_time = timings != NULL ? barTimings_getTime() : 0.0;
         stList *alignment_blocks = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
         create_alignment_blocks(msa, indices_to_caps, alignment_blocks);
 
         // Cleanup
         msa_destruct(msa);
+        if (timings != NULL) {
+            timings->blockCreation += barTimings_getTime() - start_time;
+        }
 
         return alignment_blocks;
     }
@@ -1060,6 +1034,7 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
     stHash *caps_to_indices = stHash_construct2(NULL, free); // A hash of caps to their end and row indices
 
     // Fill out the end information for building the POA alignments arrays
+    AdjacencyCache *adjacency_cache = adjacencyCache_construct(max_seq_length, mask_filter);
     End *end;
     Flower_EndIterator *endIterator = flower_getEndIterator(flower);
     int64_t i=0; // Index of the end
@@ -1073,13 +1048,14 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
         indices_to_caps[i] = st_malloc(sizeof(Cap *)*end_lengths[i]);
         overlaps[i] = st_malloc(sizeof(int64_t)*end_lengths[i]);
         get_end_sequences(end, end_strings[i], end_string_lengths[i], overlaps[i], indices_to_caps[i],
-                          max_seq_length, mask_filter);
+                          adjacency_cache);
         for(int64_t j=0; j<end_lengths[i]; j++) {
             stHash_insert(caps_to_indices, indices_to_caps[i][j], stIntTuple_construct2(i, j));
         }
         i++;
     }
     flower_destructEndIterator(endIterator);
+    adjacencyCache_destruct(adjacency_cache);
 
     // Fill out the end / row indices for each cap
     endIterator = flower_getEndIterator(flower);
@@ -1109,11 +1085,14 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
         i++;
     }
     flower_destructEndIterator(endIterator);
+    if (timings != NULL) {
+        timings->sequenceExtraction += barTimings_getTime() - start_time;
+    }
 
     // Now make the consistent MSAs
     Msa **msas = make_consistent_partial_order_alignments(end_no, end_lengths, end_strings, end_string_lengths,
                                                           right_end_indexes, right_end_row_indexes, overlaps, window_size,
-                                                          poa_parameters);
+                                                          poa_parameters, timings);
 
     // Temp debug output
     //for(int64_t i=0; i<end_no; i++) {
@@ -1121,6 +1100,7 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
     //}
 
     //Now convert to set of alignment blocks
+    start_time = timings != NULL ? barTimings_getTime() : 0.0;
     stList *alignment_blocks = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
     for(int64_t i=0; i<end_no; i++) {
         create_alignment_blocks(msas[i], indices_to_caps[i], alignment_blocks);
@@ -1136,6 +1116,9 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
     }
     free(msas);
     stHash_destruct(caps_to_indices);
+    if (timings != NULL) {
+        timings->blockCreation += barTimings_getTime() - start_time;
+    }
 
     // Temp debug output
     //for(int64_t i=0; i<stList_length(alignment_blocks); i++) {
@@ -5,14 +5,7 @@
 #include "cactus.h"
 #include "sonLib.h"
 #include "stPinchGraphs.h"
-
-typedef struct {
-    Name name; // sequence Name, since the cap Name typically used
-               // isn't easily accessible from flowers further down in
-               // the hierarchy.
-    int64_t start; // 0-based start, inclusive.
-    int64_t stop; // 0-based end, exclusive.
-} bedRegion;
+#include "rescue.h"
 
 // Compare two bed regions in their little-endian format as mapped
 // from the file. Returns 0 for any overlap.
@@ -39,5 +39,39 @@ AdjacencySequence *adjacencySequence_construct(Cap *cap, int64_t maxLength);
  */
 void adjacencySequence_destruct(AdjacencySequence *subSequence);
 
+/*
+ * Fills out the coordinates and length of the adjacency sequence for the cap (as adjacencySequence_construct),
+ * without extracting the string, which is set to NULL.
+ */
+void adjacencySequence_fillOutCoordinates(Cap *cap, int64_t maxLength, AdjacencySequence *adjacencySequence);
+
+/*
+ * A per-flower cache of adjacency strings. Each adjacency is extracted from the sequence store at most once,
+ * whichever of its two caps it is requested from, and only its first and last maxLength bases are kept.
+ * The cache is not thread safe, it is intended to be used by the thread aligning the flower.
+ */
+typedef struct _AdjacencyCache AdjacencyCache;
+
+/*
+ * Creates an empty cache for the given maximum string length. If maskFilter >= 0 strings
+ * are cut before the first run of more than maskFilter masked (lower case or N) bases.
+ */
+AdjacencyCache *adjacencyCache_construct(int64_t maxLength, int64_t maskFilter);
+
+void adjacencyCache_destruct(AdjacencyCache *adjacencyCache);
+
+/*
+ * Returns a copy of the prefix of the adjacency string incident with the cap (which must be on its 5' side), read in
+ * the orientation of the cap. The prefix is at most maxLength long and is cut by the mask filter. Sets length to the length
+ * of the returned prefix, and overlap to the number of bases it overlaps the (mask filtered) prefix of the reverse
+ * complement adjacency string.
+ */
+char *adjacencyCache_getString(AdjacencyCache *adjacencyCache, Cap *cap, int64_t *length, int64_t *overlap);
+
+/*
+ * As adjacencySequence_construct, but with the string taken from the cache, using the cache's maxLength.
+ */
+AdjacencySequence *adjacencySequence_construct2(Cap *cap, AdjacencyCache *adjacencyCache);
+
 
 #endif /* ADJACENCYSEQUENCES_H_ */
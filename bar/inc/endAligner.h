@@ -17,49 +17,111 @@
 #include "sonLib.h"
 #include "cactus.h"
 #include "pairwiseAligner.h"
+#include "stPinchIterator.h"
+#include "adjacencySequences.h"
 
-typedef struct _AlignedPair {
-    int64_t subsequenceIdentifier;
-    int64_t position;
-    bool strand;
-    int64_t score;
-    struct _AlignedPair *reverse;
-} AlignedPair;
+/*
+ * An end alignment: a sorted set of aligned pairs, packed as a struct of arrays.
+ *
+ * Each aligned pair is stored as two entries, one for each of its sides, and reverse[i]
+ * gives the index of the other side of entry i. Entries are ordered by subsequence identifier,
+ * position and strand (ties broken by the same key of the reverse entry), so the pairs
+ * aligned to any interval of a subsequence are contiguous and found by binary search.
+ *
+ * Pairs are added with endAlignment_add and the set is then ordered with endAlignment_sort.
+ * Removing a pair just marks both of its entries as deleted.
+ */
+typedef struct _EndAlignment {
+    int64_t length; // Number of entries, two per aligned pair, including deleted entries.
+    int64_t maxLength;
+    int64_t deletedNumber;
+    int64_t *subsequenceIdentifiers;
+    int64_t *positions;
+    int64_t *scores;
+    int64_t *reverse;
+    bool *strands;
+    bool *deleted;
+} EndAlignment;
+
+/*
+ * Constructs an empty end alignment, with room for the given number of aligned pairs.
+ */
+EndAlignment *endAlignment_construct(int64_t initialPairNumber);
 
 /*
- * Constructs the an aligned pair.
+ * Destruct the end alignment.
  */
-AlignedPair *alignedPair_construct(int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+void endAlignment_destruct(EndAlignment *endAlignment);
+
+/*
+ * Appends an aligned pair. The end alignment must be sorted using endAlignment_sort
+ * before it is queried.
+ */
+void endAlignment_add(EndAlignment *endAlignment, int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
         int64_t subsequenceIdentifier2, int64_t position2, bool strand2, int64_t score1, int64_t score2);
 
 /*
- * Destruct the aligned pair.
+ * Sorts the entries of the end alignment, discarding any deleted pairs.
+ */
+void endAlignment_sort(EndAlignment *endAlignment);
+
+/*
+ * Number of aligned pairs in the end alignment, excluding deleted pairs.
+ */
+int64_t endAlignment_size(EndAlignment *endAlignment);
+
+/*
+ * Removes the aligned pair with the entry i (and so also the entry reverse[i]).
+ */
+void endAlignment_remove(EndAlignment *endAlignment, int64_t i);
+
+/*
+ * Compares two entries of the end alignment.
+ */
+int endAlignment_cmp(EndAlignment *endAlignment, int64_t i, int64_t j);
+
+/*
+ * Returns the index of the first entry whose subsequence identifier, position and strand are
+ * greater than or equal to those given, or endAlignment->length if there is none.
+ * The end alignment must be sorted.
+ */
+int64_t endAlignment_lowerBound(EndAlignment *endAlignment, int64_t subsequenceIdentifier, int64_t position, bool strand);
+
+/*
+ * Returns non-zero iff the two sorted end alignments contain the same (non-deleted) aligned pairs, with the same scores.
+ */
+bool endAlignment_equals(EndAlignment *endAlignment1, EndAlignment *endAlignment2);
+
+/*
+ * Appends the (non-deleted) aligned pairs of source to target. The target must be sorted afterwards.
  */
-void alignedPair_destruct(AlignedPair *alignedPair);
+void endAlignment_appendAll(EndAlignment *target, EndAlignment *source);
 
 /*
- * Compares two aligned pairs.
+ * Constructs a pinch iterator that returns one single base pinch per (non-deleted) aligned pair.
+ * Does not cleanup or modify the end alignment.
  */
-int alignedPair_cmpFn(const AlignedPair *alignedPair1, const AlignedPair *alignedPair2);
+stPinchIterator *stPinchIterator_constructFromEndAlignment(EndAlignment *endAlignment);
 
 /*
  * Creates a global alignment (as a set of aligned pairs) of the sequences from the end,
- * the pairs returned are ordered according
- * to the alignerPair comparison function.
+ * the returned end alignment is sorted. If adjacencyCache is not NULL the adjacency strings are taken from it, in which
+ * case it must have been constructed with maxSequenceLength and no mask filter.
  */
-stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
-                              bool useProgressiveMerging, float gapGamma,
-                              PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters);
+EndAlignment *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+                               bool useProgressiveMerging, float gapGamma,
+                               PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters,
+                               AdjacencyCache *adjacencyCache);
 
 /*
  * Writes an end alignment to the given file.
  */
-void writeEndAlignmentToDisk(End *end, stSortedSet *endAlignment, FILE *fileHandle);
+void writeEndAlignmentToDisk(End *end, EndAlignment *endAlignment, FILE *fileHandle);
 
 /*
  * Loads an end alignment from the given file.
  */
-stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end);
+EndAlignment *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end);
 
 
 #endif /* ENDALIGNER_H_ */
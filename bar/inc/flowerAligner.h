@@ -15,6 +15,24 @@
 #define FLOWER_ALIGNER_H_
 
 #include "pairwiseAligner.h"
+#include "endAligner.h"
+#include "adjacencySequences.h"
+
+/*
+ * The entries of an end alignment that are aligned to an adjacency sequence, ordered along the adjacency sequence.
+ */
+typedef struct _InducedAlignment {
+    EndAlignment *endAlignment;
+    int64_t *entries; // Indices into endAlignment
+    int64_t length;
+} InducedAlignment;
+
+/*
+ * Gets the induced alignment of the adjacency sequence from the (sorted) end alignment.
+ */
+InducedAlignment *getInducedAlignment(EndAlignment *endAlignment, AdjacencySequence *adjacencySequence);
+
+void inducedAlignment_destruct(InducedAlignment *inducedAlignment);
 
 /*
  * Constructs an alignment for the flower by constructing an alignment for each end
@@ -23,14 +41,23 @@
  * to construct the alignment, maxSequenceLength is the maximum length of a sequence to consider in the end alignment.
  * Model parameters is the parameters of the pairwise alignment model.
  */
-stSortedSet *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees,
+EndAlignment *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
         PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments);
 
 /*
  * As above, but including alignments from disk.
  */
-stSortedSet *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
+EndAlignment *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
+        int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments);
+
+/*
+ * As above, but starting from a hash of ends to already computed end alignments (for example, those
+ * computed in parallel for a large flower). The hash must destruct its values with endAlignment_destruct
+ * and is consumed.
+ */
+EndAlignment *makeFlowerAlignment4(StateMachine *sM, Flower *flower, stHash *endAlignments, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
         PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments);
 
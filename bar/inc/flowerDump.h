@@ -0,0 +1,25 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef FLOWER_DUMP_H_
+#define FLOWER_DUMP_H_
+
+#include "sonLib.h"
+#include "cactus.h"
+
+/*
+ * Writes the ends, caps and adjacency sequences of a flower that has yet to be aligned by bar
+ * to the file, so that bar can be rerun on the flower offline (see loadFlowerFromDisk).
+ * Only the sequence that is in the flower is written: the parts of each sequence
+ * between caps that are not adjacent in the flower are removed, and the cap coordinates shifted to match.
+ */
+void writeFlowerToDisk(Flower *flower, FILE *fileHandle);
+
+/*
+ * Reads a flower written by writeFlowerToDisk into the cactus disk, adding an event to the cactus disk's
+ * event tree for each of the flower's events. Returns NULL if the file is at its end.
+ */
+Flower *loadFlowerFromDisk(CactusDisk *cactusDisk, FILE *fileHandle);
+
+#endif
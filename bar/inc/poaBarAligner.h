@@ -11,6 +11,7 @@
 #include "cactus.h"
 #include "stPinchIterator.h"
 #include "pairwiseAligner.h"
+#include "stateMachine.h"
 #include "abpoa.h"
 #include "flowerAligner.h"
 
@@ -19,6 +20,78 @@
  */
 void bar(stList *flowers, CactusParams *p, CactusDisk *cactusDisk, stList *listOfEndAlignmentFiles);
 
+/*
+ * The parameters used by bar, parsed once from the cactus params.
+ */
+typedef struct _BarParams {
+    int64_t maximumLength; // Banding limit
+    bool usePoa;
+    // Pecan params
+    int64_t spanningTrees;
+    bool useProgressiveMerging;
+    float matchGamma;
+    bool pruneOutStubAlignments;
+    PairwiseAlignmentParameters *pairwiseAlignmentParameters;
+    StateMachine *sM;
+    // Poa params
+    int64_t poaWindow;
+    int64_t maskFilter;
+    abpoa_para_t *poaParameters; // NULL if not using poa
+    // Block filtering params
+    int64_t minimumIngroupDegree;
+    int64_t minimumOutgroupDegree;
+    int64_t minimumDegree;
+    int64_t minimumNumberOfSpecies;
+} BarParams;
+
+BarParams *barParams_construct(CactusParams *params);
+
+void barParams_destruct(BarParams *barParams);
+
+/*
+ * Estimates the relative cost of running bar on the flower, from the number of adjacencies, the total
+ * length of the adjacencies (each capped at maximumLength, the banding limit) and the maximum degree of an end.
+ * Used to schedule the most expensive flowers first.
+ */
+double estimateFlowerBarCost(Flower *flower, int64_t maximumLength);
+
+/*
+ * Wall clock seconds spent in each phase of bar, accumulated by the functions that are passed one.
+ * Pecan alignment, which interleaves the phases, is counted entirely as alignment.
+ */
+typedef struct _BarTimings {
+    double sequenceExtraction; // Getting the adjacency strings
+    double alignment; // Running poa (or pecan) on the strings
+    double trimming; // Making overlapping alignments consistent
+    double blockCreation; // Converting the msas to alignment blocks
+    double annealing; // Pinching the alignments into the pinch graph
+    double melting; // Filtering blocks from the pinch graph
+    double cactusConstruction; // Building the pinch graph and converting it back into flowers
+} BarTimings;
+
+/*
+ * Current wall clock time, in seconds.
+ */
+double barTimings_getTime(void);
+
+/*
+ * Adds the times in timings2 to timings1.
+ */
+void barTimings_add(BarTimings *timings1, BarTimings *timings2);
+
+/*
+ * Total of the phase times.
+ */
+double barTimings_total(BarTimings *timings);
+
+/*
+ * Runs bar on a single flower, filling in its blocks. Precomputed end alignments, as in makeFlowerAlignment4,
+ * may be given in endAlignments (which is consumed), or read from listOfEndAlignmentFiles, otherwise both should be NULL.
+ * If timings is not NULL the time spent in each phase is added to it.
+ */
+void barFlower(Flower *flower, BarParams *barParams, stHash *endAlignments, stList *listOfEndAlignmentFiles,
+               BarTimings *timings);
+
 /*
  * Construct a pairwise alignment parameters object parsing the cactus params specified parameters.
  */
@@ -68,13 +141,15 @@ void msa_print(Msa *msa, FILE *f);
  * @param seq_no The number of strings
  * @param window_size Sliding window size which limits length of poa sub-alignments.  Memory usage is quardatic in this. 
  * @param poa_parameters abpoa parameters
+ * @param timings If not NULL, the alignment and trimming times are added to it
  * @return An msa of the strings.
  */
 Msa *msa_make_partial_order_alignment(char **seqs,
                                       int *seq_lens,
                                       int64_t seq_no,
                                       int64_t window_size,
-                                      abpoa_para_t *poa_parameters);
+                                      abpoa_para_t *poa_parameters,
+                                      BarTimings *timings);
 
 /**
  * Takes a set of ends and returns a set of consistent multiple alignments,
@@ -96,11 +171,12 @@ Msa *msa_make_partial_order_alignment(char **seqs,
  * @param overlaps For each prefix string, the length of the overlap with its reverse complement adjacency
  * @param window_size Sliding window size which limits length of poa sub-alignments.  Memory usage is quardatic in this. 
  * @param poa_parameters abpoa parameters
+ * @param timings If not NULL, the alignment and trimming times are added to it
  * @return A consistent Msa for each end
  */
 Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_lengths, char ***end_strings,
         int **end_string_lengths, int64_t **right_end_indexes, int64_t **right_end_row_indexes, int64_t **overlaps,
-        int64_t window_size, abpoa_para_t *poa_parameters);
+        int64_t window_size, abpoa_para_t *poa_parameters, BarTimings *timings);
 
 /**
  * Represents a gapless alignment of a set of sequences.
@@ -137,13 +213,15 @@ char *get_adjacency_string(Cap *cap, int *length, bool return_string);
  * @param mask_filter Trim input sequences if encountering this many consecutive soft of hard masked bases (0 = disabled)
  * @param poa_band_constant abpoa "b" parameter, where adaptive band is b+f*<length> (b < 0 = disabled)
  * @param poa_band_fraction abpoa "f" parameter, where adaptive band is b+f*<length> (b < 0 = disabled)
+ * @param timings If not NULL, the time spent in each phase is added to it
  * Returns a list of AlignmentBlock ojects
  */
 stList *make_flower_alignment_poa(Flower *flower,
                                   int64_t max_seq_length,
                                   int64_t window_size,
                                   int64_t mask_filter,
-                                  abpoa_para_t * poa_parameters);
+                                  abpoa_para_t * poa_parameters,
+                                  BarTimings *timings);
 
 /**
  * Create a pinch iterator for a list of alignment blocks.
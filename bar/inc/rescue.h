@@ -3,9 +3,11 @@
 #include "stPinchGraphs.h"
 
 typedef struct {
-    Name name;
-    int64_t start;
-    int64_t stop;
+    Name name; // sequence Name, since the cap Name typically used
+               // isn't easily accessible from flowers further down in
+               // the hierarchy.
+    int64_t start; // 0-based start, inclusive.
+    int64_t stop; // 0-based end, exclusive.
 } bedRegion;
 
 bedRegion *bedRegion_construct(Name name, int64_t start, int64_t stop);
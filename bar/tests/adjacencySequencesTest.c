@@ -91,6 +91,77 @@ static void testAdjacencySequence_7(CuTest *testCase) {
    teardown(testCase);
 }
 
+static void testAdjacencyCache(CuTest *testCase) {
+    setup(testCase);
+    int64_t maxLengths[4] = { 0, 2, 3, INT64_MAX };
+    for (int64_t i = 0; i < 4; i++) {
+        AdjacencyCache *adjacencyCache = adjacencyCache_construct(maxLengths[i], 0);
+        Flower_CapIterator *capIt = flower_getCapIterator(flower);
+        Cap *cap;
+        while ((cap = flower_getNextCap(capIt)) != NULL) {
+            if (cap_getSide(cap)) {
+                cap = cap_getReverse(cap);
+            }
+            //Should be the same as the uncached sequence, whichever end is visited first
+            AdjacencySequence *adjacencySequence = adjacencySequence_construct(cap, maxLengths[i]);
+            AdjacencySequence *adjacencySequence2 = adjacencySequence_construct2(cap, adjacencyCache);
+            CuAssertTrue(testCase, adjacencySequence->subsequenceIdentifier == adjacencySequence2->subsequenceIdentifier);
+            CuAssertIntEquals(testCase, adjacencySequence->start, adjacencySequence2->start);
+            CuAssertIntEquals(testCase, adjacencySequence->strand, adjacencySequence2->strand);
+            CuAssertIntEquals(testCase, adjacencySequence->length, adjacencySequence2->length);
+            CuAssertStrEquals(testCase, adjacencySequence->string, adjacencySequence2->string);
+
+            //There are no masked bases, so the overlap is just that of the two prefixes
+            int64_t length, overlap;
+            char *string = adjacencyCache_getString(adjacencyCache, cap, &length, &overlap);
+            CuAssertStrEquals(testCase, adjacencySequence->string, string);
+            int64_t adjacencyLength = llabs(cap_getCoordinate(cap_getAdjacency(cap)) - cap_getCoordinate(cap)) - 1;
+            CuAssertIntEquals(testCase, 2 * length > adjacencyLength ? 2 * length - adjacencyLength : 0, overlap);
+
+            free(string);
+            adjacencySequence_destruct(adjacencySequence);
+            adjacencySequence_destruct(adjacencySequence2);
+        }
+        flower_destructCapIterator(capIt);
+        adjacencyCache_destruct(adjacencyCache);
+    }
+    teardown(testCase);
+}
+
+static void testAdjacencyCache_maskFilter(CuTest *testCase) {
+    setup(testCase);
+    Sequence *sequence = sequence_construct(1, 12, "ACnnnGTnnnnA", ">masked", leafEvent, cactusDisk);
+    flower_addSequence(flower, sequence);
+    Cap *leftCap = cap_construct2(end1, 0, 1, sequence);
+    Cap *rightCap = cap_construct2(end2, 13, 1, sequence);
+    cap_makeAdjacent(leftCap, rightCap);
+
+    AdjacencyCache *adjacencyCache = adjacencyCache_construct(INT64_MAX, 3);
+    int64_t length, overlap;
+    //Forward, the first run of 3 masked bases is allowed, the run of 4 is cut
+    char *string = adjacencyCache_getString(adjacencyCache, leftCap, &length, &overlap);
+    CuAssertStrEquals(testCase, "ACnnnGT", string);
+    CuAssertIntEquals(testCase, 7, length);
+    CuAssertIntEquals(testCase, 0, overlap);
+    free(string);
+    //Reverse complement, the run of 4 is cut immediately after the first base
+    string = adjacencyCache_getString(adjacencyCache, cap_getReverse(rightCap), &length, &overlap);
+    CuAssertStrEquals(testCase, "T", string);
+    CuAssertIntEquals(testCase, 1, length);
+    CuAssertIntEquals(testCase, 0, overlap);
+    free(string);
+    adjacencyCache_destruct(adjacencyCache);
+
+    //Without a mask filter the strings overlap completely
+    adjacencyCache = adjacencyCache_construct(INT64_MAX, -1);
+    string = adjacencyCache_getString(adjacencyCache, cap_getReverse(rightCap), &length, &overlap);
+    CuAssertStrEquals(testCase, "TnnnnACnnnGT", string);
+    CuAssertIntEquals(testCase, 12, overlap);
+    free(string);
+    adjacencyCache_destruct(adjacencyCache);
+    teardown(testCase);
+}
+
 CuSuite* adjacencySequenceTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testAdjacencySequence_1);
@@ -100,5 +171,7 @@ CuSuite* adjacencySequenceTestSuite(void) {
     SUITE_ADD_TEST(suite, testAdjacencySequence_5);
     SUITE_ADD_TEST(suite, testAdjacencySequence_6);
     SUITE_ADD_TEST(suite, testAdjacencySequence_7);
+    SUITE_ADD_TEST(suite, testAdjacencyCache);
+    SUITE_ADD_TEST(suite, testAdjacencyCache_maskFilter);
     return suite;
 }
@@ -15,6 +15,7 @@ CuSuite* endAlignerTestSuite(void);
 CuSuite* flowerAlignerTestSuite(void);
 CuSuite* rescueTestSuite(void);
 CuSuite* poaBarAlignerTestSuite(void);
+CuSuite* flowerDumpTestSuite(void);
 
 int stBaseAlignerRunAllTests(void) {
 	CuString *output = CuStringNew();
@@ -24,6 +25,7 @@ int stBaseAlignerRunAllTests(void) {
 	CuSuiteAddSuite(suite, flowerAlignerTestSuite());
     CuSuiteAddSuite(suite, rescueTestSuite());
     CuSuiteAddSuite(suite, poaBarAlignerTestSuite());
+    CuSuiteAddSuite(suite, flowerDumpTestSuite());
     CuSuiteRun(suite);
 	CuSuiteSummary(suite, output);
 	CuSuiteDetails(suite, output);
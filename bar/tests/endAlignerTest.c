@@ -9,57 +9,88 @@
 #include "adjacencySequences.h"
 #include "pairwiseAligner.h"
 
-void test_alignedPair_cmpFn(CuTest *testCase) {
-    stList *list = stList_construct3(0, (void (*)(void *))alignedPair_destruct);
-
-    //(int (*)(const void *, const void *))alignedPair_cmpFn,
-
+void test_endAlignment_sort(CuTest *testCase) {
     Name seq1 = 5;
     Name seq2 = 10;
 
-    AlignedPair *aP1 = alignedPair_construct(seq1, 2, 1,
-                        seq1, 7, 1, 90, 90);
-    AlignedPair *aP2 = alignedPair_construct(seq1, 2, 1,
-            seq2, 4, 0, 10, 10);
-    AlignedPair *aP3 = alignedPair_construct(seq1, 2, 1,
-                seq2, 4, 1, 75, 72);
-    AlignedPair *aP4 = alignedPair_construct(seq1, 3, 1,
-                        seq2, 4, 0, 10, 1);
-    AlignedPair *aP5 = alignedPair_construct(seq1, 4, 1,
-                            seq2, 4, 1, 90, 100);
-
-    AlignedPair *ordering[5] = { aP2, aP1, aP4, aP5, aP3 };
+    //The pairs, in the order they are added.
+    int64_t pairs[5][8] = { { seq1, 2, 1, seq2, 4, 0, 10, 10 }, //aP2
+                            { seq1, 2, 1, seq1, 7, 1, 90, 90 }, //aP1
+                            { seq1, 3, 1, seq2, 4, 0, 10, 1 }, //aP4
+                            { seq1, 4, 1, seq2, 4, 1, 90, 100 }, //aP5
+                            { seq1, 2, 1, seq2, 4, 1, 75, 72 } }; //aP3
+    EndAlignment *endAlignment = endAlignment_construct(1); //Small, to check it grows
     for(int64_t i=0; i<5; i++) {
-        AlignedPair *aP = ordering[i];
-        st_logInfo("I got %" PRIi64 " %" PRIi64 "\n", aP, aP->reverse);
-        stList_append(list, aP);
-        stList_append(list, aP->reverse);
+        int64_t *p = pairs[i];
+        endAlignment_add(endAlignment, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
     }
-
-    stList_sort(list, (int (*)(const void *, const void *))alignedPair_cmpFn);
-
-    AlignedPair *correctOrdering[10] = { aP1, aP2, aP3, aP4, aP5, aP1->reverse, aP2->reverse, aP4->reverse, aP3->reverse, aP5->reverse };
+    endAlignment_sort(endAlignment);
+    CuAssertIntEquals(testCase, 10, endAlignment->length);
+    CuAssertIntEquals(testCase, 5, endAlignment_size(endAlignment));
+
+    //Entries are (subsequence, position, strand, score), followed by the same for the reverse.
+    int64_t correctOrdering[10][8] = { { seq1, 2, 1, 90, seq1, 7, 1, 90 }, //aP1
+                                       { seq1, 2, 1, 10, seq2, 4, 0, 10 }, //aP2
+                                       { seq1, 2, 1, 75, seq2, 4, 1, 72 }, //aP3
+                                       { seq1, 3, 1, 10, seq2, 4, 0, 1 }, //aP4
+                                       { seq1, 4, 1, 90, seq2, 4, 1, 100 }, //aP5
+                                       { seq1, 7, 1, 90, seq1, 2, 1, 90 }, //aP1->reverse
+                                       { seq2, 4, 0, 10, seq1, 2, 1, 10 }, //aP2->reverse
+                                       { seq2, 4, 0, 1, seq1, 3, 1, 10 }, //aP4->reverse
+                                       { seq2, 4, 1, 72, seq1, 2, 1, 75 }, //aP3->reverse
+                                       { seq2, 4, 1, 100, seq1, 4, 1, 90 } }; //aP5->reverse
     for(int64_t i=0; i<10; i++) {
-        st_logInfo("Checking %" PRIi64 " %" PRIi64 "\n", correctOrdering[i], stList_get(list, i));
-        CuAssertTrue(testCase, correctOrdering[i] == stList_get(list, i));
+        int64_t *e = correctOrdering[i];
+        int64_t j = endAlignment->reverse[i];
+        CuAssertIntEquals(testCase, i, endAlignment->reverse[j]);
+        CuAssertIntEquals(testCase, e[0], endAlignment->subsequenceIdentifiers[i]);
+        CuAssertIntEquals(testCase, e[1], endAlignment->positions[i]);
+        CuAssertIntEquals(testCase, e[2], endAlignment->strands[i]);
+        CuAssertIntEquals(testCase, e[3], endAlignment->scores[i]);
+        CuAssertIntEquals(testCase, e[4], endAlignment->subsequenceIdentifiers[j]);
+        CuAssertIntEquals(testCase, e[5], endAlignment->positions[j]);
+        CuAssertIntEquals(testCase, e[6], endAlignment->strands[j]);
+        CuAssertIntEquals(testCase, e[7], endAlignment->scores[j]);
+        if(i > 0) {
+            CuAssertTrue(testCase, endAlignment_cmp(endAlignment, i-1, i) < 0);
+        }
     }
 
+    //Range queries
+    CuAssertIntEquals(testCase, 0, endAlignment_lowerBound(endAlignment, seq1, 2, 0));
+    CuAssertIntEquals(testCase, 3, endAlignment_lowerBound(endAlignment, seq1, 3, 0));
+    CuAssertIntEquals(testCase, 5, endAlignment_lowerBound(endAlignment, seq1, 5, 1));
+    CuAssertIntEquals(testCase, 8, endAlignment_lowerBound(endAlignment, seq2, 4, 1));
+    CuAssertIntEquals(testCase, 10, endAlignment_lowerBound(endAlignment, seq2, 5, 0));
+
+    //Removal, then resorting, drops both sides of a pair
+    endAlignment_remove(endAlignment, 6); //aP2->reverse
+    CuAssertTrue(testCase, endAlignment->deleted[1]);
+    CuAssertIntEquals(testCase, 4, endAlignment_size(endAlignment));
+    endAlignment_sort(endAlignment);
+    CuAssertIntEquals(testCase, 8, endAlignment->length);
+    CuAssertIntEquals(testCase, 75, endAlignment->scores[1]);
+    for(int64_t i=0; i<endAlignment->length; i++) {
+        CuAssertTrue(testCase, !endAlignment->deleted[i]);
+        CuAssertIntEquals(testCase, i, endAlignment->reverse[endAlignment->reverse[i]]);
+    }
 
-    stList_destruct(list);
+    endAlignment_destruct(endAlignment);
 }
 
-int64_t isInAdjacencySequence(AlignedPair *alignedPair, AdjacencySequence *adjacencySequence) {
-    if (alignedPair->subsequenceIdentifier == adjacencySequence->subsequenceIdentifier) {
-        if (alignedPair->strand == adjacencySequence->strand) {
-            if (alignedPair->strand) {
-                if (alignedPair->position >= adjacencySequence->start
-                        && alignedPair->position < adjacencySequence->start
+int64_t isInAdjacencySequence(EndAlignment *endAlignment, int64_t i, AdjacencySequence *adjacencySequence) {
+    if (endAlignment->subsequenceIdentifiers[i] == adjacencySequence->subsequenceIdentifier) {
+        if (endAlignment->strands[i] == adjacencySequence->strand) {
+            int64_t position = endAlignment->positions[i];
+            if (endAlignment->strands[i]) {
+                if (position >= adjacencySequence->start
+                        && position < adjacencySequence->start
                                 + adjacencySequence->length) {
                     return 1;
                 }
             } else {
-                if (alignedPair->position <= adjacencySequence->start
-                        && alignedPair->position > adjacencySequence->start
+                if (position <= adjacencySequence->start
+                        && position > adjacencySequence->start
                                 - adjacencySequence->length) {
                     return 1;
                 }
@@ -73,7 +104,7 @@ int64_t isInAdjacencySequence(AlignedPair *alignedPair, AdjacencySequence *adjac
 /*
  * Checks that the position referred to is in an adjacency coming from the end.
  */
-int64_t isInAdjacency(AlignedPair *alignedPair, End *end, int64_t maxLength) {
+int64_t isInAdjacency(EndAlignment *endAlignment, int64_t i, End *end, int64_t maxLength) {
     Cap *cap;
     End_InstanceIterator *it = end_getInstanceIterator(end);
     while ((cap = end_getNext(it)) != NULL) {
@@ -82,9 +113,9 @@ int64_t isInAdjacency(AlignedPair *alignedPair, End *end, int64_t maxLength) {
         }
         AdjacencySequence *adjacencySequence = adjacencySequence_construct(cap,
                 maxLength);
-        int64_t i = isInAdjacencySequence(alignedPair, adjacencySequence);
+        int64_t j = isInAdjacencySequence(endAlignment, i, adjacencySequence);
         adjacencySequence_destruct(adjacencySequence);
-        if(i) {
+        if(j) {
             end_destructInstanceIterator(it);
             return 1;
         }
@@ -99,21 +130,21 @@ static void testMakeEndAlignments(CuTest *testCase) {
     int64_t maxLength = 4;
     for (int64_t endIndex = 0; endIndex < 3; endIndex++) {
         End *end = ends[endIndex];
-        stSortedSet *endAlignment = makeEndAlignment(stateMachine, end, 5, maxLength, end_getInstanceNumber(end) > 50, 0.5, pairwiseParameters);
+        EndAlignment *endAlignment = makeEndAlignment(stateMachine, end, 5, maxLength, end_getInstanceNumber(end) > 50, 0.5, pairwiseParameters, NULL);
 
-        stSortedSetIterator *iterator = stSortedSet_getIterator(endAlignment);
-        AlignedPair *alignedPair;
         //Check pairs are part of valid sequences from end
-
-        while ((alignedPair = stSortedSet_getNext(iterator)) != NULL) {
-            CuAssertTrue(testCase, alignedPair->score > 0); //Check score is valid.
-            CuAssertTrue(testCase, alignedPair->score <= PAIR_ALIGNMENT_PROB_1);
-            CuAssertTrue(testCase, stSortedSet_search(endAlignment, alignedPair->reverse) != NULL); //Check other end is in.
+        CuAssertIntEquals(testCase, 2 * endAlignment_size(endAlignment), endAlignment->length);
+        for (int64_t i = 0; i < endAlignment->length; i++) {
+            CuAssertTrue(testCase, endAlignment->scores[i] > 0); //Check score is valid.
+            CuAssertTrue(testCase, endAlignment->scores[i] <= PAIR_ALIGNMENT_PROB_1);
+            CuAssertTrue(testCase, endAlignment->reverse[endAlignment->reverse[i]] == i); //Check other end is in.
+            if (i > 0) { //Check the entries are sorted.
+                CuAssertTrue(testCase, endAlignment_cmp(endAlignment, i - 1, i) < 0);
+            }
             //Check coordinates are in sequence..
-            CuAssertTrue(testCase, isInAdjacency(alignedPair, end, maxLength));
+            CuAssertTrue(testCase, isInAdjacency(endAlignment, i, end, maxLength));
         }
-        stSortedSet_destructIterator(iterator);
-        stSortedSet_destruct(endAlignment);
+        endAlignment_destruct(endAlignment);
     }
     teardown(testCase);
 }
@@ -124,7 +155,7 @@ static void testReadAndWriteEndAlignments(CuTest *testCase) {
     int64_t maxLength = 4;
     for (int64_t endIndex = 0; endIndex < 3; endIndex++) {
         End *end = ends[endIndex];
-        stSortedSet *endAlignment = makeEndAlignment(stateMachine, end, 5, maxLength, end_getInstanceNumber(end) > 50, 0.5, pairwiseParameters);
+        EndAlignment *endAlignment = makeEndAlignment(stateMachine, end, 5, maxLength, end_getInstanceNumber(end) > 50, 0.5, pairwiseParameters, NULL);
         char *temporaryEndAlignmentFile = "temporaryEndAlignmentFile.end";
         FILE *fileHandle = fopen(temporaryEndAlignmentFile, "w");
         writeEndAlignmentToDisk(end, endAlignment, fileHandle);
@@ -132,18 +163,18 @@ static void testReadAndWriteEndAlignments(CuTest *testCase) {
         fclose(fileHandle);
         fileHandle = fopen(temporaryEndAlignmentFile, "r");
         End *end2;
-        stSortedSet *endAlignment2 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
+        EndAlignment *endAlignment2 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
         CuAssertPtrEquals(testCase, end, end2);
-        stSortedSet *endAlignment3 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
+        EndAlignment *endAlignment3 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
         CuAssertPtrEquals(testCase, end, end2);
         CuAssertTrue(testCase, loadEndAlignmentFromDisk(flower, fileHandle, &end2) == NULL);
         CuAssertTrue(testCase, end2 == NULL);
         fclose(fileHandle);
-        CuAssertTrue(testCase, stSortedSet_equals(endAlignment, endAlignment2));
-        CuAssertTrue(testCase, stSortedSet_equals(endAlignment, endAlignment3));
-        stSortedSet_destruct(endAlignment);
-        stSortedSet_destruct(endAlignment2);
-        stSortedSet_destruct(endAlignment3);
+        CuAssertTrue(testCase, endAlignment_equals(endAlignment, endAlignment2));
+        CuAssertTrue(testCase, endAlignment_equals(endAlignment, endAlignment3));
+        endAlignment_destruct(endAlignment);
+        endAlignment_destruct(endAlignment2);
+        endAlignment_destruct(endAlignment3);
         stFile_rmtree(temporaryEndAlignmentFile);
     }
     teardown(testCase);
@@ -153,6 +184,6 @@ CuSuite* endAlignerTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testMakeEndAlignments);
     SUITE_ADD_TEST(suite, testReadAndWriteEndAlignments);
-    SUITE_ADD_TEST(suite, test_alignedPair_cmpFn);
+    SUITE_ADD_TEST(suite, test_endAlignment_sort);
     return suite;
 }
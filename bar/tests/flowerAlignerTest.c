@@ -9,8 +9,8 @@
 #include "endAligner.h"
 #include "adjacencySequences.h"
 #include "pairwiseAligner.h"
-
-stList *getInducedAlignment(stSortedSet *endAlignment, AdjacencySequence *adjacencySequence);
+#include "poaBarAligner.h"
+#include <math.h>
 
 static int getRandomPosition(AdjacencySequence *adjacencySequence) {
     if(adjacencySequence->strand) {
@@ -21,19 +21,16 @@ static int getRandomPosition(AdjacencySequence *adjacencySequence) {
     }
 }
 
-int64_t isInAdjacencySequence(AlignedPair *alignedPair, AdjacencySequence *adjacencySequence);
+int64_t isInAdjacencySequence(EndAlignment *endAlignment, int64_t i, AdjacencySequence *adjacencySequence);
 
-stList *getinducedAlignment2(stSortedSet *endAlignment, AdjacencySequence *adjacencySequence) {
-    stList *inducedAlignment = stList_construct();
-    stSortedSetIterator *it = stSortedSet_getIterator(endAlignment);
-    AlignedPair *alignedPair;
-    while((alignedPair = stSortedSet_getNext(it)) != NULL) {
-        if(isInAdjacencySequence(alignedPair, adjacencySequence)) {
-            stList_append(inducedAlignment, alignedPair);
+stList *getinducedAlignment2(EndAlignment *endAlignment, AdjacencySequence *adjacencySequence) {
+    //The entries are sorted, so just filter them
+    stList *inducedAlignment = stList_construct3(0, (void (*)(void *))stIntTuple_destruct);
+    for(int64_t i=0; i<endAlignment->length; i++) {
+        if(isInAdjacencySequence(endAlignment, i, adjacencySequence)) {
+            stList_append(inducedAlignment, stIntTuple_construct1(i));
         }
     }
-    stSortedSet_destructIterator(it);
-    stList_sort(inducedAlignment, (int (*)(const void *, const void *))alignedPair_cmpFn);
     if(!adjacencySequence->strand) {
         stList_reverse(inducedAlignment);
     }
@@ -44,8 +41,7 @@ void test_getInducedAlignment(CuTest *testCase) {
     for(int64_t test=0; test<100; test++) {
         setup(testCase);
 
-        stSortedSet *sortedAlignment = stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
-                       (void (*)(void *))alignedPair_destruct);
+        EndAlignment *sortedAlignment = endAlignment_construct(0);
 
 
         stList *adjacencySequences = stList_construct3(0, (void (*)(void *))adjacencySequence_destruct);
@@ -61,44 +57,29 @@ void test_getInducedAlignment(CuTest *testCase) {
             AdjacencySequence *aS1 = st_randomChoice(adjacencySequences);
             AdjacencySequence *aS2 = st_randomChoice(adjacencySequences);
             if(aS1 != aS2) {
-                AlignedPair *alignedPair =
-                        alignedPair_construct(aS1->subsequenceIdentifier, getRandomPosition(aS1), aS1->strand,
-                                              aS2->subsequenceIdentifier, getRandomPosition(aS2), aS2->strand,
-                                              st_randomInt(0, PAIR_ALIGNMENT_PROB_1), st_randomInt(0, PAIR_ALIGNMENT_PROB_1));
-                stSortedSet_insert(sortedAlignment, alignedPair);
-                stSortedSet_insert(sortedAlignment, alignedPair->reverse);
+                endAlignment_add(sortedAlignment, aS1->subsequenceIdentifier, getRandomPosition(aS1), aS1->strand,
+                                 aS2->subsequenceIdentifier, getRandomPosition(aS2), aS2->strand,
+                                 st_randomInt(0, PAIR_ALIGNMENT_PROB_1), st_randomInt(0, PAIR_ALIGNMENT_PROB_1));
             }
         }
+        endAlignment_sort(sortedAlignment);
 
         for(int64_t i=0; i<stList_length(adjacencySequences); i++) {
             AdjacencySequence *adjacencySequence = stList_get(adjacencySequences, i);
-            stList *inducedAlignment = getInducedAlignment(sortedAlignment, adjacencySequence);
+            InducedAlignment *inducedAlignment = getInducedAlignment(sortedAlignment, adjacencySequence);
             stList *inducedAlignment2 = getinducedAlignment2(sortedAlignment, adjacencySequence);
 
-            /*st_logInfo("The lengths are %" PRIi64 " %" PRIi64 "\n", stList_length(inducedAlignment), stList_length(inducedAlignment2));
-            st_logInfo("Adj %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "\n", adjacencySequence->sequenceName, adjacencySequence->start, adjacencySequence->length, adjacencySequence->strand);
-
-            for(int64_t j=0; j<stList_length(inducedAlignment); j++) {
-                AlignedPair *aP = stList_get(inducedAlignment, j);
-                st_logInfo("Hello %" PRIi64 " %" PRIi64 " %" PRIi64 "\n", aP->sequence, aP->position, aP->strand);
-            }
-
-            for(int64_t j=0; j<stList_length(inducedAlignment2); j++) {
-                AlignedPair *aP = stList_get(inducedAlignment2, j);
-                st_logInfo("Goodbye %" PRIi64 " %" PRIi64 " %" PRIi64 "\n", aP->sequence, aP->position, aP->strand);
-            }*/
-
-            CuAssertTrue(testCase, stList_length(inducedAlignment) == stList_length(inducedAlignment2));
-            for(int64_t j=0; j<stList_length(inducedAlignment); j++) {
-                CuAssertTrue(testCase, stList_get(inducedAlignment, j) == stList_get(inducedAlignment2, j));
+            CuAssertTrue(testCase, inducedAlignment->length == stList_length(inducedAlignment2));
+            for(int64_t j=0; j<inducedAlignment->length; j++) {
+                CuAssertTrue(testCase, inducedAlignment->entries[j] == stIntTuple_get(stList_get(inducedAlignment2, j), 0));
             }
 
-            stList_destruct(inducedAlignment);
+            inducedAlignment_destruct(inducedAlignment);
             stList_destruct(inducedAlignment2);
         }
 
         //cleanup
-        stSortedSet_destruct(sortedAlignment);
+        endAlignment_destruct(sortedAlignment);
         teardown(testCase);
     }
 }
@@ -110,25 +91,35 @@ void test_flowerAlignerRandom(CuTest *testCase) {
     setup(testCase);
     int64_t maxLength = 5;
     StateMachine *sM = stateMachine5_construct(fiveState);
-    stSortedSet *flowerAlignment = makeFlowerAlignment(sM, flower, 5, maxLength, 1, 0.5, pairwiseParameters, st_random() > 0.5);
+    EndAlignment *flowerAlignment = makeFlowerAlignment(sM, flower, 5, maxLength, 1, 0.5, pairwiseParameters, st_random() > 0.5);
     stateMachine_destruct(sM);
     //Check the aligned pairs are all good..
-    stSortedSetIterator *iterator = stSortedSet_getIterator(flowerAlignment);
-    AlignedPair *alignedPair;
-    while((alignedPair = stSortedSet_getNext(iterator)) != NULL) {
-        CuAssertTrue(testCase, alignedPair->score > 0); //Check score is valid
-        CuAssertTrue(testCase, alignedPair->score <= PAIR_ALIGNMENT_PROB_1);
-        CuAssertTrue(testCase, stSortedSet_search(flowerAlignment, alignedPair->reverse) != NULL); //Check other end is in.
+    for(int64_t i=0; i<flowerAlignment->length; i++) {
+        CuAssertTrue(testCase, !flowerAlignment->deleted[i]);
+        CuAssertTrue(testCase, flowerAlignment->scores[i] > 0); //Check score is valid
+        CuAssertTrue(testCase, flowerAlignment->scores[i] <= PAIR_ALIGNMENT_PROB_1);
+        CuAssertTrue(testCase, flowerAlignment->reverse[flowerAlignment->reverse[i]] == i); //Check other end is in.
     }
-    stSortedSet_destructIterator(iterator);
-    stSortedSet_destruct(flowerAlignment);
+    endAlignment_destruct(flowerAlignment);
 
     teardown(testCase);
 }
 
+void test_estimateFlowerBarCost(CuTest *testCase) {
+    setup(testCase);
+    // 6 adjacencies, of lengths 4, 5, 1, 6, 4 and 0, each counted from both of its caps; end1 has degree 6
+    double adjacencyCost = estimateFlowerBarCost(flower, 0);
+    CuAssertDblEquals(testCase, 6 * 64.0, adjacencyCost, 0.0001);
+    CuAssertDblEquals(testCase, 2 * 20 * log2(7.0), estimateFlowerBarCost(flower, INT64_MAX) - adjacencyCost, 0.0001);
+    // Lengths are capped by the banding limit
+    CuAssertDblEquals(testCase, 2 * 5 * log2(7.0), estimateFlowerBarCost(flower, 1) - adjacencyCost, 0.0001);
+    teardown(testCase);
+}
+
 CuSuite* flowerAlignerTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_getInducedAlignment);
     SUITE_ADD_TEST(suite, test_flowerAlignerRandom);
+    SUITE_ADD_TEST(suite, test_estimateFlowerBarCost);
     return suite;
 }
@@ -0,0 +1,65 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "flowersShared.h"
+#include "adjacencySequences.h"
+#include "flowerDump.h"
+
+static stList *getAdjacencyStrings(Flower *flower) {
+    /*
+     * Gets the sorted strings of the adjacencies of the flower, read from each side.
+     */
+    stList *strings = stList_construct3(0, free);
+    Flower_CapIterator *capIt = flower_getCapIterator(flower);
+    Cap *cap;
+    while ((cap = flower_getNextCap(capIt)) != NULL) {
+        for (int64_t i = 0; i < 2; i++) {
+            Cap *cap2 = i ? cap_getReverse(cap) : cap;
+            if (!cap_getSide(cap2)) {
+                AdjacencySequence *adjacencySequence = adjacencySequence_construct(cap2, INT64_MAX);
+                stList_append(strings, stString_print("%s %i", adjacencySequence->string, end_isAttached(cap_getEnd(cap2))));
+                adjacencySequence_destruct(adjacencySequence);
+            }
+        }
+    }
+    flower_destructCapIterator(capIt);
+    stList_sort(strings, (int (*)(const void *, const void *))strcmp);
+    return strings;
+}
+
+static void testWriteAndLoadFlower(CuTest *testCase) {
+    setup(testCase);
+    FILE *fileHandle = tmpfile();
+    writeFlowerToDisk(flower, fileHandle);
+    writeFlowerToDisk(flower, fileHandle);
+    rewind(fileHandle);
+
+    CactusDisk *cactusDisk2 = cactusDisk_construct();
+    stList *strings = getAdjacencyStrings(flower);
+    for (int64_t i = 0; i < 2; i++) {
+        Flower *flower2 = loadFlowerFromDisk(cactusDisk2, fileHandle);
+        CuAssertPtrNotNull(testCase, flower2);
+        CuAssertIntEquals(testCase, flower_getSequenceNumber(flower), flower_getSequenceNumber(flower2));
+        CuAssertIntEquals(testCase, flower_getEndNumber(flower), flower_getEndNumber(flower2));
+        CuAssertIntEquals(testCase, flower_getCapNumber(flower), flower_getCapNumber(flower2));
+        stList *strings2 = getAdjacencyStrings(flower2);
+        CuAssertIntEquals(testCase, stList_length(strings), stList_length(strings2));
+        for (int64_t j = 0; j < stList_length(strings); j++) {
+            CuAssertStrEquals(testCase, stList_get(strings, j), stList_get(strings2, j));
+        }
+        stList_destruct(strings2);
+    }
+    CuAssertPtrEquals(testCase, NULL, loadFlowerFromDisk(cactusDisk2, fileHandle));
+
+    stList_destruct(strings);
+    cactusDisk_destruct(cactusDisk2);
+    fclose(fileHandle);
+    teardown(testCase);
+}
+
+CuSuite* flowerDumpTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testWriteAndLoadFlower);
+    return suite;
+}
@@ -0,0 +1,430 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks the tools that process the lastz alignments before CAF on synthetic alignments, running them in the
+ * order of the pipeline (see blast.py and mappingQualityRescoringAndFiltering.py) and reporting the throughput and
+ * peak memory of each.
+ */
+
+#include <time.h>
+#include <math.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "sonLib.h"
+#include "bioioC.h"
+
+void usage() {
+    fprintf(stderr, "cactus_blastBenchmark, version 0.1\n");
+    fprintf(stderr, "-l --logLevel : Set the log level\n");
+    fprintf(stderr, "-o --outputDir : [Required] The existing directory to write the synthetic data and tool outputs to\n");
+    fprintf(stderr, "-n --alignments : (int > 0) The number of alignments to generate [default: 100000]\n");
+    fprintf(stderr, "-m --minLength : (int > 0) The minimum length of an alignment on the target [default: 100]\n");
+    fprintf(stderr, "-M --maxLength : (int >= minLength) The maximum length of an alignment on the target, lengths "
+            "being log-uniformly distributed between the two [default: 10000]\n");
+    fprintf(stderr, "-d --depth : (float > 0) The average number of alignments covering a target base [default: 10]\n");
+    fprintf(stderr, "-r --repeats : (int > 0) The number of query copies each aligned target interval has, as for a "
+            "repeat [default: 1]\n");
+    fprintf(stderr, "-i --indelRate : (float) The probability of an indel after each aligned base [default: 0.02]\n");
+    fprintf(stderr, "-c --contigs : (int > 0) The number of target and of query contigs [default: 10]\n");
+    fprintf(stderr, "-k --chunkSize : (int > 0) The size of the chunks the raw alignments' coordinates are relative to "
+            "[default: 1000000]\n");
+    fprintf(stderr, "-a --maxAlignmentsPerSite : (int > 0) Passed to cactus_calculateMappingQualities [default: 5]\n");
+    fprintf(stderr, "-t --threads : (int > 0) Passed to cactus_coverage [default: the number of online processors]\n");
+    fprintf(stderr, "-g --generateOnly : Only write the synthetic data\n");
+    fprintf(stderr, "-s --seed : (int) The random seed [default: 0]\n");
+    fprintf(stderr, "-h --help : Print this help message\n");
+}
+
+typedef struct _syntheticAlignmentParams {
+    int64_t alignments;
+    int64_t minLength;
+    int64_t maxLength;
+    double depth;
+    int64_t repeats;
+    double indelRate;
+    int64_t contigs;
+    int64_t chunkSize;
+} SyntheticAlignmentParams;
+
+static int64_t randomLength(SyntheticAlignmentParams *sp) {
+    return (int64_t)exp(log(sp->minLength) + st_random() * (log(sp->maxLength + 1) - log(sp->minLength)));
+}
+
+static int64_t getContigLength(SyntheticAlignmentParams *sp) {
+    /*
+     * Makes the target long enough that the alignments cover it to the requested depth, on average.
+     */
+    double meanLength = sp->maxLength == sp->minLength ? sp->minLength :
+                        (sp->maxLength - sp->minLength) / (log(sp->maxLength) - log(sp->minLength));
+    int64_t contigLength = (int64_t)(sp->alignments * meanLength / sp->depth / sp->contigs);
+    return contigLength > sp->maxLength ? contigLength : sp->maxLength;
+}
+
+static void writeTargetSequences(SyntheticAlignmentParams *sp, int64_t contigLength, const char *fastaFile) {
+    FILE *fileHandle = fopen(fastaFile, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open %s\n", fastaFile);
+    }
+    char *string = st_malloc(contigLength + 1);
+    for (int64_t i = 0; i < sp->contigs; i++) {
+        for (int64_t j = 0; j < contigLength; j++) {
+            string[j] = "ACGT"[st_randomInt(0, 4)];
+        }
+        string[contigLength] = '\0';
+        char *header = stString_print("target%" PRIi64 "", i);
+        fastaWrite(string, header, fileHandle);
+        free(header);
+    }
+    free(string);
+    fclose(fileHandle);
+}
+
+static int64_t writeOps(SyntheticAlignmentParams *sp, int64_t targetLength, FILE *fileHandle) {
+    /*
+     * Writes random ops covering targetLength bases of the target, returning the number of query bases covered.
+     * In the cigar the query is the first sequence, so 'I' ops are query bases and 'D' ops target bases.
+     */
+    int64_t i = 0, queryLength = 0;
+    while (i < targetLength) {
+        int64_t matchLength = 1;
+        while (i + matchLength < targetLength && st_random() >= sp->indelRate) {
+            matchLength++;
+        }
+        fprintf(fileHandle, " M %" PRIi64 "", matchLength);
+        i += matchLength;
+        queryLength += matchLength;
+        if (i < targetLength) {
+            int64_t indelLength = st_randomInt(1, 6);
+            if (st_random() < 0.5) {
+                fprintf(fileHandle, " I %" PRIi64 "", indelLength);
+                queryLength += indelLength;
+            } else {
+                indelLength = indelLength < targetLength - i ? indelLength : targetLength - i;
+                fprintf(fileHandle, " D %" PRIi64 "", indelLength);
+                i += indelLength;
+            }
+        }
+    }
+    return queryLength;
+}
+
+static void writeRawAlignments(SyntheticAlignmentParams *sp, int64_t contigLength, const char *cigarFile) {
+    /*
+     * Writes alignments of target intervals to sp->repeats random places in the query, as lastz reports them on
+     * chunks: the contigs are named "contig|chunkStart" and the coordinates are relative to the chunk.
+     */
+    FILE *fileHandle = fopen(cigarFile, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open %s\n", cigarFile);
+    }
+    for (int64_t i = 0; i < sp->alignments;) {
+        int64_t targetContig = st_randomInt(0, sp->contigs);
+        int64_t targetLength = randomLength(sp);
+        int64_t targetStart = st_randomInt(0, contigLength - targetLength + 1);
+        int64_t targetChunk = targetStart / sp->chunkSize * sp->chunkSize;
+        // The best copy has the highest score and the others a little less, to give a spread of mapping qualities
+        double bestScore = 100.0 * targetLength;
+        for (int64_t j = 0; j < sp->repeats && i < sp->alignments; j++, i++) {
+            char *ops;
+            size_t opsLength;
+            FILE *opsHandle = open_memstream(&ops, &opsLength);
+            int64_t queryLength = writeOps(sp, targetLength, opsHandle);
+            fclose(opsHandle);
+            int64_t queryContig = st_randomInt(0, sp->contigs);
+            int64_t queryStart = st_randomInt(0, contigLength);
+            int64_t queryChunk = queryStart / sp->chunkSize * sp->chunkSize;
+            bool queryStrand = st_random() < 0.5;
+            int64_t start = queryStart - queryChunk, end = start + queryLength;
+            fprintf(fileHandle, "cigar: query%" PRIi64 "|%" PRIi64 " %" PRIi64 " %" PRIi64 " %c target%" PRIi64 "|%"
+                    PRIi64 " %" PRIi64 " %" PRIi64 " + %" PRIi64 "%s\n", queryContig, queryChunk,
+                    queryStrand ? start : end, queryStrand ? end : start, queryStrand ? '+' : '-', targetContig,
+                    targetChunk, targetStart - targetChunk, targetStart - targetChunk + targetLength,
+                    (int64_t)(bestScore * (j == 0 ? 1.0 : 1.0 - 0.1 * st_random())), ops);
+            free(ops);
+        }
+    }
+    fclose(fileHandle);
+}
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static int64_t countLines(const char *file) {
+    FILE *fileHandle = fopen(file, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open %s\n", file);
+    }
+    int64_t lines = 0;
+    char buffer[65536];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), fileHandle)) > 0) {
+        for (size_t i = 0; i < length; i++) {
+            lines += buffer[i] == '\n';
+        }
+    }
+    fclose(fileHandle);
+    return lines;
+}
+
+static void redirect(const char *file, int flags, int fd) {
+    int fileFd = open(file, flags, 0644);
+    if (fileFd < 0 || dup2(fileFd, fd) < 0) {
+        fprintf(stderr, "Could not open %s\n", file);
+        _exit(127);
+    }
+    close(fileFd);
+}
+
+static void runTool(const char *name, stList *arguments, const char *inputFile, const char *stdinFile,
+                    const char *stdoutFile) {
+    /*
+     * Runs the tool as a child process, so that its peak memory can be measured separately, and reports the
+     * number of alignments in its input file per second of wall time.
+     */
+    int64_t alignments = countLines(inputFile);
+    char **argv = st_malloc(sizeof(char *) * (stList_length(arguments) + 1));
+    for (int64_t i = 0; i < stList_length(arguments); i++) {
+        argv[i] = stList_get(arguments, i);
+    }
+    argv[stList_length(arguments)] = NULL;
+    fflush(stdout);
+
+    double startTime = getTime();
+    pid_t pid = fork();
+    if (pid < 0) {
+        st_errAbort("Could not fork to run %s\n", name);
+    }
+    if (pid == 0) {
+        if (stdinFile != NULL) {
+            redirect(stdinFile, O_RDONLY, STDIN_FILENO);
+        }
+        if (stdoutFile != NULL) {
+            redirect(stdoutFile, O_WRONLY | O_CREAT | O_TRUNC, STDOUT_FILENO);
+        }
+        execvp(argv[0], argv);
+        fprintf(stderr, "Could not run %s\n", argv[0]);
+        _exit(127);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        st_errAbort("%s failed\n", name);
+    }
+    double time = getTime() - startTime;
+    // ru_maxrss is in kilobytes on Linux
+    fprintf(stdout, "%s\t%" PRIi64 "\t%f\t%f\t%ld\n", name, alignments, time, time > 0 ? alignments / time : 0.0,
+            usage.ru_maxrss);
+    free(argv);
+}
+
+static char *getPath(const char *outputDir, const char *file) {
+    return stString_print("%s/%s", outputDir, file);
+}
+
+static void benchmarkTools(const char *outputDir, const char *logLevelString, int64_t maxAlignmentsPerSite,
+                           int64_t threads) {
+    char *targetFasta = getPath(outputDir, "target.fa");
+    char *rawCigars = getPath(outputDir, "raw.cigar");
+    char *convertedCigars = getPath(outputDir, "converted.cigar");
+    char *mirroredCigars = getPath(outputDir, "mirrored.cigar");
+    char *sortedCigars = getPath(outputDir, "sorted.cigar");
+    char *splitCigars = getPath(outputDir, "split.cigar");
+    char *coverageBed = getPath(outputDir, "coverage.bed");
+    stList *arguments;
+
+    fprintf(stdout, "tool\talignments\tseconds\talignments_per_second\tpeak_rss_kb\n");
+
+    arguments = stList_construct3(0, free);
+    stList_append(arguments, stString_copy("cactus_blast_convertCoordinates"));
+    stList_append(arguments, stString_copy(rawCigars));
+    stList_append(arguments, stString_copy(convertedCigars));
+    stList_append(arguments, stString_copy("1"));
+    runTool("cactus_blast_convertCoordinates", arguments, rawCigars, NULL, NULL);
+    stList_destruct(arguments);
+
+    arguments = stList_construct3(0, free);
+    stList_append(arguments, stString_copy("cactus_coverage"));
+    stList_append(arguments, stString_copy(targetFasta));
+    stList_append(arguments, stString_copy(convertedCigars));
+    stList_append(arguments, stString_copy("--threads"));
+    stList_append(arguments, stString_print("%" PRIi64 "", threads));
+    runTool("cactus_coverage", arguments, convertedCigars, NULL, coverageBed);
+    stList_destruct(arguments);
+
+    arguments = stList_construct3(0, free);
+    stList_append(arguments, stString_copy("cactus_mirrorAndOrientAlignments"));
+    stList_append(arguments, stString_copy(logLevelString));
+    stList_append(arguments, stString_copy(convertedCigars));
+    stList_append(arguments, stString_copy(mirroredCigars));
+    runTool("cactus_mirrorAndOrientAlignments", arguments, convertedCigars, NULL, NULL);
+    stList_destruct(arguments);
+
+    // Sorted by coordinate on the first sequence, as the pipeline does
+    arguments = stList_construct3(0, free);
+    stList_append(arguments, stString_copy("sort"));
+    stList_append(arguments, stString_copy("-k6,6"));
+    stList_append(arguments, stString_copy("-k7,7n"));
+    stList_append(arguments, stString_copy("-k8,8n"));
+    stList_append(arguments, stString_copy("-o"));
+    stList_append(arguments, stString_copy(sortedCigars));
+    stList_append(arguments, stString_copy(mirroredCigars));
+    runTool("sort", arguments, mirroredCigars, NULL, NULL);
+    stList_destruct(arguments);
+
+    arguments = stList_construct3(0, free);
+    stList_append(arguments, stString_copy("cactus_splitAlignmentOverlaps"));
+    stList_append(arguments, stString_copy(logLevelString));
+    stList_append(arguments, stString_copy(sortedCigars));
+    stList_append(arguments, stString_copy(splitCigars));
+    runTool("cactus_splitAlignmentOverlaps", arguments, sortedCigars, NULL, NULL);
+    stList_destruct(arguments);
+
+    // Uses the values in cactus_progressive_config.xml, with the given number of alignments per site
+    arguments = stList_construct3(0, free);
+    stList_append(arguments, stString_copy("cactus_calculateMappingQualities"));
+    stList_append(arguments, stString_copy(logLevelString));
+    stList_append(arguments, stString_print("%" PRIi64 "", maxAlignmentsPerSite));
+    stList_append(arguments, stString_copy("0.0"));
+    stList_append(arguments, stString_copy("0.001"));
+    for (int64_t i = 0; i < maxAlignmentsPerSite; i++) {
+        stList_append(arguments, stString_print("%s/mapq.%" PRIi64 ".cigar", outputDir, i));
+    }
+    runTool("cactus_calculateMappingQualities", arguments, splitCigars, splitCigars, NULL);
+    stList_destruct(arguments);
+
+    free(targetFasta);
+    free(rawCigars);
+    free(convertedCigars);
+    free(mirroredCigars);
+    free(sortedCigars);
+    free(splitCigars);
+    free(coverageBed);
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = "CRITICAL";
+    char *outputDir = NULL;
+    int64_t maxAlignmentsPerSite = 5;
+    int64_t threads = sysconf(_SC_NPROCESSORS_ONLN); // As cactus_coverage only uses one thread unless told otherwise
+    bool generateOnly = 0;
+    int64_t seed = 0;
+    SyntheticAlignmentParams sp = { .alignments = 100000, .minLength = 100, .maxLength = 10000, .depth = 10.0,
+                                    .repeats = 1, .indelRate = 0.02, .contigs = 10, .chunkSize = 1000000 };
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
+                { "outputDir", required_argument, 0, 'o' },
+                { "alignments", required_argument, 0, 'n' },
+                { "minLength", required_argument, 0, 'm' },
+                { "maxLength", required_argument, 0, 'M' },
+                { "depth", required_argument, 0, 'd' },
+                { "repeats", required_argument, 0, 'r' },
+                { "indelRate", required_argument, 0, 'i' },
+                { "contigs", required_argument, 0, 'c' },
+                { "chunkSize", required_argument, 0, 'k' },
+                { "maxAlignmentsPerSite", required_argument, 0, 'a' },
+                { "threads", required_argument, 0, 't' },
+                { "generateOnly", no_argument, 0, 'g' },
+                { "seed", required_argument, 0, 's' },
+                { "help", no_argument, 0, 'h' },
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int64_t key = getopt_long(argc, argv, "l:o:n:m:M:d:r:i:c:k:a:t:gs:h", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        int i = 1;
+        switch (key) {
+            case 'l':
+                logLevelString = optarg;
+                break;
+            case 'o':
+                outputDir = optarg;
+                break;
+            case 'n':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.alignments);
+                break;
+            case 'm':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.minLength);
+                break;
+            case 'M':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.maxLength);
+                break;
+            case 'd':
+                i = sscanf(optarg, "%lf", &sp.depth);
+                break;
+            case 'r':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.repeats);
+                break;
+            case 'i':
+                i = sscanf(optarg, "%lf", &sp.indelRate);
+                break;
+            case 'c':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.contigs);
+                break;
+            case 'k':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.chunkSize);
+                break;
+            case 'a':
+                i = sscanf(optarg, "%" PRIi64 "", &maxAlignmentsPerSite);
+                break;
+            case 't':
+                i = sscanf(optarg, "%" PRIi64 "", &threads);
+                break;
+            case 'g':
+                generateOnly = 1;
+                break;
+            case 's':
+                i = sscanf(optarg, "%" PRIi64 "", &seed);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+        if (i != 1) {
+            st_errAbort("Could not parse the argument of option -%c: '%s'\n", (char)key, optarg);
+        }
+    }
+
+    st_setLogLevelFromString(logLevelString);
+
+    if (outputDir == NULL) {
+        st_errAbort("The output directory must be given\n");
+    }
+    if (sp.alignments < 1 || sp.minLength < 1 || sp.maxLength < sp.minLength || sp.depth <= 0 || sp.repeats < 1 ||
+        sp.contigs < 1 || sp.chunkSize < 1 || maxAlignmentsPerSite < 1 || threads < 1) {
+        st_errAbort("The synthetic alignment options must be positive\n");
+    }
+    st_randomSeed(seed);
+
+    int64_t contigLength = getContigLength(&sp);
+    st_logInfo("Generating %" PRIi64 " alignments on %" PRIi64 " contigs of length %" PRIi64 "\n", sp.alignments,
+               sp.contigs, contigLength);
+    char *targetFasta = getPath(outputDir, "target.fa");
+    char *rawCigars = getPath(outputDir, "raw.cigar");
+    writeTargetSequences(&sp, contigLength, targetFasta);
+    writeRawAlignments(&sp, contigLength, rawCigars);
+    free(targetFasta);
+    free(rawCigars);
+
+    if (!generateOnly) {
+        benchmarkTools(outputDir, logLevelString, maxAlignmentsPerSite, threads);
+    }
+
+    return 0;
+}
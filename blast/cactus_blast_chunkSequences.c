@@ -22,12 +22,18 @@ int main(int argc, char *argv[]) {
     assert(i == 1);
     i = sscanf(argv[3], "%" PRIi64 "", &chunkOverlapSize);
     assert(i == 1);
-    setupToChunkSequences(chunkSize, chunkOverlapSize, argv[4]);
+    SequenceChunker *chunker = sequenceChunker_construct(chunkSize, chunkOverlapSize);
+    stList *fastaFiles = stList_construct();
     for (int64_t i = 5; i < argc; i++) {
-        FILE *fileHandle2 = fopen(argv[i], "r");
-        fastaReadToFunction(fileHandle2, NULL, processSequenceToChunk);
-        fclose(fileHandle2);
+        stList_append(fastaFiles, argv[i]);
     }
-    finishChunkingSequences();
+    sequenceChunker_addFastaFiles(chunker, fastaFiles);
+    stList *chunkFiles = sequenceChunker_writeChunks(chunker, argv[4]);
+    for (int64_t i = 0; i < stList_length(chunkFiles); i++) {
+        fprintf(stdout, "%s\n", (char *)stList_get(chunkFiles, i));
+    }
+    stList_destruct(chunkFiles);
+    stList_destruct(fastaFiles);
+    sequenceChunker_destruct(chunker);
     return 0;
 }
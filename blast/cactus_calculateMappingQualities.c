@@ -21,28 +21,34 @@ int cmpAlignmentsFn(const void *a, const void *b) {
 }
 
 void updateScoresToReflectMappingQualities(stList *alignments, float alpha, uint64_t numAlignmentsToScore) {
-	// Create an array of the scores
-	float *alignmentScores = st_calloc(stList_length(alignments), sizeof(float));
-	for(uint64_t i=0; i<stList_length(alignments); i++) {
-		alignmentScores[i] = ((struct PairwiseAlignment *)stList_get(alignments, i))->score;
+	// The alignments are sorted by ascending score
+	uint64_t alignmentNumber = stList_length(alignments);
+	if(alignmentNumber == 0) {
+		return;
 	}
+	float maxScore = ((struct PairwiseAlignment *)stList_get(alignments, alignmentNumber-1))->score;
+
+	// The denominator for alignment i is z_i = sum_j 10^(alpha*(s_j - s_i)) = 10^(alpha*(m - s_i)) * zMax,
+	// where m is the maximum score and zMax = sum_j 10^(alpha*(s_j - m)). zMax is in [1, n], so the sum can't
+	// overflow, and the cut-off below bounds the scale factor by 10^10, so each z_i is found in O(1)
+	double zMax = 0.0;
+	for(uint64_t j=0; j<alignmentNumber; j++) {
+		zMax += pow(10, alpha * (((struct PairwiseAlignment *)stList_get(alignments, j))->score - maxScore));
+	}
+	assert(zMax >= 1.0);
 
 	// Calculate mapQs for the best N alignments (N = numAlignmentsToScore).
-        uint64_t start = stList_length(alignments) > numAlignmentsToScore ? stList_length(alignments) - numAlignmentsToScore : 0;
-	for(uint64_t i=start; i<stList_length(alignments); i++) {
+	uint64_t start = alignmentNumber > numAlignmentsToScore ? alignmentNumber - numAlignmentsToScore : 0;
+	for(uint64_t i=start; i<alignmentNumber; i++) {
 		struct PairwiseAlignment *pA = stList_get(alignments, i);
 
 		// Cut off the calculation if clearly going to be zero
-		if(alpha * (alignmentScores[i] - alignmentScores[stList_length(alignments)-1]) < -10) {
+		if(alpha * (pA->score - maxScore) < -10) {
 			pA->score = 0.0;
 		}
 
 		else {
-			// Calculate the denominator
-			double z = 0.0;
-			for(uint64_t j=0; j<stList_length(alignments); j++) {
-				z += pow(10, alpha * (alignmentScores[j] - alignmentScores[i]));
-			}
+			double z = zMax * pow(10, alpha * (maxScore - pA->score));
 			assert(z >= 1.0);
 
 			if(z <= 1.000001) { // Round scores to max of 60
@@ -54,9 +60,6 @@ void updateScoresToReflectMappingQualities(stList *alignments, float alpha, uint
 			}
 		}
 	}
-
-	// Cleanup
-	free(alignmentScores);
 }
 
 void reportAlignments(stList *alignments, int64_t maxAlignmentsPerSite,
@@ -1,47 +1,92 @@
 #include <getopt.h>
 #include <errno.h>
+#include <ctype.h>
 #include "sonLib.h"
 #include "bioioC.h"
-#include "pairwiseAlignment.h"
+#include "blastAlignmentLib.h"
 
-// For blocks on the same contig.
-struct block {
-    int64_t start;
-    int64_t end;
-    int64_t value;
-};
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+// Coverage depths are reported saturated at this value
+#define MAX_COVERAGE 65535
 
 // For calculating coverage on the target genome
-static stHash *sequenceLengths = NULL;
+typedef struct _sequenceInfo {
+    int64_t length;
+    int64_t index; // In sequenceNames
+} SequenceInfo;
+
+static stHash *sequenceInfos = NULL;
 static stList *sequenceNames = NULL;
-static stHash *sequenceCoverage = NULL;
 // For determining if a sequence belongs to the "query" genome
 // (although there is no relation to the query contig in the cigar):
 // i.e. the genome specified in --from, if any
 static stSet *otherGenomeSequences = NULL;
-// For splitting sequence coverage arrays by ID, if we're using the
-// --depthByID option.
-static stHash *IDToSequenceCoverage;
+// For counting coverage depth by the "id=N|" prefix of the aligned
+// sequence, if we're using the --depthById option. Maps the prefixes
+// to consecutive integers.
+static stHash *IDs = NULL;
+
+/*
+ * Coverage is recorded as a list of the aligned intervals of each
+ * sequence, rather than as an array of counts along it, so memory is
+ * proportional to the number of alignments and not to the sequence
+ * length times the number of IDs. Each thread keeps its own lists,
+ * which are merged and swept per sequence once the input is read.
+ */
+typedef struct _coverageInterval {
+    int64_t start;
+    int64_t end; // Exclusive
+    int64_t id; // Index of the ID of the aligned sequence, with --depthById, else 0
+} CoverageInterval;
 
-// Add a sequence from the genome to sequenceLength and sequenceNames
+typedef struct _intervalList {
+    CoverageInterval *intervals;
+    int64_t length;
+    int64_t capacity;
+} IntervalList;
+
+static void intervalList_add(IntervalList *list, int64_t start, int64_t end, int64_t id) {
+    if (list->length == list->capacity) {
+        list->capacity = list->capacity == 0 ? 64 : 2 * list->capacity;
+        list->intervals = st_realloc(list->intervals, list->capacity * sizeof(CoverageInterval));
+    }
+    CoverageInterval *interval = &list->intervals[list->length++];
+    interval->start = start;
+    interval->end = end;
+    interval->id = id;
+}
+
+// A run of constant, non-zero coverage, as printed in the bed output
+typedef struct _coverageRun {
+    int64_t start;
+    int64_t end;
+    uint16_t depth;
+} CoverageRun;
+
+// Add a sequence from the genome to sequenceInfos and sequenceNames
 static void addSequenceLength(void* destination, const char *name, const char *seq, int64_t len)
 {
     char *identifier = stString_copy(name);
     // lastz only takes the first token of a fasta header as the seq ID.
     // not thread-safe
     identifier = strtok(identifier, " ");
-    stList_append(sequenceNames, identifier);
-    int64_t *heapLen = malloc(sizeof(int64_t));
-    *heapLen = len;
-    if(stHash_search(sequenceLengths, identifier) != NULL) {
+    if(stHash_search(sequenceInfos, identifier) != NULL) {
         fprintf(stderr, "Duplicate sequence identifier %s found: make sure "
                 "the first tokens in the headers are unique\n", identifier);
         exit(1);
     }
+    SequenceInfo *info = st_malloc(sizeof(SequenceInfo));
+    info->length = len;
+    info->index = stList_length(sequenceNames);
+    stList_append(sequenceNames, identifier);
 
     // extra copy in case the hash is deleted before the list, or vice
     // versa.
-    stHash_insert(sequenceLengths, stString_copy(identifier), heapLen);
+    stHash_insert(sequenceInfos, stString_copy(identifier), info);
 }
 
 static void addOtherGenomeSequence(void* destination, const char *name, const char *seq,
@@ -68,52 +113,38 @@ static void usage(void)
     fprintf(stderr, "--depthById: Assume that headers have an 'id=N|' prefix, "
             "where N is an integer. Score coverage depth by the number of "
             "different prefixes that align to a region, rather than the total "
-            "number of alignments. Uses much more memory than the standard mode."
-            "\n");
+            "number of alignments.\n");
     fprintf(stderr, "--from <fromFastaFile>: Only consider alignments for which one sequence is in fastaFile and the other is in fromFastaFile (multiple allowed).\n");
+    fprintf(stderr, "--threads <N>: Read the alignments file and compute coverage using N threads [default: 1].\n");
 }
 
-static void printCoverage(char *name, uint16_t *array, int64_t length) {
-    int64_t i, regionStart = 0;
-    uint16_t prevCoverage = 0;
-    for(i = 0; i < length; i++) {
-        if(array[i] != prevCoverage) {
-            if(prevCoverage != 0) {
-                printf("%s\t%" PRIi64 "\t%" PRIi64 "\t\t%u\n", name,
-                       regionStart, i, prevCoverage);
-            }
-            regionStart = i;
-        }
-        prevCoverage = array[i];
-    }
-    if(prevCoverage != 0) {
+static void printCoverage(char *name, CoverageRun *runs, int64_t runNumber) {
+    for(int64_t i = 0; i < runNumber; i++) {
         printf("%s\t%" PRIi64 "\t%" PRIi64 "\t\t%u\n", name,
-               regionStart, i, prevCoverage);
+               runs[i].start, runs[i].end, runs[i].depth);
     }
 }
 
-// Fill in the part of a coverage array that is covered by a
+// Add the intervals of a coverage list that are covered by a
 // particular pairwise alignment. contigNum is which contig this
-// coverage array corresponds to in the CIGAR.
-static void fillCoverage(struct PairwiseAlignment *pA, int contigNum,
-                         uint16_t *coverageArray)
+// coverage list corresponds to in the CIGAR.
+static void fillCoverage(Cigar *cigar, int contigNum, int64_t length,
+                         int64_t id, IntervalList *coverage)
 {
-    int strand = contigNum == 1 ? pA->strand1 : pA->strand2;
-    int64_t startPos = contigNum == 1 ? pA->start1 : pA->start2;
-    int64_t endPos = contigNum == 1 ? pA->end1 : pA->end2;
-    int64_t i, j;
-    int64_t *lenPtr = stHash_search(sequenceLengths, contigNum == 1 ? pA->contig1 : pA->contig2);
-    assert(lenPtr != NULL);
-    int64_t len = *lenPtr;
-    if(endPos > len) {
-        fprintf(stderr, "Error: alignment on %s:%" PRIi64 "-%" PRIi64 " is past chr end\n", contigNum == 1 ? pA->contig1 : pA->contig2, startPos, endPos);
+    int strand = contigNum == 1 ? cigar->strand1 : cigar->strand2;
+    int64_t startPos = contigNum == 1 ? cigar->start1 : cigar->start2;
+    int64_t endPos = contigNum == 1 ? cigar->end1 : cigar->end2;
+    if(endPos > length) {
+        fprintf(stderr, "Error: alignment on %.*s:%" PRIi64 "-%" PRIi64 " is past chr end\n",
+                (int)(contigNum == 1 ? cigar->contig1Length : cigar->contig2Length),
+                contigNum == 1 ? cigar->contig1 : cigar->contig2, startPos, endPos);
         exit(1);
     }
     int64_t curAlignmentPos = startPos;
-    for(i = 0; i < pA->operationList->length; i++) {
-        struct AlignmentOperation *op = pA->operationList->list[i];
-        switch(op->opType) {
-        case PAIRWISE_INDEL_Y:
+    for(int64_t i = 0; i < cigar->opNumber; i++) {
+        CigarOp *op = &cigar->ops[i];
+        switch(op->type) {
+        case 'I':
             if(contigNum == 2) {
                 if(strand) {
                     curAlignmentPos += op->length;
@@ -122,7 +153,7 @@ static void fillCoverage(struct PairwiseAlignment *pA, int contigNum,
                 }
             }
             break;
-        case PAIRWISE_INDEL_X:
+        case 'D':
             if(contigNum == 1) {
                 if(strand) {
                     curAlignmentPos += op->length;
@@ -131,29 +162,16 @@ static void fillCoverage(struct PairwiseAlignment *pA, int contigNum,
                 }
             }
             break;
-        case PAIRWISE_MATCH:
+        case 'M':
+            if(op->length == 0) {
+                break;
+            }
             if(strand) {
-                for(j=curAlignmentPos; j < curAlignmentPos + op->length; j++) {
-                    if(coverageArray[j] == 65535) {
-                        fprintf(stderr, "WARNING: Coverage hit cap (65535) on contig: "
-                                "%s pos: %" PRIi64 "\n",
-                                contigNum == 1 ? pA->contig1 : pA->contig2, j);
-                    } else {
-                        coverageArray[j]++;
-                    }
-                }
+                intervalList_add(coverage, curAlignmentPos, curAlignmentPos + op->length, id);
                 curAlignmentPos += op->length;
                 assert(curAlignmentPos <= endPos);
             } else {
-                for(j=curAlignmentPos-1; j >= curAlignmentPos - op->length; j--) {
-                    if(coverageArray[j] == 65535) {
-                        fprintf(stderr, "WARNING: Coverage hit cap (65535) on contig: "
-                                "%s pos: %" PRIi64 "\n",
-                                contigNum == 1 ? pA->contig1 : pA->contig2, j);
-                    } else {
-                        coverageArray[j]++;
-                    }
-                }
+                intervalList_add(coverage, curAlignmentPos - op->length, curAlignmentPos, id);
                 curAlignmentPos -= op->length;
                 assert(curAlignmentPos >= endPos);
             }
@@ -161,46 +179,191 @@ static void fillCoverage(struct PairwiseAlignment *pA, int contigNum,
     }
 }
 
-// Get the proper coverage array to fill in, given the "on" header
-// (i.e. a header in the fasta provided in the arguments to this
-// program), and the "from" header (the other header in the CIGAR file,
-// which may or may not be in that fasta). Initialize the array if necessary.
-static uint16_t *getCoverageArray(char *onHeader, char *fromHeader,
-                                  int depthById) {
-    stHash *coverageHash;
-    if (depthById) {
-        // We're splitting arrays by "id=N|" of the "from" header.
+// Get the index of the ID of the "from" header (the other header in the
+// CIGAR file, which may or may not be in the fasta), for --depthById.
+static int64_t getID(char *fromHeader) {
+    int64_t index;
+#if defined(_OPENMP)
+#pragma omp critical(coverageIDs)
+#endif
+    {
+        // We're splitting coverage by "id=N|" of the "from" header.
         stList *attributes = fastaDecodeHeader(fromHeader);
         char *id = stList_get(attributes, 0);
         if (strncmp(id, "id=", 3)) {
             st_errAbort("Using --depthById mode, but header %s does not have an "
                         "'id=N|' prefix", fromHeader);
         }
-        stHash *sequenceSubCoverage = stHash_search(IDToSequenceCoverage, id);
-        if (sequenceSubCoverage == NULL) {
-            // Initialize coverage sub-hash.
-            sequenceSubCoverage = stHash_construct3(stHash_stringKey,
-                                                    stHash_stringEqualKey, free,
-                                                    free);
-            stHash_insert(IDToSequenceCoverage, id, sequenceSubCoverage);
+        int64_t *indexPtr = stHash_search(IDs, id);
+        if (indexPtr == NULL) {
+            indexPtr = st_malloc(sizeof(int64_t));
+            *indexPtr = stHash_size(IDs);
+            stHash_insert(IDs, stString_copy(id), indexPtr);
         }
-        coverageHash = sequenceSubCoverage;
-    } else {
-        coverageHash = sequenceCoverage;
+        index = *indexPtr;
+        stList_destruct(attributes);
     }
-    int64_t *lengthPtr = stHash_search(sequenceLengths, onHeader);
-    assert(lengthPtr != NULL);
-    uint16_t *array;
-    if((array = stHash_search(coverageHash, onHeader)) == NULL) {
-        // Coverage array for this seq doesn't exist yet, so
-        // create it
-        int64_t length = *lengthPtr;
-        array = st_malloc(length * sizeof(uint16_t));
-        memset(array, 0, length * sizeof(uint16_t));
-        stHash_insert(coverageHash, stString_copy(onHeader),
-                      array);
+    return index;
+}
+
+static bool readCigar(FILE *alignmentsHandle, int64_t rangeEnd, char **line, size_t *lineCapacity, Cigar *cigar,
+                      char **contig1, char **contig2) {
+    /*
+     * Reads and parses the next cigar line starting before rangeEnd into the line buffer, returning false if there
+     * is none. The cigar lines are parsed in place, rather than read with cigarRead, which is not reentrant. The
+     * contig names are terminated in the line buffer and returned in contig1 and contig2.
+     */
+    while(ftello(alignmentsHandle) < rangeEnd) {
+        ssize_t length = getline(line, lineCapacity, alignmentsHandle);
+        if(length == -1) {
+            return 0;
+        }
+        char *lineEnd = *line + length;
+        while(lineEnd > *line && isspace(lineEnd[-1])) {
+            lineEnd--;
+        }
+        if(parseCigarLine(*line, lineEnd, cigar)) {
+            *contig1 = *line + (cigar->contig1 - *line);
+            *contig2 = *line + (cigar->contig2 - *line);
+            (*contig1)[cigar->contig1Length] = '\0';
+            (*contig2)[cigar->contig2Length] = '\0';
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void seekToLineStart(FILE *alignmentsHandle, int64_t offset) {
+    /*
+     * Moves to the first line starting at or after offset.
+     */
+    if(offset == 0) {
+        fseeko(alignmentsHandle, 0, SEEK_SET);
+        return;
+    }
+    fseeko(alignmentsHandle, offset - 1, SEEK_SET);
+    int c;
+    while((c = getc(alignmentsHandle)) != EOF && c != '\n');
+}
+
+static void readCoverage(char *alignmentsPath, int64_t rangeStart, int64_t rangeEnd, int outputOnContig1,
+                         int outputOnContig2, int depthById, IntervalList *coverage) {
+    /*
+     * Adds the coverage from the alignments whose lines start in the given byte range of the alignments file.
+     */
+    FILE *alignmentsHandle = fopen(alignmentsPath, "r");
+    if(alignmentsHandle == NULL) {
+        st_errAbort("Could not open alignments file %s", alignmentsPath);
+    }
+    seekToLineStart(alignmentsHandle, rangeStart);
+    char *line = NULL;
+    size_t lineCapacity = 0;
+    Cigar cigar = { 0 };
+    char *contig1, *contig2;
+    while(readCigar(alignmentsHandle, rangeEnd, &line, &lineCapacity, &cigar, &contig1, &contig2)) {
+        SequenceInfo *info;
+        if((outputOnContig1 && (info = stHash_search(sequenceInfos, contig1))) && ((otherGenomeSequences == NULL) || stSet_search(otherGenomeSequences, contig2))) {
+            // contig 1 is present in the fasta and contig 2 is in the
+            // "from" genome if it exists
+            fillCoverage(&cigar, 1, info->length, depthById ? getID(contig2) : 0, &coverage[info->index]);
+        }
+        if((outputOnContig2 && (info = stHash_search(sequenceInfos, contig2))) && ((otherGenomeSequences == NULL) || stSet_search(otherGenomeSequences, contig1))) {
+            // contig 2 is present in the fasta and contig 1 is in the
+            // "from" genome if it exists
+            fillCoverage(&cigar, 2, info->length, depthById ? getID(contig1) : 0, &coverage[info->index]);
+        }
     }
-    return array;
+    free(line);
+    free(cigar.ops);
+    fclose(alignmentsHandle);
+}
+
+static int cmpIntervalsByIDThenStart(const void *a, const void *b) {
+    const CoverageInterval *i = a, *j = b;
+    if(i->id != j->id) {
+        return i->id < j->id ? -1 : 1;
+    }
+    return i->start < j->start ? -1 : (i->start > j->start ? 1 : 0);
+}
+
+static int64_t mergeIntervalsByID(CoverageInterval *intervals, int64_t length) {
+    /*
+     * Replaces the intervals of each ID by their union, so that each position
+     * is counted at most once per ID, returning the new number of intervals.
+     */
+    qsort(intervals, length, sizeof(CoverageInterval), cmpIntervalsByIDThenStart);
+    int64_t j = 0;
+    for(int64_t i = 0; i < length; i++) {
+        if(j > 0 && intervals[j-1].id == intervals[i].id && intervals[i].start <= intervals[j-1].end) {
+            if(intervals[i].end > intervals[j-1].end) {
+                intervals[j-1].end = intervals[i].end;
+            }
+        } else {
+            intervals[j++] = intervals[i];
+        }
+    }
+    return j;
+}
+
+static int cmpInt64s(const void *a, const void *b) {
+    int64_t i = *(const int64_t *)a, j = *(const int64_t *)b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+static CoverageRun *getCoverageRuns(char *name, CoverageInterval *intervals, int64_t length, int64_t *runNumber) {
+    /*
+     * Sweeps the sorted interval starts and ends to get the runs of
+     * constant, non-zero coverage depth.
+     */
+    int64_t *starts = st_malloc(length * sizeof(int64_t));
+    int64_t *ends = st_malloc(length * sizeof(int64_t));
+    for(int64_t i = 0; i < length; i++) {
+        starts[i] = intervals[i].start;
+        ends[i] = intervals[i].end;
+    }
+    qsort(starts, length, sizeof(int64_t), cmpInt64s);
+    qsort(ends, length, sizeof(int64_t), cmpInt64s);
+
+    CoverageRun *runs = NULL;
+    int64_t runCapacity = 0;
+    *runNumber = 0;
+    int64_t depth = 0, runStart = 0, i = 0, j = 0;
+    uint16_t runDepth = 0;
+    bool warned = 0;
+    while(j < length) {
+        int64_t position = i < length && starts[i] < ends[j] ? starts[i] : ends[j];
+        while(i < length && starts[i] == position) {
+            depth++;
+            i++;
+        }
+        while(j < length && ends[j] == position) {
+            depth--;
+            j++;
+        }
+        if(depth > MAX_COVERAGE && !warned) {
+            fprintf(stderr, "WARNING: Coverage hit cap (%d) on contig: "
+                    "%s pos: %" PRIi64 "\n", MAX_COVERAGE, name, position);
+            warned = 1;
+        }
+        uint16_t newDepth = depth > MAX_COVERAGE ? MAX_COVERAGE : depth;
+        if(newDepth != runDepth) {
+            if(runDepth != 0) {
+                if(*runNumber == runCapacity) {
+                    runCapacity = runCapacity == 0 ? 64 : 2 * runCapacity;
+                    runs = st_realloc(runs, runCapacity * sizeof(CoverageRun));
+                }
+                runs[*runNumber].start = runStart;
+                runs[*runNumber].end = position;
+                runs[(*runNumber)++].depth = runDepth;
+            }
+            runStart = position;
+            runDepth = newDepth;
+        }
+    }
+    assert(depth == 0 && runDepth == 0);
+    free(starts);
+    free(ends);
+    return runs;
 }
 
 int main(int argc, char *argv[])
@@ -211,9 +374,11 @@ int main(int argc, char *argv[])
                              {"onlyContig2", no_argument, NULL, '2'},
                              {"depthById", no_argument, NULL, 'i'},
                              {"from", required_argument, NULL, 'f'},
+                             {"threads", required_argument, NULL, 'T'},
                              {0, 0, 0, 0} };
     int outputOnContig1 = TRUE, outputOnContig2 = TRUE, depthById = FALSE;
     int64_t flag, i;
+    int numThreads = 1;
     while((flag = getopt_long(argc, argv, "", opts, NULL)) != -1) {
         switch(flag) {
         case '1':
@@ -228,6 +393,11 @@ int main(int argc, char *argv[])
         case 'f':
             stList_append(otherGenomeFastaPaths, stString_copy(optarg));
             break;
+        case 'T':
+            if(sscanf(optarg, "%d", &numThreads) != 1 || numThreads <= 0) {
+                st_errAbort("--threads must be a positive integer");
+            }
+            break;
         case '?':
         default:
             usage();
@@ -239,6 +409,9 @@ int main(int argc, char *argv[])
                 "mutually exclusive\n");
         return 1;
     }
+#if defined(_OPENMP)
+    omp_set_num_threads(numThreads);
+#endif
 
     if(stList_length(otherGenomeFastaPaths) > 0) {
         otherGenomeSequences = stSet_construct3(stHash_stringKey,
@@ -261,15 +434,10 @@ int main(int argc, char *argv[])
     stList_destruct(otherGenomeFastaPaths);
     otherGenomeFastaPaths = NULL;
 
-    sequenceLengths = stHash_construct3(stHash_stringKey,
-                                        stHash_stringEqualKey, free, free);
-    sequenceCoverage = stHash_construct3(stHash_stringKey,
-                                         stHash_stringEqualKey, free, free);
+    sequenceInfos = stHash_construct3(stHash_stringKey,
+                                      stHash_stringEqualKey, free, free);
     sequenceNames = stList_construct3(0, free);
-    IDToSequenceCoverage = stHash_construct3(stHash_stringKey,
-                                             stHash_stringEqualKey,
-                                             free,
-                                             (void (*)(void *)) stHash_destruct);
+    IDs = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free, free);
 
     if (optind >= argc - 1) {
         fprintf(stderr, "fasta file for sequence and alignments file (in "
@@ -284,76 +452,80 @@ int main(int argc, char *argv[])
     }
     fastaReadToFunction(fastaHandle, NULL, addSequenceLength);
     fclose(fastaHandle);
+    int64_t sequenceNumber = stList_length(sequenceNames);
 
-    // Fill coverage arrays with the alignments
-    FILE *alignmentsHandle = fopen(argv[optind + 1], "r");
-    for(;;) {
-        int64_t *lengthPtr;
-        struct PairwiseAlignment *pA = cigarRead(alignmentsHandle);
-        if(pA == NULL) {
-            // Reached end of alignment file
-            break;
-        }
-        if((outputOnContig1 && (lengthPtr = stHash_search(sequenceLengths, pA->contig1))) && ((otherGenomeSequences == NULL) || stSet_search(otherGenomeSequences, pA->contig2))) {
-            // contig 1 is present in the fasta and contig 2 is in the
-            // "from" genome if it exists
-            uint16_t *array = getCoverageArray(pA->contig1, pA->contig2,
-                                               depthById);
-            fillCoverage(pA, 1, array);
-        }
-        if((outputOnContig2 && (lengthPtr = stHash_search(sequenceLengths, pA->contig2))) && ((otherGenomeSequences == NULL) || stSet_search(otherGenomeSequences, pA->contig1))) {
-            // contig 2 is present in the fasta and contig 1 is in the
-            // "from" genome if it exists
-            uint16_t *array = getCoverageArray(pA->contig2, pA->contig1,
-                                               depthById);
-            fillCoverage(pA, 2, array);
-        }
-        destructPairwiseAlignment(pA);
+    // Split the alignments file into a byte range per thread
+    char *alignmentsPath = argv[optind + 1];
+    FILE *alignmentsHandle = fopen(alignmentsPath, "r");
+    if (!alignmentsHandle) {
+        st_errAbort("Could not open alignments file %s", alignmentsPath);
     }
+    fseeko(alignmentsHandle, 0, SEEK_END);
+    int64_t fileSize = ftello(alignmentsHandle);
     fclose(alignmentsHandle);
+    int64_t threadNumber = 1;
+#if defined(_OPENMP)
+    threadNumber = omp_get_max_threads();
+#endif
+    int64_t rangeLength = fileSize / threadNumber + 1;
 
-    if (depthById) {
-        // Have to merge all coverage arrays that are divided by
-        // source ID into the main sequenceCoverage hash.
-        stHashIterator *idIt = stHash_getIterator(IDToSequenceCoverage);
-        char *id;
-        while ((id = stHash_getNext(idIt)) != NULL) {
-            stHash *subHash = stHash_search(IDToSequenceCoverage, id);
-            assert(subHash != NULL);
-            stHashIterator *sequenceIt = stHash_getIterator(subHash);
-            char *sequence;
-            while ((sequence = stHash_getNext(sequenceIt)) != NULL) {
-                uint16_t *srcArray = stHash_search(subHash, sequence);
-                assert(srcArray != NULL);
-                uint16_t *destArray = getCoverageArray(sequence, NULL, FALSE);
-                int64_t *length = stHash_search(sequenceLengths, sequence);
-                assert(length != NULL && *length >= 0);
-                for (int64_t i = 0; i < *length; i++) {
-                    if (srcArray[i] > 0) {
-                        destArray[i]++;
-                    }
-                }
-            }
+    // Collect the coverage intervals of each sequence, per thread
+    IntervalList **threadCoverage = st_malloc(threadNumber * sizeof(IntervalList *));
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static, 1)
+#endif
+    for(int64_t t = 0; t < threadNumber; t++) {
+        threadCoverage[t] = st_calloc(sequenceNumber > 0 ? sequenceNumber : 1, sizeof(IntervalList));
+        readCoverage(alignmentsPath, t * rangeLength, (t + 1) * rangeLength, outputOnContig1, outputOnContig2,
+                     depthById, threadCoverage[t]);
+    }
+
+    // Merge the threads' intervals and sweep them for each sequence
+    CoverageRun **runs = st_calloc(sequenceNumber > 0 ? sequenceNumber : 1, sizeof(CoverageRun *));
+    int64_t *runNumbers = st_calloc(sequenceNumber > 0 ? sequenceNumber : 1, sizeof(int64_t));
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for(int64_t j = 0; j < sequenceNumber; j++) {
+        int64_t length = 0;
+        for(int64_t t = 0; t < threadNumber; t++) {
+            length += threadCoverage[t][j].length;
         }
-        stHash_destruct(IDToSequenceCoverage);
+        if(length == 0) {
+            continue;
+        }
+        CoverageInterval *intervals = st_malloc(length * sizeof(CoverageInterval));
+        length = 0;
+        for(int64_t t = 0; t < threadNumber; t++) {
+            IntervalList *list = &threadCoverage[t][j];
+            memcpy(intervals + length, list->intervals, list->length * sizeof(CoverageInterval));
+            length += list->length;
+            free(list->intervals);
+        }
+        if(depthById) {
+            // Score coverage depth by the number of different IDs
+            length = mergeIntervalsByID(intervals, length);
+        }
+        runs[j] = getCoverageRuns(stList_get(sequenceNames, j), intervals, length, &runNumbers[j]);
+        free(intervals);
     }
 
     // Print results as BED
-    for(i = 0; i < stList_length(sequenceNames); i++) {
-        uint16_t *array;
-        char *name = stList_get(sequenceNames, i);
-        int64_t *lengthPtr = stHash_search(sequenceLengths, name);
-        assert(lengthPtr != NULL);
-        int64_t length = *lengthPtr;
-        if((array = stHash_search(sequenceCoverage, name))) {
-            printCoverage(name, array, length);
-        }
+    for(i = 0; i < sequenceNumber; i++) {
+        printCoverage(stList_get(sequenceNames, i), runs[i], runNumbers[i]);
+        free(runs[i]);
     }
 
     // Cleanup
+    for(int64_t t = 0; t < threadNumber; t++) {
+        free(threadCoverage[t]);
+    }
+    free(threadCoverage);
+    free(runs);
+    free(runNumbers);
     stList_destruct(sequenceNames);
-    stHash_destruct(sequenceCoverage);
-    stHash_destruct(sequenceLengths);
+    stHash_destruct(sequenceInfos);
+    stHash_destruct(IDs);
     if(otherGenomeSequences) {
 //        stSet_destruct(otherGenomeSequences);
     }
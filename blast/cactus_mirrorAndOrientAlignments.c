@@ -6,70 +6,192 @@
 
 #include "sonLib.h"
 #include "pairwiseAlignment.h"
+#include "blastAlignmentLib.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 /*
  * Script takes a set of pairwise alignments using the lastz cigar format and returns a modified
  * set such that all alignments are reported with respect to the positive strand of the first sequence
  * and such that all alignments are mirrored, so that they are additionally reporting after flipping the first
  * sequence for the second sequence.
+ *
+ * Rather than reading each alignment with cigarRead and writing it with cigarWrite, the cigar lines are parsed in
+ * place with parseCigarLine and the output written straight from their tokens, giving the same text as cigarWrite.
+ * The input is read in batches of pieces of whole lines, which are processed in parallel and written out in order.
  */
 
-void invertStrands(struct PairwiseAlignment *pairwiseAlignment) {
+#define MIRROR_PIECE_BYTES (1 << 20)
+#define MIRROR_PIECES_PER_THREAD 4
+// Room for the formatted score and coordinates beyond the length of the input line, per output line
+#define MIRROR_LINE_SLACK 256
+
+typedef struct _buffer {
+	char *text;
+	int64_t length;
+	int64_t maxLength;
+} Buffer;
+
+static void buffer_reserve(Buffer *buffer, int64_t length) {
+	if(buffer->length + length > buffer->maxLength) {
+		buffer->maxLength = (buffer->length + length) * 2;
+		buffer->text = st_realloc(buffer->text, buffer->maxLength);
+	}
+}
+
+static void invertCigarStrands(Cigar *cigar, bool *opsReversed) {
 	/*
-	 * Inverts the strands of the alignment.
+	 * Inverts the strands of the alignment, flipping opsReversed, which says if the ops are to be written in reverse
+	 * order.
 	 */
 	// Flips the strands of first sequence
 
-	if(pairwiseAlignment->start1 != pairwiseAlignment->end1) { // If alignment has non zero length on the first sequence
-		int64_t start = pairwiseAlignment->start1;
-		pairwiseAlignment->start1 = pairwiseAlignment->end1;
-		pairwiseAlignment->end1 = start;
+	if(cigar->start1 != cigar->end1) { // If alignment has non zero length on the first sequence
+		int64_t start = cigar->start1;
+		cigar->start1 = cigar->end1;
+		cigar->end1 = start;
 	}
-	pairwiseAlignment->strand1 = pairwiseAlignment->strand1 ? 0 : 1;
+	cigar->strand1 = !cigar->strand1;
 
-	if(pairwiseAlignment->start1 != pairwiseAlignment->end1) { // If alignment has non zero length on the second sequence
-		int64_t start = pairwiseAlignment->start2;
-		pairwiseAlignment->start2 = pairwiseAlignment->end2;
-		pairwiseAlignment->end2 = start;
+	if(cigar->start1 != cigar->end1) { // If alignment has non zero length on the second sequence
+		int64_t start = cigar->start2;
+		cigar->start2 = cigar->end2;
+		cigar->end2 = start;
 	}
-	pairwiseAlignment->strand2 = pairwiseAlignment->strand2 ? 0 : 1;
+	cigar->strand2 = !cigar->strand2;
 
 	// Invert the order of the operations
-	listReverse(pairwiseAlignment->operationList);
+	*opsReversed = !*opsReversed;
 }
 
-void cigarReverse(struct PairwiseAlignment *pairwiseAlignment) {
+static void mirrorCigar(Cigar *cigar, bool *opsMirrored) {
 	/*
-	 * Flips the query and target sequences
+	 * Flips the query and target sequences, flipping opsMirrored, which says if the I and D ops are to be swapped
+	 * when written.
 	 */
 
 	// Swap the 1s and 2s
-	char *contig1 = pairwiseAlignment->contig1;
-	int64_t start1 = pairwiseAlignment->start1;
-	int64_t end1 = pairwiseAlignment->end1;
-	int64_t strand1 = pairwiseAlignment->strand1;
+	const char *contig1 = cigar->contig1;
+	int64_t contig1Length = cigar->contig1Length;
+	int64_t start1 = cigar->start1;
+	int64_t end1 = cigar->end1;
+	bool strand1 = cigar->strand1;
 
-	pairwiseAlignment->contig1 = pairwiseAlignment->contig2;
-	pairwiseAlignment->start1 = pairwiseAlignment->start2;
-	pairwiseAlignment->end1 = pairwiseAlignment->end2;
-	pairwiseAlignment->strand1 = pairwiseAlignment->strand2;
+	cigar->contig1 = cigar->contig2;
+	cigar->contig1Length = cigar->contig2Length;
+	cigar->start1 = cigar->start2;
+	cigar->end1 = cigar->end2;
+	cigar->strand1 = cigar->strand2;
 
-	pairwiseAlignment->contig2 = contig1;
-	pairwiseAlignment->start2 = start1;
-	pairwiseAlignment->end2 = end1;
-	pairwiseAlignment->strand2 = strand1;
+	cigar->contig2 = contig1;
+	cigar->contig2Length = contig1Length;
+	cigar->start2 = start1;
+	cigar->end2 = end1;
+	cigar->strand2 = strand1;
 
 	// Invert the operations
-	struct AlignmentOperation *op;
-	for(int64_t i=0; i<pairwiseAlignment->operationList->length; i++) {
-		op = pairwiseAlignment->operationList->list[i];
-		assert(op->length >= 0);
-		if(op->opType == PAIRWISE_INDEL_Y) {
-			op->opType = PAIRWISE_INDEL_X;
+	*opsMirrored = !*opsMirrored;
+}
+
+static char *formatInt(char *p, int64_t i) {
+	char digits[20];
+	int64_t j = 0;
+	uint64_t k = i < 0 ? -(uint64_t)i : (uint64_t)i;
+	if(i < 0) {
+		*p++ = '-';
+	}
+	do {
+		digits[j++] = '0' + k % 10;
+		k /= 10;
+	} while(k > 0);
+	while(j > 0) {
+		*p++ = digits[--j];
+	}
+	return p;
+}
+
+static char *formatContig(char *p, const char *contig, int64_t contigLength, int64_t start, int64_t end,
+		bool strand) {
+	memcpy(p, contig, contigLength);
+	p += contigLength;
+	*p++ = ' ';
+	p = formatInt(p, start);
+	*p++ = ' ';
+	p = formatInt(p, end);
+	*p++ = ' ';
+	*p++ = strand ? '+' : '-';
+	return p;
+}
+
+static void writeCigar(Cigar *cigar, bool opsReversed, bool opsMirrored, const char *score, int64_t scoreLength, int64_t lineLength, Buffer *out) {
+	/*
+	 * Appends the cigar to out as cigarWrite would write it.
+	 */
+	buffer_reserve(out, lineLength + MIRROR_LINE_SLACK);
+	char *p = out->text + out->length;
+	memcpy(p, "cigar: ", 7);
+	p += 7;
+	p = formatContig(p, cigar->contig2, cigar->contig2Length, cigar->start2, cigar->end2, cigar->strand2);
+	*p++ = ' ';
+	p = formatContig(p, cigar->contig1, cigar->contig1Length, cigar->start1, cigar->end1, cigar->strand1);
+	*p++ = ' ';
+	memcpy(p, score, scoreLength);
+	p += scoreLength;
+	for(int64_t i=0; i<cigar->opNumber; i++) {
+		CigarOp *op = &cigar->ops[opsReversed ? cigar->opNumber - 1 - i : i];
+		*p++ = ' ';
+		*p++ = !opsMirrored || op->type == 'M' ? op->type : op->type == 'I' ? 'D' : 'I';
+		*p++ = ' ';
+		p = formatInt(p, op->length);
+	}
+	*p++ = '\n';
+	out->length = p - out->text;
+	assert(out->length <= out->maxLength);
+}
+
+static void mirrorAndOrientPiece(const char *piece, int64_t pieceLength, Cigar *cigar, Buffer *out) {
+	/*
+	 * For each cigar line of the piece writes out the oriented alignment and its oriented mirror.
+	 */
+	out->length = 0;
+	const char *pieceEnd = piece + pieceLength;
+	for(const char *line = piece, *lineEnd; line < pieceEnd; line = lineEnd + 1) {
+		lineEnd = memchr(line, '\n', pieceEnd - line);
+		assert(lineEnd != NULL);
+		if(!parseCigarLine(line, lineEnd, cigar)) { // Skip blank lines
+			continue;
+		}
+		// The contig names can be longer than MIRROR_LINE_SLACK but not than the line they came from
+		int64_t lineLength = lineEnd - line;
+		// Score is written as cigarWrite writes it, and is the same for both lines
+		char scoreString[MIRROR_LINE_SLACK / 2];
+		int64_t scoreLength = snprintf(scoreString, sizeof(scoreString), "%f", cigar->score);
+		if(scoreLength >= (int64_t)sizeof(scoreString)) {
+			st_errAbort("Got a cigar with an out of range score: %.*s\n", (int)lineLength, line);
+		}
+
+		// Write out original cigar
+		bool opsReversed = 0, opsMirrored = 0;
+		if(!cigar->strand1) {
+			invertCigarStrands(cigar, &opsReversed);
 		}
-		else if(op->opType == PAIRWISE_INDEL_X) {
-			op->opType = PAIRWISE_INDEL_Y;
+		writeCigar(cigar, opsReversed, opsMirrored, scoreString, scoreLength, lineLength, out);
+
+		// Write out mirror cigar (with query and target reversed)
+		mirrorCigar(cigar, &opsMirrored);
+		if(!cigar->strand1) {
+			invertCigarStrands(cigar, &opsReversed);
 		}
+		writeCigar(cigar, opsReversed, opsMirrored, scoreString, scoreLength, lineLength, out);
+	}
+}
+
+static void writeOutput(const void *buffer, int64_t length, FILE *fileHandle) {
+	if(fwrite(buffer, 1, length, fileHandle) != length) {
+		st_errAbort("Failed to write alignments\n");
 	}
 }
 
@@ -92,28 +214,90 @@ int main(int argc, char *argv[]) {
 		assert(argc == 2);
 	}
 
-    struct PairwiseAlignment *pairwiseAlignment;
+	int64_t batchSize = MIRROR_PIECES_PER_THREAD;
+#if defined(_OPENMP)
+	batchSize *= omp_get_max_threads();
+#endif
+	// Per piece of the batch, its start in the input buffer, its output and the scratch space to parse its lines
+	int64_t *pieceStarts = st_malloc(sizeof(int64_t) * (batchSize + 1));
+	Buffer *outs = st_calloc(batchSize, sizeof(Buffer));
+	Cigar *cigars = st_calloc(batchSize, sizeof(Cigar));
 
-    while ((pairwiseAlignment = cigarRead(fileHandleIn)) != NULL) {
+	// The input buffer, holding the lines of the current batch followed by the start of the next
+	int64_t inLength = 0, inMaxLength = batchSize * MIRROR_PIECE_BYTES;
+	char *in = st_malloc(inMaxLength + 1);
+	bool endOfInput = 0;
+	while(!endOfInput || inLength > 0) {
+		// Fill the buffer, ending it with a newline at the end of the input
+		if(!endOfInput) {
+			inLength += fread(in + inLength, 1, inMaxLength - inLength, fileHandleIn);
+			if(inLength < inMaxLength) {
+				if(ferror(fileHandleIn)) {
+					st_errAbort("Failed to read alignments\n");
+				}
+				endOfInput = 1;
+				if(inLength > 0 && in[inLength - 1] != '\n') {
+					in[inLength++] = '\n';
+				}
+			}
+		}
 
-        // Write out original cigar
-    	if(!pairwiseAlignment->strand1) {
-    		invertStrands(pairwiseAlignment);
-    	}
-    	checkPairwiseAlignment(pairwiseAlignment);
-        cigarWrite(fileHandleOut, pairwiseAlignment, 0);
+		// The batch is the complete lines in the buffer
+		int64_t batchLength = inLength;
+		while(batchLength > 0 && in[batchLength - 1] != '\n') {
+			batchLength--;
+		}
+		if(batchLength == 0) {
+			if(inLength == 0) {
+				break;
+			}
+			// A line longer than the buffer
+			assert(!endOfInput);
+			inMaxLength *= 2;
+			in = st_realloc(in, inMaxLength + 1);
+			continue;
+		}
 
-        // Write out mirror cigar (with query and target reversed)
-        cigarReverse(pairwiseAlignment);
-        if(!pairwiseAlignment->strand1) {
-        	invertStrands(pairwiseAlignment);
-        }
-        checkPairwiseAlignment(pairwiseAlignment);
-        cigarWrite(fileHandleOut, pairwiseAlignment, 0);
+		// Split the batch into pieces of whole lines
+		int64_t pieceNumber = 0;
+		pieceStarts[0] = 0;
+		while(pieceStarts[pieceNumber] < batchLength) {
+			int64_t pieceEnd = pieceStarts[pieceNumber] + batchLength / batchSize + 1;
+			if(pieceEnd >= batchLength || pieceNumber + 1 == batchSize) {
+				pieceEnd = batchLength;
+			}
+			else {
+				while(in[pieceEnd - 1] != '\n') {
+					pieceEnd++;
+				}
+			}
+			pieceStarts[++pieceNumber] = pieceEnd;
+		}
 
-        // Cleanup
-        destructPairwiseAlignment(pairwiseAlignment);
-    }
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+		for(int64_t i=0; i<pieceNumber; i++) {
+			mirrorAndOrientPiece(in + pieceStarts[i], pieceStarts[i+1] - pieceStarts[i], &cigars[i], &outs[i]);
+		}
+		for(int64_t i=0; i<pieceNumber; i++) {
+			writeOutput(outs[i].text, outs[i].length, fileHandleOut);
+		}
+
+		// Move the start of the next batch to the front of the buffer
+		memmove(in, in + batchLength, inLength - batchLength);
+		inLength -= batchLength;
+	}
+
+	// Cleanup
+	for(int64_t i=0; i<batchSize; i++) {
+		free(outs[i].text);
+		free(cigars[i].ops);
+	}
+	free(outs);
+	free(cigars);
+	free(pieceStarts);
+	free(in);
     fclose(fileHandleIn);
     fclose(fileHandleOut);
 
@@ -19,155 +19,201 @@ uint64_t getEndCoordinate(struct PairwiseAlignment *pairwiseAlignment) {
 	return pairwiseAlignment->end1;
 }
 
-struct PairwiseAlignment *removeAlignmentPrefix(struct PairwiseAlignment *pairwiseAlignment, int64_t prefixEnd) {
-	// Store the original start coordinates
-	//checkPairwiseAlignment(pairwiseAlignment);
-	int64_t start1 = pairwiseAlignment->start1, start2 = pairwiseAlignment->start2;
-	assert(pairwiseAlignment->end1 > prefixEnd);
-	assert(pairwiseAlignment->start1 < prefixEnd);
-	assert(pairwiseAlignment->strand1);
-
-	// Split the ops in the cigar string between the prefix and suffix alignments
-	struct List *prefixOps = constructEmptyList(0, (void (*)(void *))destructAlignmentOperation);
-	int64_t i = 0;
-	do {
-		assert(i < pairwiseAlignment->operationList->length);
-		struct AlignmentOperation *op = pairwiseAlignment->operationList->list[i];
-		assert(op->length > 0);
+/*
+ * An active alignment is a cursor into the operations of an alignment read from the input, which are never modified.
+ * Everything before the cursor has already been written out as prefixes of the alignment.
+ */
+typedef struct _activeAlignment {
+	struct PairwiseAlignment *pairwiseAlignment;
+	int64_t opIndex; // Index of the first operation not completely written out
+	int64_t opOffset; // Length of the operation at opIndex already written out
+	int64_t start1, start2; // Start coordinates of the remaining suffix of the alignment
+	int64_t order; // Order the alignment was read in, to break ties between alignments with the same end
+} ActiveAlignment;
 
-		if(op->opType == PAIRWISE_INDEL_Y) { // Insert in second sequence
-			listAppend(prefixOps, op);
-			i++;
-			pairwiseAlignment->start2 += pairwiseAlignment->strand2 ? op->length : -op->length;
-		}
-		else { // Not an insert in second sequence
-			// Op is in the prefix alignment
-			int64_t j;
-			if(pairwiseAlignment->start1 + op->length <= prefixEnd) {
-				listAppend(prefixOps, op);
-				i++;
-				j = op->length;
-			}
-			// Op spans the prefix and suffix alignments, so split it
-			else {
-				j = prefixEnd-pairwiseAlignment->start1;
-				assert(j > 0);
-				listAppend(prefixOps, constructAlignmentOperation(op->opType, j, op->score));
-				op->length -= j;
-				assert(op->length > 0);
-				assert(pairwiseAlignment->start1+j == prefixEnd);
-			}
+/*
+ * Min-heap of active alignments ordered by end coordinate on the first sequence.
+ */
+typedef struct _activeAlignmentHeap {
+	ActiveAlignment *alignments;
+	int64_t length;
+	int64_t maxLength;
+	int64_t alignmentsRead;
+} ActiveAlignmentHeap;
 
-			// Update start coordinates of suffix alignments
-			pairwiseAlignment->start1 += j;
-			if(op->opType != PAIRWISE_INDEL_X) {
-				pairwiseAlignment->start2 += pairwiseAlignment->strand2 ? j : -j;
-			}
-		}
-	} while(pairwiseAlignment->start1 < prefixEnd);
+static bool activeAlignment_lessThan(ActiveAlignment *a1, ActiveAlignment *a2) {
+	uint64_t end1 = getEndCoordinate(a1->pairwiseAlignment), end2 = getEndCoordinate(a2->pairwiseAlignment);
+	return end1 < end2 || (end1 == end2 && a1->order < a2->order);
+}
 
-	assert(pairwiseAlignment->start1 == prefixEnd);
+static void activeAlignmentHeap_swap(ActiveAlignmentHeap *heap, int64_t i, int64_t j) {
+	ActiveAlignment a = heap->alignments[i];
+	heap->alignments[i] = heap->alignments[j];
+	heap->alignments[j] = a;
+}
 
-        if (i > 0) {
-            // Remove prefix ops from pairwise alignment
-            uint64_t j=0;
+static ActiveAlignment *activeAlignmentHeap_peek(ActiveAlignmentHeap *heap) {
+	assert(heap->length > 0);
+	return &heap->alignments[0];
+}
 
-            while(i < pairwiseAlignment->operationList->length) {
-                pairwiseAlignment->operationList->list[j++] = pairwiseAlignment->operationList->list[i++];
-            }
-            pairwiseAlignment->operationList->length = j;
-        }
-        assert(pairwiseAlignment->operationList->length > 0);
+static void activeAlignmentHeap_insert(ActiveAlignmentHeap *heap, struct PairwiseAlignment *pairwiseAlignment) {
+	if(heap->length == heap->maxLength) {
+		heap->maxLength = heap->maxLength == 0 ? 16 : heap->maxLength * 2;
+		heap->alignments = st_realloc(heap->alignments, heap->maxLength * sizeof(ActiveAlignment));
+	}
+	ActiveAlignment *activeAlignment = &heap->alignments[heap->length];
+	activeAlignment->pairwiseAlignment = pairwiseAlignment;
+	activeAlignment->opIndex = 0;
+	activeAlignment->opOffset = 0;
+	activeAlignment->start1 = pairwiseAlignment->start1;
+	activeAlignment->start2 = pairwiseAlignment->start2;
+	activeAlignment->order = heap->alignmentsRead++;
 
-	// Create prefix pairwiseAlignment
-	struct PairwiseAlignment *prefixAlignment = constructPairwiseAlignment(pairwiseAlignment->contig1,
-			start1, pairwiseAlignment->start1, 1,
-			pairwiseAlignment->contig2, start2, pairwiseAlignment->start2, pairwiseAlignment->strand2,
-			pairwiseAlignment->score, prefixOps);
+	// Sift up
+	int64_t i = heap->length++;
+	while(i > 0 && activeAlignment_lessThan(&heap->alignments[i], &heap->alignments[(i-1)/2])) {
+		activeAlignmentHeap_swap(heap, i, (i-1)/2);
+		i = (i-1)/2;
+	}
+}
 
-	return prefixAlignment;
+/*
+ * Removes the alignment with the smallest end coordinate, destructing its pairwise alignment.
+ */
+static void activeAlignmentHeap_removeFirst(ActiveAlignmentHeap *heap) {
+	assert(heap->length > 0);
+	destructPairwiseAlignment(heap->alignments[0].pairwiseAlignment);
+	heap->alignments[0] = heap->alignments[--heap->length];
+
+	// Sift down
+	int64_t i = 0;
+	while(1) {
+		int64_t smallest = i, left = 2*i+1, right = 2*i+2;
+		if(left < heap->length && activeAlignment_lessThan(&heap->alignments[left], &heap->alignments[smallest])) {
+			smallest = left;
+		}
+		if(right < heap->length && activeAlignment_lessThan(&heap->alignments[right], &heap->alignments[smallest])) {
+			smallest = right;
+		}
+		if(smallest == i) {
+			break;
+		}
+		activeAlignmentHeap_swap(heap, i, smallest);
+		i = smallest;
+	}
 }
 
-void emitBlock(stSortedSet *activeAlignments, uint64_t from, uint64_t to, FILE *fileHandleOut) {
+static void emitAlignmentPrefix(ActiveAlignment *activeAlignment, int64_t prefixEnd, struct List *prefixOps,
+		FILE *fileHandleOut) {
 	/*
-	 * Emits block of alignments that are all start, inclusive, at 'fromt' and end, exclusive, at 'to'.
+	 * Writes out the alignment from the cursor up to prefixEnd and moves the cursor to prefixEnd. The prefix is built
+	 * in a scratch alignment that shares the operations of the input alignment; only the operations split at
+	 * either end of the prefix are copied, into partialOps.
 	 */
-	// Now split the remaining alignments, which must all end after prefixEnd
-	struct PairwiseAlignment *pairwiseAlignment;
-	while(stSortedSet_size(activeAlignments) > 0 &&
-		  getStartCoordinate(pairwiseAlignment = stSortedSet_getFirst(activeAlignments)) < to) {
-		assert(getStartCoordinate(pairwiseAlignment) == from);
-		//assert(getEndCoordinate(pairwiseAlignment) >= to);
-		
-		// Remove from active alignments
-		assert(stSortedSet_search(activeAlignments, pairwiseAlignment) == pairwiseAlignment);
-		stSortedSet_remove(activeAlignments, pairwiseAlignment);
-		assert(stSortedSet_search(activeAlignments, pairwiseAlignment) == NULL);
-		
-		// If the alignment needs to be split
-		if(getEndCoordinate(pairwiseAlignment) > to) {
-			// Cleave off the prefix of the alignment
-			struct PairwiseAlignment *prefixPairwiseAlignment = removeAlignmentPrefix(pairwiseAlignment, to);
-			assert(getStartCoordinate(prefixPairwiseAlignment) == from);
-			assert(getEndCoordinate(prefixPairwiseAlignment) == to);
-			assert(getStartCoordinate(pairwiseAlignment) == to);
-
-			// Add back the suffix alignment to the set
-			stSortedSet_insert(activeAlignments, pairwiseAlignment);
-
-			// Set the prefix alignment to be written out and then cleaned up
-			pairwiseAlignment = prefixPairwiseAlignment;
+	struct PairwiseAlignment *pairwiseAlignment = activeAlignment->pairwiseAlignment;
+	struct List *ops = pairwiseAlignment->operationList;
+	struct AlignmentOperation partialOps[2];
+	int64_t partialOpNumber = 0;
+	int64_t start1 = activeAlignment->start1, start2 = activeAlignment->start2;
+	assert(start1 < prefixEnd);
+	assert(getEndCoordinate(pairwiseAlignment) >= prefixEnd);
+	// The last prefix also takes any trailing inserts in the second sequence
+	bool isLastPrefix = getEndCoordinate(pairwiseAlignment) == prefixEnd;
+
+	prefixOps->length = 0;
+	while(activeAlignment->opIndex < ops->length && (activeAlignment->start1 < prefixEnd || isLastPrefix)) {
+		struct AlignmentOperation *op = ops->list[activeAlignment->opIndex];
+		int64_t remaining = op->length - activeAlignment->opOffset;
+		assert(remaining > 0);
+
+		// Length of the op that is in the prefix
+		int64_t j = remaining;
+		if(op->opType != PAIRWISE_INDEL_Y && activeAlignment->start1 + remaining > prefixEnd) {
+			j = prefixEnd - activeAlignment->start1;
+		}
+		assert(j > 0);
+
+		if(j == op->length) {
+			listAppend(prefixOps, op);
+		}
+		else { // Op spans the cursor or prefixEnd, so the prefix gets a copy of its piece of it
+			assert(partialOpNumber < 2);
+			struct AlignmentOperation *partialOp = &partialOps[partialOpNumber++];
+			*partialOp = *op;
+			partialOp->length = j;
+			listAppend(prefixOps, partialOp);
+		}
+
+		// Move the cursor past the piece
+		if(op->opType != PAIRWISE_INDEL_Y) {
+			activeAlignment->start1 += j;
+		}
+		if(op->opType != PAIRWISE_INDEL_X) {
+			activeAlignment->start2 += pairwiseAlignment->strand2 ? j : -j;
+		}
+		if(j == remaining) {
+			activeAlignment->opIndex++;
+			activeAlignment->opOffset = 0;
+		}
+		else {
+			activeAlignment->opOffset += j;
 		}
-		
-		// Write out the prefix alignment up until end
-		cigarWrite(fileHandleOut, pairwiseAlignment, 0);
-		// Delete the pairwise alignment
-		assert(stSortedSet_search(activeAlignments, pairwiseAlignment) == NULL);
-		destructPairwiseAlignment(pairwiseAlignment);
 	}
+	assert(activeAlignment->start1 == prefixEnd);
+
+	struct PairwiseAlignment prefixAlignment = *pairwiseAlignment;
+	prefixAlignment.start1 = start1;
+	prefixAlignment.end1 = prefixEnd;
+	prefixAlignment.start2 = start2;
+	prefixAlignment.end2 = activeAlignment->start2;
+	prefixAlignment.operationList = prefixOps;
+	//checkPairwiseAlignment(&prefixAlignment);
+	cigarWrite(fileHandleOut, &prefixAlignment, 0);
 }
 
-void splitAlignmentOverlaps(stSortedSet *activeAlignments, uint64_t splitUpto, FILE *fileHandleOut) {
-	if(stSortedSet_size(activeAlignments) == 0) {
+void emitBlock(ActiveAlignmentHeap *activeAlignments, uint64_t from, uint64_t to, struct List *prefixOps,
+		FILE *fileHandleOut) {
+	/*
+	 * Emits block of alignments that are all start, inclusive, at 'from' and end, exclusive, at 'to'.
+	 */
+	// Every active alignment starts at from and ends at or after to, so write out the prefix of each. Moving the
+	// cursors does not change the end coordinates, so the heap stays ordered.
+	for(int64_t i=0; i<activeAlignments->length; i++) {
+		assert(activeAlignments->alignments[i].start1 == from);
+		emitAlignmentPrefix(&activeAlignments->alignments[i], to, prefixOps, fileHandleOut);
+	}
+
+	// Remove the alignments that have been completely written out
+	while(activeAlignments->length > 0 &&
+		  getEndCoordinate(activeAlignmentHeap_peek(activeAlignments)->pairwiseAlignment) == to) {
+		activeAlignmentHeap_removeFirst(activeAlignments);
+	}
+}
+
+void splitAlignmentOverlaps(ActiveAlignmentHeap *activeAlignments, uint64_t splitUpto, struct List *prefixOps,
+		FILE *fileHandleOut) {
+	if(activeAlignments->length == 0) {
 		return; // Nothing to do
 	}
 
 	// Process overlaps between alignments that precede splitUpto
-	uint64_t from = getStartCoordinate(stSortedSet_getFirst(activeAlignments));
+	uint64_t from = activeAlignmentHeap_peek(activeAlignments)->start1;
 	uint64_t to;
 	// while (minEndCoordinate = Min end coordinate in S) < splitUpto:
-	while(stSortedSet_size(activeAlignments) > 0 &&
-		  (to = getEndCoordinate(stSortedSet_getFirst(activeAlignments))) < splitUpto) {
+	while(activeAlignments->length > 0 &&
+		  (to = getEndCoordinate(activeAlignmentHeap_peek(activeAlignments)->pairwiseAlignment)) < splitUpto) {
 		assert(from < to);
-		emitBlock(activeAlignments, from, to, fileHandleOut);
+		emitBlock(activeAlignments, from, to, prefixOps, fileHandleOut);
 		from = to;
 	}
 
 	// Now split at the splitUpto point
-	if(stSortedSet_size(activeAlignments) > 0) {
-		assert(from < to);
-		emitBlock(activeAlignments, from, splitUpto, fileHandleOut);
+	if(activeAlignments->length > 0 && from < splitUpto) {
+		emitBlock(activeAlignments, from, splitUpto, prefixOps, fileHandleOut);
 	}
 }
 
-int comparePairwiseAlignments(const void *a, const void *b) {
-	struct PairwiseAlignment *pA1 = (struct PairwiseAlignment *)a;
-	struct PairwiseAlignment *pA2 = (struct PairwiseAlignment *)b;
-
-	int i = strcmp(pA1->contig1, pA2->contig1);
-	if(i == 0) {
-		i = pA1->start1 > pA2->start1 ? 1 : pA1->start1 < pA2->start1 ? -1 : 0;
-		if(i == 0) {
-			i = pA1->end1 > pA2->end1 ? 1 : pA1->end1 < pA2->end1 ? -1 : 0;
-			if(i == 0) {
-				i = pA1 > pA2 ? 1 : pA1 < pA2 ? -1 : 0;
-			}
-		}
-	}
-
-	return i;
-}
-
 int main(int argc, char *argv[]) {
 	/*
 	 * Each alignment has a unique first sequence interval, defined by where it starts and ends on the
@@ -192,35 +238,39 @@ int main(int argc, char *argv[]) {
 	}
 
     // Set of alignments being progressively processed, ordered by ascending query end coordinate
-    stSortedSet *activeAlignments = stSortedSet_construct3(comparePairwiseAlignments, NULL);
+    ActiveAlignmentHeap activeAlignments = { NULL, 0, 0, 0 };
+    // Scratch list holding the operations of each prefix as it is written out
+    struct List *prefixOps = constructEmptyList(0, NULL);
 
     struct PairwiseAlignment *pairwiseAlignment;
     while ((pairwiseAlignment = cigarRead(fileHandleIn)) != NULL) {
 
     	// There are existing alignments
-    	if(stSortedSet_size(activeAlignments) > 0) {
+    	if(activeAlignments.length > 0) {
     		// If the new alignment is on the same sequence as the previous sequence
-			if(strcmp(((struct PairwiseAlignment *)stSortedSet_getFirst(activeAlignments))->contig1,
+			if(strcmp(activeAlignmentHeap_peek(&activeAlignments)->pairwiseAlignment->contig1,
 					pairwiseAlignment->contig1) == 0) {
 				// Remove overlaps in alignments up to but excluding the start of pairwiseAlignment
-				splitAlignmentOverlaps(activeAlignments, getStartCoordinate(pairwiseAlignment), fileHandleOut);
+				splitAlignmentOverlaps(&activeAlignments, getStartCoordinate(pairwiseAlignment), prefixOps,
+						fileHandleOut);
 			}
 			else {
 				// If pairwiseAlignment is on a new sequence
-				splitAlignmentOverlaps(activeAlignments, UINT64_MAX, fileHandleOut);
-				assert(stSortedSet_size(activeAlignments) == 0);
+				splitAlignmentOverlaps(&activeAlignments, UINT64_MAX, prefixOps, fileHandleOut);
+				assert(activeAlignments.length == 0);
 			}
     	}
 
     	// Add pairwiseAlignment to the set of activeAlignemnts
-    	stSortedSet_insert(activeAlignments, pairwiseAlignment);
+    	activeAlignmentHeap_insert(&activeAlignments, pairwiseAlignment);
     }
     // Remove remaining overlaps in alignments
-    splitAlignmentOverlaps(activeAlignments, UINT64_MAX, fileHandleOut);
-    assert(stSortedSet_size(activeAlignments) == 0);
+    splitAlignmentOverlaps(&activeAlignments, UINT64_MAX, prefixOps, fileHandleOut);
+    assert(activeAlignments.length == 0);
 
     // Cleanup
-    stSortedSet_destruct(activeAlignments);
+    free(activeAlignments.alignments);
+    destructList(prefixOps);
     if(argc == 4) {
     	fclose(fileHandleIn);
     	fclose(fileHandleOut);
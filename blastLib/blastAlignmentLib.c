@@ -5,10 +5,17 @@
  *      Author: benedictpaten
  */
 
+#include <ctype.h>
 #include "bioioC.h"
 #include "cactus.h"
 #include "sonLib.h"
 #include "pairwiseAlignment.h"
+#include "blastAlignmentLib.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 /*
  * Converting coordinates of pairwise alignments
@@ -44,101 +51,487 @@ void convertCoordinatesOfPairwiseAlignment(struct PairwiseAlignment *pairwiseAli
 }
 
 /*
- * Routine reads in chunk up a set of sequences into overlapping sequence files.
+ * Parsing cigar lines
  */
 
-static int64_t chunkRemaining;
-static FILE *chunkFileHandle = NULL;
-static const char *chunksDir = NULL;
-static int64_t chunkNo = 0;
-static char *tempChunkFile = NULL;
-static int64_t chunkSize;
-static int64_t chunkOverlapSize;
-
-void finishChunkingSequences() {
-    if (chunkFileHandle != NULL) {
-        fclose(chunkFileHandle);
-        fprintf(stdout, "%s\n", tempChunkFile);
-        free(tempChunkFile);
-        tempChunkFile = NULL;
-        chunkFileHandle = NULL;
+static const char *getToken(const char *p, const char *lineEnd, const char **token, int64_t *tokenLength) {
+    /*
+     * Finds the next whitespace separated token of the line, returning the position after it.
+     */
+    while (p < lineEnd && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
     }
+    *token = p;
+    while (p < lineEnd && *p != ' ' && *p != '\t' && *p != '\r') {
+        p++;
+    }
+    *tokenLength = p - *token;
+    return p;
 }
 
-static void updateChunkRemaining(int64_t seqLength) {
-    //Update remaining portion of the chunk.
-    assert(seqLength >= 0);
-    chunkRemaining -= seqLength;
-    if (chunkRemaining <= 0) {
-        finishChunkingSequences();
-        chunkRemaining = chunkSize;
-    }
+static bool parseInt(const char *token, int64_t tokenLength, int64_t *i) {
+    // The token is followed by whitespace or the end of the line, so strtoll stops at its end
+    char *end;
+    *i = strtoll(token, &end, 10);
+    return tokenLength > 0 && end == token + tokenLength;
 }
 
-static int64_t processSubsequenceChunk(char *fastaHeader, int64_t start, char *sequence, int64_t seqLength, int64_t lengthOfChunkRemaining) {
-    if (chunkFileHandle == NULL) {
-        tempChunkFile = stString_print("%s/%" PRIi64 "", chunksDir, chunkNo++);
-        chunkFileHandle = fopen(tempChunkFile, "w");
+static bool parseStrand(const char *token, int64_t tokenLength, bool *strand) {
+    *strand = *token == '+';
+    return tokenLength == 1 && (*token == '+' || *token == '-');
+}
+
+bool parseCigarLine(const char *line, const char *lineEnd, Cigar *cigar) {
+    const char *token, *p = line;
+    int64_t tokenLength;
+    p = getToken(p, lineEnd, &token, &tokenLength);
+    if (tokenLength == 0) {
+        return 0;
     }
+    bool ok = tokenLength == 6 && strncmp(token, "cigar:", 6) == 0;
+    p = getToken(p, lineEnd, &cigar->contig2, &cigar->contig2Length);
+    ok = ok && cigar->contig2Length > 0;
+    p = getToken(p, lineEnd, &token, &tokenLength);
+    ok = ok && parseInt(token, tokenLength, &cigar->start2);
+    p = getToken(p, lineEnd, &token, &tokenLength);
+    ok = ok && parseInt(token, tokenLength, &cigar->end2);
+    p = getToken(p, lineEnd, &token, &tokenLength);
+    ok = ok && parseStrand(token, tokenLength, &cigar->strand2);
+    p = getToken(p, lineEnd, &cigar->contig1, &cigar->contig1Length);
+    ok = ok && cigar->contig1Length > 0;
+    p = getToken(p, lineEnd, &token, &tokenLength);
+    ok = ok && parseInt(token, tokenLength, &cigar->start1);
+    p = getToken(p, lineEnd, &token, &tokenLength);
+    ok = ok && parseInt(token, tokenLength, &cigar->end1);
+    p = getToken(p, lineEnd, &token, &tokenLength);
+    ok = ok && parseStrand(token, tokenLength, &cigar->strand1);
+    p = getToken(p, lineEnd, &token, &tokenLength);
+    char *scoreEnd;
+    cigar->score = strtof(token, &scoreEnd);
+    ok = ok && tokenLength > 0 && scoreEnd == token + tokenLength;
 
-    int64_t i = 0;
-    fastaHeader = stString_copy(fastaHeader);
-    while (fastaHeader[i] != '\0') {
-        if (fastaHeader[i] == ' ' || fastaHeader[i] == '\t') {
-            fastaHeader[i] = '\0';
-            break;
+    int64_t length1 = 0, length2 = 0;
+    cigar->opNumber = 0;
+    while (ok && (p = getToken(p, lineEnd, &token, &tokenLength)) > token) {
+        ok = tokenLength == 1 && (*token == 'M' || *token == 'I' || *token == 'D');
+        if (cigar->opNumber == cigar->maxOpNumber) {
+            cigar->maxOpNumber = cigar->maxOpNumber * 2 + 16;
+            cigar->ops = st_realloc(cigar->ops, cigar->maxOpNumber * sizeof(CigarOp));
         }
-        i++;
+        CigarOp *op = &cigar->ops[cigar->opNumber++];
+        op->type = *token;
+        p = getToken(p, lineEnd, &token, &tokenLength);
+        ok = ok && parseInt(token, tokenLength, &op->length) && op->length >= 0;
+        length1 += op->type != 'I' ? op->length : 0;
+        length2 += op->type != 'D' ? op->length : 0;
+    }
+    ok = ok && length1 == (cigar->strand1 ? cigar->end1 - cigar->start1 : cigar->start1 - cigar->end1);
+    ok = ok && length2 == (cigar->strand2 ? cigar->end2 - cigar->start2 : cigar->start2 - cigar->end2);
+    if (!ok) {
+        st_errAbort("Got an invalid cigar line: %.*s\n", (int) (lineEnd - line), line);
     }
-    char *chunkHeader = stString_print("%s|%" PRIi64 "\n", fastaHeader, start);
-    free(fastaHeader);
-    assert(lengthOfChunkRemaining <= chunkSize);
+    return 1;
+}
+
+/*
+ * Routines to chunk up a set of sequences into overlapping sequence files. The chunks are planned from the lengths of
+ * the sequences alone, as descriptors of the pieces of sequence in each chunk, and the bases are only read when a
+ * chunk's file is written.
+ */
+
+struct _sequenceChunker {
+    int64_t chunkSize;
+    int64_t overlapSize;
+    stList *sequences; // The ChunkSequences, in the order they were added
+    stList *fileNames; // Of the FASTA files the sequences were read from
+    ChunkPiece *pieces;
+    int64_t pieceNumber;
+    int64_t maxPieceNumber;
+    int64_t *chunkStarts; // Index of the first piece of each chunk
+    int64_t chunkNumber;
+    int64_t maxChunkNumber;
+    int64_t chunkRemaining; // Bases that can be added to the last chunk before it is full
+    bool chunkIsOpen; // If the next piece goes in the last chunk, rather than starting a new one
+    char *chunksDir; // If not NULL, the directory full chunks are written to as soon as they are full
+    int64_t writtenChunkNumber; // The number of chunks already written to chunksDir
+};
+
+static void chunkSequence_destruct(ChunkSequence *sequence) {
+    free(sequence->name);
+    free(sequence->string);
+    free(sequence);
+}
+
+static ChunkSequence *chunkSequence_construct(const char *fastaHeader) {
+    ChunkSequence *sequence = st_calloc(1, sizeof(ChunkSequence));
+    // The sequence is named by the first word of its header
+    sequence->name = stString_getSubString(fastaHeader, 0, strcspn(fastaHeader, " \t"));
+    return sequence;
+}
+
+SequenceChunker *sequenceChunker_construct(int64_t chunkSize, int64_t overlapSize) {
+    SequenceChunker *chunker = st_calloc(1, sizeof(SequenceChunker));
+    chunker->chunkSize = chunkSize;
+    assert(chunkSize > 0);
+    chunker->overlapSize = overlapSize;
+    assert(overlapSize >= 0);
+    chunker->sequences = stList_construct3(0, (void (*)(void *))chunkSequence_destruct);
+    chunker->fileNames = stList_construct3(0, free);
+    chunker->chunkRemaining = chunkSize;
+    return chunker;
+}
+
+void sequenceChunker_destruct(SequenceChunker *chunker) {
+    for (int64_t i = 0; i < chunker->pieceNumber; i++) {
+        free(chunker->pieces[i].bases);
+    }
+    free(chunker->chunksDir);
+    stList_destruct(chunker->sequences);
+    stList_destruct(chunker->fileNames);
+    free(chunker->pieces);
+    free(chunker->chunkStarts);
+    free(chunker);
+}
+
+static int64_t addPiece(SequenceChunker *chunker, ChunkSequence *sequence, int64_t start, int64_t lengthOfChunkRemaining,
+                        bool isOverlap) {
+    /*
+     * Adds the piece of the sequence starting at start, up to lengthOfChunkRemaining long, returning its length.
+     */
+    assert(lengthOfChunkRemaining <= chunker->chunkSize);
     assert(start >= 0);
     int64_t lengthOfSubsequence = lengthOfChunkRemaining;
-    if (start + lengthOfChunkRemaining > seqLength) {
-        lengthOfSubsequence = seqLength - start;
+    if (start + lengthOfChunkRemaining > sequence->length) {
+        lengthOfSubsequence = sequence->length - start;
     }
     assert(lengthOfSubsequence > 0);
-    char c = sequence[start + lengthOfSubsequence];
-    sequence[start + lengthOfSubsequence] = '\0';
-    fastaWrite(&sequence[start], chunkHeader, chunkFileHandle);
-    //fprintf(chunkFileHandle, "%s\n", &sequence[start]);
-    free(chunkHeader);
-    sequence[start + lengthOfSubsequence] = c;
-
-    updateChunkRemaining(lengthOfSubsequence);
+
+    if (!chunker->chunkIsOpen) {
+        if (chunker->chunkNumber == chunker->maxChunkNumber) {
+            chunker->maxChunkNumber = chunker->maxChunkNumber * 2 + 16;
+            chunker->chunkStarts = st_realloc(chunker->chunkStarts, chunker->maxChunkNumber * sizeof(int64_t));
+        }
+        chunker->chunkStarts[chunker->chunkNumber++] = chunker->pieceNumber;
+        chunker->chunkIsOpen = 1;
+    }
+    if (chunker->pieceNumber == chunker->maxPieceNumber) {
+        chunker->maxPieceNumber = chunker->maxPieceNumber * 2 + 16;
+        chunker->pieces = st_realloc(chunker->pieces, chunker->maxPieceNumber * sizeof(ChunkPiece));
+    }
+    ChunkPiece *piece = &chunker->pieces[chunker->pieceNumber++];
+    piece->sequence = sequence;
+    piece->start = start;
+    piece->length = lengthOfSubsequence;
+    piece->isOverlap = isOverlap;
+    piece->bases = NULL;
+
+    //Update remaining portion of the chunk.
+    chunker->chunkRemaining -= lengthOfSubsequence;
+    if (chunker->chunkRemaining <= 0) {
+        chunker->chunkIsOpen = 0;
+        chunker->chunkRemaining = chunker->chunkSize;
+    }
     return lengthOfSubsequence;
 }
 
-void processSequenceToChunk(void* dest, const char *fastaHeader, const char *sequence, int64_t sequenceLength) {
-    if (sequenceLength > 0) {
-        int64_t lengthOfSubsequence = processSubsequenceChunk((char *) fastaHeader, 0, (char *) sequence, sequenceLength, chunkRemaining);
-        while (sequenceLength - lengthOfSubsequence > 0) {
-            //Make the non overlap file
-            int64_t lengthOfFollowingSubsequence = processSubsequenceChunk((char *) fastaHeader, lengthOfSubsequence, (char *) sequence, sequenceLength, chunkRemaining);
+static void addSequence(SequenceChunker *chunker, ChunkSequence *sequence) {
+    stList_append(chunker->sequences, sequence);
+    if (sequence->length > 0) {
+        int64_t lengthOfSubsequence = addPiece(chunker, sequence, 0, chunker->chunkRemaining, 0);
+        while (sequence->length - lengthOfSubsequence > 0) {
+            //Make the non overlap piece
+            int64_t lengthOfFollowingSubsequence = addPiece(chunker, sequence, lengthOfSubsequence,
+                                                            chunker->chunkRemaining, 0);
 
-            //Make the overlap file
-            if(chunkOverlapSize > 0) {
-                int64_t i = lengthOfSubsequence - chunkOverlapSize / 2;
+            //Make the overlap piece
+            if (chunker->overlapSize > 0) {
+                int64_t i = lengthOfSubsequence - chunker->overlapSize / 2;
                 if (i < 0) {
                     i = 0;
                 }
-                processSubsequenceChunk((char *) fastaHeader, i, (char *) sequence, sequenceLength, chunkOverlapSize);
+                addPiece(chunker, sequence, i, chunker->overlapSize, 1);
             }
             lengthOfSubsequence += lengthOfFollowingSubsequence;
         }
     }
 }
 
-void setupToChunkSequences(int64_t chunkSize2, int64_t overlapSize2, const char *chunksDir2) {
-    chunkSize = chunkSize2;
-    assert(chunkSize > 0);
-    chunkOverlapSize = overlapSize2;
-    assert(chunkOverlapSize >= 0);
-    chunksDir = chunksDir2;
-    chunkNo = 0;
-    chunkRemaining = chunkSize;
-    chunkFileHandle = NULL;
+static void writeFullChunks(SequenceChunker *chunker) {
+    /*
+     * Writes the chunks that have become full since the last call to chunksDir, then frees the bases copied for
+     * their pieces.
+     */
+    int64_t fullChunkNumber = chunker->chunkIsOpen ? chunker->chunkNumber - 1 : chunker->chunkNumber;
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) if(fullChunkNumber - chunker->writtenChunkNumber > 1)
+#endif
+    for (int64_t i = chunker->writtenChunkNumber; i < fullChunkNumber; i++) {
+        free(sequenceChunker_writeChunk(chunker, i, chunker->chunksDir));
+    }
+    if (fullChunkNumber > chunker->writtenChunkNumber) {
+        int64_t end = fullChunkNumber < chunker->chunkNumber ? chunker->chunkStarts[fullChunkNumber] : chunker->pieceNumber;
+        for (int64_t i = chunker->chunkStarts[chunker->writtenChunkNumber]; i < end; i++) {
+            free(chunker->pieces[i].bases);
+            chunker->pieces[i].bases = NULL;
+        }
+        chunker->writtenChunkNumber = fullChunkNumber;
+    }
+}
+
+void sequenceChunker_processSequence(void *destination, const char *fastaHeader, const char *sequence, int64_t length) {
+    SequenceChunker *chunker = destination;
+    ChunkSequence *chunkSequence = chunkSequence_construct(fastaHeader);
+    chunkSequence->length = length;
+    if (chunker->chunksDir == NULL) {
+        chunkSequence->string = stString_getSubString(sequence, 0, length);
+        addSequence(chunker, chunkSequence);
+        return;
+    }
+    /*
+     * The chunks the sequence fills are written while it is borrowed from the caller, and only the bases of its pieces
+     * in the last, open chunk are copied, so at most a chunk of bases is kept between calls.
+     */
+    chunkSequence->string = (char *)sequence;
+    addSequence(chunker, chunkSequence);
+    writeFullChunks(chunker);
+    if (chunker->chunkIsOpen) {
+        for (int64_t i = chunker->chunkStarts[chunker->chunkNumber - 1]; i < chunker->pieceNumber; i++) {
+            ChunkPiece *piece = &chunker->pieces[i];
+            if (piece->sequence == chunkSequence) {
+                piece->bases = stString_getSubString(sequence, piece->start, piece->length);
+            }
+        }
+    }
+    chunkSequence->string = NULL;
+}
+
+void sequenceChunker_writeChunksAsFull(SequenceChunker *chunker, const char *chunksDir) {
+    assert(chunker->chunksDir == NULL && chunker->chunkNumber == 0);
+    chunker->chunksDir = stString_copy(chunksDir);
+}
+
+static stList *scanFastaFile(const char *fileName) {
+    /*
+     * Gets the names, lengths and locations of the sequences in the FASTA file, without keeping their bases. If all
+     * but the last line of a sequence have the same length, and no whitespace but their line ends, the bases can be
+     * found from the sequence's offset without reading it, as with a FASTA index.
+     */
+    FILE *fileHandle = fopen(fileName, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open FASTA file %s\n", fileName);
+    }
+    stList *sequences = stList_construct3(0, (void (*)(void *))chunkSequence_destruct);
+    ChunkSequence *sequence = NULL;
+    bool shortLineSeen = 0; // If a line of the current sequence has been shorter than its first
+    int64_t maxHeaderLength = 64;
+    char *header = st_malloc(maxHeaderLength);
+    int64_t offset = 0; // Of the next character
+    int c;
+    while ((c = getc(fileHandle)) != EOF) {
+        if (c == '>') {
+            int64_t headerLength = 0;
+            offset++;
+            while ((c = getc(fileHandle)) != EOF) {
+                offset++;
+                if (c == '\n') {
+                    break;
+                }
+                if (headerLength + 1 >= maxHeaderLength) {
+                    maxHeaderLength *= 2;
+                    header = st_realloc(header, maxHeaderLength);
+                }
+                header[headerLength++] = c;
+            }
+            while (headerLength > 0 && header[headerLength - 1] == '\r') {
+                headerLength--;
+            }
+            header[headerLength] = '\0';
+            sequence = chunkSequence_construct(header);
+            sequence->fileName = fileName;
+            sequence->offset = offset;
+            sequence->hasRegularLines = 1;
+            stList_append(sequences, sequence);
+            shortLineSeen = 0;
+            continue;
+        }
+
+        // Count the bases and bytes of a line of sequence
+        int64_t lineBases = 0, lineBytes = 0;
+        bool spaceSeen = 0, isRegularLine = 1;
+        for (; c != EOF; c = getc(fileHandle)) {
+            lineBytes++;
+            offset++;
+            if (c == '\n') {
+                break;
+            }
+            if (isspace(c)) {
+                spaceSeen = 1;
+            } else {
+                isRegularLine = isRegularLine && !spaceSeen;
+                lineBases++;
+            }
+        }
+        if (lineBases == 0) { // A blank line
+            shortLineSeen = 1;
+            continue;
+        }
+        if (sequence == NULL) {
+            st_errAbort("The FASTA file %s has bases before its first header\n", fileName);
+        }
+        if (sequence->length == 0) {
+            sequence->lineBases = lineBases;
+            sequence->lineBytes = lineBytes;
+            sequence->hasRegularLines = isRegularLine && !shortLineSeen;
+        } else if (!isRegularLine || shortLineSeen || lineBases > sequence->lineBases ||
+                   (lineBases == sequence->lineBases && c == '\n' && lineBytes != sequence->lineBytes)) {
+            sequence->hasRegularLines = 0;
+        }
+        shortLineSeen = lineBases < sequence->lineBases;
+        sequence->length += lineBases;
+    }
+    free(header);
+    fclose(fileHandle);
+    return sequences;
+}
+
+void sequenceChunker_addFastaFiles(SequenceChunker *chunker, stList *fastaFiles) {
+    stList *fileSequences = stList_construct3(0, (void (*)(void *))stList_destruct);
+    for (int64_t i = 0; i < stList_length(fastaFiles); i++) {
+        stList_append(chunker->fileNames, stString_copy(stList_get(fastaFiles, i)));
+        stList_append(fileSequences, NULL);
+    }
+    // The files are scanned in parallel, then their sequences chunked in order
+    int64_t firstFile = stList_length(chunker->fileNames) - stList_length(fastaFiles);
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int64_t i = 0; i < stList_length(fastaFiles); i++) {
+        stList_set(fileSequences, i, scanFastaFile(stList_get(chunker->fileNames, firstFile + i)));
+    }
+    for (int64_t i = 0; i < stList_length(fastaFiles); i++) {
+        stList *sequences = stList_get(fileSequences, i);
+        stList_setDestructor(sequences, NULL);
+        for (int64_t j = 0; j < stList_length(sequences); j++) {
+            addSequence(chunker, stList_get(sequences, j));
+        }
+    }
+    stList_destruct(fileSequences);
+}
+
+int64_t sequenceChunker_getChunkNumber(SequenceChunker *chunker) {
+    return chunker->chunkNumber;
+}
+
+ChunkPiece *sequenceChunker_getChunk(SequenceChunker *chunker, int64_t chunkIndex, int64_t *pieceNumber) {
+    assert(chunkIndex >= 0 && chunkIndex < chunker->chunkNumber);
+    int64_t end = chunkIndex + 1 < chunker->chunkNumber ? chunker->chunkStarts[chunkIndex + 1] : chunker->pieceNumber;
+    *pieceNumber = end - chunker->chunkStarts[chunkIndex];
+    return &chunker->pieces[chunker->chunkStarts[chunkIndex]];
+}
+
+static void readPieceBases(ChunkPiece *piece, FILE *fileHandle, char *bases) {
+    /*
+     * Reads the bases of the piece from its FASTA file into bases, which must have room for them and the line ends
+     * between them, followed by a terminating zero.
+     */
+    ChunkSequence *sequence = piece->sequence;
+    int64_t j = 0;
+    if (sequence->hasRegularLines) {
+        int64_t lastBase = piece->start + piece->length - 1;
+        int64_t start = sequence->offset + (piece->start / sequence->lineBases) * sequence->lineBytes +
+                        piece->start % sequence->lineBases;
+        int64_t end = sequence->offset + (lastBase / sequence->lineBases) * sequence->lineBytes +
+                      lastBase % sequence->lineBases + 1;
+        if (fseeko(fileHandle, start, SEEK_SET) != 0 || fread(bases, 1, end - start, fileHandle) != end - start) {
+            st_errAbort("Failed to read sequence %s from FASTA file %s\n", sequence->name, sequence->fileName);
+        }
+        for (int64_t i = 0; i < end - start; i++) {
+            if (!isspace(bases[i])) {
+                bases[j++] = bases[i];
+            }
+        }
+    } else {
+        if (fseeko(fileHandle, sequence->offset, SEEK_SET) != 0) {
+            st_errAbort("Failed to read sequence %s from FASTA file %s\n", sequence->name, sequence->fileName);
+        }
+        int64_t i = 0;
+        int c;
+        while (j < piece->length && (c = getc(fileHandle)) != EOF) {
+            if (!isspace(c) && i++ >= piece->start) {
+                bases[j++] = c;
+            }
+        }
+    }
+    if (j != piece->length) {
+        st_errAbort("Failed to read sequence %s from FASTA file %s\n", sequence->name, sequence->fileName);
+    }
+    bases[j] = '\0';
+}
+
+char *sequenceChunker_writeChunk(SequenceChunker *chunker, int64_t chunkIndex, const char *chunksDir) {
+    int64_t pieceNumber;
+    ChunkPiece *pieces = sequenceChunker_getChunk(chunker, chunkIndex, &pieceNumber);
+    char *chunkFile = stString_print("%s/%" PRIi64 "", chunksDir, chunkIndex);
+    FILE *chunkFileHandle = fopen(chunkFile, "w");
+    if (chunkFileHandle == NULL) {
+        st_errAbort("Could not open chunk file %s\n", chunkFile);
+    }
+    // The pieces of a chunk usually come from one FASTA file, so it is kept open between them
+    const char *fileName = NULL;
+    FILE *fileHandle = NULL;
+    for (int64_t i = 0; i < pieceNumber; i++) {
+        ChunkPiece *piece = &pieces[i];
+        ChunkSequence *sequence = piece->sequence;
+        char *chunkHeader = stString_print("%s|%" PRIi64 "\n", sequence->name, piece->start);
+        if (piece->bases != NULL) {
+            fastaWrite(piece->bases, chunkHeader, chunkFileHandle);
+        } else if (sequence->string != NULL) {
+            // Copied, as other chunks may be writing overlapping pieces of the same string
+            char *bases = stString_getSubString(sequence->string, piece->start, piece->length);
+            fastaWrite(bases, chunkHeader, chunkFileHandle);
+            free(bases);
+        } else {
+            if (sequence->fileName != fileName) {
+                if (fileHandle != NULL) {
+                    fclose(fileHandle);
+                }
+                fileName = sequence->fileName;
+                if ((fileHandle = fopen(fileName, "r")) == NULL) {
+                    st_errAbort("Could not open FASTA file %s\n", fileName);
+                }
+            }
+            // Room for the bases, and the line ends between them if they are read from regular lines
+            int64_t maxLength = piece->length + 1;
+            if (sequence->hasRegularLines) {
+                maxLength += (piece->length / sequence->lineBases + 1) * (sequence->lineBytes - sequence->lineBases);
+            }
+            char *bases = st_malloc(maxLength);
+            readPieceBases(piece, fileHandle, bases);
+            fastaWrite(bases, chunkHeader, chunkFileHandle);
+            free(bases);
+        }
+        free(chunkHeader);
+    }
+    if (fileHandle != NULL) {
+        fclose(fileHandle);
+    }
+    fclose(chunkFileHandle);
+    return chunkFile;
+}
+
+stList *sequenceChunker_writeChunks(SequenceChunker *chunker, const char *chunksDir) {
+    assert(chunker->chunksDir == NULL || strcmp(chunker->chunksDir, chunksDir) == 0);
+    stList *chunkFiles = stList_construct3(chunker->chunkNumber, free);
+    for (int64_t i = 0; i < chunker->writtenChunkNumber; i++) {
+        stList_set(chunkFiles, i, stString_print("%s/%" PRIi64 "", chunksDir, i));
+    }
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int64_t i = chunker->writtenChunkNumber; i < chunker->chunkNumber; i++) {
+        stList_set(chunkFiles, i, sequenceChunker_writeChunk(chunker, i, chunksDir));
+    }
+    return chunkFiles;
 }
 
 /*
@@ -180,13 +573,6 @@ int64_t writeFlowerSequences(Flower *flower, void(*processSequence)(void *destin
     return sequencesWritten;
 }
 
-/* hack to remain compatible until blastAlignmentLib can be made thread safe */
-int64_t writeFlowerSequencesUnsafe(Flower *flower, void(*processSequence)(void *destination, const char *name, const char *seq, int64_t length), int64_t minimumSequenceLength) {
-    return writeFlowerSequences(flower, processSequence, NULL, minimumSequenceLength);
-}
-    
-
-
 // Delay opening so it doesn't write file if no flowers.  Not sure if this behavior is
 // relied on, so keeping old behavior when making code thread safe.
 typedef struct {
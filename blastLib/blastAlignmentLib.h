@@ -17,14 +17,105 @@ int64_t writeFlowerSequencesInFile(Flower *flower, const char *tempFile1, int64_
 
 int64_t writeFlowerSequences(Flower *flower, void(*processSequence)(void *destination, const char *name, const char *seq, int64_t length), void *destination, int64_t minimumSequenceLength);
 
-int64_t writeFlowerSequencesUnsafe(Flower *flower, void(*processSequence)(void *destination, const char *name, const char *seq, int64_t length), int64_t minimumSequenceLength);
-
 void convertCoordinatesOfPairwiseAlignment(struct PairwiseAlignment *pairwiseAlignment, int convertContig1, int convertContig2);
 
-void setupToChunkSequences(int64_t chunkSize2, int64_t overlapSize2, const char *chunksDir2);
+/*
+ * Parsing of lastz cigar lines in place. Unlike cigarRead this copies nothing and keeps no state, so lines can be
+ * parsed by several threads at once.
+ */
+
+typedef struct _cigarOp {
+    char type; // 'M', 'I' (an insert in the second sequence) or 'D' (an insert in the first sequence)
+    int64_t length;
+} CigarOp;
+
+/*
+ * A parsed cigar line, whose contig names point into the line and are not terminated. In the line the second sequence
+ * is given before the first.
+ */
+typedef struct _cigar {
+    const char *contig1, *contig2;
+    int64_t contig1Length, contig2Length;
+    int64_t start1, end1, start2, end2;
+    bool strand1, strand2;
+    float score;
+    CigarOp *ops; // In the order they appear in the line, grown as needed so it can be reused, freed by the caller
+    int64_t opNumber, maxOpNumber;
+} Cigar;
+
+/*
+ * Parses the line "cigar: contig2 start2 end2 strand2 contig1 start1 end1 strand1 score (op length)*" ending at lineEnd
+ * into cigar, checking that the ops cover the coordinates as checkPairwiseAlignment does. Returns false if the line
+ * is blank, and aborts if it is not a valid cigar line.
+ */
+bool parseCigarLine(const char *line, const char *lineEnd, Cigar *cigar);
+
+/*
+ * Chunking of sequences into overlapping sets of subsequences. Chunks are planned from the lengths of the sequences,
+ * as descriptors of their pieces, and the bases only read when a chunk's file is written. A chunker is not shared
+ * between threads while sequences are added to it, but different chunks can be written in parallel.
+ */
+
+typedef struct _chunkSequence {
+    char *name; // The first word of the sequence's FASTA header
+    int64_t length;
+    char *string; // The bases, if the sequence was given in memory, else NULL
+    const char *fileName; // Of the FASTA file the sequence is in, if string is NULL
+    int64_t offset; // Of the sequence's first line in the FASTA file
+    bool hasRegularLines; // If all lines but the last have lineBases bases and are lineBytes long
+    int64_t lineBases;
+    int64_t lineBytes;
+} ChunkSequence;
 
-void processSequenceToChunk(void* destination, const char *fastaHeader, const char *sequence, int64_t length);
+typedef struct _chunkPiece {
+    ChunkSequence *sequence;
+    int64_t start;
+    int64_t length;
+    bool isOverlap; // If the piece overlaps the join between two other pieces of the sequence
+    char *bases; // A copy of the piece's bases, if they are neither kept with its sequence nor in a file, else NULL
+} ChunkPiece;
 
-void finishChunkingSequences();
+typedef struct _sequenceChunker SequenceChunker;
+
+SequenceChunker *sequenceChunker_construct(int64_t chunkSize, int64_t overlapSize);
+
+void sequenceChunker_destruct(SequenceChunker *chunker);
+
+/*
+ * Adds a sequence to the chunker, copying it, or with sequenceChunker_writeChunksAsFull copying only the bases of
+ * the chunk it leaves unfinished. Has the signature of the callbacks of fastaReadToFunction and writeFlowerSequences,
+ * with the chunker as the destination.
+ */
+void sequenceChunker_processSequence(void *chunker, const char *fastaHeader, const char *sequence, int64_t length);
+
+/*
+ * Makes sequenceChunker_processSequence write each chunk to chunksDir as soon as it is full, so that the sequences
+ * given in memory are not kept until the chunks are written. Must be called before any sequences are added, and
+ * sequenceChunker_writeChunks given the same directory to write the last chunk.
+ */
+void sequenceChunker_writeChunksAsFull(SequenceChunker *chunker, const char *chunksDir);
+
+/*
+ * Adds the sequences of the FASTA files, in order, without reading their bases into memory. The files are scanned in
+ * parallel.
+ */
+void sequenceChunker_addFastaFiles(SequenceChunker *chunker, stList *fastaFiles);
+
+int64_t sequenceChunker_getChunkNumber(SequenceChunker *chunker);
+
+/*
+ * Gets the pieces of the given chunk. The array is valid until more sequences are added.
+ */
+ChunkPiece *sequenceChunker_getChunk(SequenceChunker *chunker, int64_t chunkIndex, int64_t *pieceNumber);
+
+/*
+ * Writes the chunk to the FASTA file chunksDir/chunkIndex, returning the file's name.
+ */
+char *sequenceChunker_writeChunk(SequenceChunker *chunker, int64_t chunkIndex, const char *chunksDir);
+
+/*
+ * Writes every chunk not yet written, in parallel, returning the list of the names of the files of all the chunks.
+ */
+stList *sequenceChunker_writeChunks(SequenceChunker *chunker, const char *chunksDir);
 
 #endif /* BLASTALIGNMENTLIB_H_ */
@@ -0,0 +1,200 @@
+#include "CuTest.h"
+#include "sonLib.h"
+#include "bioioC.h"
+#include "blastAlignmentLib.h"
+
+#define CHUNK_TEST_DIR "sequenceChunkerTestTempDir"
+
+// The layouts of the FASTA files the chunker is tested on
+enum fastaLayout {
+    REGULAR_LINES, // All lines but the last of a sequence the same length
+    CRLF_LINES, // As REGULAR_LINES, with DOS line ends
+    RAGGED_LINES, // Lines of random lengths, without a line end after the last
+    BLANK_LINES // As REGULAR_LINES, with blank lines between some lines and whitespace within and after others
+};
+
+static void writeFastaFile(const char *fileName, stList *headers, stList *sequences, enum fastaLayout layout) {
+    FILE *fileHandle = fopen(fileName, "w");
+    const char *lineEnd = layout == CRLF_LINES ? "\r\n" : "\n";
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        char *sequence = stList_get(sequences, i);
+        int64_t length = strlen(sequence);
+        fprintf(fileHandle, ">%s%s", (char *)stList_get(headers, i), lineEnd);
+        for (int64_t j = 0; j < length;) {
+            int64_t lineLength = layout == RAGGED_LINES ? st_randomInt(1, 100) : 60;
+            if (lineLength > length - j) {
+                lineLength = length - j;
+            }
+            double r = layout == BLANK_LINES ? st_random() : 1.0;
+            if (r < 0.1 && lineLength > 1) {
+                fprintf(fileHandle, "%.*s %.*s", (int)lineLength / 2, sequence + j, (int)(lineLength - lineLength / 2),
+                        sequence + j + lineLength / 2);
+            } else {
+                fprintf(fileHandle, "%.*s", (int)lineLength, sequence + j);
+            }
+            j += lineLength;
+            if (r >= 0.1 && r < 0.2) {
+                fprintf(fileHandle, " \t");
+            } else if (r >= 0.2 && r < 0.3) {
+                fprintf(fileHandle, "\n  \n");
+            }
+            if (layout != RAGGED_LINES || j < length || i + 1 < stList_length(sequences)) {
+                fprintf(fileHandle, "%s", lineEnd);
+            }
+        }
+    }
+    fclose(fileHandle);
+}
+
+static void readChunkSequence(void *destination, const char *fastaHeader, const char *sequence, int64_t length) {
+    stList_append(destination, stString_print("%.*s %s", (int)strcspn(fastaHeader, " \t\r\n"), fastaHeader,
+                                              sequence));
+}
+
+static char *readChunks(stList *chunkFiles) {
+    /*
+     * Gets the names and bases of the sequences of the chunk files, with the sequences of a chunk separated by
+     * spaces and the chunks by newlines.
+     */
+    stList *chunks = stList_construct3(0, free);
+    for (int64_t i = 0; i < stList_length(chunkFiles); i++) {
+        stList *chunkSequences = stList_construct3(0, free);
+        FILE *fileHandle = fopen(stList_get(chunkFiles, i), "r");
+        fastaReadToFunction(fileHandle, chunkSequences, readChunkSequence);
+        fclose(fileHandle);
+        stList_append(chunks, stString_join2(" ", chunkSequences));
+        stList_destruct(chunkSequences);
+    }
+    char *chunksString = stString_join2("\n", chunks);
+    stList_destruct(chunks);
+    return chunksString;
+}
+
+static char *chunkInMemory(stList *headers, stList *sequences, int64_t chunkSize, int64_t overlapSize,
+                           bool writeChunksAsFull) {
+    /*
+     * Chunks the sequences, given to the chunker in memory. If writeChunksAsFull, they are given from a buffer that
+     * is overwritten after each sequence is added, so the chunks are wrong unless the chunker copies what it needs.
+     */
+    char *chunksDir = stFile_pathJoin(CHUNK_TEST_DIR, writeChunksAsFull ? "streamed" : "memory");
+    stFile_mkdir(chunksDir);
+    SequenceChunker *chunker = sequenceChunker_construct(chunkSize, overlapSize);
+    if (writeChunksAsFull) {
+        sequenceChunker_writeChunksAsFull(chunker, chunksDir);
+    }
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        char *sequence = stString_copy(stList_get(sequences, i));
+        int64_t length = strlen(sequence);
+        sequenceChunker_processSequence(chunker, stList_get(headers, i), sequence, length);
+        memset(sequence, 'X', length);
+        free(sequence);
+    }
+    stList *chunkFiles = sequenceChunker_writeChunks(chunker, chunksDir);
+    char *chunks = readChunks(chunkFiles);
+    stList_destruct(chunkFiles);
+    sequenceChunker_destruct(chunker);
+    free(chunksDir);
+    return chunks;
+}
+
+static char *chunkFastaFile(stList *headers, stList *sequences, int64_t chunkSize, int64_t overlapSize,
+                            enum fastaLayout layout) {
+    /*
+     * Chunks the sequences, written to a FASTA file with the given layout.
+     */
+    char *chunksDir = stFile_pathJoin(CHUNK_TEST_DIR, "file");
+    stFile_mkdir(chunksDir);
+    char *fastaFile = stFile_pathJoin(CHUNK_TEST_DIR, "sequences.fa");
+    writeFastaFile(fastaFile, headers, sequences, layout);
+    SequenceChunker *chunker = sequenceChunker_construct(chunkSize, overlapSize);
+    stList *fastaFiles = stList_construct();
+    stList_append(fastaFiles, fastaFile);
+    sequenceChunker_addFastaFiles(chunker, fastaFiles);
+    stList *chunkFiles = sequenceChunker_writeChunks(chunker, chunksDir);
+    char *chunks = readChunks(chunkFiles);
+    stList_destruct(chunkFiles);
+    stList_destruct(fastaFiles);
+    sequenceChunker_destruct(chunker);
+    stFile_rmtree(chunksDir);
+    free(fastaFile);
+    free(chunksDir);
+    return chunks;
+}
+
+static void checkChunks(CuTest *testCase, stList *headers, stList *sequences, int64_t chunkSize,
+                        int64_t overlapSize, const char *expectedChunks) {
+    /*
+     * Checks that the sequences are chunked the same in memory, streamed, and from a FASTA file in each layout. If
+     * expectedChunks is not NULL, they must be split as it says.
+     */
+    if (stFile_exists(CHUNK_TEST_DIR)) {
+        stFile_rmtree(CHUNK_TEST_DIR);
+    }
+    stFile_mkdir(CHUNK_TEST_DIR);
+    char *chunks = chunkInMemory(headers, sequences, chunkSize, overlapSize, 0);
+    if (expectedChunks != NULL) {
+        CuAssertStrEquals(testCase, expectedChunks, chunks);
+    }
+    char *streamedChunks = chunkInMemory(headers, sequences, chunkSize, overlapSize, 1);
+    CuAssertStrEquals(testCase, chunks, streamedChunks);
+    free(streamedChunks);
+    enum fastaLayout layouts[] = { REGULAR_LINES, CRLF_LINES, RAGGED_LINES, BLANK_LINES };
+    for (int64_t i = 0; i < sizeof(layouts) / sizeof(enum fastaLayout); i++) {
+        char *fileChunks = chunkFastaFile(headers, sequences, chunkSize, overlapSize, layouts[i]);
+        CuAssertStrEquals(testCase, chunks, fileChunks);
+        free(fileChunks);
+    }
+    free(chunks);
+    stFile_rmtree(CHUNK_TEST_DIR);
+}
+
+static void testSequenceChunker_split(CuTest *testCase) {
+    /*
+     * Chunks two short sequences into chunks of 10 bases, with overlaps of 4 bases between the pieces of the second.
+     */
+    stList *headers = stList_construct();
+    stList *sequences = stList_construct();
+    stList_append(headers, "a first sequence");
+    stList_append(sequences, "ACGTACG");
+    stList_append(headers, "b");
+    stList_append(sequences, "TTGCAACGGATCCAG");
+    checkChunks(testCase, headers, sequences, 10, 4,
+                "a|0 ACGTACG b|0 TTG\n"
+                "b|3 CAACGGATCC\n"
+                "b|1 TGCA b|13 AG b|11 CCAG");
+    stList_destruct(headers);
+    stList_destruct(sequences);
+}
+
+static void testSequenceChunker_random(CuTest *testCase) {
+    /*
+     * Chunks random sequences, some longer than a chunk and some empty, with random chunk and overlap sizes.
+     */
+    for (int64_t test = 0; test < 20; test++) {
+        st_randomSeed(test);
+        stList *headers = stList_construct3(0, free);
+        stList *sequences = stList_construct3(0, free);
+        int64_t sequenceNumber = st_randomInt(1, 10);
+        for (int64_t i = 0; i < sequenceNumber; i++) {
+            stList_append(headers, stString_print("sequence%" PRIi64 " with a description", i));
+            int64_t length = st_randomInt(0, 500);
+            char *sequence = st_malloc(length + 1);
+            for (int64_t j = 0; j < length; j++) {
+                sequence[j] = "ACGTN"[st_randomInt(0, 5)];
+            }
+            sequence[length] = '\0';
+            stList_append(sequences, sequence);
+        }
+        int64_t chunkSize = st_randomInt(1, 300);
+        checkChunks(testCase, headers, sequences, chunkSize, st_randomInt(0, chunkSize + 1), NULL);
+        stList_destruct(headers);
+        stList_destruct(sequences);
+    }
+}
+
+CuSuite *sequenceChunkerTestSuite(void) {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testSequenceChunker_split);
+    SUITE_ADD_TEST(suite, testSequenceChunker_random);
+    return suite;
+}
@@ -0,0 +1,69 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Converts a binary c2h file, written by cactus_consolidated --binaryOutput, to the c2h text format.
+ */
+
+#include <getopt.h>
+#include "sonLib.h"
+#include "cactus.h"
+#include "hal.h"
+
+void usage() {
+    fprintf(stderr, "cactus_c2hBinaryToText [binaryC2hFile] [c2hFile]\n");
+    fprintf(stderr, "-l --logLevel : Set the log level\n");
+    fprintf(stderr, "-h --help : Print this help message\n");
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
+                { "help", no_argument, 0, 'h' },
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int64_t key = getopt_long(argc, argv, "l:h", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        switch (key) {
+            case 'l':
+                logLevelString = optarg;
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    st_setLogLevelFromString(logLevelString);
+
+    if (optind + 2 != argc) {
+        usage();
+        return 1;
+    }
+
+    FILE *binaryFileHandle = fopen(argv[optind], "rb");
+    if (binaryFileHandle == NULL) {
+        st_errAbort("Could not open the binary c2h file %s\n", argv[optind]);
+    }
+    FILE *fileHandle = fopen(argv[optind + 1], "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the c2h file %s\n", argv[optind + 1]);
+    }
+    c2hBinaryToText(binaryFileHandle, fileHandle);
+    fclose(binaryFileHandle);
+    fclose(fileHandle);
+
+    return 0;
+}
@@ -0,0 +1,319 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "sonLib.h"
+#include "c2hBinary.h"
+
+#define C2H_BINARY_MAGIC "C2HB"
+#define C2H_BINARY_BUFFER_SIZE (1 << 20)
+#define C2H_BINARY_MAX_SEGMENT_LENGTH 64 // A type and at most four ten byte varints
+
+static uint64_t zigzagEncode(int64_t i) {
+    return ((uint64_t)i << 1) ^ (uint64_t)(i >> 63);
+}
+
+static int64_t zigzagDecode(uint64_t i) {
+    return (int64_t)(i >> 1) ^ -(int64_t)(i & 1);
+}
+
+/*
+ * Writer
+ */
+
+struct _c2hBinaryWriter {
+    FILE *fileHandle;
+    char *buffer;
+    int64_t length; // Of the buffered bytes
+    int64_t written; // Bytes written to the file before the buffered bytes
+    bool inSequence;
+    int64_t end; // Of the previous segment of the current sequence
+    int64_t name; // The previous segment or parent name of the current sequence
+    int64_t sequenceNumber;
+    int64_t sequenceCapacity;
+    int64_t *sequenceOffsets; // The file offsets of the sequence records
+    int64_t *segmentNumbers;
+};
+
+static void writer_flush(C2hBinaryWriter *writer) {
+    if (writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->fileHandle) != writer->length) {
+        st_errAbort("Failed to write the binary c2h output\n");
+    }
+    writer->written += writer->length;
+    writer->length = 0;
+}
+
+static void writer_reserve(C2hBinaryWriter *writer, int64_t length) {
+    if (writer->length + length > C2H_BINARY_BUFFER_SIZE) {
+        writer_flush(writer);
+    }
+}
+
+static void writer_addBytes(C2hBinaryWriter *writer, const void *bytes, int64_t length) {
+    if (length > C2H_BINARY_BUFFER_SIZE) {
+        writer_flush(writer);
+        if (fwrite(bytes, 1, length, writer->fileHandle) != length) {
+            st_errAbort("Failed to write the binary c2h output\n");
+        }
+        writer->written += length;
+        return;
+    }
+    writer_reserve(writer, length);
+    memcpy(writer->buffer + writer->length, bytes, length);
+    writer->length += length;
+}
+
+static void writer_addVarint(C2hBinaryWriter *writer, uint64_t i) {
+    /*
+     * The caller must have reserved room for the varint.
+     */
+    while (i >= 0x80) {
+        writer->buffer[writer->length++] = (char)(i | 0x80);
+        i >>= 7;
+    }
+    writer->buffer[writer->length++] = (char)i;
+}
+
+static void writer_addString(C2hBinaryWriter *writer, const char *string) {
+    int64_t length = strlen(string);
+    writer_reserve(writer, 10);
+    writer_addVarint(writer, length);
+    writer_addBytes(writer, string, length);
+}
+
+C2hBinaryWriter *c2hBinaryWriter_construct(FILE *fileHandle) {
+    C2hBinaryWriter *writer = st_calloc(1, sizeof(C2hBinaryWriter));
+    writer->fileHandle = fileHandle;
+    writer->buffer = st_malloc(C2H_BINARY_BUFFER_SIZE);
+    writer_addBytes(writer, C2H_BINARY_MAGIC, 4);
+    writer_reserve(writer, 10);
+    writer_addVarint(writer, C2H_BINARY_VERSION);
+    return writer;
+}
+
+static void writer_endSequence(C2hBinaryWriter *writer) {
+    if (writer->inSequence) {
+        writer_reserve(writer, 1);
+        writer_addVarint(writer, C2H_END_OF_SEQUENCE);
+        writer->inSequence = 0;
+    }
+}
+
+void c2hBinaryWriter_destruct(C2hBinaryWriter *writer) {
+    writer_endSequence(writer);
+    int64_t indexOffset = writer->written + writer->length;
+    writer_reserve(writer, 10);
+    writer_addVarint(writer, writer->sequenceNumber);
+    int64_t previousOffset = 0;
+    for (int64_t i = 0; i < writer->sequenceNumber; i++) {
+        writer_reserve(writer, 20);
+        writer_addVarint(writer, writer->sequenceOffsets[i] - previousOffset);
+        writer_addVarint(writer, writer->segmentNumbers[i]);
+        previousOffset = writer->sequenceOffsets[i];
+    }
+    uint8_t bytes[8];
+    for (int64_t i = 0; i < 8; i++) {
+        bytes[i] = (uint8_t)((uint64_t)indexOffset >> (8 * i));
+    }
+    writer_addBytes(writer, bytes, 8);
+    writer_addBytes(writer, C2H_BINARY_MAGIC, 4);
+    writer_flush(writer);
+    free(writer->sequenceOffsets);
+    free(writer->segmentNumbers);
+    free(writer->buffer);
+    free(writer);
+}
+
+void c2hBinaryWriter_addSequence(C2hBinaryWriter *writer, const char *eventHeader, const char *sequenceHeader,
+                                 bool isBottom) {
+    writer_endSequence(writer);
+    if (writer->sequenceNumber == writer->sequenceCapacity) {
+        writer->sequenceCapacity = writer->sequenceCapacity == 0 ? 64 : 2 * writer->sequenceCapacity;
+        writer->sequenceOffsets = st_realloc(writer->sequenceOffsets, sizeof(int64_t) * writer->sequenceCapacity);
+        writer->segmentNumbers = st_realloc(writer->segmentNumbers, sizeof(int64_t) * writer->sequenceCapacity);
+    }
+    writer->sequenceOffsets[writer->sequenceNumber] = writer->written + writer->length;
+    writer->segmentNumbers[writer->sequenceNumber++] = 0;
+    writer_addString(writer, eventHeader);
+    writer_addString(writer, sequenceHeader);
+    writer_reserve(writer, 1);
+    writer->buffer[writer->length++] = isBottom ? 1 : 0;
+    writer->inSequence = 1;
+    writer->end = 0;
+    writer->name = 0;
+}
+
+void c2hBinaryWriter_addSegment(C2hBinaryWriter *writer, C2hSegment *segment) {
+    assert(writer->inSequence);
+    assert(segment->start >= 0 && segment->length >= 0);
+    writer_reserve(writer, C2H_BINARY_MAX_SEGMENT_LENGTH);
+    writer_addVarint(writer, segment->type);
+    if (segment->type == C2H_BOTTOM_SEGMENT) {
+        writer_addVarint(writer, zigzagEncode(segment->name - writer->name));
+        writer->name = segment->name;
+    }
+    writer_addVarint(writer, zigzagEncode(segment->start - writer->end));
+    writer_addVarint(writer, segment->length);
+    writer->end = segment->start + segment->length;
+    if (segment->type == C2H_TOP_SEGMENT) {
+        writer_addVarint(writer, zigzagEncode(segment->parent - writer->name));
+        writer_addVarint(writer, segment->orientation);
+        writer->name = segment->parent;
+    }
+    writer->segmentNumbers[writer->sequenceNumber - 1]++;
+}
+
+/*
+ * Reader
+ */
+
+struct _c2hBinaryReader {
+    FILE *fileHandle;
+    int64_t sequenceNumber;
+    int64_t *sequenceOffsets;
+    int64_t *segmentNumbers;
+    char *eventHeader;
+    char *sequenceHeader;
+    bool inSequence;
+    int64_t end;
+    int64_t name;
+};
+
+static uint64_t reader_getVarint(C2hBinaryReader *reader) {
+    uint64_t i = 0;
+    for (int64_t shift = 0; shift < 64; shift += 7) {
+        int c = getc(reader->fileHandle);
+        if (c == EOF) {
+            st_errAbort("Unexpected end of binary c2h file\n");
+        }
+        i |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return i;
+        }
+    }
+    st_errAbort("Malformed varint in binary c2h file\n");
+    return 0;
+}
+
+static char *reader_getString(C2hBinaryReader *reader) {
+    int64_t length = reader_getVarint(reader);
+    char *string = st_malloc(length + 1);
+    if (fread(string, 1, length, reader->fileHandle) != length) {
+        st_errAbort("Unexpected end of binary c2h file\n");
+    }
+    string[length] = '\0';
+    return string;
+}
+
+static void reader_checkMagic(C2hBinaryReader *reader) {
+    char magic[4];
+    if (fread(magic, 1, 4, reader->fileHandle) != 4 || memcmp(magic, C2H_BINARY_MAGIC, 4) != 0) {
+        st_errAbort("Not a binary c2h file\n");
+    }
+}
+
+static void reader_seek(C2hBinaryReader *reader, int64_t offset, int whence) {
+    if (fseeko(reader->fileHandle, offset, whence) != 0) {
+        st_errAbort("Failed to seek in binary c2h file\n");
+    }
+}
+
+C2hBinaryReader *c2hBinaryReader_construct(FILE *fileHandle) {
+    C2hBinaryReader *reader = st_calloc(1, sizeof(C2hBinaryReader));
+    reader->fileHandle = fileHandle;
+    reader_seek(reader, 0, SEEK_SET);
+    reader_checkMagic(reader);
+    int64_t version = reader_getVarint(reader);
+    if (version != C2H_BINARY_VERSION) {
+        st_errAbort("Unsupported binary c2h version: %" PRIi64 "\n", version);
+    }
+
+    // Read the index
+    reader_seek(reader, -12, SEEK_END);
+    uint8_t bytes[8];
+    if (fread(bytes, 1, 8, fileHandle) != 8) {
+        st_errAbort("Unexpected end of binary c2h file\n");
+    }
+    reader_checkMagic(reader);
+    int64_t indexOffset = 0;
+    for (int64_t i = 0; i < 8; i++) {
+        indexOffset |= (int64_t)bytes[i] << (8 * i);
+    }
+    reader_seek(reader, indexOffset, SEEK_SET);
+    reader->sequenceNumber = reader_getVarint(reader);
+    reader->sequenceOffsets = st_malloc(sizeof(int64_t) * (reader->sequenceNumber + 1));
+    reader->segmentNumbers = st_malloc(sizeof(int64_t) * (reader->sequenceNumber + 1));
+    int64_t offset = 0;
+    for (int64_t i = 0; i < reader->sequenceNumber; i++) {
+        offset += reader_getVarint(reader);
+        reader->sequenceOffsets[i] = offset;
+        reader->segmentNumbers[i] = reader_getVarint(reader);
+    }
+    return reader;
+}
+
+void c2hBinaryReader_destruct(C2hBinaryReader *reader) {
+    free(reader->sequenceOffsets);
+    free(reader->segmentNumbers);
+    free(reader->eventHeader);
+    free(reader->sequenceHeader);
+    free(reader);
+}
+
+int64_t c2hBinaryReader_getSequenceNumber(C2hBinaryReader *reader) {
+    return reader->sequenceNumber;
+}
+
+int64_t c2hBinaryReader_getSegmentNumber(C2hBinaryReader *reader, int64_t sequenceIndex) {
+    assert(sequenceIndex >= 0 && sequenceIndex < reader->sequenceNumber);
+    return reader->segmentNumbers[sequenceIndex];
+}
+
+void c2hBinaryReader_readSequence(C2hBinaryReader *reader, int64_t sequenceIndex, C2hSequence *sequence) {
+    assert(sequenceIndex >= 0 && sequenceIndex < reader->sequenceNumber);
+    reader_seek(reader, reader->sequenceOffsets[sequenceIndex], SEEK_SET);
+    free(reader->eventHeader);
+    free(reader->sequenceHeader);
+    reader->eventHeader = reader_getString(reader);
+    reader->sequenceHeader = reader_getString(reader);
+    int c = getc(reader->fileHandle);
+    if (c == EOF) {
+        st_errAbort("Unexpected end of binary c2h file\n");
+    }
+    sequence->eventHeader = reader->eventHeader;
+    sequence->sequenceHeader = reader->sequenceHeader;
+    sequence->isBottom = c;
+    reader->inSequence = 1;
+    reader->end = 0;
+    reader->name = 0;
+}
+
+bool c2hBinaryReader_getNextSegment(C2hBinaryReader *reader, C2hSegment *segment) {
+    if (!reader->inSequence) {
+        return 0;
+    }
+    int64_t type = reader_getVarint(reader);
+    if (type == C2H_END_OF_SEQUENCE) {
+        reader->inSequence = 0;
+        return 0;
+    }
+    if (type != C2H_INSERTION_SEGMENT && type != C2H_TOP_SEGMENT && type != C2H_BOTTOM_SEGMENT) {
+        st_errAbort("Unknown segment type in binary c2h file: %" PRIi64 "\n", type);
+    }
+    segment->type = type;
+    if (type == C2H_BOTTOM_SEGMENT) {
+        segment->name = reader->name + zigzagDecode(reader_getVarint(reader));
+        reader->name = segment->name;
+    }
+    segment->start = reader->end + zigzagDecode(reader_getVarint(reader));
+    segment->length = reader_getVarint(reader);
+    reader->end = segment->start + segment->length;
+    if (type == C2H_TOP_SEGMENT) {
+        segment->parent = reader->name + zigzagDecode(reader_getVarint(reader));
+        segment->orientation = reader_getVarint(reader);
+        reader->name = segment->parent;
+    }
+    return 1;
+}
@@ -6,23 +6,24 @@
 
 #include "cactus.h"
 #include "sonLib.h"
-#include "bioioC.h"
 
-static Name globalReferenceEventName;
-
-static int compareSequences(Sequence *sequence, Sequence *sequence2) {
+static int compareSequences(const void *a, const void *b, void *extraArg) {
+    /*
+     * Orders the sequences by event, putting the reference event, given by extraArg, first, then by name.
+     */
+    Sequence *sequence = (Sequence *)a, *sequence2 = (Sequence *)b;
+    Name referenceEventName = *(Name *)extraArg;
     Event *event = sequence_getEvent(sequence);
     Event *event2 = sequence_getEvent(sequence2);
     int i = cactusMisc_nameCompare(event_getName(event), event_getName(event2));
     if (i != 0) {
-        return event_getName(event) == globalReferenceEventName ? -1 : (event_getName(event2) == globalReferenceEventName ? 1 : i);
+        return event_getName(event) == referenceEventName ? -1 : (event_getName(event2) == referenceEventName ? 1 : i);
     }
     i = cactusMisc_nameCompare(sequence_getName(sequence), sequence_getName(sequence2));
     return i;
 }
 
 static stList *getSequences(Flower *flower, Name referenceEventName) {
-    globalReferenceEventName = referenceEventName;
     stList *sequences = stList_construct();
     Sequence *sequence;
     Flower_SequenceIterator *seqIt = flower_getSequenceIterator(flower);
@@ -30,22 +31,23 @@ static stList *getSequences(Flower *flower, Name referenceEventName) {
         stList_append(sequences, sequence);
     }
     flower_destructSequenceIterator(seqIt);
-    stList_sort(sequences, (int (*)(const void *, const void *))compareSequences);
+    stList_sort2(sequences, compareSequences, &referenceEventName);
     return sequences;
 }
 
-void printFastaSequences(Flower *flower, FILE *fileHandle, Name referenceEventName) {
+void printFastaSequences(Flower *flower, FILE *fileHandle, FILE *indexFileHandle, Name referenceEventName) {
     stList *sequences = getSequences(flower, referenceEventName);
-    for(int64_t i=0; i<stList_length(sequences); i++) {
+    stList *nonTrivialSequences = stList_construct();
+    stList *headers = stList_construct();
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
         Sequence *sequence = stList_get(sequences, i);
-        if(!sequence_isTrivialSequence(sequence)) {
-            char *string = sequence_getString(sequence, sequence_getStart(sequence),
-                    sequence_getLength(sequence), 1);
-            const char *header = sequence_getHeader(sequence);
-            fastaWrite(string, (char *)header, fileHandle);
-            //fprintf(fileHandle, ">%s\n%s\n", (char *)header, string);
-            free(string);
+        if (!sequence_isTrivialSequence(sequence)) {
+            stList_append(nonTrivialSequences, sequence);
+            stList_append(headers, (char *)sequence_getHeader(sequence));
         }
     }
+    sequence_writeFasta(nonTrivialSequences, headers, 80, fileHandle, indexFileHandle);
+    stList_destruct(headers);
+    stList_destruct(nonTrivialSequences);
     stList_destruct(sequences);
 }
@@ -3,12 +3,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "cactus.h"
 #include "sonLib.h"
 #include "recursiveThreadBuilder.h"
+#include "c2hBinary.h"
+#include "hal.h"
 
-static Name globalReferenceEventName;
+/*
+ * The state shared by the functions writing the output for one flower, passed to the thread builder's write
+ * functions as their extra argument, so that outputs can be made for different flowers or references
+ * concurrently.
+ */
+typedef struct _halEmitter {
+    Name referenceEventName;
+} HalEmitter;
 
 /*
  * Hal encodes a hierarchical alignment format.
@@ -77,62 +87,239 @@ static Name globalReferenceEventName;
  *      1
  */
 
-static void writeSequenceHeader(FILE *fileHandle, Sequence *sequence) {
+/*
+ * The c2h text is formatted into a large buffer, with integers converted by hand, and written out only
+ * when the buffer fills, rather than with a printf call or an allocated string per line. Each call to make
+ * the hal output has its own writer.
+ */
+#define C2H_BUFFER_SIZE (1 << 20)
+#define C2H_MAX_LINE_LENGTH 128 // "a", up to four 20 digit fields each preceded by a tab, and a newline
+
+typedef struct _c2hWriter {
+    FILE *fileHandle;
+    char *buffer;
+    int64_t length;
+} C2hWriter;
+
+static void c2hWriter_init(C2hWriter *writer, FILE *fileHandle) {
+    writer->fileHandle = fileHandle;
+    writer->buffer = st_malloc(C2H_BUFFER_SIZE);
+    writer->length = 0;
+}
+
+static void c2hWriter_flush(C2hWriter *writer) {
+    if (writer->length > 0 && fwrite(writer->buffer, 1, writer->length, writer->fileHandle) != writer->length) {
+        st_errAbort("Failed to write the c2h output\n");
+    }
+    writer->length = 0;
+}
+
+static void c2hWriter_finish(C2hWriter *writer) {
+    c2hWriter_flush(writer);
+    free(writer->buffer);
+}
+
+static char *c2hWriter_reserve(C2hWriter *writer, int64_t length) {
+    /*
+     * Returns the end of the buffered text, having made room for at least length more characters.
+     */
+    assert(length <= C2H_BUFFER_SIZE);
+    if (writer->length + length > C2H_BUFFER_SIZE) {
+        c2hWriter_flush(writer);
+    }
+    return writer->buffer + writer->length;
+}
+
+static void c2hWriter_addString(C2hWriter *writer, const char *string) {
+    int64_t length = strlen(string);
+    if (length > C2H_BUFFER_SIZE) {
+        c2hWriter_flush(writer);
+        if (fwrite(string, 1, length, writer->fileHandle) != length) {
+            st_errAbort("Failed to write the c2h output\n");
+        }
+        return;
+    }
+    memcpy(c2hWriter_reserve(writer, length), string, length);
+    writer->length += length;
+}
+
+static char *formatInt(char *p, uint64_t i) {
+    char digits[20];
+    int64_t j = 0;
+    do {
+        digits[j++] = '0' + i % 10;
+        i /= 10;
+    } while (i > 0);
+    while (j > 0) {
+        *p++ = digits[--j];
+    }
+    return p;
+}
+
+static char *formatSegmentLine(char *p, int64_t *fields, int64_t fieldNumber) {
+    /*
+     * Writes "a" followed by the tab separated fields and a newline at p, returning the end of the line.
+     */
+    *p++ = 'a';
+    for (int64_t i = 0; i < fieldNumber; i++) {
+        *p++ = '\t';
+        p = formatInt(p, fields[i]);
+    }
+    *p++ = '\n';
+    return p;
+}
+
+static void writeSequenceLine(C2hWriter *writer, const char *eventHeader, const char *sequenceHeader, bool isBottom) {
     //s eventName sequenceName isBottom
+    c2hWriter_addString(writer, "s\t'");
+    c2hWriter_addString(writer, eventHeader);
+    c2hWriter_addString(writer, "'\t'");
+    c2hWriter_addString(writer, sequenceHeader);
+    c2hWriter_addString(writer, isBottom ? "'\t1\n" : "'\t0\n");
+}
+
+static void writeSequenceHeader(C2hWriter *writer, HalEmitter *emitter, Sequence *sequence) {
     Event *event = sequence_getEvent(sequence);
     assert(event != NULL);
     assert(event_getHeader(event) != NULL);
     assert(sequence_getHeader(sequence) != NULL);
-    fprintf(fileHandle, "s\t'%s'\t'%s'\t%i\n", event_getHeader(event), sequence_getHeader(sequence),
-            event_getName(event) == globalReferenceEventName);
+    writeSequenceLine(writer, event_getHeader(event), sequence_getHeader(sequence),
+                      event_getName(event) == emitter->referenceEventName);
 }
 
-static char *writeTerminalAdjacency(Cap *cap, void *extraArg) {
+/*
+ * The segment lines are described by a type, as in the binary format (see c2hBinary.h), followed by the values of
+ * their fields.
+ */
+static int64_t getSegmentFieldNumber(int64_t type) {
+    return type == C2H_INSERTION_SEGMENT ? 2 : (type == C2H_TOP_SEGMENT ? 4 : 3);
+}
+
+static int64_t getTerminalAdjacencyLine(HalEmitter *emitter, Cap *cap, int64_t *line) {
+    /*
+     * Puts the type and fields of the line for the adjacency in line, returning the number of entries, which is
+     * zero if the adjacency is empty.
+     */
     //a start length reference-segment block-orientation
     Cap *adjacentCap = cap_getAdjacency(cap);
     assert(adjacentCap != NULL);
     int64_t adjacencyLength = cap_getCoordinate(adjacentCap) - cap_getCoordinate(cap) - 1;
     assert(adjacencyLength >= 0);
-    if (adjacencyLength > 0) {
-        Sequence *sequence = cap_getSequence(cap);
-        assert(sequence != NULL);
-        assert(cap_getEvent(cap) != NULL);
-        if (event_getName(cap_getEvent(cap)) == globalReferenceEventName) {
-            return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", cap_getName(cap), cap_getCoordinate(cap) + 1 - sequence_getStart(sequence), adjacencyLength);
-        }
-        return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\n", cap_getCoordinate(cap) + 1 - sequence_getStart(sequence), adjacencyLength);
+    if (adjacencyLength == 0) {
+        return 0;
     }
-    else {
-        return stString_copy("");
+    Sequence *sequence = cap_getSequence(cap);
+    assert(sequence != NULL);
+    assert(cap_getEvent(cap) != NULL);
+    int64_t i = 0;
+    if (event_getName(cap_getEvent(cap)) == emitter->referenceEventName) {
+        line[i++] = C2H_BOTTOM_SEGMENT;
+        line[i++] = cap_getName(cap);
+    } else {
+        line[i++] = C2H_INSERTION_SEGMENT;
     }
+    line[i++] = cap_getCoordinate(cap) + 1 - sequence_getStart(sequence);
+    line[i++] = adjacencyLength;
+    return i;
 }
 
-static char *writeSegment(Segment *segment, void *extraArg) {
+static int64_t getSegmentLine(HalEmitter *emitter, Segment *segment, int64_t *line) {
+    /*
+     * As getTerminalAdjacencyLine, for a segment, which always has a line.
+     */
     Block *block = segment_getBlock(segment);
-    Segment *referenceSegment = block_getSegmentForEvent(block, globalReferenceEventName);
+    Segment *referenceSegment = block_getSegmentForEvent(block, emitter->referenceEventName);
     if (referenceSegment == NULL) {
         Cap *cap5 = segment_get5Cap(segment);
         Cap *cap3 = segment_get3Cap(segment);
         Sequence *sequence = cap_getSequence(cap5);
-        return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\n", cap_getCoordinate(cap5) - sequence_getStart(sequence), cap_getCoordinate(cap3) - cap_getCoordinate(cap5) + 1);
+        line[0] = C2H_INSERTION_SEGMENT;
+        line[1] = cap_getCoordinate(cap5) - sequence_getStart(sequence);
+        line[2] = cap_getCoordinate(cap3) - cap_getCoordinate(cap5) + 1;
+        return 3;
     }
     Sequence *sequence = segment_getSequence(segment);
     assert(sequence != NULL);
     Name eventName = event_getName(segment_getEvent(segment));
-    if (referenceSegment != segment && eventName != globalReferenceEventName) { //Is a top segment
-        return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", segment_getStart(segment) - sequence_getStart(sequence), segment_getLength(segment), segment_getName(referenceSegment), segment_getStrand(referenceSegment));
-    } else {
-        //Is a bottom segment
-        return stString_print("a\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\n", segment_getName(segment), segment_getStart(segment) - sequence_getStart(sequence), segment_getLength(segment));
+    if (referenceSegment != segment && eventName != emitter->referenceEventName) { //Is a top segment
+        line[0] = C2H_TOP_SEGMENT;
+        line[1] = segment_getStart(segment) - sequence_getStart(sequence);
+        line[2] = segment_getLength(segment);
+        line[3] = segment_getName(referenceSegment);
+        line[4] = segment_getStrand(referenceSegment);
+        return 5;
     }
+    //Is a bottom segment
+    line[0] = C2H_BOTTOM_SEGMENT;
+    line[1] = segment_getName(segment);
+    line[2] = segment_getStart(segment) - sequence_getStart(sequence);
+    line[3] = segment_getLength(segment);
+    return 4;
 }
 
-static int compareCaps(Cap *cap, Cap *cap2) {
+static char *lineToString(int64_t *line, int64_t lineLength) {
+    /*
+     * The database builders take ownership of a string per segment or adjacency.
+     */
+    char string[C2H_MAX_LINE_LENGTH];
+    char *p = string;
+    if (lineLength > 0) {
+        p = formatSegmentLine(p, line + 1, lineLength - 1);
+    }
+    *p = '\0';
+    return stString_copy(string);
+}
+
+static char *writeTerminalAdjacency(Cap *cap, void *extraArg) {
+    int64_t line[5];
+    return lineToString(line, getTerminalAdjacencyLine(extraArg, cap, line));
+}
+
+static char *writeSegment(Segment *segment, void *extraArg) {
+    int64_t line[5];
+    return lineToString(line, getSegmentLine(extraArg, segment, line));
+}
+
+static void writeTerminalAdjacencyRecord(Cap *cap, ThreadRecord *record, void *extraArg) {
+    int64_t line[5];
+    int64_t lineLength = getTerminalAdjacencyLine(extraArg, cap, line);
+    for (int64_t i = 0; i < lineLength; i++) {
+        threadRecord_addInt(record, line[i]);
+    }
+}
+
+static void writeSegmentRecord(Segment *segment, ThreadRecord *record, void *extraArg) {
+    int64_t line[5];
+    int64_t lineLength = getSegmentLine(extraArg, segment, line);
+    for (int64_t i = 0; i < lineLength; i++) {
+        threadRecord_addInt(record, line[i]);
+    }
+}
+
+static void writeThreadRecord(C2hWriter *writer, ThreadRecord *record) {
+    /*
+     * Renders the segment lines of a thread record as c2h text.
+     */
+    int64_t offset = 0;
+    int64_t fields[4];
+    while (offset < threadRecord_getFieldsLength(record)) {
+        int64_t fieldNumber = getSegmentFieldNumber(threadRecord_getInt(record, &offset));
+        for (int64_t i = 0; i < fieldNumber; i++) {
+            fields[i] = threadRecord_getInt(record, &offset);
+        }
+        char *p = c2hWriter_reserve(writer, C2H_MAX_LINE_LENGTH);
+        writer->length = formatSegmentLine(p, fields, fieldNumber) - writer->buffer;
+    }
+}
+
+static int compareCaps(const void *a, const void *b, void *extraArg) {
+    Cap *cap = (Cap *)a, *cap2 = (Cap *)b;
+    Name referenceEventName = ((HalEmitter *)extraArg)->referenceEventName;
     Event *event = cap_getEvent(cap);
     Event *event2 = cap_getEvent(cap2);
     int i = cactusMisc_nameCompare(event_getName(event), event_getName(event2));
     if (i != 0) {
-        return event_getName(event) == globalReferenceEventName ? -1 : (event_getName(event2) == globalReferenceEventName ? 1 : i);
+        return event_getName(event) == referenceEventName ? -1 : (event_getName(event2) == referenceEventName ? 1 : i);
     }
     Sequence *sequence = cap_getSequence(cap);
     Sequence *sequence2 = cap_getSequence(cap2);
@@ -143,14 +330,14 @@ static int compareCaps(Cap *cap, Cap *cap2) {
     return i;
 }
 
-static stList *getCaps(Flower *flower) {
+static stList *getCaps(Flower *flower, HalEmitter *emitter) {
     //Get the caps in order
     stList *caps = stList_construct();
     End *end;
     Flower_EndIterator *endIt = flower_getEndIterator(flower);
     while ((end = flower_getNextEnd(endIt)) != NULL) {
         if (end_isStubEnd(end)) { // && end_isAttached(end)) {
-            Cap *cap; // = end_getCapForEvent(end, globalReferenceEventName);
+            Cap *cap;
             End_InstanceIterator *capIt = end_getInstanceIterator(end);
             while ((cap = end_getNext(capIt)) != NULL) {
                 if (cap_getSequence(cap) != NULL) {
@@ -164,47 +351,123 @@ static stList *getCaps(Flower *flower) {
         }
     }
     flower_destructEndIterator(endIt);
-    stList_sort(caps, (int(*)(const void *, const void *)) compareCaps);
+    stList_sort2(caps, compareCaps, emitter);
     return caps;
 }
 
 void makeHalFormat(Flower *flower, stKVDatabase *database, Name referenceEventName, FILE *fileHandle) {
-    globalReferenceEventName = referenceEventName;
-    stList *caps = getCaps(flower);
+    HalEmitter emitter = { .referenceEventName = referenceEventName };
+    stList *caps = getCaps(flower, &emitter);
     if (fileHandle == NULL) {
-        buildRecursiveThreads(database, caps, writeSegment, writeTerminalAdjacency, NULL);
+        buildRecursiveThreads(database, caps, writeSegment, writeTerminalAdjacency, &emitter);
     } else {
-        stList *threadStrings = buildRecursiveThreadsInList(database, caps, writeSegment, writeTerminalAdjacency, NULL);
+        stList *threadStrings = buildRecursiveThreadsInList(database, caps, writeSegment, writeTerminalAdjacency, &emitter);
         assert(stList_length(threadStrings) == stList_length(caps));
+        C2hWriter writer;
+        c2hWriter_init(&writer, fileHandle);
         for (int64_t i = 0; i < stList_length(threadStrings); i++) {
             Cap *cap = stList_get(caps, i);
             if(!sequence_isTrivialSequence(cap_getSequence(cap))) {
-                char *threadString = stList_get(threadStrings, i);
-                writeSequenceHeader(fileHandle, cap_getSequence(cap));
-                fprintf(fileHandle, "%s\n", threadString);
+                writeSequenceHeader(&writer, &emitter, cap_getSequence(cap));
+                c2hWriter_addString(&writer, stList_get(threadStrings, i));
+                c2hWriter_addString(&writer, "\n");
             }
         }
+        c2hWriter_finish(&writer);
+        stList_destruct(threadStrings);
     }
     stList_destruct(caps);
 }
 
+static void writeBinaryThreadRecord(C2hBinaryWriter *writer, HalEmitter *emitter, Sequence *sequence,
+                                    ThreadRecord *record) {
+    Event *event = sequence_getEvent(sequence);
+    c2hBinaryWriter_addSequence(writer, event_getHeader(event), sequence_getHeader(sequence),
+                                event_getName(event) == emitter->referenceEventName);
+    int64_t offset = 0;
+    C2hSegment segment;
+    while (offset < threadRecord_getFieldsLength(record)) {
+        segment.type = threadRecord_getInt(record, &offset);
+        if (segment.type == C2H_BOTTOM_SEGMENT) {
+            segment.name = threadRecord_getInt(record, &offset);
+        }
+        segment.start = threadRecord_getInt(record, &offset);
+        segment.length = threadRecord_getInt(record, &offset);
+        if (segment.type == C2H_TOP_SEGMENT) {
+            segment.parent = threadRecord_getInt(record, &offset);
+            segment.orientation = threadRecord_getInt(record, &offset);
+        }
+        c2hBinaryWriter_addSegment(writer, &segment);
+    }
+}
+
 void makeHalFormatNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName, FILE *fileHandle) {
-    globalReferenceEventName = referenceEventName;
-    stList *caps = getCaps(flower);
+    makeHalFormatNoDb2(flower, rh, referenceEventName, fileHandle, 0);
+}
+
+void makeHalFormatNoDb2(Flower *flower, RecordHolder *rh, Name referenceEventName, FILE *fileHandle, bool binary) {
+    HalEmitter emitter = { .referenceEventName = referenceEventName };
+    stList *caps = getCaps(flower, &emitter);
     if (fileHandle == NULL) {
-        buildRecursiveThreadsNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL);
+        buildRecursiveThreadsNoDb(rh, caps, writeSegmentRecord, writeTerminalAdjacencyRecord, &emitter);
     } else {
-        stList *threadStrings = buildRecursiveThreadsInListNoDb(rh, caps, writeSegment, writeTerminalAdjacency, NULL);
-        assert(stList_length(threadStrings) == stList_length(caps));
-        for (int64_t i = 0; i < stList_length(threadStrings); i++) {
+        stList *threads = buildRecursiveThreadsInListNoDb(rh, caps, writeSegmentRecord, writeTerminalAdjacencyRecord, &emitter);
+        assert(stList_length(threads) == stList_length(caps));
+        C2hWriter writer;
+        C2hBinaryWriter *binaryWriter = NULL;
+        if (binary) {
+            binaryWriter = c2hBinaryWriter_construct(fileHandle);
+        } else {
+            c2hWriter_init(&writer, fileHandle);
+        }
+        for (int64_t i = 0; i < stList_length(threads); i++) {
             Cap *cap = stList_get(caps, i);
             if(!sequence_isTrivialSequence(cap_getSequence(cap))) {
-                char *threadString = stList_get(threadStrings, i);
-                writeSequenceHeader(fileHandle, cap_getSequence(cap));
-                fprintf(fileHandle, "%s\n", threadString);
+                if (binary) {
+                    writeBinaryThreadRecord(binaryWriter, &emitter, cap_getSequence(cap), stList_get(threads, i));
+                } else {
+                    writeSequenceHeader(&writer, &emitter, cap_getSequence(cap));
+                    writeThreadRecord(&writer, stList_get(threads, i));
+                    c2hWriter_addString(&writer, "\n");
+                }
             }
         }
-        stList_destruct(threadStrings);
+        if (binary) {
+            c2hBinaryWriter_destruct(binaryWriter);
+        } else {
+            c2hWriter_finish(&writer);
+        }
+        stList_destruct(threads);
     }
     stList_destruct(caps);
-}
\ No newline at end of file
+}
+
+void c2hBinaryToText(FILE *binaryFileHandle, FILE *fileHandle) {
+    C2hBinaryReader *reader = c2hBinaryReader_construct(binaryFileHandle);
+    C2hWriter writer;
+    c2hWriter_init(&writer, fileHandle);
+    C2hSequence sequence;
+    C2hSegment segment;
+    int64_t fields[4];
+    for (int64_t i = 0; i < c2hBinaryReader_getSequenceNumber(reader); i++) {
+        c2hBinaryReader_readSequence(reader, i, &sequence);
+        writeSequenceLine(&writer, sequence.eventHeader, sequence.sequenceHeader, sequence.isBottom);
+        while (c2hBinaryReader_getNextSegment(reader, &segment)) {
+            int64_t j = 0;
+            if (segment.type == C2H_BOTTOM_SEGMENT) {
+                fields[j++] = segment.name;
+            }
+            fields[j++] = segment.start;
+            fields[j++] = segment.length;
+            if (segment.type == C2H_TOP_SEGMENT) {
+                fields[j++] = segment.parent;
+                fields[j++] = segment.orientation;
+            }
+            char *p = c2hWriter_reserve(&writer, C2H_MAX_LINE_LENGTH);
+            writer.length = formatSegmentLine(p, fields, j) - writer.buffer;
+        }
+        c2hWriter_addString(&writer, "\n");
+    }
+    c2hWriter_finish(&writer);
+    c2hBinaryReader_destruct(reader);
+}
@@ -0,0 +1,112 @@
+/*
+ * c2hBinary.h
+ *
+ * A binary form of the .c2h format written by makeHalFormatNoDb (see hal.c), which avoids formatting every
+ * segment as decimal text only for it to be parsed back.
+ *
+ * file :
+ *      "C2HB" version sequenceRecord* index indexOffset "C2HB"
+ *
+ * sequenceRecord :
+ *      eventHeader sequenceHeader isBottom segmentRecord* endOfSequence
+ *
+ * eventHeader, sequenceHeader :
+ *      length(varint) bytes
+ *
+ * isBottom :
+ *      byte, 0 or 1
+ *
+ * segmentRecord :
+ *      C2H_INSERTION_SEGMENT start length
+ *      C2H_TOP_SEGMENT start length parentSegment alignmentOrientation
+ *      C2H_BOTTOM_SEGMENT segmentName start length
+ *
+ * endOfSequence :
+ *      C2H_END_OF_SEQUENCE
+ *
+ * All integers are unsigned LEB128 varints. start is stored as the zigzag encoded difference from the end of the
+ * previous segment of the sequence (or from 0), so is usually 0, and segmentName and parentSegment as the zigzag
+ * encoded difference from the previous segment or parent name in the sequence.
+ *
+ * index :
+ *      sequenceNumber (sequenceOffset segmentNumber)*
+ *
+ * Each sequenceOffset is the difference between the file offset of the sequence's record and that of the previous
+ * sequence (or 0). indexOffset is the file offset of the index as 8 little endian bytes.
+ *
+ *  Created on: 19 Oct 2026
+ */
+
+#ifndef C2H_BINARY_H_
+#define C2H_BINARY_H_
+
+#include "sonLib.h"
+
+#define C2H_BINARY_VERSION 1
+
+#define C2H_INSERTION_SEGMENT 0 // start length
+#define C2H_TOP_SEGMENT 1 // start length parentSegment alignmentOrientation
+#define C2H_BOTTOM_SEGMENT 2 // segmentName start length
+#define C2H_END_OF_SEQUENCE 3
+
+typedef struct _c2hSegment {
+    int64_t type;
+    int64_t name; // Of a bottom segment
+    int64_t start;
+    int64_t length;
+    int64_t parent; // Name of the bottom segment a top segment aligns to
+    int64_t orientation; // Of a top segment's alignment to its parent
+} C2hSegment;
+
+typedef struct _c2hSequence {
+    char *eventHeader;
+    char *sequenceHeader;
+    bool isBottom;
+} C2hSequence;
+
+typedef struct _c2hBinaryWriter C2hBinaryWriter;
+
+C2hBinaryWriter *c2hBinaryWriter_construct(FILE *fileHandle);
+
+/*
+ * Writes the index and the end of the file, then frees the writer. Does not close the file.
+ */
+void c2hBinaryWriter_destruct(C2hBinaryWriter *writer);
+
+/*
+ * Starts a new sequence, ending the previous one.
+ */
+void c2hBinaryWriter_addSequence(C2hBinaryWriter *writer, const char *eventHeader, const char *sequenceHeader,
+                                 bool isBottom);
+
+/*
+ * Adds a segment to the current sequence.
+ */
+void c2hBinaryWriter_addSegment(C2hBinaryWriter *writer, C2hSegment *segment);
+
+typedef struct _c2hBinaryReader C2hBinaryReader;
+
+/*
+ * Reads the index of the file, aborting if it is not a binary c2h file.
+ */
+C2hBinaryReader *c2hBinaryReader_construct(FILE *fileHandle);
+
+void c2hBinaryReader_destruct(C2hBinaryReader *reader);
+
+int64_t c2hBinaryReader_getSequenceNumber(C2hBinaryReader *reader);
+
+int64_t c2hBinaryReader_getSegmentNumber(C2hBinaryReader *reader, int64_t sequenceIndex);
+
+/*
+ * Moves to the start of the given sequence, reading its description into sequence. The headers are owned by the
+ * reader and valid until the next call.
+ */
+void c2hBinaryReader_readSequence(C2hBinaryReader *reader, int64_t sequenceIndex, C2hSequence *sequence);
+
+/*
+ * Reads the next segment of the current sequence into segment, returning false, and leaving segment unchanged, once
+ * the sequence's segments are exhausted.
+ */
+bool c2hBinaryReader_getNextSegment(C2hBinaryReader *reader, C2hSegment *segment);
+
+#endif /* C2H_BINARY_H_ */
@@ -17,6 +17,20 @@ void makeHalFormat(Flower *flower, stKVDatabase *database, Name referenceEventNa
 
 void makeHalFormatNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName, FILE *fileHandle);
 
-void printFastaSequences(Flower *flower, FILE *fileHandle, Name referenceEventName);
+/*
+ * As makeHalFormatNoDb, writing the binary form of c2h described in c2hBinary.h if binary is true.
+ */
+void makeHalFormatNoDb2(Flower *flower, RecordHolder *rh, Name referenceEventName, FILE *fileHandle, bool binary);
+
+/*
+ * Converts a binary c2h file to the c2h text that makeHalFormatNoDb would have written.
+ */
+void c2hBinaryToText(FILE *binaryFileHandle, FILE *fileHandle);
+
+/*
+ * Writes the non-trivial sequences of the flower as FASTA, those of the reference event first, and, if
+ * indexFileHandle is not NULL, their .fai index.
+ */
+void printFastaSequences(Flower *flower, FILE *fileHandle, FILE *indexFileHandle, Name referenceEventName);
 
 #endif /* HAL_H_ */
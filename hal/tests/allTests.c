@@ -10,10 +10,12 @@
 #include <string.h>
 #include "sonLib.h"
 
+CuSuite *c2hBinaryTestSuite(void);
 
 int halGeneratorAllTests(void) {
 	CuString *output = CuStringNew();
 	CuSuite* suite = CuSuiteNew();
+	CuSuiteAddSuite(suite, c2hBinaryTestSuite());
 	CuSuiteRun(suite);
 	CuSuiteSummary(suite, output);
 	CuSuiteDetails(suite, output);
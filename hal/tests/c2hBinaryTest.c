@@ -0,0 +1,100 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "CuTest.h"
+#include "sonLib.h"
+#include "cactus.h"
+#include "c2hBinary.h"
+#include "hal.h"
+
+static C2hSegment segments[] = { { C2H_BOTTOM_SEGMENT, 1000000007, 0, 10, 0, 0 },
+                                 { C2H_BOTTOM_SEGMENT, 12, 10, 5, 0, 0 },
+                                 { C2H_INSERTION_SEGMENT, 0, 15, 3, 0, 0 },
+                                 { C2H_TOP_SEGMENT, 0, 0, 10, 1000000007, 1 },
+                                 { C2H_TOP_SEGMENT, 0, 12, 5, 12, 0 } };
+
+static const char *c2hText = "s\t'Anc0'\t'Anc0.0'\t1\n"
+                             "a\t1000000007\t0\t10\n"
+                             "a\t12\t10\t5\n"
+                             "a\t15\t3\n"
+                             "\n"
+                             "s\t'human'\t'chr1'\t0\n"
+                             "a\t0\t10\t1000000007\t1\n"
+                             "a\t12\t5\t12\t0\n"
+                             "\n"
+                             "s\t'mouse'\t'chr1'\t0\n"
+                             "\n";
+
+static FILE *writeTestFile(void) {
+    FILE *fileHandle = tmpfile();
+    C2hBinaryWriter *writer = c2hBinaryWriter_construct(fileHandle);
+    c2hBinaryWriter_addSequence(writer, "Anc0", "Anc0.0", 1);
+    for (int64_t i = 0; i < 3; i++) {
+        c2hBinaryWriter_addSegment(writer, &segments[i]);
+    }
+    c2hBinaryWriter_addSequence(writer, "human", "chr1", 0);
+    for (int64_t i = 3; i < 5; i++) {
+        c2hBinaryWriter_addSegment(writer, &segments[i]);
+    }
+    c2hBinaryWriter_addSequence(writer, "mouse", "chr1", 0);
+    c2hBinaryWriter_destruct(writer);
+    return fileHandle;
+}
+
+static void testC2hBinary_roundTrip(CuTest *testCase) {
+    FILE *fileHandle = writeTestFile();
+    C2hBinaryReader *reader = c2hBinaryReader_construct(fileHandle);
+    CuAssertIntEquals(testCase, 3, c2hBinaryReader_getSequenceNumber(reader));
+    CuAssertIntEquals(testCase, 3, c2hBinaryReader_getSegmentNumber(reader, 0));
+    CuAssertIntEquals(testCase, 2, c2hBinaryReader_getSegmentNumber(reader, 1));
+    CuAssertIntEquals(testCase, 0, c2hBinaryReader_getSegmentNumber(reader, 2));
+
+    // Read the sequences out of order, using the index
+    int64_t firstSegments[] = { 3, 0 };
+    for (int64_t i = 1; i >= 0; i--) {
+        C2hSequence sequence;
+        c2hBinaryReader_readSequence(reader, i, &sequence);
+        CuAssertStrEquals(testCase, i == 0 ? "Anc0" : "human", sequence.eventHeader);
+        CuAssertStrEquals(testCase, i == 0 ? "Anc0.0" : "chr1", sequence.sequenceHeader);
+        CuAssertIntEquals(testCase, i == 0, sequence.isBottom);
+        C2hSegment segment;
+        for (int64_t j = 0; j < c2hBinaryReader_getSegmentNumber(reader, i); j++) {
+            CuAssertTrue(testCase, c2hBinaryReader_getNextSegment(reader, &segment));
+            C2hSegment *expected = &segments[firstSegments[i] + j];
+            CuAssertIntEquals(testCase, expected->type, segment.type);
+            CuAssertIntEquals(testCase, expected->start, segment.start);
+            CuAssertIntEquals(testCase, expected->length, segment.length);
+            if (expected->type == C2H_BOTTOM_SEGMENT) {
+                CuAssertIntEquals(testCase, expected->name, segment.name);
+            }
+            if (expected->type == C2H_TOP_SEGMENT) {
+                CuAssertIntEquals(testCase, expected->parent, segment.parent);
+                CuAssertIntEquals(testCase, expected->orientation, segment.orientation);
+            }
+        }
+        CuAssertTrue(testCase, !c2hBinaryReader_getNextSegment(reader, &segment));
+    }
+    c2hBinaryReader_destruct(reader);
+    fclose(fileHandle);
+}
+
+static void testC2hBinary_toText(CuTest *testCase) {
+    FILE *fileHandle = writeTestFile();
+    FILE *textFileHandle = tmpfile();
+    c2hBinaryToText(fileHandle, textFileHandle);
+    rewind(textFileHandle);
+    char text[1000];
+    size_t length = fread(text, 1, sizeof(text) - 1, textFileHandle);
+    text[length] = '\0';
+    CuAssertStrEquals(testCase, c2hText, text);
+    fclose(fileHandle);
+    fclose(textFileHandle);
+}
+
+CuSuite *c2hBinaryTestSuite(void) {
+    CuSuite *suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testC2hBinary_roundTrip);
+    SUITE_ADD_TEST(suite, testC2hBinary_toText);
+    return suite;
+}
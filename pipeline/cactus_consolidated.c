@@ -36,6 +36,9 @@ void usage() {
     fprintf(stderr, "-f --outputFile : [Required] The file to write the combined cactus to hal output\n");
     fprintf(stderr, "-F --outputHalFastaFile : The file to write the sequences in to build the hal file.\n");
     fprintf(stderr, "-G --outputReferenceFile : The file to write the sequences of the reference in (used in the progressive recursion).\n");
+    fprintf(stderr, "-B --binaryOutput : Write the output file in the binary c2h format (see hal/inc/c2hBinary.h), "
+            "which cactus_c2hBinaryToText converts to text\n");
+    fprintf(stderr, "-i --outputFastaIndexes : Also write a .fai index alongside each of the output FASTA files\n");
     fprintf(stderr, "-s --sequences [Required] [eventName fastaFile/Directory]xN: [Required] The sequences\n");
     fprintf(stderr, "-a --alignments : [Required] The alignments file\n");
     fprintf(stderr, "-S --secondaryAlignments : The secondary alignments file\n");
@@ -67,8 +70,14 @@ static RecordHolder *getMergedRecordHolders(stHash *recordHolders, Flower *flowe
     return rh;
 }
 
+typedef struct _bottomUpArgs {
+    Name referenceEventName;
+    stTree *phylogeneticTree; // Shared by all the flowers, see bottomUpNoDb2
+} BottomUpArgs;
+
 static void callBottomUp(Flower *flower, RecordHolder *rh, void *extraArg) {
-    bottomUpNoDb(flower, rh, (Name)extraArg, 0, generateJukesCantorMatrix);
+    BottomUpArgs *args = extraArg;
+    bottomUpNoDb2(flower, rh, args->referenceEventName, 0, args->phylogeneticTree);
 }
 
 static void callHalFn(Flower *flower, RecordHolder *rh, void *extraArg) {
@@ -122,6 +131,16 @@ static bool refSequenceProvided(char *sequenceFilesAndEvents, char *referenceEve
     return found_ref;
 }
 
+static FILE *openFastaIndex(char *fastaFile) {
+    char *indexFile = stString_print("%s.fai", fastaFile);
+    FILE *fileHandle = fopen(indexFile, "w");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the FASTA index file %s\n", indexFile);
+    }
+    free(indexFile);
+    return fileHandle;
+}
+
 int flower_sizeCmpFn(const void *a, const void *b) {
     // Sort by number of caps the flowers contains
     int64_t i = flower_getCapNumber((Flower *)a), j = flower_getCapNumber((Flower *)b);
@@ -147,6 +166,8 @@ int main(int argc, char *argv[]) {
     char *outgroupEvents = NULL;
     char *referenceEventString = NULL;
     bool runChecks = 0;
+    bool outputFastaIndexes = 0;
+    bool binaryOutput = 0;
 
     ///////////////////////////////////////////////////////////////////////////
     // (0) Parse the inputs handed by genomeCactus.py / setup stuff.
@@ -166,6 +187,8 @@ int main(int argc, char *argv[]) {
                 { "outputFile", required_argument, 0, 'f' },
                 { "outputHalFastaFile", required_argument, 0, 'F' },
                 { "outputReferenceFile", required_argument, 0, 'G' },
+                { "outputFastaIndexes", no_argument, 0, 'i' },
+                { "binaryOutput", no_argument, 0, 'B' },
                 { "sequences", required_argument, 0, 's' },
                 { "alignments", required_argument, 0, 'a' },
                 { "secondaryAlignments", required_argument, 0, 'S' },
@@ -180,7 +203,7 @@ int main(int argc, char *argv[]) {
 
         int option_index = 0;
 
-        int64_t key = getopt_long(argc, argv, "l:p:s:a:S:c:g:o:hr:F:G:tT:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:p:s:a:S:c:g:o:hr:F:G:iBtT:", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -202,6 +225,12 @@ int main(int argc, char *argv[]) {
             case 'G':
                 outputReferenceFile = optarg;
                 break;
+            case 'i':
+                outputFastaIndexes = 1;
+                break;
+            case 'B':
+                binaryOutput = 1;
+                break;
             case 's':
                 sequenceFilesAndEvents = optarg;
                 break;
@@ -407,8 +436,13 @@ int main(int argc, char *argv[]) {
         st_logInfo("Ran cactus make reference, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
 
         // Bottom-up reference coordinates phase
-        RecordHolder *rh = doBottomUpTraversal(flowerLayers, callBottomUp, (void *)referenceEventName);
-        bottomUpNoDb(flower, rh, referenceEventName, 1, generateJukesCantorMatrix);
+        // The phylogenetic tree used for base calling is the same for every flower, so is built once
+        BottomUpArgs bottomUpArgs;
+        bottomUpArgs.referenceEventName = referenceEventName;
+        bottomUpArgs.phylogeneticTree = getPhylogeneticTreeRootedAtGivenEvent(referenceEvent, generateJukesCantorMatrix);
+        RecordHolder *rh = doBottomUpTraversal(flowerLayers, callBottomUp, &bottomUpArgs);
+        bottomUpNoDb2(flower, rh, referenceEventName, 1, bottomUpArgs.phylogeneticTree);
+        cleanupPhylogeneticTree(bottomUpArgs.phylogeneticTree);
         assert(recordHolder_size(rh) == 0);
         recordHolder_destruct(rh);
         st_logInfo("Ran cactus make reference bottom up coordinates, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
@@ -438,8 +472,8 @@ int main(int argc, char *argv[]) {
     //////////////////////////////////////////////
 
     rh = doBottomUpTraversal(flowerLayers, callHalFn, (void *)referenceEventName);
-    FILE *fileHandle = fopen(outputFile, "w");
-    makeHalFormatNoDb(flower, rh, referenceEventName, fileHandle);
+    FILE *fileHandle = fopen(outputFile, binaryOutput ? "wb" : "w");
+    makeHalFormatNoDb2(flower, rh, referenceEventName, fileHandle, binaryOutput);
     fclose(fileHandle);
     assert(recordHolder_size(rh) == 0);
     recordHolder_destruct(rh);
@@ -451,15 +485,23 @@ int main(int argc, char *argv[]) {
 
     if(outputHalFastaFile != NULL) {
         fileHandle = fopen(outputHalFastaFile, "w");
-        printFastaSequences(flower, fileHandle, referenceEventName);
+        FILE *indexFileHandle = outputFastaIndexes ? openFastaIndex(outputHalFastaFile) : NULL;
+        printFastaSequences(flower, fileHandle, indexFileHandle, referenceEventName);
         fclose(fileHandle);
+        if (indexFileHandle != NULL) {
+            fclose(indexFileHandle);
+        }
         st_logInfo("Dumped sequences for hal file, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
     }
 
     if(outputReferenceFile != NULL) {
         fileHandle = fopen(outputReferenceFile, "w");
-        getReferenceSequences(fileHandle, flower, referenceEventString);
+        FILE *indexFileHandle = outputFastaIndexes ? openFastaIndex(outputReferenceFile) : NULL;
+        getReferenceSequences(fileHandle, indexFileHandle, flower, referenceEventString);
         fclose(fileHandle);
+        if (indexFileHandle != NULL) {
+            fclose(indexFileHandle);
+        }
         st_logInfo("Dumped reference sequences, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
     }
 
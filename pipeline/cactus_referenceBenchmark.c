@@ -0,0 +1,517 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+/*
+ * Benchmarks the reference phase of cactus_consolidated on synthetic flower hierarchies, reporting the time
+ * spent in each of its sub-phases.
+ */
+
+#include <time.h>
+#include <getopt.h>
+#include "sonLib.h"
+#include "cactus.h"
+#include "stPinchGraphs.h"
+#include "stCaf.h"
+#include "cactusReference.h"
+#include "addReferenceCoordinates.h"
+#include "traverseFlowers.h"
+#include "blockMLString.h"
+#include "recursiveThreadBuilder.h"
+
+#define REFERENCE_EVENT_HEADER "Anc0"
+
+void usage() {
+    fprintf(stderr, "cactus_referenceBenchmark, version 0.1\n");
+    fprintf(stderr, "-l --logLevel : Set the log level\n");
+    fprintf(stderr, "-p --params : [Required] The cactus config file\n");
+    fprintf(stderr, "-n --replicates : (int > 0) The number of synthetic hierarchies to build references for [default: 1]\n");
+    fprintf(stderr, "-g --genomes : (int > 0) The number of genomes [default: 10]\n");
+    fprintf(stderr, "-c --chains : (int > 0) The number of ancestral blocks shared by all the genomes [default: 100]\n");
+    fprintf(stderr, "-b --blockLength : (int > 0) The length of each ancestral block [default: 100]\n");
+    fprintf(stderr, "-t --tangleSize : (int >= 0) The maximum length of the unaligned sequence between blocks [default: 50]\n");
+    fprintf(stderr, "-R --rearrangementRate : (float) The probability of an inversion at each block of each genome [default: 0.01]\n");
+    fprintf(stderr, "-d --depth : (int >= 0) The number of rounds of inserting blocks shared by subsets of the genomes "
+            "between the blocks of the previous round, which nests flowers [default: 2]\n");
+    fprintf(stderr, "-D --divergence : (float) The substitution rate of each genome from the ancestor [default: 0.02]\n");
+    fprintf(stderr, "-s --seed : (int) The random seed [default: 0]\n");
+    fprintf(stderr, "-h --help : Print this help message\n");
+}
+
+typedef struct _syntheticHierarchyParams {
+    int64_t genomes;
+    int64_t chains;
+    int64_t blockLength;
+    int64_t tangleSize;
+    double rearrangementRate;
+    int64_t depth;
+    double divergence;
+} SyntheticHierarchyParams;
+
+typedef struct _ancestralBlock {
+    char *string;
+    bool *present; // Whether each genome has a copy of the block
+} AncestralBlock;
+
+typedef struct _blockCopy {
+    int64_t genome;
+    int64_t coordinate; // Of the first base, in the coordinates of the genome's sequence
+    bool strand;
+} BlockCopy;
+
+static char randomBase(void) {
+    return "ACGT"[st_randomInt(0, 4)];
+}
+
+static AncestralBlock *ancestralBlock_construct(SyntheticHierarchyParams *sp, bool *present) {
+    AncestralBlock *block = st_malloc(sizeof(AncestralBlock));
+    block->string = st_malloc(sp->blockLength + 1);
+    for (int64_t i = 0; i < sp->blockLength; i++) {
+        block->string[i] = randomBase();
+    }
+    block->string[sp->blockLength] = '\0';
+    block->present = present;
+    return block;
+}
+
+static void ancestralBlock_destruct(AncestralBlock *block) {
+    free(block->string);
+    free(block->present);
+    free(block);
+}
+
+static stList *makeAncestralBlocks(SyntheticHierarchyParams *sp) {
+    /*
+     * Makes the ordered blocks of the ancestor: chains blocks present in every genome, then depth rounds
+     * in which, with probability one half, one to three blocks present in a random subset (of at least two) of
+     * the genomes having the preceding block are inserted after each block.
+     */
+    stList *blocks = stList_construct3(0, (void (*)(void *))ancestralBlock_destruct);
+    for (int64_t i = 0; i < sp->chains; i++) {
+        bool *present = st_malloc(sizeof(bool) * sp->genomes);
+        for (int64_t j = 0; j < sp->genomes; j++) {
+            present[j] = 1;
+        }
+        stList_append(blocks, ancestralBlock_construct(sp, present));
+    }
+    for (int64_t level = 0; level < sp->depth; level++) {
+        stList *newBlocks = stList_construct3(0, (void (*)(void *))ancestralBlock_destruct);
+        for (int64_t i = 0; i < stList_length(blocks); i++) {
+            AncestralBlock *block = stList_get(blocks, i);
+            stList_append(newBlocks, block);
+            if (i + 1 < stList_length(blocks) && st_random() < 0.5) {
+                bool *present = st_malloc(sizeof(bool) * sp->genomes);
+                int64_t presentNumber = 0;
+                for (int64_t j = 0; j < sp->genomes; j++) {
+                    present[j] = block->present[j] && st_random() < 0.5;
+                    presentNumber += present[j];
+                }
+                if (presentNumber < 2) {
+                    free(present);
+                    continue;
+                }
+                int64_t insertNumber = st_randomInt(1, 4);
+                for (int64_t j = 0; j < insertNumber; j++) {
+                    bool *present2 = st_malloc(sizeof(bool) * sp->genomes);
+                    memcpy(present2, present, sizeof(bool) * sp->genomes);
+                    stList_append(newBlocks, ancestralBlock_construct(sp, present2));
+                }
+                free(present);
+            }
+        }
+        stList_setDestructor(blocks, NULL);
+        stList_destruct(blocks);
+        blocks = newBlocks;
+    }
+    return blocks;
+}
+
+static void appendBlock(stList *strings, AncestralBlock *block, bool strand, double divergence) {
+    int64_t length = strlen(block->string);
+    char *string = st_malloc(length + 1);
+    for (int64_t i = 0; i < length; i++) {
+        char c = strand ? block->string[i] : stString_reverseComplementChar(block->string[length - 1 - i]);
+        string[i] = st_random() < divergence ? randomBase() : c;
+    }
+    string[length] = '\0';
+    stList_append(strings, string);
+}
+
+static void appendGap(stList *strings, int64_t tangleSize) {
+    int64_t length = st_randomInt(0, tangleSize + 1);
+    char *string = st_malloc(length + 1);
+    for (int64_t i = 0; i < length; i++) {
+        string[i] = randomBase();
+    }
+    string[length] = '\0';
+    stList_append(strings, string);
+}
+
+static Cap *makeGenome(CactusDisk *cactusDisk, Flower *flower, Event *event, int64_t genome, SyntheticHierarchyParams *sp,
+                       stList *blocks, stList *blockCopies) {
+    /*
+     * Adds a sequence for the genome to the flower, made of its copies of the ancestral blocks, with runs of
+     * blocks inverted at the rearrangement rate and random unaligned sequence between the blocks. Appends the copies
+     * to the lists of copies of each block and returns the 5' cap of the sequence.
+     */
+    int64_t *order = st_malloc(sizeof(int64_t) * stList_length(blocks));
+    bool *strands = st_malloc(sizeof(bool) * stList_length(blocks));
+    int64_t copyNumber = 0;
+    for (int64_t i = 0; i < stList_length(blocks); i++) {
+        if (((AncestralBlock *)stList_get(blocks, i))->present[genome]) {
+            order[copyNumber] = i;
+            strands[copyNumber++] = 1;
+        }
+    }
+    for (int64_t i = 0; i < copyNumber; i++) {
+        if (st_random() < sp->rearrangementRate) { // Invert a run of up to three blocks
+            int64_t j = i + st_randomInt(0, 3);
+            j = j < copyNumber ? j : copyNumber - 1;
+            for (int64_t k = i, l = j; k <= l; k++, l--) {
+                int64_t o = order[k];
+                order[k] = order[l];
+                order[l] = o;
+                bool s = strands[k];
+                strands[k] = !strands[l];
+                strands[l] = !s;
+            }
+            i = j;
+        }
+    }
+
+    stList *strings = stList_construct3(0, free);
+    int64_t coordinate = 2; // The sequences start at 2, after the 5' cap, as in cactus_setup
+    appendGap(strings, sp->tangleSize);
+    coordinate += strlen(stList_peek(strings));
+    for (int64_t i = 0; i < copyNumber; i++) {
+        BlockCopy *copy = st_malloc(sizeof(BlockCopy));
+        copy->genome = genome;
+        copy->coordinate = coordinate;
+        copy->strand = strands[i];
+        stList_append(stList_get(blockCopies, order[i]), copy);
+        appendBlock(strings, stList_get(blocks, order[i]), strands[i], sp->divergence);
+        appendGap(strings, sp->tangleSize);
+        coordinate += sp->blockLength + strlen(stList_peek(strings));
+    }
+    char *string = stString_join2("", strings);
+    int64_t length = strlen(string);
+    assert(coordinate == length + 2);
+
+    char *header = stString_print("%s.chr1", event_getHeader(event));
+    Sequence *sequence = sequence_construct(2, length, string, header, event, cactusDisk);
+    flower_addSequence(flower, sequence);
+    End *end1 = end_construct2(0, 1, flower);
+    End *end2 = end_construct2(1, 1, flower);
+    Cap *cap1 = cap_construct2(end1, 1, 1, sequence);
+    Cap *cap2 = cap_construct2(end2, length + 2, 1, sequence);
+    cap_makeAdjacent(cap1, cap2);
+
+    free(header);
+    free(string);
+    stList_destruct(strings);
+    free(order);
+    free(strands);
+    return cap1;
+}
+
+static Flower *makeSyntheticHierarchy(CactusDisk *cactusDisk, SyntheticHierarchyParams *sp) {
+    /*
+     * Makes a root flower holding a sequence for each genome, as cactus_setup does, aligns the copies of
+     * each ancestral block and builds the flower hierarchy from the alignment with caf.
+     */
+    Flower *flower = flower_construct(cactusDisk);
+    EventTree *eventTree = eventTree_construct2(cactusDisk);
+    Event *referenceEvent = event_construct3(REFERENCE_EVENT_HEADER, 0.1, eventTree_getRootEvent(eventTree), eventTree);
+
+    stList *blocks = makeAncestralBlocks(sp);
+    stList *blockCopies = stList_construct3(0, (void (*)(void *))stList_destruct);
+    for (int64_t i = 0; i < stList_length(blocks); i++) {
+        stList_append(blockCopies, stList_construct3(0, free));
+    }
+    Cap **caps = st_malloc(sizeof(Cap *) * sp->genomes);
+    for (int64_t i = 0; i < sp->genomes; i++) {
+        char *eventHeader = stString_print("genome%" PRIi64 "", i);
+        Event *event = event_construct3(eventHeader, 0.1, referenceEvent, eventTree);
+        caps[i] = makeGenome(cactusDisk, flower, event, i, sp, blocks, blockCopies);
+        free(eventHeader);
+    }
+
+    // The single leaf group and chain of a flower made by cactus_setup
+    Group *group = group_construct2(flower);
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        end_setGroup(end, group);
+    }
+    flower_destructEndIterator(endIt);
+    group_constructChainForLink(group);
+
+    // Align the copies of each block to its first copy
+    stPinchThreadSet *threadSet = stCaf_setup(flower);
+    for (int64_t i = 0; i < stList_length(blockCopies); i++) {
+        stList *copies = stList_get(blockCopies, i);
+        BlockCopy *copy = stList_get(copies, 0);
+        stPinchThread *thread = stPinchThreadSet_getThread(threadSet, cap_getName(caps[copy->genome]));
+        for (int64_t j = 1; j < stList_length(copies); j++) {
+            BlockCopy *copy2 = stList_get(copies, j);
+            stPinchThread *thread2 = stPinchThreadSet_getThread(threadSet, cap_getName(caps[copy2->genome]));
+            stPinchThread_pinch(thread, thread2, copy->coordinate, copy2->coordinate, sp->blockLength,
+                                copy->strand == copy2->strand);
+        }
+    }
+    stCaf_makeDegreeOneBlocks(threadSet);
+    stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX);
+    stPinchThreadSet_destruct(threadSet);
+
+    free(caps);
+    stList_destruct(blockCopies);
+    stList_destruct(blocks);
+    return flower;
+}
+
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1.0e-9;
+}
+
+typedef struct _referenceBenchmarkTimings {
+    int64_t flowers;
+    int64_t layers;
+    int64_t blocks;
+    double makeReference; // All of cactus_make_reference
+    ReferenceStats stats; // The sub-phases of buildReferenceTopDown, summed over the flowers
+    double mlStrings; // Computing the ML strings of the blocks containing reference segments, on their own
+    double bottomUp; // The bottom up pass, which computes the ML strings again and builds the threads
+    double topDown;
+} ReferenceBenchmarkTimings;
+
+static double timeMaximumLikelihoodStrings(stList *flowerLayers, Event *referenceEvent, stTree *phylogeneticTree,
+                                           int64_t *blockNumber) {
+    double startTime = getTime();
+    for (int64_t i = 0; i < stList_length(flowerLayers); i++) {
+        stList *flowers = stList_get(flowerLayers, i);
+        for (int64_t j = 0; j < stList_length(flowers); j++) {
+            Flower_EndIterator *endIt = flower_getEndIterator(stList_get(flowers, j));
+            End *end;
+            while ((end = flower_getNextEnd(endIt)) != NULL) {
+                if (!end_isBlockEnd(end) || !end_getSide(end)) { // Visit each block once, from its 5 prime end
+                    continue;
+                }
+                Block *block = end_getBlock(end);
+                (*blockNumber)++;
+                if (block_getSegmentForEvent(block, event_getName(referenceEvent)) != NULL) {
+                    free(getMaximumLikelihoodString(phylogeneticTree, block));
+                }
+            }
+            flower_destructEndIterator(endIt);
+        }
+    }
+    return getTime() - startTime;
+}
+
+static void runBottomUp(stList *flowerLayers, Name referenceEventName, stTree *phylogeneticTree) {
+    /*
+     * The bottom up pass of cactus_consolidated, run serially: the records of each flower's children are
+     * merged into the flower's record holder before its threads are built.
+     */
+    stHash *recordHolders = stHash_construct();
+    for (int64_t i = stList_length(flowerLayers) - 1; i >= 0; i--) {
+        stList *flowers = stList_get(flowerLayers, i);
+        stHash *newRecordHolders = stHash_construct();
+        for (int64_t j = 0; j < stList_length(flowers); j++) {
+            Flower *flower = stList_get(flowers, j);
+            RecordHolder *rh = recordHolder_construct();
+            stList *children = stList_construct();
+            getChildFlowers(flower, children);
+            for (int64_t k = 0; k < stList_length(children); k++) {
+                recordHolder_transferAll(rh, stHash_remove(recordHolders, stList_get(children, k)));
+            }
+            stList_destruct(children);
+            bottomUpNoDb2(flower, rh, referenceEventName, i == 0, phylogeneticTree);
+            stHash_insert(newRecordHolders, flower, rh);
+        }
+        assert(stHash_size(recordHolders) == 0);
+        stHash_destruct(recordHolders);
+        recordHolders = newRecordHolders;
+    }
+    stList *rhs = stHash_getValues(recordHolders);
+    for (int64_t i = 0; i < stList_length(rhs); i++) {
+        assert(recordHolder_size(stList_get(rhs, i)) == 0);
+        recordHolder_destruct(stList_get(rhs, i));
+    }
+    stList_destruct(rhs);
+    stHash_destruct(recordHolders);
+}
+
+static void benchmarkHierarchy(Flower *flower, CactusParams *params, ReferenceBenchmarkTimings *t) {
+    CactusDisk *cactusDisk = flower_getCactusDisk(flower);
+    Event *referenceEvent = eventTree_getEventByHeader(flower_getEventTree(flower), REFERENCE_EVENT_HEADER);
+    Name referenceEventName = event_getName(referenceEvent);
+    stList *flowerLayers = getFlowerHierarchyInLayers(flower);
+    t->layers = stList_length(flowerLayers);
+
+    double startTime = getTime();
+    for (int64_t i = 0; i < stList_length(flowerLayers); i++) {
+        stList *flowers = stList_get(flowerLayers, i);
+        t->flowers += stList_length(flowers);
+        cactus_make_reference2(flowers, REFERENCE_EVENT_HEADER, cactusDisk, params, &t->stats);
+    }
+    t->makeReference = getTime() - startTime;
+
+    stTree *phylogeneticTree = getPhylogeneticTreeRootedAtGivenEvent(referenceEvent, generateJukesCantorMatrix);
+    t->mlStrings = timeMaximumLikelihoodStrings(flowerLayers, referenceEvent, phylogeneticTree, &t->blocks);
+
+    startTime = getTime();
+    runBottomUp(flowerLayers, referenceEventName, phylogeneticTree);
+    t->bottomUp = getTime() - startTime;
+    cleanupPhylogeneticTree(phylogeneticTree);
+
+    startTime = getTime();
+    for (int64_t i = 0; i < stList_length(flowerLayers); i++) {
+        stList *flowers = stList_get(flowerLayers, i);
+        for (int64_t j = 0; j < stList_length(flowers); j++) {
+            topDown(stList_get(flowers, j), referenceEventName);
+        }
+    }
+    t->topDown = getTime() - startTime;
+
+    stList_destruct(flowerLayers);
+}
+
+static void printTimings(const char *name, ReferenceBenchmarkTimings *t) {
+    fprintf(stdout, "%s\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%f\t%" PRIi64 "\n",
+            name, t->flowers, t->layers, t->blocks, t->stats.nodeNumber, t->makeReference, t->stats.zTime,
+            t->stats.greedyTime, t->stats.samplingTime, t->stats.nudgingTime, t->mlStrings, t->bottomUp,
+            t->bottomUp - t->mlStrings, t->topDown, t->stats.maxPossibleScore, t->stats.finalScore,
+            t->stats.finalBadAdjacencies);
+}
+
+static void addTimings(ReferenceBenchmarkTimings *total, ReferenceBenchmarkTimings *t) {
+    total->flowers += t->flowers;
+    total->layers += t->layers;
+    total->blocks += t->blocks;
+    total->makeReference += t->makeReference;
+    total->stats.nodeNumber += t->stats.nodeNumber;
+    total->stats.zTime += t->stats.zTime;
+    total->stats.greedyTime += t->stats.greedyTime;
+    total->stats.samplingTime += t->stats.samplingTime;
+    total->stats.nudgingTime += t->stats.nudgingTime;
+    total->mlStrings += t->mlStrings;
+    total->bottomUp += t->bottomUp;
+    total->topDown += t->topDown;
+    total->stats.maxPossibleScore += t->stats.maxPossibleScore;
+    total->stats.finalScore += t->stats.finalScore;
+    total->stats.finalBadAdjacencies += t->stats.finalBadAdjacencies;
+}
+
+int main(int argc, char *argv[]) {
+    char *logLevelString = NULL;
+    char *paramsFile = NULL;
+    int64_t replicates = 1;
+    int64_t seed = 0;
+    SyntheticHierarchyParams sp = { .genomes = 10, .chains = 100, .blockLength = 100, .tangleSize = 50,
+                                    .rearrangementRate = 0.01, .depth = 2, .divergence = 0.02 };
+
+    while (1) {
+        static struct option long_options[] = { { "logLevel", required_argument, 0, 'l' },
+                { "params", required_argument, 0, 'p' },
+                { "replicates", required_argument, 0, 'n' },
+                { "genomes", required_argument, 0, 'g' },
+                { "chains", required_argument, 0, 'c' },
+                { "blockLength", required_argument, 0, 'b' },
+                { "tangleSize", required_argument, 0, 't' },
+                { "rearrangementRate", required_argument, 0, 'R' },
+                { "depth", required_argument, 0, 'd' },
+                { "divergence", required_argument, 0, 'D' },
+                { "seed", required_argument, 0, 's' },
+                { "help", no_argument, 0, 'h' },
+                { 0, 0, 0, 0 } };
+
+        int option_index = 0;
+
+        int64_t key = getopt_long(argc, argv, "l:p:n:g:c:b:t:R:d:D:s:h", long_options, &option_index);
+
+        if (key == -1) {
+            break;
+        }
+
+        int i = 1;
+        switch (key) {
+            case 'l':
+                logLevelString = optarg;
+                break;
+            case 'p':
+                paramsFile = optarg;
+                break;
+            case 'n':
+                i = sscanf(optarg, "%" PRIi64 "", &replicates);
+                break;
+            case 'g':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.genomes);
+                break;
+            case 'c':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.chains);
+                break;
+            case 'b':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.blockLength);
+                break;
+            case 't':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.tangleSize);
+                break;
+            case 'R':
+                i = sscanf(optarg, "%lf", &sp.rearrangementRate);
+                break;
+            case 'd':
+                i = sscanf(optarg, "%" PRIi64 "", &sp.depth);
+                break;
+            case 'D':
+                i = sscanf(optarg, "%lf", &sp.divergence);
+                break;
+            case 's':
+                i = sscanf(optarg, "%" PRIi64 "", &seed);
+                break;
+            case 'h':
+                usage();
+                return 0;
+            default:
+                usage();
+                return 1;
+        }
+        if (i != 1) {
+            st_errAbort("Could not parse the argument of option -%c: '%s'\n", (char)key, optarg);
+        }
+    }
+
+    st_setLogLevelFromString(logLevelString);
+
+    if (paramsFile == NULL) {
+        st_errAbort("The cactus config file must be given\n");
+    }
+    if (replicates < 1 || sp.genomes < 1 || sp.chains < 1 || sp.blockLength < 1 || sp.tangleSize < 0 || sp.depth < 0) {
+        st_errAbort("The synthetic hierarchy options must be positive\n");
+    }
+    st_randomSeed(seed);
+
+    CactusParams *params = cactusParams_load(paramsFile);
+
+    fprintf(stdout, "hierarchy\tflowers\tlayers\tblocks\tnodes\tmake_reference\tcalculate_z\tgreedy\tsampling\tnudging\t"
+            "ml_strings\tbottom_up\tthread_building\ttop_down\tmax_possible_score\tfinal_score\tbad_adjacencies\n");
+    ReferenceBenchmarkTimings totalTimings = { 0 };
+    for (int64_t i = 0; i < replicates; i++) {
+        CactusDisk *cactusDisk = cactusDisk_construct();
+        Flower *flower = makeSyntheticHierarchy(cactusDisk, &sp);
+        ReferenceBenchmarkTimings timings = { 0 };
+        benchmarkHierarchy(flower, params, &timings);
+        char *name = stString_print("synthetic%" PRIi64 "", i);
+        printTimings(name, &timings);
+        free(name);
+        addTimings(&totalTimings, &timings);
+        cactusDisk_destruct(cactusDisk);
+    }
+    printTimings("total", &totalTimings);
+
+    cactusParams_destruct(params);
+
+    return 0;
+}
@@ -203,6 +203,21 @@ static char *segmentWriteFn(Segment *segment, void *extraArg) {
     return appendedSegmentString;
 }
 
+static void terminalAdjacencyRecordWriteFn(Cap *cap, ThreadRecord *record, void *extraArg) {
+}
+
+static void segmentRecordWriteFn(Segment *segment, ThreadRecord *record, void *extraArg) {
+    /*
+     * As segmentWriteFn, with the ML string as the bases of the record and whether the segment
+     * is non-trivial as its one field.
+     */
+    stTree *phylogeneticTree = extraArg;
+    char *segmentString = getMaximumLikelihoodString(phylogeneticTree, segment_getBlock(segment));
+    threadRecord_addBases(record, segmentString, segment_getLength(segment));
+    threadRecord_addInt(record, block_getInstanceNumber(segment_getBlock(segment)) != 1);
+    free(segmentString);
+}
+
 /*
  * A thread is trivial if all the segments it contains come from blocks containing only a reference segment.
  * These reference only segments represent scaffold gaps. At the same time, it processes the thread string
@@ -242,14 +257,17 @@ static Sequence *addSequence(Flower *flower, Cap *cap, int64_t index, char *stri
     return sequence;
 }
 
-static int64_t setCoordinates(Flower *flower, Sequence *sequence, Cap *cap, int64_t coordinate) {
-    /*
-     * Sets the coordinates of the reference thread and sets the bases of the actual sequence
-     * that of the consensus.
-     */
+static void addSequenceToFlower(Flower *flower, Sequence *sequence) {
     if (flower_getSequence(flower, sequence_getName(sequence)) == NULL) {
         flower_addSequence(flower, sequence);
     }
+}
+
+static int64_t setCoordinates(Sequence *sequence, Cap *cap, int64_t coordinate) {
+    /*
+     * Sets the coordinates of the reference thread and sets the bases of the actual sequence
+     * that of the consensus. The sequence must be added to the flower of the cap by the caller.
+     */
     assert(cap_getStrand(cap));
     assert(!cap_getSide(cap));
     int64_t adjacencyLength = cap_getCoordinate(cap);
@@ -309,27 +327,54 @@ static stList *bottomUp1(Flower *flower, Name referenceEventName, stMatrix *(*ge
     return caps;
 }
 
+static void addThreadSequence(Cap *cap, char *threadString, bool trivialString,
+                              int64_t *nonTrivialSeqIndex, int64_t *trivialSeqIndex) {
+    assert(cap_getStrand(cap));
+    assert(!cap_getSide(cap));
+    Flower *flower = end_getFlower(cap_getEnd(cap));
+    Sequence *sequence = addSequence(flower, cap, trivialString ? (*trivialSeqIndex)++ : (*nonTrivialSeqIndex)++,
+                                     threadString, trivialString);
+    addSequenceToFlower(flower, sequence);
+    int64_t endCoordinate = setCoordinates(sequence, cap, sequence_getStart(sequence) - 1);
+    (void) endCoordinate;
+    assert(endCoordinate == sequence_getLength(sequence) + sequence_getStart(sequence));
+}
+
 static void bottomUp2(stList *threadStrings, stList *caps) {
     assert(stList_length(threadStrings) == stList_length(caps));
     int64_t nonTrivialSeqIndex = 0, trivialSeqIndex = stList_length(threadStrings); //These are used as indices for the names of trivial and non-trivial sequences.
     for (int64_t i = 0; i < stList_length(threadStrings); i++) {
-        Cap *cap = stList_get(caps, i);
-        assert(cap_getStrand(cap));
-        assert(!cap_getSide(cap));
-        Flower *flower = end_getFlower(cap_getEnd(cap));
         char *threadString = stList_get(threadStrings, i);
         bool trivialString = isTrivialString(&threadString); //This alters the original string
-        Sequence *sequence = addSequence(flower, cap, trivialString ? trivialSeqIndex++ : nonTrivialSeqIndex++,
-                                                     threadString, trivialString);
+        addThreadSequence(stList_get(caps, i), threadString, trivialString, &nonTrivialSeqIndex, &trivialSeqIndex);
         free(threadString);
-        int64_t endCoordinate = setCoordinates(flower, sequence, cap, sequence_getStart(sequence) - 1);
-        (void) endCoordinate;
-        assert(endCoordinate == sequence_getLength(sequence) + sequence_getStart(sequence));
     }
     stList_setDestructor(threadStrings, NULL); //The strings are already cleaned up by the above loop
     stList_destruct(threadStrings);
 }
 
+static void bottomUp2Records(stList *threads, stList *caps) {
+    /*
+     * As bottomUp2, for the thread records written by segmentRecordWriteFn. A thread is trivial
+     * if none of its segments are marked non-trivial.
+     */
+    assert(stList_length(threads) == stList_length(caps));
+    int64_t nonTrivialSeqIndex = 0, trivialSeqIndex = stList_length(threads);
+    for (int64_t i = 0; i < stList_length(threads); i++) {
+        ThreadRecord *thread = stList_get(threads, i);
+        bool trivialString = 1;
+        for (int64_t offset = 0; offset < threadRecord_getFieldsLength(thread);) {
+            if (threadRecord_getInt(thread, &offset)) {
+                trivialString = 0;
+            }
+        }
+        char *threadString = stString_getSubString(threadRecord_getBases(thread), 0, threadRecord_getBasesLength(thread));
+        addThreadSequence(stList_get(caps, i), threadString, trivialString, &nonTrivialSeqIndex, &trivialSeqIndex);
+        free(threadString);
+    }
+    stList_destruct(threads);
+}
+
 void bottomUp(Flower *flower, stKVDatabase *sequenceDatabase, Name referenceEventName,
               bool isTop, stMatrix *(*generateSubstitutionMatrix)(double)) {
     /*
@@ -356,31 +401,66 @@ void bottomUp(Flower *flower, stKVDatabase *sequenceDatabase, Name referenceEven
     stList_destruct(caps);
 }
 
+void bottomUpNoDb2(Flower *flower, RecordHolder *rh, Name referenceEventName,
+                   bool isTop, stTree *phylogeneticTree) {
+    stList *caps = bottomUp1(flower, referenceEventName, NULL);
+
+    if (isTop) {
+        stList *threads = buildRecursiveThreadsInListNoDb(rh, caps, segmentRecordWriteFn,
+                                                          terminalAdjacencyRecordWriteFn, phylogeneticTree);
+        bottomUp2Records(threads, caps);
+    } else {
+        buildRecursiveThreadsNoDb(rh, caps, segmentRecordWriteFn, terminalAdjacencyRecordWriteFn, phylogeneticTree);
+    }
+    stList_destruct(caps);
+}
+
 void bottomUpNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName,
               bool isTop, stMatrix *(*generateSubstitutionMatrix)(double)) {
-    stList *caps = bottomUp1(flower, referenceEventName, generateSubstitutionMatrix);
-
     //Get the phylogenetic event trees for base calling.
     stTree *phylogeneticTree =
             getPhylogeneticTreeRootedAtGivenEvent(eventTree_getEvent(flower_getEventTree(flower), referenceEventName),
                                                   generateSubstitutionMatrix);
+    bottomUpNoDb2(flower, rh, referenceEventName, isTop, phylogeneticTree);
+    cleanupPhylogeneticTree(phylogeneticTree);
+}
 
-    if (isTop) {
-        stList *threadStrings = buildRecursiveThreadsInListNoDb(rh, caps, segmentWriteFn,
-                                                            terminalAdjacencyWriteFn, phylogeneticTree);
-        bottomUp2(threadStrings, caps);
-    } else {
-        buildRecursiveThreadsNoDb(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, phylogeneticTree);
+typedef struct _nestedSequence {
+    Flower *nestedFlower;
+    Sequence *sequence;
+} NestedSequence;
+
+static int nestedSequence_cmpFn(const void *a, const void *b) {
+    const NestedSequence *n1 = a, *n2 = b;
+    if (n1->nestedFlower != n2->nestedFlower) {
+        return n1->nestedFlower < n2->nestedFlower ? -1 : 1;
+    }
+    return cactusMisc_nameCompare(sequence_getName(n1->sequence), sequence_getName(n2->sequence));
+}
+
+static void addSequencesToNestedFlowers(NestedSequence *nestedSequences, int64_t length) {
+    /*
+     * Adds each distinct sequence to its nested flower, once per nested flower and in name order,
+     * so that flower_addSequence appends rather than shuffling the flower's sorted sequences.
+     */
+    qsort(nestedSequences, length, sizeof(NestedSequence), nestedSequence_cmpFn);
+    for (int64_t i = 0; i < length; i++) {
+        if (i == 0 || nestedSequence_cmpFn(&nestedSequences[i - 1], &nestedSequences[i]) != 0) {
+            addSequenceToFlower(nestedSequences[i].nestedFlower, nestedSequences[i].sequence);
+        }
     }
-    cleanupPhylogeneticTree(phylogeneticTree);
-    stList_destruct(caps);
 }
 
 void topDown(Flower *flower, Name referenceEventName) {
     /*
      * Run on each flower, top down. Sets the coordinates of each reference cap to the correct
      * sequence, and sets the bases of the reference sequence to be consensus bases.
+     * The reference sequences threading each nested flower are collected as the coordinates are set
+     * and added to the nested flowers in one batch at the end. Each nested flower is only reached from
+     * its parent, so calls on the flowers of a layer can run in parallel.
      */
+    int64_t nestedSequenceNumber = 0, maxNestedSequenceNumber = 16;
+    NestedSequence *nestedSequences = st_malloc(sizeof(NestedSequence) * maxNestedSequenceNumber);
     Flower_EndIterator *endIt = flower_getEndIterator(flower);
     End *end;
     while ((end = flower_getNextEnd(endIt)) != NULL) {
@@ -399,8 +479,13 @@ void topDown(Flower *flower, Name referenceEventName) {
                     nestedCap = cap_getStrand(nestedCap) ? nestedCap : cap_getReverse(nestedCap);
                     assert(cap_getStrand(nestedCap));
                     assert(!cap_getSide(nestedCap));
-                    int64_t endCoordinate = setCoordinates(nestedFlower, sequence,
-                                                           nestedCap, cap_getCoordinate(cap));
+                    int64_t endCoordinate = setCoordinates(sequence, nestedCap, cap_getCoordinate(cap));
+                    if (nestedSequenceNumber == maxNestedSequenceNumber) {
+                        maxNestedSequenceNumber *= 2;
+                        nestedSequences = st_realloc(nestedSequences, sizeof(NestedSequence) * maxNestedSequenceNumber);
+                    }
+                    nestedSequences[nestedSequenceNumber].nestedFlower = nestedFlower;
+                    nestedSequences[nestedSequenceNumber++].sequence = sequence;
                     (void) endCoordinate;
                     assert(endCoordinate == cap_getCoordinate(cap_getAdjacency(cap)));
                     assert(endCoordinate
@@ -411,4 +496,6 @@ void topDown(Flower *flower, Name referenceEventName) {
         }
     }
     flower_destructEndIterator(endIt);
+    addSequencesToNestedFlowers(nestedSequences, nestedSequenceNumber);
+    free(nestedSequences);
 }
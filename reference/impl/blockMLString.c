@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <ctype.h>
+#include <math.h>
 #include "cactus.h"
 #include "sonLib.h"
 
@@ -12,6 +13,34 @@
  * Code to calculate a maximum likelihood (ML) string for a block using Felsenstein's pruning algorithm.
  */
 
+/*
+ * The number of products accumulated into a node's base probabilities before they are checked
+ * for rescaling, and the maximum probability at a position below which that position is rescaled.
+ * A node's base probabilities are also rescaled once complete, so that each product can only shrink
+ * them by the substitution probabilities.
+ */
+#define FELSENSTEIN_RESCALE_INTERVAL 4
+#define FELSENSTEIN_RESCALE_THRESHOLD 0x1p-32f
+
+/*
+ * Seed of the counter-based random numbers used to break ties between equally likely bases, so that
+ * the ML strings do not depend on the order in which blocks are processed.
+ */
+#define ML_STRING_TIE_BREAK_SEED 0x2545f4914f6cdd1dULL
+
+typedef struct _felsensteinSchedule {
+    /*
+     * The nodes of a phylogenetic tree flattened into post-order, so that the pruning
+     * algorithm can be run without recursing over the stTree.
+     */
+    int64_t nodeNumber;
+    int64_t *parents; // Index of the parent of each node, or -1 for the root, which is last
+    Event **leafEvents; // The event of each leaf node, or NULL for an internal node
+    float *matrices; // The 4x4 substitution matrix of each node's parent branch, row major
+    float *leafVectors; // The product of each matrix with A, C, G, T and N columns, 20 values per node
+    int64_t maxLiveColumns; // The most column sets that are needed at once, see computeBaseProbs
+} FelsensteinSchedule;
+
 /////
 // Code to for creating a phylogenetic model of a given event tree with associated substitution matrices.
 ////
@@ -29,14 +58,22 @@ Event *getEvent(stTree *tree) {
     return ((void **) stTree_getClientData(tree))[1];
 }
 
+static FelsensteinSchedule *getSchedule(stTree *tree) {
+    /*
+     * Gets the post-order schedule of the tree, which is only set for the root.
+     */
+    return ((void **) stTree_getClientData(tree))[2];
+}
+
 static stTree *getPhylogeneticTree(Event *event, Event *eventToTreatAsParent,
         stMatrix *(*generateSubstitutionMatrix)(double)) {
     stTree *tree = stTree_construct();
     stMatrix *matrix = generateSubstitutionMatrix(
             event_getBranchLength(eventToTreatAsParent == NULL ? event : eventToTreatAsParent));
-    void **attributes = st_malloc(sizeof(void *) * 2);
+    void **attributes = st_malloc(sizeof(void *) * 3);
     attributes[0] = matrix;
     attributes[1] = event;
+    attributes[2] = NULL;
     stTree_setClientData(tree, attributes);
     for (int64_t i = 0; i < event_getChildNumber(event); i++) {
         if (eventToTreatAsParent != event_getChild(event, i)) {
@@ -46,6 +83,60 @@ static stTree *getPhylogeneticTree(Event *event, Event *eventToTreatAsParent,
     return tree;
 }
 
+static int64_t fillSchedule(FelsensteinSchedule *schedule, stTree *tree, int64_t *index, int64_t depth) {
+    /*
+     * Adds the subtree to the schedule in post-order, returning the index of its root
+     * and updating maxLiveColumns with the depth of its nodes.
+     */
+    int64_t childIndices[stTree_getChildNumber(tree) + 1];
+    for (int64_t i = 0; i < stTree_getChildNumber(tree); i++) {
+        childIndices[i] = fillSchedule(schedule, stTree_getChild(tree, i), index, depth + 1);
+    }
+    int64_t j = (*index)++;
+    for (int64_t i = 0; i < stTree_getChildNumber(tree); i++) {
+        schedule->parents[childIndices[i]] = j;
+    }
+    schedule->parents[j] = -1;
+    schedule->leafEvents[j] = stTree_getChildNumber(tree) == 0 ? getEvent(tree) : NULL;
+    stMatrix *matrix = getSubMatrix(tree);
+    assert(stMatrix_n(matrix) == 4 && stMatrix_m(matrix) == 4);
+    float *m = &schedule->matrices[j * 16], *v = &schedule->leafVectors[j * 20];
+    for (int64_t k = 0; k < 4; k++) {
+        v[16 + k] = 0.0;
+        for (int64_t l = 0; l < 4; l++) {
+            m[k * 4 + l] = *stMatrix_getCell(matrix, k, l);
+            v[l * 4 + k] = m[k * 4 + l]; // Column l of the matrix is its product with base l
+            v[16 + k] += m[k * 4 + l]; // An N is a column of ones
+        }
+    }
+    // While a node is computed a column set may be held by it and by each of its ancestors
+    if (depth + 1 > schedule->maxLiveColumns) {
+        schedule->maxLiveColumns = depth + 1;
+    }
+    return j;
+}
+
+static FelsensteinSchedule *felsensteinSchedule_construct(stTree *tree) {
+    FelsensteinSchedule *schedule = st_calloc(1, sizeof(FelsensteinSchedule));
+    schedule->nodeNumber = stTree_getNumNodes(tree);
+    schedule->parents = st_malloc(sizeof(int64_t) * schedule->nodeNumber);
+    schedule->leafEvents = st_malloc(sizeof(Event *) * schedule->nodeNumber);
+    schedule->matrices = st_malloc(sizeof(float) * 16 * schedule->nodeNumber);
+    schedule->leafVectors = st_malloc(sizeof(float) * 20 * schedule->nodeNumber);
+    int64_t index = 0;
+    fillSchedule(schedule, tree, &index, 0);
+    assert(index == schedule->nodeNumber);
+    return schedule;
+}
+
+static void felsensteinSchedule_destruct(FelsensteinSchedule *schedule) {
+    free(schedule->parents);
+    free(schedule->leafEvents);
+    free(schedule->matrices);
+    free(schedule->leafVectors);
+    free(schedule);
+}
+
 stTree *getPhylogeneticTreeRootedAtGivenEvent(Event *event, stMatrix *(*generateSubstitutionMatrix)(double)) {
     /*
      * Creates a stTree isomorphic to the eventTree that 'event' is part of, but rooted at 'event'.
@@ -53,6 +144,7 @@ stTree *getPhylogeneticTreeRootedAtGivenEvent(Event *event, stMatrix *(*generate
      * The first is a substitution matrix giving substitution probabilities for bases along the incident parent branch of
      * the re-rooted tree.
      * The second is the event that it maps to in the original event tree.
+     * The root additionally holds the post-order schedule used by getMaximumLikelihoodString.
      */
     stTree *tree = getPhylogeneticTree(event, NULL, generateSubstitutionMatrix); //This builds the subtree rooted at the given event
     stMatrix_destruct(getSubMatrix(tree)); //This cleans up the substitution matrix for the root of the remodeled tree.
@@ -68,6 +160,8 @@ stTree *getPhylogeneticTreeRootedAtGivenEvent(Event *event, stMatrix *(*generate
         tree2 = tree3;
         event = pEvent;
     }
+
+    ((void **) stTree_getClientData(tree))[2] = felsensteinSchedule_construct(tree);
     return tree;
 }
 
@@ -76,6 +170,9 @@ void cleanupPhylogeneticTreeP(stTree *tree) {
         cleanupPhylogeneticTreeP(stTree_getChild(tree, i));
     }
     stMatrix_destruct(getSubMatrix(tree));
+    if (getSchedule(tree) != NULL) {
+        felsensteinSchedule_destruct(getSchedule(tree));
+    }
     free(stTree_getClientData(tree));
 }
 
@@ -94,6 +191,7 @@ stMatrix *generateJukesCantorMatrix(double distance) {
     return stMatrix_jukesCantor(distance, 4);
 }
 
+
 /////
 // The following calls the ML string for a block from a set of base probabilities.
 /////
@@ -114,25 +212,77 @@ char indexToChar(int64_t i) {
     }
 }
 
-static char *getMaxLikelihoodString(double *baseProbs, int64_t length) {
+static uint64_t mixBits(uint64_t x) {
+    /*
+     * The splitmix64 finalizer, which maps each 64 bit integer to a well mixed one.
+     */
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static uint64_t hashString(const char *string) {
+    /*
+     * FNV-1a hash of a string.
+     */
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *string != '\0'; string++) {
+        h = (h ^ (uint8_t)*string) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t getBlockKey(stList *segments) {
+    /*
+     * Gets a key for the block of the segments that is the same in every run on the same input: the smallest hash of the
+     * event header, sequence header, start coordinate and strand of any of its segments. Block names are not used as they
+     * are drawn from a counter shared by the threads building the cactus, so differ between runs.
+     */
+    uint64_t key = UINT64_MAX;
+    for (int64_t i = 0; i < stList_length(segments); i++) {
+        Segment *segment = stList_get(segments, i);
+        Sequence *sequence = segment_getSequence(segment);
+        uint64_t h = mixBits(hashString(event_getHeader(segment_getEvent(segment))) ^
+                             mixBits(hashString(sequence_getHeader(sequence)) ^
+                                     mixBits(segment_getStart(segment) * 2 + segment_getStrand(segment))));
+        if (h < key) {
+            key = h;
+        }
+    }
+    return mixBits(key ^ ML_STRING_TIE_BREAK_SEED);
+}
+
+static char *getMaxLikelihoodString(float *baseProbs, int64_t length, stList *segments) {
     /*
      * For the "baseProbs" 2d array of base probabilities generates a ML string of bases.
-     * The baseProbs array is organised as
-     * [ Prob of A at position 0, Prob of C at position 0, Prob of G at position 0, Prob of T at position 0,
-     *   Prob of A at position 1, Prob of C at position 1, Prob of G at position 1, Prob of T at position 1,
+     * The baseProbs array is organised column major, as
+     * [ Prob of A at position 0, Prob of A at position 1, ..., Prob of A at position length-1,
+     *   Prob of C at position 0, Prob of C at position 1, ...
      *   ...
      *  etc.
      *  The returned string is a an upper case string of A, C, G and T.
      *  Length is the length of the string.
-     *  In case of bases at a position with equal probability a (somewhat) random base is chosen.
+     *  In case of bases at a position with equal probability a (somewhat) random base is chosen, using
+     *  random bits drawn from the position and the key of the block of the segments (see getBlockKey), so the choice
+     *  is the same in every run. The key is only computed if there is a tie.
      */
     char *mlString = st_malloc(sizeof(char) * (length+1));
+    uint64_t key = 0;
+    bool haveKey = 0;
     for (int64_t i = 0; i < length; i++) {
         int64_t k = 0;
-        double m = baseProbs[i * 4];
+        float m = baseProbs[i];
+        uint64_t r = 0;
         for (int64_t j = 1; j < 4; j++) {
-            double n = baseProbs[i * 4 + j];
-            if (n > m || (n == m && st_random() > 0.5)) {
+            float n = baseProbs[j * length + i];
+            if (n == m && r == 0) { // Only mix the bits for positions with a tie
+                if (!haveKey) {
+                    key = getBlockKey(segments);
+                    haveKey = 1;
+                }
+                r = mixBits(key ^ mixBits(i + 1));
+            }
+            if (n > m || (n == m && ((r >> j) & 1))) {
                 k = j;
                 m = n;
             }
@@ -147,79 +297,152 @@ static char *getMaxLikelihoodString(double *baseProbs, int64_t length) {
 // The following functions are the meat of the Felsenstein's algorithm implementation.
 ///
 
-static double *transformBaseProbsBySubstitutionMatrix(double *baseProbs, int64_t length, stMatrix *substitutionMatrix) {
+typedef struct _felsensteinScratch {
+    /*
+     * Memory reused by every call to computeBaseProbs on a thread, grown as needed.
+     */
+    float *columns; // Column sets, each 4 * length floats
+    int64_t columnsCapacity;
+    int64_t *nodeColumns; // The column set held by each node of the schedule, or -1
+    int64_t *nodeProducts; // The number of products accumulated into each node's column set
+    int64_t *freeColumns; // Stack of unused column sets
+    int64_t nodeCapacity;
+    uint32_t *upperCounts; // Number of upper case bases at each position of the block, for masking
+    uint32_t *nCounts; // Number of bases other than A, C, G or T at each position of the block
+    int64_t countCapacity;
+    bool *segmentsCounted; // Whether each segment's bases have been counted
+    int64_t segmentCapacity;
+} FelsensteinScratch;
+
+static FelsensteinScratch scratch = { NULL, 0, NULL, NULL, NULL, 0, NULL, NULL, 0, NULL, 0 };
+#if defined(_OPENMP)
+#pragma omp threadprivate(scratch)
+#endif
+
+static void resetBaseCounts(int64_t blockLength) {
+    if (blockLength > scratch.countCapacity) {
+        scratch.countCapacity = blockLength * 2;
+        free(scratch.upperCounts);
+        free(scratch.nCounts);
+        scratch.upperCounts = st_malloc(sizeof(uint32_t) * scratch.countCapacity);
+        scratch.nCounts = st_malloc(sizeof(uint32_t) * scratch.countCapacity);
+    }
+    memset(scratch.upperCounts, 0, sizeof(uint32_t) * blockLength);
+    memset(scratch.nCounts, 0, sizeof(uint32_t) * blockLength);
+}
+
+static void reserveScratch(FelsensteinSchedule *schedule, int64_t blockLength, int64_t segmentNumber) {
+    int64_t columnsNeeded = schedule->maxLiveColumns * 4 * blockLength;
+    if (columnsNeeded > scratch.columnsCapacity) {
+        scratch.columnsCapacity = columnsNeeded * 2;
+        free(scratch.columns); // Nothing is held between calls, so no need to copy
+        scratch.columns = st_malloc(sizeof(float) * scratch.columnsCapacity);
+    }
+    if (schedule->nodeNumber > scratch.nodeCapacity) {
+        scratch.nodeCapacity = schedule->nodeNumber * 2;
+        scratch.nodeColumns = st_realloc(scratch.nodeColumns, sizeof(int64_t) * scratch.nodeCapacity);
+        scratch.nodeProducts = st_realloc(scratch.nodeProducts, sizeof(int64_t) * scratch.nodeCapacity);
+        scratch.freeColumns = st_realloc(scratch.freeColumns, sizeof(int64_t) * scratch.nodeCapacity);
+    }
+    resetBaseCounts(blockLength);
+    if (segmentNumber > scratch.segmentCapacity) {
+        scratch.segmentCapacity = segmentNumber * 2;
+        free(scratch.segmentsCounted);
+        scratch.segmentsCounted = st_malloc(sizeof(bool) * scratch.segmentCapacity);
+    }
+}
+
+static void transformBaseProbsBySubstitutionMatrix(float *baseProbs, int64_t length, const float *m) {
     /*
-     * Updates the array of base probs, as described in getMaxLikelihoodString by multiplying the vector of base
-     * probabilities at each position by the given substitution matrix.
-     * Returns the input array.
+     * Updates the column major base probs, as described in getMaxLikelihoodString, by multiplying the vector
+     * of base probabilities at each position by the given row major 4x4 substitution matrix.
+     * The loop has no dependencies between positions, so is vectorised by the compiler.
      */
-    assert(stMatrix_n(substitutionMatrix) == 4);
-    double v[4];
+    float *restrict a = baseProbs, *restrict c = a + length, *restrict g = c + length, *restrict t = g + length;
     for (int64_t i = 0; i < length; i++) {
-        stMatrix_multiplySquareMatrixAndColumnVector2(substitutionMatrix, &(baseProbs[i * 4]), v);
-        memcpy(&(baseProbs[i * 4]), v, sizeof(double) * 4);
+        float a1 = a[i], c1 = c[i], g1 = g[i], t1 = t[i];
+        a[i] = m[0] * a1 + m[1] * c1 + m[2] * g1 + m[3] * t1;
+        c[i] = m[4] * a1 + m[5] * c1 + m[6] * g1 + m[7] * t1;
+        g[i] = m[8] * a1 + m[9] * c1 + m[10] * g1 + m[11] * t1;
+        t[i] = m[12] * a1 + m[13] * c1 + m[14] * g1 + m[15] * t1;
     }
-    return baseProbs;
 }
 
-double *getEmptyBaseProbsString(int64_t length) {
+static void multiply(float *restrict baseProbs1, const float *restrict baseProbs2, int64_t blockLength) {
     /*
-     * Gets an array of base probs, as described in getMaxLikelihoodString,
-     * for a block of 'length' positions, in which each position is initialised to 1.0.
+     * Updates baseProbs1, so that at each position i, baseProbs1[i] = baseProbs1[i] * baseProbs2[i], each
+     * being the probability of a given base at a given position whose probability if the product of the initial probabilities.
      */
-    double *baseProbs = st_malloc(length * 4 * sizeof(double));
-    for (int64_t i = 0; i < length * 4; i++) {
-        baseProbs[i] = 1.0;
+    for (int64_t j = 0; j < blockLength * 4; j++) {
+        baseProbs1[j] *= baseProbs2[j];
     }
-    return baseProbs;
 }
 
-double *getBaseProbsString(Segment *segment) {
+static void multiplyBySegment(float *baseProbs, Segment *segment, const float *leafVectors, bool first) {
     /*
-     * Gets an array of base probs, as described in getMaxLikelihoodString, representing
-     * the input string.
+     * Multiplies (or, if first, sets) the base probs by those of the segment's bases after substitution,
+     * looked up from the leaf's precomputed products of its substitution matrix with each base.
+     * If N we marginalise over all possibilities. The segment's bases are counted for masking in the same pass.
      */
     char *string = segment_getString(segment);
     int64_t length = segment_getLength(segment);
-    double *baseProbs = st_calloc(length * 4, sizeof(double)); //Gets the initial array initialised to 0.0 values
     for (int64_t i = 0; i < length; i++) {
-        switch (toupper(string[i])) {
+        const float *v;
+        char uC = toupper(string[i]);
+        scratch.upperCounts[i] += uC == string[i];
+        switch (uC) {
         case 'A':
-            assert(baseProbs[i * 4] == 0.0);
-            baseProbs[i * 4] = 1.0;
+            v = leafVectors;
             break;
         case 'C':
-            baseProbs[i * 4 + 1] = 1.0;
+            v = leafVectors + 4;
             break;
         case 'G':
-            baseProbs[i * 4 + 2] = 1.0;
+            v = leafVectors + 8;
             break;
         case 'T':
-            baseProbs[i * 4 + 3] = 1.0;
+            v = leafVectors + 12;
             break;
-        default: //If N we treat marginalise over all possibilities.
-            baseProbs[i * 4] = 1.0;
-            baseProbs[i * 4 + 1] = 1.0;
-            baseProbs[i * 4 + 2] = 1.0;
-            baseProbs[i * 4 + 3] = 1.0;
+        default:
+            v = leafVectors + 16;
+            scratch.nCounts[i]++;
             break;
         }
+        for (int64_t j = 0; j < 4; j++) {
+            baseProbs[j * length + i] = first ? v[j] : baseProbs[j * length + i] * v[j];
+        }
     }
     free(string);
-    return baseProbs;
 }
 
-static void multiply(double *baseProbs1, double *baseProbs2, int64_t blockLength) {
+static void rescale(float *baseProbs, int64_t length, float threshold) {
     /*
-     * Convenience function.
-     * Updates baseProbs1, so that at each position i, baseProbs1[i] = baseProbs1[i] * baseProbs2[i], each
-     * being the probability of a given base at a given position whose probability if the product of the initial probabilities.
-     * Frees base probs2.
+     * Multiplies the probabilities at each position whose maximum has fallen below the threshold
+     * by a power of two that brings the maximum back to [0.5, 1), so that long products do not underflow.
+     * The ML base at a position is unaffected, and, scaling by a power of two being exact, so are ties.
      */
-    for (int64_t j = 0; j < blockLength * 4; j++) {
-        baseProbs1[j] *= baseProbs2[j];
+    float *a = baseProbs, *c = a + length, *g = c + length, *t = g + length;
+    for (int64_t i = 0; i < length; i++) {
+        float m = fmaxf(fmaxf(a[i], c[i]), fmaxf(g[i], t[i]));
+        if (m < threshold && m > 0.0f) {
+            int e;
+            frexpf(m, &e);
+            a[i] = ldexpf(a[i], -e);
+            c[i] = ldexpf(c[i], -e);
+            g[i] = ldexpf(g[i], -e);
+            t[i] = ldexpf(t[i], -e);
+        }
+    }
+}
+
+static float *getNodeColumns(int64_t node, int64_t blockLength) {
+    return scratch.columns + scratch.nodeColumns[node] * 4 * blockLength;
+}
+
+static void countProduct(int64_t node, int64_t blockLength) {
+    if (++scratch.nodeProducts[node] % FELSENSTEIN_RESCALE_INTERVAL == 0) {
+        rescale(getNodeColumns(node, blockLength), blockLength, FELSENSTEIN_RESCALE_THRESHOLD);
     }
-    free(baseProbs2);
 }
 
 static int getFirstSegmentMatchingEvent(const void *a, const void *b) {
@@ -228,88 +451,120 @@ static int getFirstSegmentMatchingEvent(const void *a, const void *b) {
     return e1 < e2 ? -1 : (e1 > e2 ? 1 : 0);
 }
 
-static double *computeBaseProbs(stTree *tree, stList *eventSortedSegments, int64_t blockLength) {
+static void countSegmentBases(Segment *segment) {
+    /*
+     * Counts the segment's bases for masking, for segments whose events are not leaves of the tree.
+     */
+    char *string = segment_getString(segment);
+    int64_t length = segment_getLength(segment);
+    for (int64_t i = 0; i < length; i++) {
+        char uC = toupper(string[i]);
+        scratch.upperCounts[i] += uC == string[i];
+        scratch.nCounts[i] += uC != 'A' && uC != 'C' && uC != 'G' && uC != 'T';
+    }
+    free(string);
+}
+
+static float *computeBaseProbs(FelsensteinSchedule *schedule, stList *eventSortedSegments, int64_t blockLength) {
     /*
-     * This is the Felsenstein's function to compute the probabilities of each base at each position of the block for the given root node of tree
+     * This is the Felsenstein's function to compute the probabilities of each base at each position of the block for the root of the tree
      * (which is a phylogenetic tree and attached substitution matrices created by getSubstitutionTreeRootedAtGivenEvent).
+     * The nodes are visited in the schedule's post-order. Each node's probabilities are multiplied into those held by its
+     * parent as soon as they are complete, so column sets are only held by the current node and its ancestors, all taken from
+     * the thread's scratch memory. Returns NULL if the tree has no segments, else the root's probabilities, which are valid
+     * until the next call on the thread.
+     * Every segment's bases are also counted into the scratch upper case and N counts, reading each segment's string once.
      */
-    //The code is recursive.
-    if (stTree_getChildNumber(tree) > 0) { //Case root is an internal node.
-        double *baseProbs = computeBaseProbs(stTree_getChild(tree, 0), eventSortedSegments, blockLength);
-        int64_t i=1;
-        // While there are no base probs, cos the subtree is empty replace base probs with those from another branch
-        while(baseProbs == NULL && i < stTree_getChildNumber(tree)) {
-            baseProbs = computeBaseProbs(stTree_getChild(tree, i++), eventSortedSegments, blockLength);
-        }
-        // Now that we have base probs combine the remaining branches
-        while(i < stTree_getChildNumber(tree)) {
-            double *baseProbs2 = computeBaseProbs(stTree_getChild(tree, i++), eventSortedSegments, blockLength);
-            if(baseProbs2 != NULL) {
-                multiply(baseProbs, baseProbs2, blockLength);
+    int64_t segmentNumber = stList_length(eventSortedSegments);
+    reserveScratch(schedule, blockLength, segmentNumber);
+    memset(scratch.segmentsCounted, 0, sizeof(bool) * segmentNumber);
+    int64_t freeColumnNumber = schedule->maxLiveColumns;
+    for (int64_t i = 0; i < freeColumnNumber; i++) {
+        scratch.freeColumns[i] = i;
+    }
+    for (int64_t i = 0; i < schedule->nodeNumber; i++) {
+        scratch.nodeColumns[i] = -1;
+        scratch.nodeProducts[i] = 0;
+    }
+    for (int64_t node = 0; node < schedule->nodeNumber; node++) {
+        Event *event = schedule->leafEvents[node];
+        if (event != NULL) { //Case node is a leaf
+            int64_t i = stList_binarySearchFirstIndex(eventSortedSegments, event, getFirstSegmentMatchingEvent);
+            if (i != -1) {
+                assert(freeColumnNumber > 0);
+                scratch.nodeColumns[node] = scratch.freeColumns[--freeColumnNumber];
+                float *baseProbs = getNodeColumns(node, blockLength);
+                multiplyBySegment(baseProbs, stList_get(eventSortedSegments, i), &schedule->leafVectors[node * 20], 1);
+                scratch.segmentsCounted[i] = 1;
+                while (++i < segmentNumber) {
+                    Segment *segment = stList_get(eventSortedSegments, i);
+                    if (segment_getEvent(segment) != event) {
+                        break;
+                    }
+                    multiplyBySegment(baseProbs, segment, &schedule->leafVectors[node * 20], 0);
+                    scratch.segmentsCounted[i] = 1;
+                    countProduct(node, blockLength);
+                }
             }
+        } else if (scratch.nodeColumns[node] != -1) { //Case node is internal, and its subtree has segments
+            transformBaseProbsBySubstitutionMatrix(getNodeColumns(node, blockLength), blockLength,
+                                                   &schedule->matrices[node * 16]);
         }
-        return baseProbs == NULL ? NULL : transformBaseProbsBySubstitutionMatrix(baseProbs, blockLength, getSubMatrix(tree));
-    } else { //Case root is a leaf
-        Event *event = getEvent(tree);
-        int64_t i = stList_binarySearchFirstIndex(eventSortedSegments, event, getFirstSegmentMatchingEvent);
-        if(i == -1) {
-            return NULL;
-        }
-        double *baseProbs = transformBaseProbsBySubstitutionMatrix(getBaseProbsString(stList_get(eventSortedSegments, i)),
-                                                                   blockLength, getSubMatrix(tree));
-        while(++i < stList_length(eventSortedSegments)) {
-            Segment *segment = stList_get(eventSortedSegments, i);
-            if(segment_getEvent(segment) != event) {
-                break;
+        int64_t parent = schedule->parents[node];
+        if (parent != -1 && scratch.nodeColumns[node] != -1) {
+            rescale(getNodeColumns(node, blockLength), blockLength, 0.5f);
+            if (scratch.nodeColumns[parent] == -1) { // The parent takes the node's columns
+                scratch.nodeColumns[parent] = scratch.nodeColumns[node];
+            } else {
+                multiply(getNodeColumns(parent, blockLength), getNodeColumns(node, blockLength), blockLength);
+                scratch.freeColumns[freeColumnNumber++] = scratch.nodeColumns[node];
+                countProduct(parent, blockLength);
             }
-            multiply(baseProbs, transformBaseProbsBySubstitutionMatrix(getBaseProbsString(segment), blockLength, getSubMatrix(tree)), blockLength);
         }
-        return baseProbs;
     }
+    for (int64_t i = 0; i < segmentNumber; i++) { // Segments of internal events and events not in the tree
+        if (!scratch.segmentsCounted[i]) {
+            countSegmentBases(stList_get(eventSortedSegments, i));
+        }
+    }
+    int64_t root = schedule->nodeNumber - 1;
+    assert(schedule->parents[root] == -1);
+    return scratch.nodeColumns[root] == -1 ? NULL : getNodeColumns(root, blockLength);
 }
 
 ////
 // The following is used to soft-mask (make lower case) bases deemed to be repetitive in the source genomes.
 ////
 
-void maskAncestralRepeatBases(Block *block, stList *segments, char *mlString) {
+static void maskByBaseCounts(char *mlString, int64_t length, const uint32_t *upperCounts, const uint32_t *nCounts,
+                             int64_t segmentNumber) {
     /*
-     * Soft masks the positions in the mlString that are deemed to be repetitive. A position is repetitive
-     * if greater than 50% of the bases from which it is derived are not upper case.
+     * Converts any upper case character to lower case if the majority of bases
+     * from which it is derived are not upper case, and to N if all of them are Ns.
      */
-    //assert(block_getInstanceNumber(block) == stList_length(segments));
-
-    int64_t l = block_getLength(block), j = stList_length(segments);
-    int64_t *upperCounts = st_calloc(l, sizeof(int64_t)); //Counts of upper case bases at each position of the block.
-    int64_t *nCounts = st_calloc(l, sizeof(int64_t)); //Counts of Ns at each position of the block.
-
-    //Iterate through the sequences of the segments of a block and collate the number of upper case bases.
-    for(int64_t i=0; i<j; i++) {
-        Segment *segment = stList_get(segments, i);
-        assert(segment_getSequence(segment) != NULL);
-        char *string = segment_getString(segment);
-        for (int64_t k = 0; k < l; k++) {
-            char uC = toupper(string[k]);
-            upperCounts[k] += uC == string[k] ? 1 : 0;
-            nCounts[k] += (uC != 'A' && uC != 'C' && uC != 'G' && uC != 'T' ? 1 : 0);
-        }
-        free(string);
-    }
-
-    //Convert any upper case character to lower case if the majority of bases
-    //from which it is derived are not upper case.
-    for (int64_t i = 0; i < l; i++) {
-        if (nCounts[i] == j) {
+    for (int64_t i = 0; i < length; i++) {
+        if (nCounts[i] == segmentNumber) {
             mlString[i] = 'N';
         }
-        if (upperCounts[i] <= j / 2) {
+        if (upperCounts[i] <= segmentNumber / 2) {
             mlString[i] = tolower(mlString[i]);
         }
     }
+}
 
-    //Cleanup
-    free(upperCounts);
-    free(nCounts);
+void maskAncestralRepeatBases(Block *block, stList *segments, char *mlString) {
+    /*
+     * Soft masks the positions in the mlString that are deemed to be repetitive. A position is repetitive
+     * if greater than 50% of the bases from which it is derived are not upper case.
+     * getMaximumLikelihoodString does this itself from the counts gathered by computeBaseProbs.
+     */
+    int64_t l = block_getLength(block), j = stList_length(segments);
+    resetBaseCounts(l);
+    for(int64_t i=0; i<j; i++) {
+        assert(segment_getSequence((Segment *)stList_get(segments, i)) != NULL);
+        countSegmentBases(stList_get(segments, i));
+    }
+    maskByBaseCounts(mlString, l, scratch.upperCounts, scratch.nCounts, j);
 }
 
 static int sortByEvent(const void *a, const void *b) {
@@ -356,14 +611,19 @@ char *getMaximumLikelihoodString(stTree *tree, Block *block) {
         mlString[block_getLength(block)] = '\0';
     } else {
         stList *eventSortedSegments = segmentsSortedByEvent(block);
-        double *baseProbs = computeBaseProbs(tree, eventSortedSegments, block_getLength(block));
-        if(baseProbs == NULL) {
-            baseProbs = getEmptyBaseProbsString(block_getLength(block));
+        FelsensteinSchedule *schedule = getSchedule(tree);
+        assert(schedule != NULL); // The tree must be one made by getPhylogeneticTreeRootedAtGivenEvent
+        float *baseProbs = computeBaseProbs(schedule, eventSortedSegments, block_getLength(block));
+        if(baseProbs == NULL) { // No segments, so every base is equally likely
+            baseProbs = scratch.columns;
+            for (int64_t i = 0; i < block_getLength(block) * 4; i++) {
+                baseProbs[i] = 1.0;
+            }
         }
-        mlString = getMaxLikelihoodString(baseProbs, block_getLength(block));
-        maskAncestralRepeatBases(block, eventSortedSegments, mlString);
+        mlString = getMaxLikelihoodString(baseProbs, block_getLength(block), eventSortedSegments);
+        maskByBaseCounts(mlString, block_getLength(block), scratch.upperCounts, scratch.nCounts,
+                         stList_length(eventSortedSegments));
         //Cleanup
-        free(baseProbs);
         stList_destruct(eventSortedSegments);
     }
     return mlString;
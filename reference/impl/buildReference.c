@@ -5,7 +5,9 @@
 #include "stCheckEdges.h"
 #include "stMatchingAlgorithms.h"
 #include "stReferenceProblem2.h"
+#include "cactusReference.h"
 #include <math.h>
+#include <time.h>
 
 // OpenMP
 #if defined(_OPENMP)
@@ -76,45 +78,6 @@ static stList *getExtraAttachedStubsFromParent(Flower *flower) {
 ////////////////////////////////////
 ////////////////////////////////////
 
-static stList *calculateZP(Cap *cap, stHash *endsToNodes) {
-    /*
-     * Get the list of caps that represent the ends of the chains and stubs within a sequence.
-     */
-    assert(!cap_getSide(cap));
-    assert(end_isStubEnd(end_getPositiveOrientation(cap_getEnd(cap))));
-    stList *caps = stList_construct();
-    bool b = 0;
-    while (1) {
-        End *end = end_getPositiveOrientation(cap_getEnd(cap));
-        if (stHash_search(endsToNodes, end) != NULL) {
-            assert(!cap_getSide(cap));
-            if (stList_length(caps) > 0) {
-                assert(b);
-            }
-            b = 0;
-            stList_append(caps, cap);
-        }
-        cap = cap_getAdjacency(cap);
-        assert(cap != NULL);
-        end = end_getPositiveOrientation(cap_getEnd(cap));
-        if (stHash_search(endsToNodes, end) != NULL) {
-            assert(cap_getSide(cap));
-            if (stList_length(caps) > 0) {
-                assert(!b);
-            }
-            b = 1;
-            stList_append(caps, cap);
-        }
-        if (end_isStubEnd(end)) {
-            return caps;
-        }
-        assert(cap != cap_getOtherSegmentCap(cap));
-        cap = cap_getOtherSegmentCap(cap);
-        assert(cap != NULL);
-    }
-    return NULL;
-}
-
 static Cap *calculateZP4(Cap *cap, stHash *endsToNodes) {
     if (cap_getOtherSegmentCap(cap) == NULL) {
         return NULL;
@@ -310,12 +273,187 @@ static double countAdapterFn(Cap *_5Cap, int64_t length5Segment, int64_t length3
     return 1;
 }
 
-refAdjList *calculateZ(Flower *flower, stHash *endsToNodes, int64_t nodeNumber, int64_t maxWalkForCalculatingZ,
-bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, void *), void *zScoreExtraArgs) {
+typedef struct _zScoreRequest {
     /*
-     * Calculate the zScores between all ends.
+     * The parameters of one set of adjacency scores computed by calculateZs.
+     */
+    stHash *endsToNodes; // The ends to score, a subset of the ends of the first request
+    int64_t maxWalkForCalculatingZ;
+    bool ignoreUnalignedGaps;
+    double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, void *);
+    void *zScoreExtraArgs;
+} ZScoreRequest;
+
+/*
+ * The number of threads of sequence walked by each thread in a batch of calculateZs, bounding the number of
+ * edges held before they are merged.
+ */
+#define Z_WALKS_PER_THREAD_PER_BATCH 4
+
+typedef struct _zEdge {
+    int64_t request;
+    int64_t _3Node;
+    int64_t _5Node;
+    double score;
+} ZEdge;
+
+typedef struct _zThreadBuffer {
+    /*
+     * The memory used by one thread of calculateZs: the edges it has found, and scratch arrays for
+     * the caps of the thread currently being walked, grown as needed.
      */
-    refAdjList *aL = refAdjList_construct(nodeNumber);
+    ZEdge *edges;
+    int64_t edgeNumber, maxEdgeNumber;
+    Cap **caps;
+    int64_t *nodes;
+    int64_t *indices; // Indices of the caps in a request's ends
+    int64_t *capSizes; // The lengths from calculateZP2 of the caps of each request, maxCapNumber per request
+    int64_t capNumber, maxCapNumber;
+} ZThreadBuffer;
+
+static void zThreadBuffer_addEdge(ZThreadBuffer *buffer, int64_t request, int64_t _3Node, int64_t _5Node, double score) {
+    if (buffer->edgeNumber == buffer->maxEdgeNumber) {
+        buffer->maxEdgeNumber = buffer->maxEdgeNumber * 2 + 16;
+        buffer->edges = st_realloc(buffer->edges, sizeof(ZEdge) * buffer->maxEdgeNumber);
+    }
+    ZEdge *edge = &buffer->edges[buffer->edgeNumber++];
+    edge->request = request;
+    edge->_3Node = _3Node;
+    edge->_5Node = _5Node;
+    edge->score = score;
+}
+
+static void zThreadBuffer_addCap(ZThreadBuffer *buffer, Cap *cap, int64_t node, int64_t requestNumber) {
+    assert(buffer->capNumber == 0 || cap_getSide(buffer->caps[buffer->capNumber - 1]) != cap_getSide(cap));
+    if (buffer->capNumber == buffer->maxCapNumber) {
+        buffer->maxCapNumber = buffer->maxCapNumber * 2 + 16;
+        buffer->caps = st_realloc(buffer->caps, sizeof(Cap *) * buffer->maxCapNumber);
+        buffer->nodes = st_realloc(buffer->nodes, sizeof(int64_t) * buffer->maxCapNumber);
+        buffer->indices = st_realloc(buffer->indices, sizeof(int64_t) * buffer->maxCapNumber);
+        free(buffer->capSizes); // Only filled once the walk is complete
+        buffer->capSizes = st_malloc(sizeof(int64_t) * buffer->maxCapNumber * requestNumber);
+    }
+    buffer->caps[buffer->capNumber] = cap;
+    buffer->nodes[buffer->capNumber++] = node;
+}
+
+static void calculateZP(Cap *cap, stHash *endsToNodes, ZThreadBuffer *buffer, int64_t requestNumber) {
+    /*
+     * Get the list of caps that represent the ends of the chains and stubs within a sequence, and their nodes,
+     * putting them in the buffer.
+     */
+    assert(!cap_getSide(cap));
+    assert(end_isStubEnd(end_getPositiveOrientation(cap_getEnd(cap))));
+    buffer->capNumber = 0;
+    while (1) {
+        stIntTuple *node = stHash_search(endsToNodes, end_getPositiveOrientation(cap_getEnd(cap)));
+        if (node != NULL) {
+            assert(!cap_getSide(cap));
+            zThreadBuffer_addCap(buffer, cap, stIntTuple_get(node, 0), requestNumber);
+        }
+        cap = cap_getAdjacency(cap);
+        assert(cap != NULL);
+        End *end = end_getPositiveOrientation(cap_getEnd(cap));
+        node = stHash_search(endsToNodes, end);
+        if (node != NULL) {
+            assert(cap_getSide(cap));
+            zThreadBuffer_addCap(buffer, cap, stIntTuple_get(node, 0), requestNumber);
+        }
+        if (end_isStubEnd(end)) {
+            return;
+        }
+        assert(cap != cap_getOtherSegmentCap(cap));
+        cap = cap_getOtherSegmentCap(cap);
+        assert(cap != NULL);
+    }
+}
+
+static void calculateZsForCap(Cap *cap, int64_t requestNumber, ZScoreRequest *requests, int64_t nodeNumber,
+                              char **requestNodes, int64_t *capSizeRequests, ZThreadBuffer *buffer) {
+    /*
+     * Adds the edges of each request for the thread of sequence starting at the cap to the buffer.
+     */
+    calculateZP(cap, requests[0].endsToNodes, buffer, requestNumber);
+    for (int64_t r = 0; r < requestNumber; r++) {
+        ZScoreRequest *request = &requests[r];
+        /*
+         * Get the caps whose ends are in the request.
+         */
+        int64_t length = 0;
+        for (int64_t i = 0; i < buffer->capNumber; i++) {
+            if (requestNodes[r] == NULL || requestNodes[r][buffer->nodes[i] + nodeNumber]) {
+                buffer->indices[length++] = i;
+            }
+        }
+
+        /*
+         * Calculate the lengths of the sequences following the 3 caps, for efficiency. Requests with the same
+         * ends share these.
+         */
+        int64_t *capSizes = &buffer->capSizes[capSizeRequests[r] * buffer->maxCapNumber];
+        if (capSizeRequests[r] == r) {
+            for (int64_t i = 0; i < length; i++) {
+                capSizes[i] = calculateZP2(buffer->caps[buffer->indices[i]], request->endsToNodes);
+            }
+        }
+
+        /*
+         * Iterate through all pairs of 5' and 3' caps to calculate additions to scores.
+         */
+        for (int64_t i = (length > 0 && cap_getSide(buffer->caps[buffer->indices[0]])) ? 1 : 0; i < length; i += 2) {
+            Cap *_3Cap = buffer->caps[buffer->indices[i]];
+            assert(!cap_getSide(_3Cap));
+            int64_t _3CapSize = capSizes[i];
+            int64_t _3Node = buffer->nodes[buffer->indices[i]];
+            int64_t unaligned = 0;
+            for (int64_t k = 0; k < request->maxWalkForCalculatingZ; k++) {
+                int64_t j = k * 2 + i + 1;
+                if (j >= length) {
+                    break;
+                }
+                Cap *_5Cap = buffer->caps[buffer->indices[j]];
+                assert(cap_getSide(_5Cap));
+                assert(cap_getAdjacency(_5Cap) != NULL);
+                if (request->ignoreUnalignedGaps) {
+                    assert(cap_getCoordinate(_5Cap) - cap_getCoordinate(cap_getAdjacency(_5Cap)) - 1 >= 0);
+                    unaligned += cap_getCoordinate(_5Cap) - cap_getCoordinate(cap_getAdjacency(_5Cap)) - 1;
+                }
+                int64_t _5Node = buffer->nodes[buffer->indices[j]];
+                int64_t _5CapSize = capSizes[j];
+                assert(cap_getCoordinate(_5Cap) - cap_getCoordinate(_3Cap) > 0);
+                int64_t diff = cap_getCoordinate(_5Cap) - cap_getCoordinate(_3Cap) - unaligned;
+                assert(diff >= 1);
+                if (request->zScoreFn(_5Cap, 1, 1, diff, request->zScoreExtraArgs) < 0.0000000001) { //no point walking when score gets too small, should be effective for theta >= 0.000001
+                    break;
+                }
+                double score = request->zScoreFn(_5Cap, _5CapSize, _3CapSize, diff, request->zScoreExtraArgs);
+                assert(score >= -0.0001);
+                if (score <= 0.0) {
+                    score = 1e-10; //Make slightly non-zero.
+                }
+                assert(score > 0.0);
+                zThreadBuffer_addEdge(buffer, r, _3Node, _5Node, score);
+            }
+        }
+    }
+}
+
+static void calculateZs(Flower *flower, int64_t nodeNumber, int64_t requestNumber, ZScoreRequest *requests,
+                        refAdjList **adjLists) {
+    /*
+     * Calculate the zScores between all ends for each of the requests, filling in the corresponding adjacency lists,
+     * in a single walk along the threads of sequence of the flower.
+     * The walks are split between threads, each of which collects its edges in its own buffer. The walks are done in
+     * batches of a bounded number of threads of sequence, and after each batch the buffers are merged in the order of
+     * the walks, so the scores are added in the same order as a serial walk would add them while only the edges of
+     * one batch are held at once.
+     */
+    assert(requestNumber > 0);
+
+    /*
+     * Get the caps at which the walks start.
+     */
+    stList *startCaps = stList_construct();
     Flower_EndIterator *endIt = flower_getEndIterator(flower);
     End *end;
     while ((end = flower_getNextEnd(endIt)) != NULL) {
@@ -325,59 +463,7 @@ bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, v
             while ((cap = end_getNext(capIt)) != NULL) {
                 cap = cap_getStrand(cap) ? cap : cap_getReverse(cap);
                 if (!cap_getSide(cap) && cap_getSequence(cap) != NULL) {
-                    stList *caps = calculateZP(cap, endsToNodes);
-
-                    /*
-                     * Calculate the lengths of the sequences following the 3 caps, for efficiency.
-                     */
-                    int64_t *capSizes = st_malloc(sizeof(int64_t) * stList_length(caps));
-                    for (int64_t i = 0; i < stList_length(caps); i++) {
-                        Cap *cap = stList_get(caps, i);
-                        capSizes[i] = calculateZP2(cap, endsToNodes);
-                    }
-
-                    /*
-                     * Iterate through all pairs of 5' and 3' caps to calculate additions to scores.
-                     */
-                    for (int64_t i = (stList_length(caps) > 0 && cap_getSide(stList_get(caps, 0))) ? 1 : 0; i < stList_length(caps); i += 2) {
-                        Cap *_3Cap = stList_get(caps, i);
-                        assert(!cap_getSide(_3Cap));
-                        int64_t _3CapSize = capSizes[i];
-                        int64_t _3Node = stIntTuple_get(stHash_search(endsToNodes, end_getPositiveOrientation(cap_getEnd(_3Cap))), 0);
-                        int64_t unaligned = 0;
-                        for (int64_t k = 0; k < maxWalkForCalculatingZ; k++) {
-                            int64_t j = k * 2 + i + 1;
-                            if (j >= stList_length(caps)) {
-                                break;
-                            }
-                            Cap *_5Cap = stList_get(caps, j);
-                            assert(cap_getSide(_5Cap));
-                            assert(cap_getAdjacency(_5Cap) != NULL);
-                            if (ignoreUnalignedGaps) {
-                                assert(cap_getCoordinate(_5Cap) - cap_getCoordinate(cap_getAdjacency(_5Cap)) - 1 >= 0);
-                                unaligned += cap_getCoordinate(_5Cap) - cap_getCoordinate(cap_getAdjacency(_5Cap)) - 1;
-                            }
-                            int64_t _5Node = stIntTuple_get(stHash_search(endsToNodes, end_getPositiveOrientation(cap_getEnd(_5Cap))), 0);
-                            int64_t _5CapSize = capSizes[j];
-                            assert(cap_getCoordinate(_5Cap) - cap_getCoordinate(_3Cap) > 0);
-                            int64_t diff = cap_getCoordinate(_5Cap) - cap_getCoordinate(_3Cap) - unaligned;
-                            assert(diff >= 1);
-                            if (zScoreFn(_5Cap, 1, 1, diff, zScoreExtraArgs) < 0.0000000001) { //no point walking when score gets too small, should be effective for theta >= 0.000001
-                                break;
-                            }
-                            double score = zScoreFn(_5Cap, _5CapSize, _3CapSize, diff, zScoreExtraArgs);
-                            assert(score >= -0.0001);
-                            if (score <= 0.0) {
-                                score = 1e-10; //Make slightly non-zero.
-                            }
-                            assert(score > 0.0);
-                            refAdjList_addToWeight(aL, _3Node, _5Node, score);
-                            assert(refAdjList_getWeight(aL, _3Node, _5Node) == refAdjList_getWeight(aL, _5Node, _3Node));
-                            assert(refAdjList_getWeight(aL, _3Node, _5Node) >= 0.0);
-                        }
-                    }
-                    stList_destruct(caps);
-                    free(capSizes);
+                    stList_append(startCaps, cap);
                 }
             }
             end_destructInstanceIterator(capIt);
@@ -385,6 +471,114 @@ bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, v
     }
     flower_destructEndIterator(endIt);
 
+    /*
+     * For each request make a dense table of which nodes are in its ends, indexed by node + nodeNumber,
+     * and find the first request with the same ends, whose cap lengths it can reuse.
+     */
+    char **requestNodes = st_malloc(sizeof(char *) * requestNumber);
+    int64_t *capSizeRequests = st_malloc(sizeof(int64_t) * requestNumber);
+    for (int64_t r = 0; r < requestNumber; r++) {
+        capSizeRequests[r] = r;
+        for (int64_t r2 = 0; r2 < r; r2++) {
+            if (requests[r2].endsToNodes == requests[r].endsToNodes) {
+                capSizeRequests[r] = r2;
+                break;
+            }
+        }
+        requestNodes[r] = NULL; // All the nodes of the first request
+        if (requests[r].endsToNodes != requests[0].endsToNodes) {
+            requestNodes[r] = st_calloc(2 * nodeNumber + 1, sizeof(char));
+            stHashIterator *it = stHash_getIterator(requests[r].endsToNodes);
+            void *key;
+            while ((key = stHash_getNext(it)) != NULL) {
+                assert(stHash_search(requests[0].endsToNodes, key) == stHash_search(requests[r].endsToNodes, key));
+                int64_t node = stIntTuple_get(stHash_search(requests[r].endsToNodes, key), 0);
+                assert(node >= -nodeNumber && node <= nodeNumber);
+                requestNodes[r][node + nodeNumber] = 1;
+            }
+            stHash_destructIterator(it);
+        }
+    }
+
+    /*
+     * Walk the threads in parallel, in batches.
+     */
+    int64_t threadNumber = 1;
+#if defined(_OPENMP)
+    threadNumber = omp_get_max_threads();
+#endif
+    int64_t batchSize = threadNumber * Z_WALKS_PER_THREAD_PER_BATCH;
+    ZThreadBuffer *buffers = st_calloc(threadNumber, sizeof(ZThreadBuffer));
+    int64_t *capThreads = st_malloc(sizeof(int64_t) * batchSize);
+    int64_t *capEdgeStarts = st_malloc(sizeof(int64_t) * batchSize);
+    int64_t *capEdgeEnds = st_malloc(sizeof(int64_t) * batchSize);
+    for (int64_t r = 0; r < requestNumber; r++) {
+        adjLists[r] = refAdjList_construct(nodeNumber);
+    }
+    for (int64_t batchStart = 0; batchStart < stList_length(startCaps); batchStart += batchSize) {
+        int64_t batchEnd = batchStart + batchSize < stList_length(startCaps) ? batchStart + batchSize : stList_length(startCaps);
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic)
+#endif
+        for (int64_t i = batchStart; i < batchEnd; i++) {
+            int64_t thread = 0;
+#if defined(_OPENMP)
+            thread = omp_get_thread_num();
+#endif
+            ZThreadBuffer *buffer = &buffers[thread];
+            capThreads[i - batchStart] = thread;
+            capEdgeStarts[i - batchStart] = buffer->edgeNumber;
+            calculateZsForCap(stList_get(startCaps, i), requestNumber, requests, nodeNumber, requestNodes,
+                              capSizeRequests, buffer);
+            capEdgeEnds[i - batchStart] = buffer->edgeNumber;
+        }
+
+        /*
+         * Merge the edges of the batch into the adjacency lists and empty the buffers.
+         */
+        for (int64_t i = 0; i < batchEnd - batchStart; i++) {
+            ZThreadBuffer *buffer = &buffers[capThreads[i]];
+            for (int64_t j = capEdgeStarts[i]; j < capEdgeEnds[i]; j++) {
+                ZEdge *edge = &buffer->edges[j];
+                refAdjList *aL = adjLists[edge->request];
+                refAdjList_addToWeight(aL, edge->_3Node, edge->_5Node, edge->score);
+                assert(refAdjList_getWeight(aL, edge->_3Node, edge->_5Node) == refAdjList_getWeight(aL, edge->_5Node, edge->_3Node));
+                assert(refAdjList_getWeight(aL, edge->_3Node, edge->_5Node) >= 0.0);
+            }
+        }
+        for (int64_t t = 0; t < threadNumber; t++) {
+            buffers[t].edgeNumber = 0;
+        }
+    }
+
+    //Cleanup
+    for (int64_t t = 0; t < threadNumber; t++) {
+        free(buffers[t].edges);
+        free(buffers[t].caps);
+        free(buffers[t].nodes);
+        free(buffers[t].indices);
+        free(buffers[t].capSizes);
+    }
+    free(buffers);
+    free(capThreads);
+    free(capEdgeStarts);
+    free(capEdgeEnds);
+    for (int64_t r = 0; r < requestNumber; r++) {
+        free(requestNodes[r]);
+    }
+    free(requestNodes);
+    free(capSizeRequests);
+    stList_destruct(startCaps);
+}
+
+refAdjList *calculateZ(Flower *flower, stHash *endsToNodes, int64_t nodeNumber, int64_t maxWalkForCalculatingZ,
+bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, void *), void *zScoreExtraArgs) {
+    /*
+     * Calculate the zScores between all ends.
+     */
+    ZScoreRequest request = { endsToNodes, maxWalkForCalculatingZ, ignoreUnalignedGaps, zScoreFn, zScoreExtraArgs };
+    refAdjList *aL;
+    calculateZs(flower, nodeNumber, 1, &request, &aL);
     return aL;
 }
 
@@ -972,10 +1166,66 @@ stList *getReferenceIntervalsToPreserve(refOrdering *ref, refAdjList *dAL, int64
 ////////////////////////////////////
 ////////////////////////////////////
 
+static double getTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1.0e-9;
+}
+
+static void improveReference(refOrdering *ref, refAdjList *aL, refAdjList *dAL, double wiggle, int64_t permutations,
+                             int64_t nudgePermutations, int64_t maxNudge, ReferenceStats *stats) {
+    /*
+     * Builds the reference greedily from the intervals of stubs, then improves it with rounds of greedy permutation
+     * sampling and nudging, recording the scores in stats.
+     */
+    double startTime = getTime();
+    double maxPossibleScore = refAdjList_getMaxPossibleScore(aL);
+    makeReferenceGreedily2(aL, dAL, ref, wiggle);
+    double samplingStartTime = getTime();
+    int64_t badAdjacenciesAfterGreedy = getBadAdjacencyCount(dAL, ref);
+    double totalScoreAfterGreedy = getReferenceScore(aL, ref);
+    st_logDebug("The score of the initial solution is %f/%" PRIi64 " out of a max possible %f\n",
+            totalScoreAfterGreedy, badAdjacenciesAfterGreedy, maxPossibleScore);
+
+    updateReferenceGreedily(aL, dAL, ref, permutations);
+    double nudgingStartTime = getTime();
+
+    int64_t badAdjacenciesAfterGreedySampling = getBadAdjacencyCount(dAL, ref);
+    double totalScoreAfterGreedySampling = getReferenceScore(aL, ref);
+    st_logDebug(
+            "The score of the solution after permutation sampling is %f/%" PRIi64 " after %" PRIi64 " rounds of greedy permutation out of a max possible %f\n",
+            totalScoreAfterGreedySampling, badAdjacenciesAfterGreedySampling, permutations, maxPossibleScore);
+
+    //reorderReferenceToAvoidBreakpoints(dAL2, ref);
+    //int64_t badAdjacenciesAfterTopologicalReordering = getBadAdjacencyCount(dAL, ref);
+    //double totalScoreAfterTopologicalReordering = getReferenceScore(aL, ref);
+    //st_logDebug(
+    //        "The score of the solution after topological reordering is %f/%" PRIi64 " after %" PRIi64 " rounds of greedy permutation out of a max possible %f\n",
+    //        totalScoreAfterTopologicalReordering, badAdjacenciesAfterTopologicalReordering, permutations, maxPossibleScore);
+
+    nudgeGreedily(dAL, aL, ref, nudgePermutations, maxNudge);
+    double endTime = getTime();
+    int64_t badAdjacenciesAfterNudging = getBadAdjacencyCount(dAL, ref);
+    double totalScoreAfterNudging = getReferenceScore(aL, ref);
+    st_logDebug("The score of the final solution is %f/%" PRIi64 " after %" PRIi64 " rounds of greedy nudging out of a max possible %f\n",
+            totalScoreAfterNudging, badAdjacenciesAfterNudging, nudgePermutations, maxPossibleScore);
+
+    stats->maxPossibleScore = maxPossibleScore;
+    stats->scoreAfterGreedy = totalScoreAfterGreedy;
+    stats->scoreAfterSampling = totalScoreAfterGreedySampling;
+    stats->finalScore = totalScoreAfterNudging;
+    stats->badAdjacenciesAfterGreedy = badAdjacenciesAfterGreedy;
+    stats->finalBadAdjacencies = badAdjacenciesAfterNudging;
+    stats->greedyTime = samplingStartTime - startTime;
+    stats->samplingTime = nudgingStartTime - samplingStartTime;
+    stats->nudgingTime = endTime - nudgingStartTime;
+}
+
 void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int64_t permutations,
         stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber), double (*temperature)(double),
         double theta, double phi, int64_t maxWalkForCalculatingZ,
-        bool ignoreUnalignedGaps, double wiggle, int64_t numberOfNsForScaffoldGap, int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds) {
+        bool ignoreUnalignedGaps, double wiggle, int64_t numberOfNsForScaffoldGap, int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds,
+        int64_t nudgePermutations, int64_t maxNudge, ReferenceStats *stats) {
     /*
      * Implements a greedy algorithm and greedy update sampler to find a solution to the adjacency problem for a net.
      */
@@ -1021,31 +1271,40 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
     stHash *nodesToEnds = stHash_invert(endsToNodes, (uint64_t (*)(const void *)) stIntTuple_hashKey,
             (int (*)(const void *, const void *)) stIntTuple_equalsFn, (void (*)(void *)) stIntTuple_destruct, NULL);
 
+    /*
+     * Calculate z functions, using phylogenetic weighting, together with the counts of direct adjacencies
+     * between all ends, and between stub ends, in one walk of the threads.
+     */
+    stSet *chosenEvents = getEventsWithSequences(flower);
+    stHash *eventWeighting = getEventWeighting(referenceEvent, phi, chosenEvents);
+    stSet_destruct(chosenEvents);
+    void *zArgs[2] = { &theta, eventWeighting };
+    double directTheta = 0.0;
+    void *directZArgs[2] = { &directTheta, eventWeighting };
+    stHash *stubEndsToNodes = makeStubEdgesToNodesHash(stubTangleEnds, endsToNodes);
+    ZScoreRequest zRequests[4] = {
+            { endsToNodes, maxWalkForCalculatingZ, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs },
+            { endsToNodes, 1, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, directZArgs }, //Gets set of direct of direct adjacencies
+            { endsToNodes, 1, 1, countAdapterFn, NULL }, //Gets counts of direct adjacencies, used to split the reference.
+            { stubEndsToNodes, 1, 1, countAdapterFn, NULL } }; //Gets set of adjacencies between stub ends.
+    refAdjList *zAdjLists[4];
+    double zStartTime = getTime();
+    calculateZs(flower, nodeNumber, makeScaffolds ? 4 : 3, zRequests, zAdjLists);
+    double zTime = getTime() - zStartTime;
+    refAdjList *aL = zAdjLists[0], *dAL = zAdjLists[1], *countDAL = zAdjLists[2];
+    stHash_destruct(stubEndsToNodes);
+    stHash_destruct(eventWeighting);
+
     /*
      * Determine which adjacencies between stubs must be preserved (i.e. scaffolded if necessary)
      */
     stList *referenceIntervalsToPreserve = NULL;
     if (makeScaffolds) {
-        stHash *stubEndsToNodes = makeStubEdgesToNodesHash(stubTangleEnds, endsToNodes);
-        refAdjList *stubDAL = calculateZ(flower, stubEndsToNodes, nodeNumber, 1, 1, countAdapterFn, NULL); //Gets set of adjacencies between stub ends.
-        stHash_destruct(stubEndsToNodes);
+        refAdjList *stubDAL = zAdjLists[3];
         referenceIntervalsToPreserve = getReferenceIntervalsToPreserve(ref, stubDAL, minNumberOfSequencesToSupportAdjacency); //List of int-tuple pairs identifying the matchings between ends that should be preserved.
         refAdjList_destruct(stubDAL);
     }
 
-    /*
-     * Calculate z functions, using phylogenetic weighting.
-     */
-    stSet *chosenEvents = getEventsWithSequences(flower);
-    stHash *eventWeighting = getEventWeighting(referenceEvent, phi, chosenEvents);
-    stSet_destruct(chosenEvents);
-    void *zArgs[2] = { &theta, eventWeighting };
-    refAdjList *aL = calculateZ(flower, endsToNodes, nodeNumber, maxWalkForCalculatingZ, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs);
-    int64_t directTheta = 0.0;
-    zArgs[0] = &directTheta;
-    refAdjList *dAL = calculateZ(flower, endsToNodes, nodeNumber, 1, ignoreUnalignedGaps, calculateZScoreWeightedAdapterFn, zArgs); //Gets set of direct of direct adjacencies
-    stHash_destruct(eventWeighting);
-
     /*
      * Check the edges and nodes before starting to calculate the matching.
      */
@@ -1053,35 +1312,17 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
             "Starting to build the reference for flower %lli, with %" PRIi64 " stubs and %" PRIi64 " chains and %" PRIi64 " nodes in the flowers tangle\n",
             flower_getName(flower), reference_getIntervalNumber(ref), chainNumber, nodeNumber);
 
-    double maxPossibleScore = refAdjList_getMaxPossibleScore(aL);
-    makeReferenceGreedily2(aL, dAL, ref, wiggle);
-    int64_t badAdjacenciesAfterGreedy = getBadAdjacencyCount(dAL, ref);
-    double totalScoreAfterGreedy = getReferenceScore(aL, ref);
-    st_logDebug("The score of the initial solution is %f/%" PRIi64 " out of a max possible %f\n", totalScoreAfterGreedy, badAdjacenciesAfterGreedy,
-            maxPossibleScore);
-
-    updateReferenceGreedily(aL, dAL, ref, permutations);
-
-    int64_t badAdjacenciesAfterGreedySampling = getBadAdjacencyCount(dAL, ref);
-    double totalScoreAfterGreedySampling = getReferenceScore(aL, ref);
-    st_logDebug(
-            "The score of the solution after permutation sampling is %f/%" PRIi64 " after %" PRIi64 " rounds of greedy permutation out of a max possible %f\n",
-            totalScoreAfterGreedySampling, badAdjacenciesAfterGreedySampling, permutations, maxPossibleScore);
-
-    //reorderReferenceToAvoidBreakpoints(dAL2, ref);
-    //int64_t badAdjacenciesAfterTopologicalReordering = getBadAdjacencyCount(dAL, ref);
-    //double totalScoreAfterTopologicalReordering = getReferenceScore(aL, ref);
-    //st_logDebug(
-    //        "The score of the solution after topological reordering is %f/%" PRIi64 " after %" PRIi64 " rounds of greedy permutation out of a max possible %f\n",
-    //        totalScoreAfterTopologicalReordering, badAdjacenciesAfterTopologicalReordering, permutations, maxPossibleScore);
+    /*
+     * Build the reference greedily, then improve it by greedy permutation sampling and nudging.
+     */
+    ReferenceStats referenceStats;
+    improveReference(ref, aL, dAL, wiggle, permutations, nudgePermutations, maxNudge, &referenceStats);
+    referenceStats.nodeNumber = nodeNumber;
+    referenceStats.zTime = zTime;
+    if (stats != NULL) {
+        *stats = referenceStats;
+    }
 
-    int64_t maxNudge = 100;
-    int64_t nudgePermutations = 100;
-    nudgeGreedily(dAL, aL, ref, nudgePermutations, maxNudge);
-    int64_t badAdjacenciesAfterNudging = getBadAdjacencyCount(dAL, ref);
-    double totalScoreAfterNudging = getReferenceScore(aL, ref);
-    st_logDebug("The score of the final solution is %f/%" PRIi64 " after %" PRIi64 " rounds of greedy nudging out of a max possible %f\n",
-            totalScoreAfterNudging, badAdjacenciesAfterNudging, nudgePermutations, maxPossibleScore);
     //The aL and dAL arrays are no longer valid as we've added additional nodes to the reference, let's clean up the arrays explicitly.
     refAdjList_destruct(aL);
     refAdjList_destruct(dAL);
@@ -1094,7 +1335,6 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
      * The function returns a list of additional extra stub nodes, which
      * must then be turned into ends in the flower.
      */
-    refAdjList *countDAL = calculateZ(flower, endsToNodes, nodeNumber, 1, 1, countAdapterFn, NULL); //Gets set of adjacencies between stub ends.
     void *extraArgs[3] = { nodesToEnds, countDAL, &minNumberOfSequencesToSupportAdjacency };
     stList *extraStubNodes = splitReferenceAtIndicatedLocations(ref, referenceSplitFn, extraArgs);
     refAdjList_destruct(countDAL);
@@ -1159,8 +1399,77 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
 ////////////////////////////////////
 ////////////////////////////////////
 
+double estimateFlowerReferenceCost(Flower *flower, int64_t maxWalkForCalculatingZ) {
+    return (double)flower_getEndNumber(flower) * flower_getCapNumber(flower) * maxWalkForCalculatingZ;
+}
+
+typedef struct _referenceFlowerTask {
+    Flower *flower;
+    double predictedCost;
+    double time; // Seconds taken to build the reference
+    ReferenceStats stats;
+} ReferenceFlowerTask;
+
+static int referenceFlowerTask_cmpFn(const void *a, const void *b) {
+    // Sort in descending order of predicted cost, breaking ties by name so the order is deterministic
+    const ReferenceFlowerTask *t1 = a, *t2 = b;
+    if (t1->predictedCost != t2->predictedCost) {
+        return t1->predictedCost < t2->predictedCost ? 1 : -1;
+    }
+    Name n1 = flower_getName(t1->flower), n2 = flower_getName(t2->flower);
+    return n1 < n2 ? -1 : (n1 > n2 ? 1 : 0);
+}
+
+static void logReferenceTasks(ReferenceFlowerTask *tasks, int64_t taskNumber) {
+    /*
+     * Reports the time taken and scores of the reference built for each flower, and their totals.
+     */
+    double totalTime = 0.0, maxTime = 0.0, totalCost = 0.0;
+    double totalMaxPossibleScore = 0.0, totalScoreAfterGreedy = 0.0, totalFinalScore = 0.0;
+    int64_t totalBadAdjacencies = 0;
+    for (int64_t i = 0; i < taskNumber; i++) {
+        ReferenceFlowerTask *task = &tasks[i];
+        st_logDebug("Reference flower %" PRIi64 " predicted cost: %f time: %f seconds nodes: %" PRIi64
+                    " score after greedy: %f final score: %f/%" PRIi64 " max possible score: %f\n",
+                    flower_getName(task->flower), task->predictedCost, task->time, task->stats.nodeNumber,
+                    task->stats.scoreAfterGreedy, task->stats.finalScore, task->stats.finalBadAdjacencies,
+                    task->stats.maxPossibleScore);
+        totalTime += task->time;
+        maxTime = task->time > maxTime ? task->time : maxTime;
+        totalCost += task->predictedCost;
+        totalMaxPossibleScore += task->stats.maxPossibleScore;
+        totalScoreAfterGreedy += task->stats.scoreAfterGreedy;
+        totalFinalScore += task->stats.finalScore;
+        totalBadAdjacencies += task->stats.finalBadAdjacencies;
+    }
+    st_logInfo("Built references for %" PRIi64 " flowers in %f seconds of thread time, the longest flower taking %f seconds, "
+               "%g seconds per unit of predicted cost\n", taskNumber, totalTime, maxTime,
+               totalCost > 0.0 ? totalTime / totalCost : 0.0);
+    st_logInfo("Total reference score after greedy: %f, final: %f with %" PRIi64 " bad adjacencies, out of a max possible %f\n",
+               totalScoreAfterGreedy, totalFinalScore, totalBadAdjacencies, totalMaxPossibleScore);
+}
+
+static void referenceStats_add(ReferenceStats *totalStats, ReferenceStats *stats) {
+    totalStats->nodeNumber += stats->nodeNumber;
+    totalStats->maxPossibleScore += stats->maxPossibleScore;
+    totalStats->scoreAfterGreedy += stats->scoreAfterGreedy;
+    totalStats->scoreAfterSampling += stats->scoreAfterSampling;
+    totalStats->finalScore += stats->finalScore;
+    totalStats->badAdjacenciesAfterGreedy += stats->badAdjacenciesAfterGreedy;
+    totalStats->finalBadAdjacencies += stats->finalBadAdjacencies;
+    totalStats->zTime += stats->zTime;
+    totalStats->greedyTime += stats->greedyTime;
+    totalStats->samplingTime += stats->samplingTime;
+    totalStats->nudgingTime += stats->nudgingTime;
+}
+
 void cactus_make_reference(stList *flowers, char *referenceEventString,
                            CactusDisk *cactusDisk, CactusParams *params) {
+    cactus_make_reference2(flowers, referenceEventString, cactusDisk, params, NULL);
+}
+
+void cactus_make_reference2(stList *flowers, char *referenceEventString,
+                            CactusDisk *cactusDisk, CactusParams *params, ReferenceStats *totalStats) {
     ///////////////////////////////////////////////////////////////////////////
     // Build the reference
     ///////////////////////////////////////////////////////////////////////////
@@ -1175,6 +1484,8 @@ void cactus_make_reference(stList *flowers, char *referenceEventString,
     int64_t numberOfNsForScaffoldGap = cactusParams_get_int(params, 2, "reference", "numberOfNs");
     int64_t minNumberOfSequencesToSupportAdjacency = cactusParams_get_int(params, 2, "reference", "minNumberOfSequencesToSupportAdjacency");
     bool makeScaffolds = cactusParams_get_int(params, 2, "reference", "makeScaffolds");
+    int64_t nudgePermutations = cactusParams_get_int(params, 2, "reference", "nudgePermutations");
+    int64_t maxNudge = cactusParams_get_int(params, 2, "reference", "maxNudge");
 
     stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber) = chooseMatching_greedy;
     char *matchAlgorithmString = cactusParams_get_string(params, 2, "reference", "matchingAlgorithm");
@@ -1206,13 +1517,38 @@ void cactus_make_reference(stList *flowers, char *referenceEventString,
 
     double (*temperatureFn)(double) = useSimulatedAnnealing ? exponentiallyDecreasingTemperatureFn : constantTemperatureFn;
 
-#pragma omp parallel for
-    for(int64_t i=0; i<stList_length(flowers); i++) {
-        Flower *flower = stList_get(flowers, i);
-        st_logDebug("Processing flower %" PRIi64 "\n", flower_getName(flower));
-        buildReferenceTopDown(flower, referenceEventString, permutations, matchingAlgorithm, temperatureFn, theta,
+    // Order the flowers by descending predicted cost and hand them out dynamically, so that the most expensive flowers
+    // start first and no thread is left with a run of expensive flowers at the end
+    int64_t taskNumber = stList_length(flowers);
+    ReferenceFlowerTask *tasks = st_calloc(taskNumber, sizeof(ReferenceFlowerTask));
+    for (int64_t i = 0; i < taskNumber; i++) {
+        tasks[i].flower = stList_get(flowers, i);
+        tasks[i].predictedCost = estimateFlowerReferenceCost(tasks[i].flower, maxWalkForCalculatingZ);
+    }
+    qsort(tasks, taskNumber, sizeof(ReferenceFlowerTask), referenceFlowerTask_cmpFn);
+
+    // A layer with a single flower is built outside a parallel region, so the parallel loops within
+    // buildReferenceTopDown are free to use all the threads
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) if(taskNumber > 1)
+#endif
+    for(int64_t i=0; i<taskNumber; i++) {
+        ReferenceFlowerTask *task = &tasks[i];
+        st_logDebug("Processing flower %" PRIi64 "\n", flower_getName(task->flower));
+        double startTime = getTime();
+        buildReferenceTopDown(task->flower, referenceEventString, permutations, matchingAlgorithm, temperatureFn, theta,
                               phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle, numberOfNsForScaffoldGap,
-                              minNumberOfSequencesToSupportAdjacency, makeScaffolds);
+                              minNumberOfSequencesToSupportAdjacency, makeScaffolds, nudgePermutations,
+                              maxNudge, &task->stats);
+        task->time = getTime() - startTime;
+    }
+
+    logReferenceTasks(tasks, taskNumber);
+    if (totalStats != NULL) {
+        for (int64_t i = 0; i < taskNumber; i++) {
+            referenceStats_add(totalStats, &tasks[i].stats);
+        }
     }
+    free(tasks);
 }
 
@@ -1,5 +1,4 @@
 #include "cactus.h"
-#include "bioioC.h"
 
 static char *formatSequenceHeader(Sequence *sequence) {
     const char *sequenceHeader = sequence_getHeader(sequence);
@@ -12,8 +11,10 @@ static char *formatSequenceHeader(Sequence *sequence) {
     }
 }
 
-void getReferenceSequences(FILE *fileHandle, Flower *flower, char *referenceEventString){
+void getReferenceSequences(FILE *fileHandle, FILE *indexFileHandle, Flower *flower, char *referenceEventString){
     //get names of all the sequences in 'flower' for event with name 'referenceEventString'
+    stList *sequences = stList_construct();
+    stList *sequenceHeaders = stList_construct3(0, free);
     Sequence *sequence;
     Flower_SequenceIterator * seqIterator = flower_getSequenceIterator(flower);
     while((sequence = flower_getNextSequence(seqIterator)) != NULL)
@@ -25,12 +26,12 @@ void getReferenceSequences(FILE *fileHandle, Flower *flower, char *referenceEven
             !sequence_isTrivialSequence(sequence)) {
             char *sequenceHeader = formatSequenceHeader(sequence);
             st_logDebug("Sequence %s\n", sequenceHeader);
-            char *string = sequence_getString(sequence, sequence_getStart(sequence), sequence_getLength(sequence), 1);
-            fastaWrite(string, sequenceHeader, fileHandle);
-            free(string);
-            free(sequenceHeader);
+            stList_append(sequences, sequence);
+            stList_append(sequenceHeaders, sequenceHeader);
         }
     }
     flower_destructSequenceIterator(seqIterator);
-    return;
+    sequence_writeFasta(sequences, sequenceHeaders, 80, fileHandle, indexFileHandle);
+    stList_destruct(sequences);
+    stList_destruct(sequenceHeaders);
 }
@@ -8,13 +8,95 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include "cactus.h"
 #include "sonLib.h"
 #include "recursiveThreadBuilder.h"
 
+struct _threadRecord {
+    uint8_t *fields; // Unsigned LEB128 varints
+    int64_t fieldsLength;
+    int64_t fieldsCapacity;
+    char *bases;
+    int64_t basesLength;
+    int64_t basesCapacity;
+};
+
+static ThreadRecord *threadRecord_construct2(int64_t fieldsCapacity, int64_t basesCapacity) {
+    ThreadRecord *record = st_calloc(1, sizeof(ThreadRecord));
+    record->fieldsCapacity = fieldsCapacity;
+    record->fields = fieldsCapacity > 0 ? st_malloc(fieldsCapacity) : NULL;
+    record->basesCapacity = basesCapacity;
+    record->bases = basesCapacity > 0 ? st_malloc(basesCapacity) : NULL;
+    return record;
+}
+
+ThreadRecord *threadRecord_construct() {
+    return threadRecord_construct2(0, 0);
+}
+
+void threadRecord_destruct(ThreadRecord *record) {
+    free(record->fields);
+    free(record->bases);
+    free(record);
+}
+
+static void *reserve(void *buffer, int64_t *capacity, int64_t length) {
+    /*
+     * Grows the buffer to hold at least length bytes. The first allocation is exact, as most
+     * records are written once.
+     */
+    if (length > *capacity) {
+        *capacity = *capacity == 0 || length > 2 * *capacity ? length : 2 * *capacity;
+        buffer = st_realloc(buffer, *capacity);
+    }
+    return buffer;
+}
+
+void threadRecord_addInt(ThreadRecord *record, int64_t i) {
+    assert(i >= 0);
+    record->fields = reserve(record->fields, &record->fieldsCapacity, record->fieldsLength + 10);
+    uint64_t j = i;
+    while (j >= 0x80) {
+        record->fields[record->fieldsLength++] = (uint8_t)(j | 0x80);
+        j >>= 7;
+    }
+    record->fields[record->fieldsLength++] = (uint8_t)j;
+}
+
+void threadRecord_addBases(ThreadRecord *record, const char *bases, int64_t length) {
+    record->bases = reserve(record->bases, &record->basesCapacity, record->basesLength + length);
+    memcpy(record->bases + record->basesLength, bases, length);
+    record->basesLength += length;
+}
+
+int64_t threadRecord_getInt(ThreadRecord *record, int64_t *offset) {
+    uint64_t i = 0;
+    for (int64_t shift = 0;; shift += 7) {
+        assert(*offset < record->fieldsLength);
+        uint8_t byte = record->fields[(*offset)++];
+        i |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return i;
+        }
+    }
+}
+
+int64_t threadRecord_getFieldsLength(ThreadRecord *record) {
+    return record->fieldsLength;
+}
+
+const char *threadRecord_getBases(ThreadRecord *record) {
+    return record->bases;
+}
+
+int64_t threadRecord_getBasesLength(ThreadRecord *record) {
+    return record->basesLength;
+}
+
 RecordHolder *recordHolder_construct() {
-    return stHash_construct2(NULL, free);
+    return stHash_construct2(NULL, (void (*)(void *))threadRecord_destruct);
 }
 
 void recordHolder_destruct(RecordHolder *rh) {
@@ -25,34 +107,33 @@ int64_t recordHolder_size(RecordHolder *rh) {
     return stHash_size(rh);
 }
 
-static void recordHolder_add(RecordHolder *rh, Name name, char *string) {
+static void recordHolder_add(RecordHolder *rh, Name name, void *record) {
     assert(stHash_search(rh, (void *)name) == NULL);
-    stHash_insert(rh, (void *)name, string);
+    stHash_insert(rh, (void *)name, record);
 }
 
-static char *recordHolder_remove(RecordHolder *rh, Name name) {
-    char *string = stHash_remove(rh, (void *)name);
-    return string;
+static void *recordHolder_remove(RecordHolder *rh, Name name) {
+    return stHash_remove(rh, (void *)name);
 }
 
 void recordHolder_transferAll(RecordHolder *rhToAddTo, RecordHolder *rhToAdd) {
     stHashIterator *it = stHash_getIterator(rhToAdd);
     void *name;
     while((name = stHash_getNext(it)) != NULL) {
-        char *string = stHash_remove(rhToAdd, name);
-        assert(string != NULL);
+        void *record = stHash_remove(rhToAdd, name);
+        assert(record != NULL);
         assert(stHash_search(rhToAddTo, name) == NULL);
-        stHash_insert(rhToAddTo, name, string);
+        stHash_insert(rhToAddTo, name, record);
     }
     stHash_destructIterator(it);
     assert(stHash_size(rhToAdd) == 0);
     stHash_destruct(rhToAdd);
 }
 
-static void cacheNonNestedRecords(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
+static void cacheNonNestedStrings(stHash *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
         char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
     /*
-     * Caches the set of terminal adjacency and segment records present in the threads.
+     * Caches the set of terminal adjacency and segment strings present in the threads.
      */
     for (int64_t i = 0; i < stList_length(caps); i++) {
         Cap *cap = stList_get(caps, i);
@@ -74,6 +155,35 @@ static void cacheNonNestedRecords(RecordHolder *rh, stList *caps, char *(*segmen
     }
 }
 
+static void cacheNonNestedRecords(RecordHolder *rh, stList *caps,
+        void (*segmentWriteFn)(Segment *, ThreadRecord *, void *),
+        void (*terminalAdjacencyWriteFn)(Cap *, ThreadRecord *, void *), void *extraArg) {
+    /*
+     * As cacheNonNestedStrings, but writing thread records.
+     */
+    for (int64_t i = 0; i < stList_length(caps); i++) {
+        Cap *cap = stList_get(caps, i);
+        while (1) {
+            Cap *adjacentCap = cap_getAdjacency(cap);
+            assert(adjacentCap != NULL);
+            Group *group = end_getGroup(cap_getEnd(cap));
+            assert(group != NULL);
+            if (group_isLeaf(group)) { //Record must not be in the holder already
+                ThreadRecord *record = threadRecord_construct();
+                terminalAdjacencyWriteFn(cap, record, extraArg);
+                recordHolder_add(rh, cap_getName(cap), record);
+            }
+            if ((cap = cap_getOtherSegmentCap(adjacentCap)) == NULL) {
+                break;
+            }
+            Segment *segment = cap_getSegment(adjacentCap);
+            ThreadRecord *record = threadRecord_construct();
+            segmentWriteFn(segment, record, extraArg);
+            recordHolder_add(rh, segment_getName(segment), record);
+        }
+    }
+}
+
 static stList *getNestedRecordNames(stList *caps) {
     /*
      * Gets the names of non-terminal adjacencies as a list of cap names.
@@ -99,7 +209,7 @@ static stList *getNestedRecordNames(stList *caps) {
     return getRequests;
 }
 
-static void cacheNestedRecords(stKVDatabase *database, RecordHolder *rh, stList *caps) {
+static void cacheNestedRecords(stKVDatabase *database, stHash *rh, stList *caps) {
     /*
      * Caches all the non-terminal adjacencies by retrieving them from the database.
      */
@@ -134,14 +244,14 @@ static void cacheNestedRecords(stKVDatabase *database, RecordHolder *rh, stList
     stList_destruct(records);
 }
 
-static RecordHolder *cacheRecords(stKVDatabase *database, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
+static stHash *cacheRecords(stKVDatabase *database, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
         char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
     /*
      * Cache all the elements needed to construct the set of threads.
      */
-    RecordHolder *rh = recordHolder_construct(); //stCache_construct();
+    stHash *rh = stHash_construct2(NULL, free); //stCache_construct();
     cacheNestedRecords(database, rh, caps);
-    cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
+    cacheNonNestedStrings(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
     return rh;
 }
 
@@ -167,7 +277,7 @@ static void deleteNestedRecords(stKVDatabase *database, stList *caps) {
     stList_destruct(deleteRequests);
 }
 
-static char *getThread(RecordHolder *rh, Cap *startCap, bool deleteUsedRecords) {
+static char *getThreadString(stHash *rh, Cap *startCap) {
     /*
      * Iterate through, first calculating the length of the final record, then concatenating the results.
      */
@@ -193,16 +303,55 @@ static char *getThread(RecordHolder *rh, Cap *startCap, bool deleteUsedRecords)
     return string;
 }
 
+static ThreadRecord *getThreadRecord(RecordHolder *rh, Cap *startCap) {
+    /*
+     * Removes the records of the thread from the holder and concatenates them, sizing the new record
+     * exactly from the lengths of the parts.
+     */
+    Cap *cap = startCap;
+    stList *records = stList_construct3(0, (void (*)(void *))threadRecord_destruct);
+    int64_t fieldsLength = 0, basesLength = 0;
+    while (1) {
+        ThreadRecord *record = recordHolder_remove(rh, cap_getName(cap));
+        assert(record != NULL);
+        stList_append(records, record);
+        fieldsLength += record->fieldsLength;
+        basesLength += record->basesLength;
+
+        Cap *adjacentCap = cap_getAdjacency(cap);
+        assert(adjacentCap != NULL);
+
+        if ((cap = cap_getOtherSegmentCap(adjacentCap)) == NULL) {
+            break;
+        }
+        record = recordHolder_remove(rh, segment_getName(cap_getSegment(adjacentCap)));
+        assert(record != NULL);
+        stList_append(records, record);
+        fieldsLength += record->fieldsLength;
+        basesLength += record->basesLength;
+    }
+    ThreadRecord *thread = threadRecord_construct2(fieldsLength, basesLength);
+    for (int64_t i = 0; i < stList_length(records); i++) {
+        ThreadRecord *record = stList_get(records, i);
+        memcpy(thread->fields + thread->fieldsLength, record->fields, record->fieldsLength);
+        thread->fieldsLength += record->fieldsLength;
+        memcpy(thread->bases + thread->basesLength, record->bases, record->basesLength);
+        thread->basesLength += record->basesLength;
+    }
+    stList_destruct(records);
+    return thread;
+}
+
 void buildRecursiveThreads(stKVDatabase *database, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
                            char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
     //Cache records
-    RecordHolder *rh = cacheRecords(database, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
+    stHash *rh = cacheRecords(database, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
 
     //Build new threads
     stList *records = stList_construct3(stList_length(caps), (void(*)(void *)) stKVDatabaseBulkRequest_destruct);
     for (int64_t i = 0; i < stList_length(caps); i++) {
         Cap *cap = stList_get(caps, i);
-        char *string = getThread(rh, cap, 0);
+        char *string = getThreadString(rh, cap);
         assert(string != NULL);
         stList_set(records, i, stKVDatabaseBulkRequest_constructInsertRequest(cap_getName(cap),
                                                                               string, sizeof(char)*(strlen(string)+1)));
@@ -220,47 +369,43 @@ void buildRecursiveThreads(stKVDatabase *database, stList *caps, char *(*segment
             }stTryEnd;
 
     //Cleanup
-    recordHolder_destruct(rh);
+    stHash_destruct(rh);
     stList_destruct(records);
 }
 
-stList *buildRecursiveThreadsInListP(RecordHolder *rh, stList *caps, bool deleteUsedRecords) {
-    //Build new threads
-    stList *threadStrings = stList_construct3(stList_length(caps), free);
-    for (int64_t i = 0; i < stList_length(caps); i++) {
-        Cap *cap = stList_get(caps, i);
-        stList_set(threadStrings, i, getThread(rh, cap, deleteUsedRecords));
-    }
-    return threadStrings;
-}
-
 stList *buildRecursiveThreadsInList(stKVDatabase *database, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
         char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
     //Cache records
-    RecordHolder *rh = cacheRecords(database, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
-    stList *threadStrings = buildRecursiveThreadsInListP(rh, caps, 0);
-    recordHolder_destruct(rh);
+    stHash *rh = cacheRecords(database, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
+    stList *threadStrings = stList_construct3(stList_length(caps), free);
+    for (int64_t i = 0; i < stList_length(caps); i++) {
+        stList_set(threadStrings, i, getThreadString(rh, stList_get(caps, i)));
+    }
+    stHash_destruct(rh);
     return threadStrings;
 }
 
-void buildRecursiveThreadsNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-                               char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
+void buildRecursiveThreadsNoDb(RecordHolder *rh, stList *caps,
+                               void (*segmentWriteFn)(Segment *, ThreadRecord *, void *),
+                               void (*terminalAdjacencyWriteFn)(Cap *, ThreadRecord *, void *), void *extraArg) {
     //Cache records
     cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
 
     //Build new threads and add to cache
     for (int64_t i = 0; i < stList_length(caps); i++) {
         Cap *cap = stList_get(caps, i);
-        char *string = getThread(rh, cap, 1);
-        assert(string != NULL);
-        recordHolder_add(rh, cap_getName(cap), string);
+        recordHolder_add(rh, cap_getName(cap), getThreadRecord(rh, cap));
     }
 }
 
-stList *buildRecursiveThreadsInListNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-                                        char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg) {
+stList *buildRecursiveThreadsInListNoDb(RecordHolder *rh, stList *caps,
+                                        void (*segmentWriteFn)(Segment *, ThreadRecord *, void *),
+                                        void (*terminalAdjacencyWriteFn)(Cap *, ThreadRecord *, void *),
+                                        void *extraArg) {
     cacheNonNestedRecords(rh, caps, segmentWriteFn, terminalAdjacencyWriteFn, extraArg);
-    return buildRecursiveThreadsInListP(rh, caps, 1);
+    stList *threads = stList_construct3(stList_length(caps), (void (*)(void *))threadRecord_destruct);
+    for (int64_t i = 0; i < stList_length(caps); i++) {
+        stList_set(threads, i, getThreadRecord(rh, stList_get(caps, i)));
+    }
+    return threads;
 }
-
-
@@ -18,6 +18,13 @@ void bottomUp(Flower *flower, stKVDatabase *sequenceDatabase, Name referenceEven
 void bottomUpNoDb(Flower *flower, RecordHolder *rh, Name referenceEventName,
                   bool isTop, stMatrix *(*generateSubstitutionMatrix)(double));
 
+/*
+ * As bottomUpNoDb, but using a phylogenetic tree made by getPhylogeneticTreeRootedAtGivenEvent for the reference event,
+ * so that one tree can be built for a run and shared, read only, by all the flowers and threads.
+ */
+void bottomUpNoDb2(Flower *flower, RecordHolder *rh, Name referenceEventName,
+                   bool isTop, stTree *phylogeneticTree);
+
 void topDown(Flower *flower, Name referenceEventName);
 
 #endif /* ADDREFERENCECOORDINATES_H_ */
@@ -20,6 +20,6 @@ stMatrix *getSubMatrix(stTree *tree);
 
 void cleanupPhylogeneticTree(stTree *tree);
 
-void maskAncestralRepeatBases(Block *block, char *mlString);
+void maskAncestralRepeatBases(Block *block, stList *segments, char *mlString);
 
 #endif /* BLOCKMLSTRING_H_ */
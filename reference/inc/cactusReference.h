@@ -18,6 +18,7 @@
 
 #include "cactus.h"
 #include "stMatchingAlgorithms.h"
+#include "stReferenceProblem2.h"
 
 extern const char *REFERENCE_BUILDING_EXCEPTION;
 
@@ -27,7 +28,32 @@ extern const char *REFERENCE_BUILDING_EXCEPTION;
 void cactus_make_reference(stList *flowers, char *referenceEventString, CactusDisk *cactusDisk, CactusParams *params);
 
 /*
- * Construct a reference for the flower, top down.
+ * The scores of the reference built for a flower at each stage of buildReferenceTopDown, and the
+ * seconds spent in each stage.
+ */
+typedef struct _referenceStats {
+    int64_t nodeNumber;
+    double maxPossibleScore;
+    double scoreAfterGreedy;
+    double scoreAfterSampling;
+    double finalScore; // After nudging
+    int64_t badAdjacenciesAfterGreedy;
+    int64_t finalBadAdjacencies;
+    double zTime; // Calculating the adjacency scores
+    double greedyTime;
+    double samplingTime;
+    double nudgingTime;
+} ReferenceStats;
+
+/*
+ * As cactus_make_reference, adding the stats of each flower's reference to totalStats if it is not NULL.
+ */
+void cactus_make_reference2(stList *flowers, char *referenceEventString, CactusDisk *cactusDisk, CactusParams *params,
+                            ReferenceStats *totalStats);
+
+/*
+ * Construct a reference for the flower, top down. The reference is built greedily then improved with
+ * rounds of greedy permutation sampling and nudging. If stats is not NULL it is filled in with the scores of the reference.
  */
 void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader,
         int64_t permutations,
@@ -37,9 +63,25 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader,
         double phi,
         int64_t maxWalkForCalculatingZ, bool ignoreUnalignedGaps,
         double wiggle, int64_t numberOfNsForScaffoldGap,
-        int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds);
+        int64_t minNumberOfSequencesToSupportAdjacency, bool makeScaffolds,
+        int64_t nudgePermutations, int64_t maxNudge,
+        ReferenceStats *stats);
 
-double *calculateZ(Flower *flower, stHash *endsToNodes, double theta);
+/*
+ * Estimate the relative cost of buildReferenceTopDown for the flower, as the number of ends
+ * times the number of caps times the maximum walk for calculating z, used to schedule the
+ * most expensive flowers first.
+ */
+double estimateFlowerReferenceCost(Flower *flower, int64_t maxWalkForCalculatingZ);
+
+/*
+ * Calculate the adjacency scores between the ends of the flower given as keys of endsToNodes, which maps the
+ * positive orientations of the ends to their nodes, summing zScoreFn over the pairs of caps at most
+ * maxWalkForCalculatingZ ends apart on the threads of sequence. The threads are walked in parallel, and the
+ * scores are the same whatever the number of threads.
+ */
+refAdjList *calculateZ(Flower *flower, stHash *endsToNodes, int64_t nodeNumber, int64_t maxWalkForCalculatingZ,
+        bool ignoreUnalignedGaps, double (*zScoreFn)(Cap *, int64_t, int64_t, int64_t, void *), void *zScoreExtraArgs);
 
 /*
  * Weights events by how informative they are for inferring the
@@ -50,8 +92,9 @@ stHash *getEventWeighting(Event *referenceEvent, double phi,
                           stSet *chosenEvents);
 
 /*
- * Get the reference sequences, dumping them to the given file handle.
+ * Get the reference sequences, dumping them to the given file handle, and their .fai index to indexFileHandle
+ * if it is not NULL.
  */
-void getReferenceSequences(FILE *fileHandle, Flower *flower, char *referenceEventString);
+void getReferenceSequences(FILE *fileHandle, FILE *indexFileHandle, Flower *flower, char *referenceEventString);
 
 #endif /* REFERENCE_H_ */
@@ -16,6 +16,42 @@ stList *buildRecursiveThreadsInList(stKVDatabase *database, stList *caps,
         char *(*segmentWriteFn)(Segment *, void *),
         char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg);
 
+/*
+ * A thread record holds the parts of a thread written by the write functions of the NoDb builders below:
+ * a sequence of non-negative integer fields, varint encoded, and, separately, the bases. Records are concatenated
+ * by copying as threads are built up the flower hierarchy, and only rendered as text by the caller.
+ */
+typedef struct _threadRecord ThreadRecord;
+
+ThreadRecord *threadRecord_construct();
+
+void threadRecord_destruct(ThreadRecord *record);
+
+/*
+ * Appends a field, which must be non-negative.
+ */
+void threadRecord_addInt(ThreadRecord *record, int64_t i);
+
+void threadRecord_addBases(ThreadRecord *record, const char *bases, int64_t length);
+
+/*
+ * Reads the field starting at byte *offset of the fields, advancing *offset past it. The fields are read
+ * in order starting from offset 0 until *offset equals threadRecord_getFieldsLength.
+ */
+int64_t threadRecord_getInt(ThreadRecord *record, int64_t *offset);
+
+int64_t threadRecord_getFieldsLength(ThreadRecord *record);
+
+/*
+ * The bases are not null terminated.
+ */
+const char *threadRecord_getBases(ThreadRecord *record);
+
+int64_t threadRecord_getBasesLength(ThreadRecord *record);
+
+/*
+ * Map from names of caps and segments to the thread records of the threads being built.
+ */
 typedef stHash RecordHolder;
 
 RecordHolder *recordHolder_construct();
@@ -29,10 +65,16 @@ int64_t recordHolder_size(RecordHolder *rh);
  */
 void recordHolder_transferAll(RecordHolder *rhToAddTo, RecordHolder *rhToAdd);
 
-void buildRecursiveThreadsNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-                               char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg);
+void buildRecursiveThreadsNoDb(RecordHolder *rh, stList *caps,
+                               void (*segmentWriteFn)(Segment *, ThreadRecord *, void *),
+                               void (*terminalAdjacencyWriteFn)(Cap *, ThreadRecord *, void *), void *extraArg);
 
-stList *buildRecursiveThreadsInListNoDb(RecordHolder *rh, stList *caps, char *(*segmentWriteFn)(Segment *, void *),
-                                        char *(*terminalAdjacencyWriteFn)(Cap *, void *), void *extraArg);
+/*
+ * Returns a list of the thread records of the caps, which the list owns.
+ */
+stList *buildRecursiveThreadsInListNoDb(RecordHolder *rh, stList *caps,
+                                        void (*segmentWriteFn)(Segment *, ThreadRecord *, void *),
+                                        void (*terminalAdjacencyWriteFn)(Cap *, ThreadRecord *, void *),
+                                        void *extraArg);
 
 #endif /* RECURSIVETHREADBUILDER_H_ */
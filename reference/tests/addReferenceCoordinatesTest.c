@@ -159,10 +159,78 @@ static void testMLStringMakesScaffoldGaps(CuTest *testCase) {
     }
 }
 
+static void testMLStringManyConflictingLeaves(CuTest *testCase) {
+    /*
+     * Checks that the probabilities of a block with many leaves, split between two bases on short branches,
+     * are kept from underflowing, so that the majority base is still called.
+     */
+    for (int64_t testNum = 0; testNum < 10; testNum++) {
+        CactusDisk *cactusDisk = cactusDisk_construct();
+        eventTree_construct2(cactusDisk);
+        Flower *flower = flower_construct(cactusDisk);
+        Event *refEvent = eventTree_getRootEvent(flower_getEventTree(flower));
+        int64_t leafNumber = st_randomInt(200, 500);
+        Block *block = block_construct(1, flower);
+        for (int64_t i = 0; i < leafNumber; i++) {
+            Event *event = event_construct3("Boo", 0.001, refEvent, flower_getEventTree(flower));
+            Sequence *seq = sequence_construct(0, 1, i <= leafNumber / 2 ? "C" : "G", "boo", event, cactusDisk);
+            flower_addSequence(flower, seq);
+            segment_construct2(block, 0, 1, seq);
+        }
+        stTree *tree = getPhylogeneticTreeRootedAtGivenEvent(refEvent, generateJukesCantorMatrix);
+
+        char *mlString = getMaximumLikelihoodString(tree, block);
+        CuAssertStrEquals(testCase, "C", mlString);
+
+        //Cleanup
+        free(mlString);
+        cleanupPhylogeneticTree(tree);
+        cactusDisk_destruct(cactusDisk);
+    }
+}
+
+static void testMLStringTiesAreReproducible(CuTest *testCase) {
+    /*
+     * Checks that the bases chosen where two leaves disagree on a symmetric tree, so every base they
+     * contain is equally likely, do not depend on the state of the global random number generator.
+     */
+    for (int64_t testNum = 0; testNum < 10; testNum++) {
+        CactusDisk *cactusDisk = cactusDisk_construct();
+        eventTree_construct2(cactusDisk);
+        Flower *flower = flower_construct(cactusDisk);
+        Event *refEvent = eventTree_getRootEvent(flower_getEventTree(flower));
+        int64_t length = st_randomInt(1, 200);
+        Block *block = block_construct(length, flower);
+        for (int64_t i = 0; i < 2; i++) {
+            Event *event = event_construct3("Boo", 0.1, refEvent, flower_getEventTree(flower));
+            char *string = stRandom_getRandomDNAString(length, 1, 0, 0);
+            Sequence *seq = sequence_construct(0, length, string, "boo", event, cactusDisk);
+            flower_addSequence(flower, seq);
+            segment_construct2(block, 0, 1, seq);
+            free(string);
+        }
+        stTree *tree = getPhylogeneticTreeRootedAtGivenEvent(refEvent, generateJukesCantorMatrix);
+
+        st_randomSeed(testNum);
+        char *mlString = getMaximumLikelihoodString(tree, block);
+        st_randomSeed(testNum + 1000);
+        char *mlString2 = getMaximumLikelihoodString(tree, block);
+        CuAssertStrEquals(testCase, mlString, mlString2);
+
+        //Cleanup
+        free(mlString);
+        free(mlString2);
+        cleanupPhylogeneticTree(tree);
+        cactusDisk_destruct(cactusDisk);
+    }
+}
+
 CuSuite* addReferenceCoordinatesTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testMLStringRandom);
     SUITE_ADD_TEST(suite, testMLStringMakesScaffoldGaps);
+    SUITE_ADD_TEST(suite, testMLStringManyConflictingLeaves);
+    SUITE_ADD_TEST(suite, testMLStringTiesAreReproducible);
 
     return suite;
 }
@@ -8,6 +8,11 @@
 #include "sonLib.h"
 #include "cactusReference.h"
 
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 static void constructEventTree_R(stTree *cur, EventTree *eventTree) {
     for (int64_t i = 0; i < stTree_getChildNumber(cur); i++) {
         stTree *child = stTree_getChild(cur, i);
@@ -84,8 +89,136 @@ static void testEventWeighting(CuTest *testCase) {
     stSet_destruct(chosenEvents);
 }
 
+#define TEST_BLOCK_LENGTH 10
+#define TEST_GAP_LENGTH 5
+
+static Flower *constructShuffledFlower(CactusDisk *cactusDisk, int64_t genomeNumber, int64_t blockNumber, int64_t seed) {
+    /*
+     * Construct a flower with a sequence for each genome, below the reference event "Anc0", each made of a copy of
+     * each of the blocks separated by unaligned bases, with about a fifth of the blocks moved and possibly inverted.
+     * All the ends are in one tangle group. The flower is the same for the same seed.
+     */
+    st_randomSeed(seed);
+    Flower *flower = flower_construct(cactusDisk);
+    EventTree *eventTree = eventTree_construct2(cactusDisk);
+    Event *referenceEvent = event_construct3("Anc0", 0.1, eventTree_getRootEvent(eventTree), eventTree);
+    Block **blocks = st_malloc(sizeof(Block *) * blockNumber);
+    for (int64_t i = 0; i < blockNumber; i++) {
+        blocks[i] = block_construct(TEST_BLOCK_LENGTH, flower);
+    }
+    int64_t *order = st_malloc(sizeof(int64_t) * blockNumber);
+    bool *strands = st_malloc(sizeof(bool) * blockNumber);
+    int64_t length = blockNumber * (TEST_BLOCK_LENGTH + TEST_GAP_LENGTH) + TEST_GAP_LENGTH;
+    char *string = st_malloc(length + 1);
+    for (int64_t i = 0; i < genomeNumber; i++) {
+        for (int64_t j = 0; j < blockNumber; j++) {
+            order[j] = j;
+            strands[j] = 1;
+        }
+        for (int64_t j = 0; j < blockNumber; j++) {
+            if (st_random() < 0.2) {
+                int64_t k = st_randomInt(0, blockNumber);
+                int64_t o = order[j];
+                order[j] = order[k];
+                order[k] = o;
+                strands[j] = st_random() < 0.5;
+            }
+        }
+        for (int64_t j = 0; j < length; j++) {
+            string[j] = "ACGT"[st_randomInt(0, 4)];
+        }
+        string[length] = '\0';
+
+        char *header = stString_print("genome%" PRIi64 "", i);
+        Event *event = event_construct3(header, 0.1, referenceEvent, eventTree);
+        Sequence *sequence = sequence_construct(2, length, string, header, event, cactusDisk);
+        flower_addSequence(flower, sequence);
+        free(header);
+        Cap *cap = cap_construct2(end_construct2(0, 1, flower), 1, 1, sequence);
+        for (int64_t j = 0; j < blockNumber; j++) {
+            Segment *segment = segment_construct2(blocks[order[j]],
+                    2 + TEST_GAP_LENGTH + j * (TEST_BLOCK_LENGTH + TEST_GAP_LENGTH), strands[j], sequence);
+            segment = strands[j] ? segment : segment_getReverse(segment); // On the positive strand of the sequence
+            cap_makeAdjacent(cap, segment_get5Cap(segment));
+            cap = segment_get3Cap(segment);
+        }
+        cap_makeAdjacent(cap, cap_construct2(end_construct2(1, 1, flower), length + 2, 1, sequence));
+    }
+    free(string);
+    free(order);
+    free(strands);
+    free(blocks);
+
+    Group *group = group_construct2(flower);
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        end_setGroup(end, group);
+    }
+    flower_destructEndIterator(endIt);
+    return flower;
+}
+
+static double testZScoreFn(Cap *_5Cap, int64_t length5Segment, int64_t length3Segment, int64_t gap, void *extraArgs) {
+    return (double) (length5Segment + length3Segment) / gap;
+}
+
+static void testCalculateZInParallel(CuTest *testCase) {
+    /*
+     * Test that the adjacency scores calculated with more than one thread are the same as those calculated with one.
+     */
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    Flower *flower = constructShuffledFlower(cactusDisk, 40, 20, 1);
+    stHash *endsToNodes = stHash_construct2(NULL, (void (*)(void *)) stIntTuple_destruct);
+    int64_t nodeNumber = 0;
+    Flower_EndIterator *endIt = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIt)) != NULL) {
+        if (end_isStubEnd(end)) {
+            stHash_insert(endsToNodes, end_getPositiveOrientation(end), stIntTuple_construct1(++nodeNumber));
+        } else if (end_getSide(end)) { // Visit each block once, from its 5 prime end
+            Block *block = end_getBlock(end);
+            nodeNumber++;
+            stHash_insert(endsToNodes, end_getPositiveOrientation(block_get5End(block)), stIntTuple_construct1(nodeNumber));
+            stHash_insert(endsToNodes, end_getPositiveOrientation(block_get3End(block)), stIntTuple_construct1(-nodeNumber));
+        }
+    }
+    flower_destructEndIterator(endIt);
+
+#if defined(_OPENMP)
+    int threadNumber = omp_get_max_threads();
+    omp_set_num_threads(1);
+#endif
+    refAdjList *serialAL = calculateZ(flower, endsToNodes, nodeNumber, 10, 1, testZScoreFn, NULL);
+#if defined(_OPENMP)
+    omp_set_num_threads(4);
+#endif
+    refAdjList *parallelAL = calculateZ(flower, endsToNodes, nodeNumber, 10, 1, testZScoreFn, NULL);
+#if defined(_OPENMP)
+    omp_set_num_threads(threadNumber);
+#endif
+
+    double totalScore = 0.0;
+    for (int64_t n1 = -nodeNumber; n1 <= nodeNumber; n1++) {
+        for (int64_t n2 = -nodeNumber; n2 <= nodeNumber; n2++) {
+            if (n1 != 0 && n2 != 0) {
+                CuAssertDblEquals(testCase, refAdjList_getWeight(serialAL, n1, n2),
+                                  refAdjList_getWeight(parallelAL, n1, n2), 0.0);
+                totalScore += refAdjList_getWeight(serialAL, n1, n2);
+            }
+        }
+    }
+    CuAssertTrue(testCase, totalScore > 0.0);
+
+    refAdjList_destruct(serialAL);
+    refAdjList_destruct(parallelAL);
+    stHash_destruct(endsToNodes);
+    cactusDisk_destruct(cactusDisk);
+}
+
 CuSuite* buildReferenceTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testEventWeighting);
+    SUITE_ADD_TEST(suite, testCalculateZInParallel);
     return suite;
 }
@@ -6,6 +6,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "sonLib.h"
 #include "cactus.h"
@@ -25,6 +26,23 @@ static char *writeTerminalAdjacency(Cap *cap, void *extraArg) {
     return stString_print("%" PRIi64 " %s ", cap_getCoordinate(cap), sequence_getString(sequence, cap_getCoordinate(cap)+1, cap_getCoordinate(cap_getAdjacency(cap)) - cap_getCoordinate(cap) - 1, 1));
 }
 
+static void writeSegmentRecord(Segment *segment, ThreadRecord *record, void *extraArg) {
+    char *string = segment_getString(segment);
+    threadRecord_addInt(record, segment_getStart(segment));
+    threadRecord_addBases(record, string, segment_getLength(segment));
+    free(string);
+}
+
+static void writeTerminalAdjacencyRecord(Cap *cap, ThreadRecord *record, void *extraArg) {
+    int64_t length = cap_getCoordinate(cap_getAdjacency(cap)) - cap_getCoordinate(cap) - 1;
+    if(length > 0) {
+        char *string = sequence_getString(cap_getSequence(cap), cap_getCoordinate(cap)+1, length, 1);
+        threadRecord_addInt(record, cap_getCoordinate(cap));
+        threadRecord_addBases(record, string, length);
+        free(string);
+    }
+}
+
 static void recursiveFileBuilder_test(CuTest *testCase) {
     //Make flower with two ends and 2 blocks, and one child, one empty adjacency and two containing additional blocks.
 
@@ -99,8 +117,81 @@ static void recursiveFileBuilder_test(CuTest *testCase) {
     stFile_rmtree(tempDir);
 }
 
+static void recursiveThreadBuilderNoDb_test(CuTest *testCase) {
+    /*
+     * As recursiveFileBuilder_test, building the thread records bottom up through a record holder.
+     */
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    eventTree_construct2(cactusDisk);
+    Flower *flower = flower_construct(cactusDisk);
+    End *end1 = end_construct2(0, 1, flower);
+    End *end2 = end_construct2(1, 1, flower);
+    Event *referenceEvent = eventTree_getRootEvent(flower_getEventTree(flower));
+    Sequence *sequence1 = sequence_construct(1, 5, "ACGTA", "ref sequence", referenceEvent, cactusDisk);
+    flower_addSequence(flower, sequence1);
+    Cap *cap1 = cap_construct2(end1, 0, 1, sequence1);
+    Cap *cap2 = cap_construct2(end2, 6, 1, sequence1);
+    cap_makeAdjacent(cap1, cap2);
+    Group *group1 = group_construct2(flower);
+    end_setGroup(end1, group1);
+    end_setGroup(end2, group1);
+    Flower *nestedFlower = group_makeNestedFlower(group1);
+    Block *block1 = block_construct(3, nestedFlower);
+    Segment *segment1 = segment_construct2(block1, 1, 1, flower_getSequence(nestedFlower, sequence_getName(sequence1)));
+    cap_makeAdjacent(flower_getCap(nestedFlower, cap_getName(cap1)), segment_get5Cap(segment1));
+    cap_makeAdjacent(segment_get3Cap(segment1), flower_getCap(nestedFlower, cap_getName(cap2)));
+    Group *nestedGroup = group_construct2(nestedFlower);
+    End *end;
+    Flower_EndIterator *endIt = flower_getEndIterator(nestedFlower);
+    while((end = flower_getNextEnd(endIt)) != NULL) {
+        end_setGroup(end, nestedGroup);
+    }
+    flower_destructEndIterator(endIt);
+
+    //Build the thread of the nested flower, then the thread of the parent from it
+    RecordHolder *rh = recordHolder_construct();
+    stList *caps = stList_construct();
+    stList_append(caps, flower_getCap(nestedFlower, cap_getName(cap1)));
+    buildRecursiveThreadsNoDb(rh, caps, writeSegmentRecord, writeTerminalAdjacencyRecord, NULL);
+    CuAssertIntEquals(testCase, 1, recordHolder_size(rh));
+    stList_pop(caps);
+    stList_append(caps, cap1);
+    stList *threads = buildRecursiveThreadsInListNoDb(rh, caps, writeSegmentRecord, writeTerminalAdjacencyRecord, NULL);
+    CuAssertIntEquals(testCase, 0, recordHolder_size(rh));
+
+    CuAssertIntEquals(testCase, 1, stList_length(threads));
+    ThreadRecord *thread = stList_get(threads, 0);
+    int64_t offset = 0;
+    CuAssertIntEquals(testCase, 1, threadRecord_getInt(thread, &offset));
+    CuAssertIntEquals(testCase, 3, threadRecord_getInt(thread, &offset));
+    CuAssertIntEquals(testCase, threadRecord_getFieldsLength(thread), offset);
+    CuAssertIntEquals(testCase, 5, threadRecord_getBasesLength(thread));
+    CuAssertTrue(testCase, strncmp("ACGTA", threadRecord_getBases(thread), 5) == 0);
+
+    stList_destruct(threads);
+    stList_destruct(caps);
+    recordHolder_destruct(rh);
+    cactusDisk_destruct(cactusDisk);
+}
+
+static void threadRecordVarint_test(CuTest *testCase) {
+    ThreadRecord *record = threadRecord_construct();
+    int64_t values[] = { 0, 1, 127, 128, 16383, 16384, INT64_MAX };
+    for (int64_t i = 0; i < 7; i++) {
+        threadRecord_addInt(record, values[i]);
+    }
+    int64_t offset = 0;
+    for (int64_t i = 0; i < 7; i++) {
+        CuAssertTrue(testCase, threadRecord_getInt(record, &offset) == values[i]);
+    }
+    CuAssertIntEquals(testCase, threadRecord_getFieldsLength(record), offset);
+    threadRecord_destruct(record);
+}
+
 CuSuite* recursiveThreadBuilderTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, recursiveFileBuilder_test);
+    SUITE_ADD_TEST(suite, recursiveThreadBuilderNoDb_test);
+    SUITE_ADD_TEST(suite, threadRecordVarint_test);
     return suite;
 }
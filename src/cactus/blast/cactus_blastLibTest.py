@@ -0,0 +1,22 @@
+#!/usr/bin/env python3
+
+#Copyright (C) 2009-2011 by Benedict Paten (benedictpaten@gmail.com)
+#
+#Released under the MIT license, see LICENSE.txt
+import unittest
+
+from sonLib.bioio import TestStatus
+from sonLib.bioio import getLogLevelString
+
+from cactus.shared.common import cactus_call
+
+class TestCase(unittest.TestCase):
+
+    @TestStatus.shortLength
+    def testBlastLibAPI(self):
+        """Run all the blast library CuTests, fail if any of them fail.
+        """
+        cactus_call(parameters=["cactus_blastLibTests", getLogLevelString()])
+
+if __name__ == '__main__':
+    unittest.main()
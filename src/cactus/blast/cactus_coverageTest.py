@@ -124,6 +124,63 @@ class TestCase(unittest.TestCase):
         id=3|simpleSeqC1\t0\t10\t\t1
         '''))
 
+    def checkThreadsGiveSameCoverage(self, fastaPath, cigarPath, options=[]):
+        # The coverage computed with one thread and with several, which
+        # each read a byte range of the alignments, should be identical
+        beds = [cactus_call(parameters=["cactus_coverage", fastaPath, cigarPath,
+                                        "--threads", str(threads)] + options,
+                            check_output=True) for threads in (1, 4)]
+        self.assertEqual(beds[0], beds[1])
+        return beds[0]
+
+    @TestStatus.shortLength
+    def testThreads(self):
+        for fastaPath, fromPath in [(self.simpleFastaPathA, self.simpleFastaPathB),
+                                    (self.simpleFastaPathB, self.simpleFastaPathA),
+                                    (self.simpleFastaPathC, self.simpleFastaPathD)]:
+            for options in [[], ["--depthById"], ["--from", fromPath],
+                            ["--depthById", "--from", fromPath]]:
+                self.checkThreadsGiveSameCoverage(fastaPath, self.simpleCigarPath, options)
+
+    @TestStatus.shortLength
+    def testThreadsWithLinesOnRangeBoundaries(self):
+        """Test random alignments whose lines start exactly where the byte range of a thread starts."""
+        random.seed(1)
+        lines = []
+        for _ in range(200):
+            seq1 = random.choice(["id=0|simpleSeqA1", "id=1|simpleSeqA2"])
+            seq2 = random.choice(["id=2|simpleSeqB1", "id=3|simpleSeqC1"])
+            length = random.randint(1, 20)
+            start1 = random.randint(0, 48 - length)
+            start2 = random.randint(0, 48 - length)
+            if random.random() < 0.5:
+                lines.append("cigar: %s %i %i + %s %i %i + 0 M %i\n" % (seq2, start2, start2 + length,
+                                                                        seq1, start1, start1 + length, length))
+            else:
+                lines.append("cigar: %s %i %i + %s %i %i - 0 M %i\n" % (seq2, start2, start2 + length,
+                                                                        seq1, start1 + length, start1, length))
+        # Pad the first line with trailing spaces until a line starts at
+        # the start of the second thread's range, which is the file size
+        # divided by the number of threads, plus one
+        for padding in range(100):
+            text = lines[0][:-1] + " " * padding + "\n" + "".join(lines[1:])
+            lineStarts = set()
+            offset = 0
+            for line in text.splitlines(True):
+                lineStarts.add(offset)
+                offset += len(line)
+            if len(text) // 4 + 1 in lineStarts:
+                break
+        self.assertTrue(len(text) // 4 + 1 in lineStarts)
+        cigarPath = getTempFile()
+        with open(cigarPath, 'w') as f:
+            f.write(text)
+        for options in [[], ["--depthById"], ["--from", self.simpleFastaPathB],
+                        ["--depthById", "--from", self.simpleFastaPathB]]:
+            bed = self.checkThreadsGiveSameCoverage(self.simpleFastaPathA, cigarPath, options)
+            self.assertTrue(len(bed) > 0)
+        os.remove(cigarPath)
+
     @TestStatus.needsTestData
     @TestStatus.mediumLength
     def testInvariants(self):